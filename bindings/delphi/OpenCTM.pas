@@ -48,6 +48,9 @@ type
   // Callback function pointer types
   TCTMreadfn = function (ABuf: Pointer; ACount: TCTMuint; AUserData: Pointer): TCTMuint; stdcall;
   TCTMwritefn = function (ABuf: Pointer; ACount: TCTMuint; AUserData: Pointer): TCTMuint; stdcall;
+  TCTMallocfn = function (ASize: NativeUInt; AUserData: Pointer): Pointer; stdcall;
+  TCTMfreefn = procedure (APtr: Pointer; AUserData: Pointer); stdcall;
+  TCTMprogressfn = function (AStage: TCTMenum; AProgress: TCTMfloat; AUserData: Pointer): TCTMuint; stdcall;
 
 
 //------------------------------------------------------------------------------
@@ -71,11 +74,13 @@ const
   CTM_LZMA_ERROR        = $0008;
   CTM_INTERNAL_ERROR    = $0009;
   CTM_UNSUPPORTED_FORMAT_VERSION = $000A;
+  CTM_CANCELLED         = $000B;
   CTM_IMPORT            = $0101;
   CTM_EXPORT            = $0102;
   CTM_METHOD_RAW        = $0201;
   CTM_METHOD_MG1        = $0202;
   CTM_METHOD_MG2        = $0203;
+  CTM_METHOD_MG3        = $0204;
   CTM_VERTEX_COUNT      = $0301;
   CTM_TRIANGLE_COUNT    = $0302;
   CTM_HAS_NORMALS       = $0303;
@@ -85,12 +90,20 @@ const
   CTM_NORMAL_PRECISION  = $0307;
   CTM_COMPRESSION_METHOD = $0308;
   CTM_FILE_COMMENT      = $0309;
+  CTM_COMPRESSION_THREADS = $030A;
+  CTM_FILE_FORMAT       = $030B;
+  CTM_LZMA_THREADS      = $030C;
+  CTM_STREAM_BUFFER_SIZE = $030D;
+  CTM_TILE_COUNT        = $030E;
+  CTM_LZMA_SEARCH       = $030F;
+  CTM_VERTEX_ORDER      = $0310;
   CTM_NAME              = $0501;
   CTM_FILE_NAME         = $0502;
   CTM_PRECISION         = $0503;
   CTM_INDICES           = $0601;
   CTM_VERTICES          = $0602;
   CTM_NORMALS           = $0603;
+  CTM_BOUNDING_BOX      = $0604;
   CTM_UV_MAP_1          = $0700;
   CTM_UV_MAP_2          = $0701;
   CTM_UV_MAP_3          = $0702;
@@ -108,6 +121,52 @@ const
   CTM_ATTRIB_MAP_7      = $0806;
   CTM_ATTRIB_MAP_8      = $0807;
 
+  // Load/save progress stages
+  CTM_STAGE_SORT        = $0901;
+  CTM_STAGE_DELTAS      = $0902;
+  CTM_STAGE_PACK        = $0903;
+  CTM_STAGE_UNPACK      = $0904;
+  CTM_CODEC_DEFAULT     = $0A01;
+  CTM_CODEC_LZMA        = $0A02;
+  CTM_CODEC_RANS        = $0A03;
+  CTM_CODEC_STORE       = $0A04;
+  CTM_ORDER_GRID        = $0B01;
+  CTM_ORDER_MORTON      = $0B02;
+  CTM_ORDER_HILBERT     = $0B03;
+
+  // Maximum number of block types in TCTMstats
+  CTM_STATS_MAX_BLOCKS  = 16;
+
+
+//------------------------------------------------------------------------------
+// Statistics types (see ctmGetStats)
+//------------------------------------------------------------------------------
+
+type
+  TCTMstatsblock = record
+    FourCC: TCTMuint;
+    LZMACalls: TCTMuint;
+    LZMATime: TCTMfloat;
+    RawSize: NativeUInt;
+    PackedSize: NativeUInt;
+  end;
+
+  TCTMstats = record
+    TotalTime: TCTMfloat;
+    GridTime: TCTMfloat;
+    SortTime: TCTMfloat;
+    ReIndexTime: TCTMfloat;
+    DeltaTime: TCTMfloat;
+    NormalTime: TCTMfloat;
+    LZMATime: TCTMfloat;
+    CheckTime: TCTMfloat;
+    LZMACalls: TCTMuint;
+    PeakScratch: NativeUInt;
+    BlockCount: TCTMuint;
+    Blocks: array[0..CTM_STATS_MAX_BLOCKS - 1] of TCTMstatsblock;
+  end;
+  PCTMstats = ^TCTMstats;
+
 
 //------------------------------------------------------------------------------
 // Function prototypes
@@ -130,6 +189,20 @@ function ctmGetAttribMapFloat(AContext: TCTMcontext; AAttribMap: TCTMenum; AProp
 function ctmGetString(AContext: TCTMcontext; AProperty: TCTMenum): PChar; stdcall;
 procedure ctmCompressionMethod(AContext: TCTMcontext; AMethod: TCTMenum); stdcall;
 procedure ctmCompressionLevel(AContext: TCTMcontext; ALevel: TCTMuint); stdcall;
+procedure ctmCompressionThreads(AContext: TCTMcontext; AThreadCount: TCTMuint); stdcall;
+procedure ctmLZMAThreads(AContext: TCTMcontext; AThreadCount: TCTMuint); stdcall;
+procedure ctmLZMASearch(AContext: TCTMcontext; ASearch: TCTMuint); stdcall;
+procedure ctmCompressionCodec(AContext: TCTMcontext; AArray: TCTMenum; ACodec: TCTMenum); stdcall;
+procedure ctmVertexOrder(AContext: TCTMcontext; AOrder: TCTMenum); stdcall;
+procedure ctmFileFormat(AContext: TCTMcontext; AVersion: TCTMuint); stdcall;
+procedure ctmStreamBufferSize(AContext: TCTMcontext; ASize: TCTMuint); stdcall;
+procedure ctmSetAllocator(AContext: TCTMcontext; AAllocFn: TCTMallocfn; AFreeFn: TCTMfreefn; AUserData: Pointer); stdcall;
+procedure ctmLoadSelect(AContext: TCTMcontext; AArray: TCTMenum; ALoad: TCTMuint); stdcall;
+procedure ctmTileDivision(AContext: TCTMcontext; AX: TCTMuint; AY: TCTMuint; AZ: TCTMuint); stdcall;
+procedure ctmLoadRegion(AContext: TCTMcontext; AMin: PCTMfloat; AMax: PCTMfloat); stdcall;
+procedure ctmProgressCallback(AContext: TCTMcontext; AProgressFn: TCTMprogressfn; AUserData: Pointer); stdcall;
+procedure ctmCancel(AContext: TCTMcontext); stdcall;
+procedure ctmGetStats(AContext: TCTMcontext; AStats: PCTMstats); stdcall;
 procedure ctmVertexPrecision(AContext: TCTMcontext; APrecision: TCTMfloat); stdcall;
 procedure ctmVertexPrecisionRel(AContext: TCTMcontext; ARelPrecision: TCTMfloat); stdcall;
 procedure ctmNormalPrecision(AContext: TCTMcontext; APrecision: TCTMfloat); stdcall;
@@ -141,7 +214,12 @@ function ctmAddUVMap(AContext: TCTMcontext; AUVCoords: PCTMfloat; AName: PChar;
 function ctmAddAttribMap(AContext: TCTMcontext; AAttribValues: PCTMfloat; AName: PChar): TCTMenum; stdcall;
 procedure ctmLoad(AContext: TCTMcontext; AFileName: PChar); stdcall;
 procedure ctmLoadCustom(AContext: TCTMcontext; AReadFn: TCTMreadfn; AUserData: Pointer); stdcall;
+procedure ctmLoadHeader(AContext: TCTMcontext; AFileName: PChar); stdcall;
+procedure ctmLoadHeaderCustom(AContext: TCTMcontext; AReadFn: TCTMreadfn; AUserData: Pointer); stdcall;
+procedure ctmLoadAsync(AContext: TCTMcontext; AFileName: PChar); stdcall;
 procedure ctmSave(AContext: TCTMcontext; AFileName: PChar); stdcall;
+procedure ctmSaveAsync(AContext: TCTMcontext; AFileName: PChar); stdcall;
+procedure ctmWait(AContext: TCTMcontext); stdcall;
 procedure ctmSaveCustom(AContext: TCTMcontext; AWriteFn: TCTMwritefn; AUserData: Pointer); stdcall;
 
 
@@ -171,6 +249,20 @@ function ctmGetAttribMapFloat; external DLLNAME;
 function ctmGetString; external DLLNAME;
 procedure ctmCompressionMethod; external DLLNAME;
 procedure ctmCompressionLevel; external DLLNAME;
+procedure ctmCompressionThreads; external DLLNAME;
+procedure ctmLZMAThreads; external DLLNAME;
+procedure ctmLZMASearch; external DLLNAME;
+procedure ctmCompressionCodec; external DLLNAME;
+procedure ctmVertexOrder; external DLLNAME;
+procedure ctmFileFormat; external DLLNAME;
+procedure ctmStreamBufferSize; external DLLNAME;
+procedure ctmSetAllocator; external DLLNAME;
+procedure ctmLoadSelect; external DLLNAME;
+procedure ctmTileDivision; external DLLNAME;
+procedure ctmLoadRegion; external DLLNAME;
+procedure ctmProgressCallback; external DLLNAME;
+procedure ctmCancel; external DLLNAME;
+procedure ctmGetStats; external DLLNAME;
 procedure ctmVertexPrecision; external DLLNAME;
 procedure ctmVertexPrecisionRel; external DLLNAME;
 procedure ctmNormalPrecision; external DLLNAME;
@@ -182,7 +274,12 @@ function ctmAddUVMap; external DLLNAME;
 function ctmAddAttribMap; external DLLNAME;
 procedure ctmLoad; external DLLNAME;
 procedure ctmLoadCustom; external DLLNAME;
+procedure ctmLoadHeader; external DLLNAME;
+procedure ctmLoadHeaderCustom; external DLLNAME;
+procedure ctmLoadAsync; external DLLNAME;
 procedure ctmSave; external DLLNAME;
+procedure ctmSaveAsync; external DLLNAME;
+procedure ctmWait; external DLLNAME;
 procedure ctmSaveCustom; external DLLNAME;
 
 end.
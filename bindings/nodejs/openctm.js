@@ -39,6 +39,9 @@ var CTMcontext = ref.refType(ref.types.void);
 var CTMenum = ref.types.uint32;
 var CTMreadfn = ref.refType(ref.types.void);
 var CTMwritefn = ref.refType(ref.types.void);
+var CTMallocfn = ref.refType(ref.types.void);
+var CTMfreefn = ref.refType(ref.types.void);
+var CTMprogressfn = ref.refType(ref.types.void);
 
 exports.CTMfloat = CTMfloat;
 exports.CTMint = CTMint;
@@ -63,11 +66,13 @@ exports.CTM_BAD_FORMAT = 0x0007;
 exports.CTM_LZMA_ERROR = 0x0008;
 exports.CTM_INTERNAL_ERROR = 0x0009;
 exports.CTM_UNSUPPORTED_FORMAT_VERSION = 0x000A;
+exports.CTM_CANCELLED = 0x000B;
 exports.CTM_IMPORT = 0x0101;
 exports.CTM_EXPORT = 0x0102;
 exports.CTM_METHOD_RAW = 0x0201;
 exports.CTM_METHOD_MG1 = 0x0202;
 exports.CTM_METHOD_MG2 = 0x0203;
+exports.CTM_METHOD_MG3 = 0x0204;
 exports.CTM_VERTEX_COUNT = 0x0301;
 exports.CTM_TRIANGLE_COUNT = 0x0302;
 exports.CTM_HAS_NORMALS = 0x0303;
@@ -77,12 +82,20 @@ exports.CTM_VERTEX_PRECISION = 0x0306;
 exports.CTM_NORMAL_PRECISION = 0x0307;
 exports.CTM_COMPRESSION_METHOD = 0x0308;
 exports.CTM_FILE_COMMENT = 0x0309;
+exports.CTM_COMPRESSION_THREADS = 0x030A;
+exports.CTM_FILE_FORMAT = 0x030B;
+exports.CTM_LZMA_THREADS = 0x030C;
+exports.CTM_STREAM_BUFFER_SIZE = 0x030D;
+exports.CTM_TILE_COUNT = 0x030E;
+exports.CTM_LZMA_SEARCH = 0x030F;
+exports.CTM_VERTEX_ORDER = 0x0310;
 exports.CTM_NAME = 0x0501;
 exports.CTM_FILE_NAME = 0x0502;
 exports.CTM_PRECISION = 0x0503;
 exports.CTM_INDICES = 0x0601;
 exports.CTM_VERTICES = 0x0602;
 exports.CTM_NORMALS = 0x0603;
+exports.CTM_BOUNDING_BOX = 0x0604;
 exports.CTM_UV_MAP_1 = 0x0700;
 exports.CTM_UV_MAP_2 = 0x0701;
 exports.CTM_UV_MAP_3 = 0x0702;
@@ -99,6 +112,20 @@ exports.CTM_ATTRIB_MAP_5 = 0x0804;
 exports.CTM_ATTRIB_MAP_6 = 0x0805;
 exports.CTM_ATTRIB_MAP_7 = 0x0806;
 exports.CTM_ATTRIB_MAP_8 = 0x0807;
+exports.CTM_STAGE_SORT = 0x0901;
+exports.CTM_STAGE_DELTAS = 0x0902;
+exports.CTM_STAGE_PACK = 0x0903;
+exports.CTM_STAGE_UNPACK = 0x0904;
+exports.CTM_CODEC_DEFAULT = 0x0A01;
+exports.CTM_CODEC_LZMA = 0x0A02;
+exports.CTM_CODEC_RANS = 0x0A03;
+exports.CTM_CODEC_STORE = 0x0A04;
+exports.CTM_ORDER_GRID = 0x0B01;
+exports.CTM_ORDER_MORTON = 0x0B02;
+exports.CTM_ORDER_HILBERT = 0x0B03;
+
+// Maximum number of block types in CTMstats
+exports.CTM_STATS_MAX_BLOCKS = 16;
 
 // Functions
 
@@ -124,6 +151,20 @@ var openctm = ffi.Library(libname, {
     'ctmGetString' : [ref.types.CString, [CTMcontext, CTMenum]],
     'ctmCompressionMethod' : ['void', [CTMcontext, CTMenum]],
     'ctmCompressionLevel' : ['void', [CTMcontext, CTMuint]],
+    'ctmCompressionThreads' : ['void', [CTMcontext, CTMuint]],
+    'ctmLZMAThreads' : ['void', [CTMcontext, CTMuint]],
+    'ctmLZMASearch' : ['void', [CTMcontext, CTMuint]],
+    'ctmCompressionCodec' : ['void', [CTMcontext, CTMenum, CTMenum]],
+    'ctmVertexOrder' : ['void', [CTMcontext, CTMenum]],
+    'ctmFileFormat' : ['void', [CTMcontext, CTMuint]],
+    'ctmStreamBufferSize' : ['void', [CTMcontext, CTMuint]],
+    'ctmSetAllocator' : ['void', [CTMcontext, CTMallocfn, CTMfreefn, 'void *']],
+    'ctmLoadSelect' : ['void', [CTMcontext, CTMenum, CTMuint]],
+    'ctmTileDivision' : ['void', [CTMcontext, CTMuint, CTMuint, CTMuint]],
+    'ctmLoadRegion' : ['void', [CTMcontext, ref.refType(CTMfloat), ref.refType(CTMfloat)]],
+    'ctmProgressCallback' : ['void', [CTMcontext, CTMprogressfn, 'void *']],
+    'ctmCancel' : ['void', [CTMcontext]],
+    'ctmGetStats' : ['void', [CTMcontext, 'void *']],
     'ctmVertexPrecision' : ['void', [CTMcontext, CTMfloat]],
     'ctmVertexPrecisionRel' : ['void', [CTMcontext, CTMfloat]],
     'ctmNormalPrecision' : ['void', [CTMcontext, CTMfloat]],
@@ -135,7 +176,12 @@ var openctm = ffi.Library(libname, {
     'ctmAddAttribMap' : [CTMenum, [CTMcontext, ref.refType(CTMfloat), ref.types.CString]],
     'ctmLoad' : ['void', [CTMcontext, ref.types.CString]],
     'ctmLoadCustom' : ['void', [CTMcontext, CTMreadfn, 'void *']],
+    'ctmLoadHeader' : ['void', [CTMcontext, ref.types.CString]],
+    'ctmLoadHeaderCustom' : ['void', [CTMcontext, CTMreadfn, 'void *']],
+    'ctmLoadAsync' : ['void', [CTMcontext, ref.types.CString]],
     'ctmSave' : ['void', [CTMcontext, ref.types.CString]],
+    'ctmSaveAsync' : ['void', [CTMcontext, ref.types.CString]],
+    'ctmWait' : ['void', [CTMcontext]],
     'ctmSaveCustom' : ['void', [CTMcontext, CTMwritefn, 'void *']],
     // extension
     'ctmSaveToBuffer' : ['void *', [CTMcontext, ref.refType(ref.types.size_t)]],
@@ -14,9 +14,10 @@ if len(sys.argv) != 2:
     print("Usage: " + sys.argv[0] + " file")
     sys.exit()
 
-# Create an OpenCTM context, and load the file
+# Create an OpenCTM context, and load the file header (the mesh data is not
+# needed)
 ctm = ctmNewContext(CTM_IMPORT)
-ctmLoad(ctm, sys.argv[1])
+ctmLoadHeader(ctm, sys.argv[1])
 err = ctmGetError(ctm)
 if err != CTM_NONE:
     print("Error loading file: " + str(ctmErrorString(err)))
@@ -34,6 +35,8 @@ elif method == CTM_METHOD_MG1:
     methodStr = "MG1"
 elif method == CTM_METHOD_MG2:
     methodStr = "MG2"
+elif method == CTM_METHOD_MG3:
+    methodStr = "MG3"
 else:
     methodStr = "Unknown"
 
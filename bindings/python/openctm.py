@@ -36,6 +36,10 @@ CTMint = c_int32
 CTMuint = c_uint32
 CTMcontext = c_void_p
 CTMenum = c_uint32
+if os.name == 'nt':
+    CTMprogressfn = WINFUNCTYPE(CTMuint, CTMenum, CTMfloat, c_void_p)
+else:
+    CTMprogressfn = CFUNCTYPE(CTMuint, CTMenum, CTMfloat, c_void_p)
 
 # Constants
 CTM_API_VERSION = 0x00000100
@@ -54,11 +58,13 @@ CTM_BAD_FORMAT = 0x0007
 CTM_LZMA_ERROR = 0x0008
 CTM_INTERNAL_ERROR = 0x0009
 CTM_UNSUPPORTED_FORMAT_VERSION = 0x000A
+CTM_CANCELLED = 0x000B
 CTM_IMPORT = 0x0101
 CTM_EXPORT = 0x0102
 CTM_METHOD_RAW = 0x0201
 CTM_METHOD_MG1 = 0x0202
 CTM_METHOD_MG2 = 0x0203
+CTM_METHOD_MG3 = 0x0204
 CTM_VERTEX_COUNT = 0x0301
 CTM_TRIANGLE_COUNT = 0x0302
 CTM_HAS_NORMALS = 0x0303
@@ -68,12 +74,20 @@ CTM_VERTEX_PRECISION = 0x0306
 CTM_NORMAL_PRECISION = 0x0307
 CTM_COMPRESSION_METHOD = 0x0308
 CTM_FILE_COMMENT = 0x0309
+CTM_COMPRESSION_THREADS = 0x030A
+CTM_FILE_FORMAT = 0x030B
+CTM_LZMA_THREADS = 0x030C
+CTM_STREAM_BUFFER_SIZE = 0x030D
+CTM_TILE_COUNT = 0x030E
+CTM_LZMA_SEARCH = 0x030F
+CTM_VERTEX_ORDER = 0x0310
 CTM_NAME = 0x0501
 CTM_FILE_NAME = 0x0502
 CTM_PRECISION = 0x0503
 CTM_INDICES = 0x0601
 CTM_VERTICES = 0x0602
 CTM_NORMALS = 0x0603
+CTM_BOUNDING_BOX = 0x0604
 CTM_UV_MAP_1 = 0x0700
 CTM_UV_MAP_2 = 0x0701
 CTM_UV_MAP_3 = 0x0702
@@ -90,6 +104,41 @@ CTM_ATTRIB_MAP_5 = 0x0804
 CTM_ATTRIB_MAP_6 = 0x0805
 CTM_ATTRIB_MAP_7 = 0x0806
 CTM_ATTRIB_MAP_8 = 0x0807
+CTM_STAGE_SORT = 0x0901
+CTM_STAGE_DELTAS = 0x0902
+CTM_STAGE_PACK = 0x0903
+CTM_STAGE_UNPACK = 0x0904
+CTM_CODEC_DEFAULT = 0x0A01
+CTM_CODEC_LZMA = 0x0A02
+CTM_CODEC_RANS = 0x0A03
+CTM_CODEC_STORE = 0x0A04
+CTM_ORDER_GRID = 0x0B01
+CTM_ORDER_MORTON = 0x0B02
+CTM_ORDER_HILBERT = 0x0B03
+
+# Statistics (see ctmGetStats)
+CTM_STATS_MAX_BLOCKS = 16
+
+class CTMstatsblock(Structure):
+    _fields_ = [("mFourCC", CTMuint),
+                ("mLZMACalls", CTMuint),
+                ("mLZMATime", CTMfloat),
+                ("mRawSize", c_size_t),
+                ("mPackedSize", c_size_t)]
+
+class CTMstats(Structure):
+    _fields_ = [("mTotalTime", CTMfloat),
+                ("mGridTime", CTMfloat),
+                ("mSortTime", CTMfloat),
+                ("mReIndexTime", CTMfloat),
+                ("mDeltaTime", CTMfloat),
+                ("mNormalTime", CTMfloat),
+                ("mLZMATime", CTMfloat),
+                ("mCheckTime", CTMfloat),
+                ("mLZMACalls", CTMuint),
+                ("mPeakScratch", c_size_t),
+                ("mBlockCount", CTMuint),
+                ("mBlocks", CTMstatsblock * CTM_STATS_MAX_BLOCKS)]
 
 # Load the OpenCTM shared library
 if os.name == 'nt':
@@ -168,6 +217,45 @@ ctmCompressionMethod.argtypes = [CTMcontext, CTMenum]
 ctmCompressionLevel = _lib.ctmCompressionLevel
 ctmCompressionLevel.argtypes = [CTMcontext, CTMuint]
 
+ctmCompressionThreads = _lib.ctmCompressionThreads
+ctmCompressionThreads.argtypes = [CTMcontext, CTMuint]
+
+ctmLZMAThreads = _lib.ctmLZMAThreads
+ctmLZMAThreads.argtypes = [CTMcontext, CTMuint]
+
+ctmLZMASearch = _lib.ctmLZMASearch
+ctmLZMASearch.argtypes = [CTMcontext, CTMuint]
+
+ctmCompressionCodec = _lib.ctmCompressionCodec
+ctmCompressionCodec.argtypes = [CTMcontext, CTMenum, CTMenum]
+
+ctmVertexOrder = _lib.ctmVertexOrder
+ctmVertexOrder.argtypes = [CTMcontext, CTMenum]
+
+ctmFileFormat = _lib.ctmFileFormat
+ctmFileFormat.argtypes = [CTMcontext, CTMuint]
+
+ctmStreamBufferSize = _lib.ctmStreamBufferSize
+ctmStreamBufferSize.argtypes = [CTMcontext, CTMuint]
+
+ctmLoadSelect = _lib.ctmLoadSelect
+ctmLoadSelect.argtypes = [CTMcontext, CTMenum, CTMuint]
+
+ctmTileDivision = _lib.ctmTileDivision
+ctmTileDivision.argtypes = [CTMcontext, CTMuint, CTMuint, CTMuint]
+
+ctmLoadRegion = _lib.ctmLoadRegion
+ctmLoadRegion.argtypes = [CTMcontext, POINTER(CTMfloat), POINTER(CTMfloat)]
+
+ctmProgressCallback = _lib.ctmProgressCallback
+ctmProgressCallback.argtypes = [CTMcontext, CTMprogressfn, c_void_p]
+
+ctmCancel = _lib.ctmCancel
+ctmCancel.argtypes = [CTMcontext]
+
+ctmGetStats = _lib.ctmGetStats
+ctmGetStats.argtypes = [CTMcontext, POINTER(CTMstats)]
+
 ctmVertexPrecision = _lib.ctmVertexPrecision
 ctmVertexPrecision.argtypes = [CTMcontext, CTMfloat]
 
@@ -200,5 +288,17 @@ ctmAddAttribMap.restype = CTMenum
 ctmLoad = _lib.ctmLoad
 ctmLoad.argtypes = [CTMcontext, c_char_p]
 
+ctmLoadHeader = _lib.ctmLoadHeader
+ctmLoadHeader.argtypes = [CTMcontext, c_char_p]
+
+ctmLoadAsync = _lib.ctmLoadAsync
+ctmLoadAsync.argtypes = [CTMcontext, c_char_p]
+
 ctmSave = _lib.ctmSave
 ctmSave.argtypes = [CTMcontext, c_char_p]
+
+ctmSaveAsync = _lib.ctmSaveAsync
+ctmSaveAsync.argtypes = [CTMcontext, c_char_p]
+
+ctmWait = _lib.ctmWait
+ctmWait.argtypes = [CTMcontext]
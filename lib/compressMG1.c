@@ -35,52 +35,6 @@
 #endif
 
 
-//-----------------------------------------------------------------------------
-// _compareTriangle() - Comparator for the triangle sorting.
-//-----------------------------------------------------------------------------
-static int _compareTriangle(const void * elem1, const void * elem2)
-{
-  CTMuint * tri1 = (CTMuint *) elem1;
-  CTMuint * tri2 = (CTMuint *) elem2;
-  if(tri1[0] != tri2[0])
-    return tri1[0] - tri2[0];
-  else
-    return tri1[1] - tri2[1];
-}
-
-//-----------------------------------------------------------------------------
-// _ctmReArrangeTriangles() - Re-arrange all triangles for optimal
-// compression.
-//-----------------------------------------------------------------------------
-static void _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
-{
-  CTMuint * tri, tmp, i;
-
-  // Step 1: Make sure that the first index of each triangle is the smallest
-  // one (rotate triangle nodes if necessary)
-  for(i = 0; i < self->mTriangleCount; ++ i)
-  {
-    tri = &aIndices[i * 3];
-    if((tri[1] < tri[0]) && (tri[1] < tri[2]))
-    {
-      tmp = tri[0];
-      tri[0] = tri[1];
-      tri[1] = tri[2];
-      tri[2] = tmp;
-    }
-    else if((tri[2] < tri[0]) && (tri[2] < tri[1]))
-    {
-      tmp = tri[0];
-      tri[0] = tri[2];
-      tri[2] = tri[1];
-      tri[1] = tmp;
-    }
-  }
-
-  // Step 2: Sort the triangles based on the first triangle index
-  qsort((void *) aIndices, self->mTriangleCount, sizeof(CTMuint) * 3, _compareTriangle);
-}
-
 //-----------------------------------------------------------------------------
 // _ctmMakeIndexDeltas() - Calculate various forms of derivatives in order to
 // reduce data entropy.
@@ -145,49 +99,62 @@ int _ctmCompressMesh_MG1(_CTMcontext * self)
   CTMuint * indices;
   _CTMfloatmap * map;
   CTMuint i;
+  double start;
 
 #ifdef __DEBUG_
   printf("COMPRESSION METHOD: MG1\n");
 #endif
 
   // Perpare (sort) indices
-  indices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
+  if(!_ctmProgress(self, CTM_STAGE_SORT, 0.0f))
+    return CTM_FALSE;
+  indices = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * self->mTriangleCount * 3);
   if(!indices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
+  start = _ctmTime();
   for(i = 0; i < self->mTriangleCount * 3; ++ i)
     indices[i] = self->mIndices[i];
-  _ctmReArrangeTriangles(self, indices);
+  if(!_ctmReArrangeTriangles(self, indices))
+  {
+    _ctmFree(self, (void *) indices);
+    return CTM_FALSE;
+  }
+  _ctmStatsTime(&self->mStats.mReIndexTime, start);
 
   // Calculate index deltas (entropy-reduction)
+  if(!_ctmProgress(self, CTM_STAGE_DELTAS, 0.0f))
+  {
+    _ctmFree(self, (void *) indices);
+    return CTM_FALSE;
+  }
+  start = _ctmTime();
   _ctmMakeIndexDeltas(self, indices);
+  _ctmStatsTime(&self->mStats.mDeltaTime, start);
 
   // Write triangle indices
 #ifdef __DEBUG_
   printf("Inidices: ");
 #endif
-  _ctmStreamWrite(self, (void *) "INDX", 4);
+  _ctmStreamWriteTag(self, "INDX");
   if(!_ctmStreamWritePackedInts(self, (CTMint *) indices, self->mTriangleCount, 3, CTM_FALSE))
   {
-    free((void *) indices);
+    _ctmFree(self, (void *) indices);
     return CTM_FALSE;
   }
 
   // Free temporary resources
-  free((void *) indices);
+  _ctmFree(self, (void *) indices);
 
   // Write vertices
 #ifdef __DEBUG_
   printf("Vertices: ");
 #endif
-  _ctmStreamWrite(self, (void *) "VERT", 4);
+  _ctmStreamWriteTag(self, "VERT");
   if(!_ctmStreamWritePackedFloats(self, self->mVertices, self->mVertexCount * 3, 1))
-  {
-    free((void *) indices);
     return CTM_FALSE;
-  }
 
   // Write normals
   if(self->mNormals)
@@ -195,7 +162,7 @@ int _ctmCompressMesh_MG1(_CTMcontext * self)
 #ifdef __DEBUG_
     printf("Normals: ");
 #endif
-    _ctmStreamWrite(self, (void *) "NORM", 4);
+    _ctmStreamWriteTag(self, "NORM");
     if(!_ctmStreamWritePackedFloats(self, self->mNormals, self->mVertexCount, 3))
       return CTM_FALSE;
   }
@@ -207,7 +174,8 @@ int _ctmCompressMesh_MG1(_CTMcontext * self)
 #ifdef __DEBUG_
     printf("UV coordinates (%s): ", map->mName ? map->mName : "no name");
 #endif
-    _ctmStreamWrite(self, (void *) "TEXC", 4);
+    _ctmStreamWriteTag(self, "TEXC");
+    self->mBlockCodec = map->mCodec;
     _ctmStreamWriteSTRING(self, map->mName);
     _ctmStreamWriteSTRING(self, map->mFileName);
     if(!_ctmStreamWritePackedFloats(self, map->mValues, self->mVertexCount, 2))
@@ -222,7 +190,8 @@ int _ctmCompressMesh_MG1(_CTMcontext * self)
 #ifdef __DEBUG_
     printf("Vertex attributes (%s): ", map->mName ? map->mName : "no name");
 #endif
-    _ctmStreamWrite(self, (void *) "ATTR", 4);
+    _ctmStreamWriteTag(self, "ATTR");
+    self->mBlockCodec = map->mCodec;
     _ctmStreamWriteSTRING(self, map->mName);
     if(!_ctmStreamWritePackedFloats(self, map->mValues, self->mVertexCount, 4))
       return CTM_FALSE;
@@ -238,70 +207,72 @@ int _ctmCompressMesh_MG1(_CTMcontext * self)
 //-----------------------------------------------------------------------------
 int _ctmUncompressMesh_MG1(_CTMcontext * self)
 {
-  CTMuint * indices;
   _CTMfloatmap * map;
-  CTMuint i;
+  double start;
 
-  // Allocate memory for the indices
-  indices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
-  if(!indices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
-  }
+  // Read all the packed blocks from the stream. Note: If the context has a
+  // thread pool, the blocks are uncompressed concurrently in the background,
+  // so we must wait for a block before using its data.
 
   // Read triangle indices
-  if(_ctmStreamReadUINT(self) != FOURCC("INDX"))
+  if(_ctmStreamReadTag(self) != FOURCC("INDX"))
   {
     self->mError = CTM_BAD_FORMAT;
-    free(indices);
     return CTM_FALSE;
   }
-  if(!_ctmStreamReadPackedInts(self, (CTMint *) indices, self->mTriangleCount, 3, CTM_FALSE))
+  if(!_ctmStreamReadPackedInts(self, (CTMint *) self->mIndices, self->mTriangleCount, 3, CTM_FALSE))
     return CTM_FALSE;
 
-  // Restore indices
-  _ctmRestoreIndices(self, indices);
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    self->mIndices[i] = indices[i];
-
-  // Free temporary resources
-  free(indices);
-
   // Read vertices
-  if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
+  if(_ctmStreamReadTag(self) != FOURCC("VERT"))
   {
+    _ctmStreamReadDiscard(self);
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
   if(!_ctmStreamReadPackedFloats(self, self->mVertices, self->mVertexCount * 3, 1))
+  {
+    _ctmStreamReadDiscard(self);
     return CTM_FALSE;
+  }
 
-  // Read normals
-  if(self->mNormals)
+  // Read normals (or skip them, if they were not selected for loading)
+  if(self->mFileHasNormals)
   {
-    if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
+    if(_ctmStreamReadTag(self) != FOURCC("NORM"))
     {
+      _ctmStreamReadDiscard(self);
       self->mError = CTM_BAD_FORMAT;
       return CTM_FALSE;
     }
-    if(!_ctmStreamReadPackedFloats(self, self->mNormals, self->mVertexCount, 3))
+    if(self->mNormals ?
+       !_ctmStreamReadPackedFloats(self, self->mNormals, self->mVertexCount, 3) :
+       !_ctmStreamSkipPacked(self, self->mVertexCount, 3))
+    {
+      _ctmStreamReadDiscard(self);
       return CTM_FALSE;
+    }
   }
 
-  // Read UV maps
+  // Read UV maps (skipped maps have no value array)
   map = self->mUVMaps;
   while(map)
   {
-    if(_ctmStreamReadUINT(self) != FOURCC("TEXC"))
+    if(_ctmStreamReadTag(self) != FOURCC("TEXC"))
     {
+      _ctmStreamReadDiscard(self);
       self->mError = CTM_BAD_FORMAT;
       return 0;
     }
     _ctmStreamReadSTRING(self, &map->mName);
     _ctmStreamReadSTRING(self, &map->mFileName);
-    if(!_ctmStreamReadPackedFloats(self, map->mValues, self->mVertexCount, 2))
+    if(map->mValues ?
+       !_ctmStreamReadPackedFloats(self, map->mValues, self->mVertexCount, 2) :
+       !_ctmStreamSkipPacked(self, self->mVertexCount, 2))
+    {
+      _ctmStreamReadDiscard(self);
       return CTM_FALSE;
+    }
     map = map->mNext;
   }
 
@@ -309,13 +280,100 @@ int _ctmUncompressMesh_MG1(_CTMcontext * self)
   map = self->mAttribMaps;
   while(map)
   {
-    if(_ctmStreamReadUINT(self) != FOURCC("ATTR"))
+    if(_ctmStreamReadTag(self) != FOURCC("ATTR"))
     {
+      _ctmStreamReadDiscard(self);
       self->mError = CTM_BAD_FORMAT;
       return 0;
     }
     _ctmStreamReadSTRING(self, &map->mName);
-    if(!_ctmStreamReadPackedFloats(self, map->mValues, self->mVertexCount, 4))
+    if(map->mValues ?
+       !_ctmStreamReadPackedFloats(self, map->mValues, self->mVertexCount, 4) :
+       !_ctmStreamSkipPacked(self, self->mVertexCount, 4))
+    {
+      _ctmStreamReadDiscard(self);
+      return CTM_FALSE;
+    }
+    map = map->mNext;
+  }
+
+  // Restore indices (as soon as they have been uncompressed)
+  if(!_ctmStreamReadWait(self, self->mIndices))
+    return CTM_FALSE;
+  start = _ctmTime();
+  _ctmRestoreIndices(self, self->mIndices);
+  _ctmStatsTime(&self->mStats.mDeltaTime, start);
+
+  // Wait for the remaining blocks
+  return _ctmStreamReadSync(self);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadHeader_MG1() - Read the UV and attribute map information of an MG1
+// mesh from the input stream, skipping all the packed data blocks (used when
+// only the header of a file is loaded).
+//-----------------------------------------------------------------------------
+int _ctmReadHeader_MG1(_CTMcontext * self)
+{
+  _CTMfloatmap * map;
+
+  // Skip triangle indices
+  if(_ctmStreamReadTag(self) != FOURCC("INDX"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  if(!_ctmStreamSkipPacked(self, self->mTriangleCount, 3))
+    return CTM_FALSE;
+
+  // Skip vertices
+  if(_ctmStreamReadTag(self) != FOURCC("VERT"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  if(!_ctmStreamSkipPacked(self, self->mVertexCount * 3, 1))
+    return CTM_FALSE;
+
+  // Skip normals
+  if(self->mFileHasNormals)
+  {
+    if(_ctmStreamReadTag(self) != FOURCC("NORM"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(!_ctmStreamSkipPacked(self, self->mVertexCount, 3))
+      return CTM_FALSE;
+  }
+
+  // Read UV map names
+  map = self->mUVMaps;
+  while(map)
+  {
+    if(_ctmStreamReadTag(self) != FOURCC("TEXC"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    _ctmStreamReadSTRING(self, &map->mName);
+    _ctmStreamReadSTRING(self, &map->mFileName);
+    if(!_ctmStreamSkipPacked(self, self->mVertexCount, 2))
+      return CTM_FALSE;
+    map = map->mNext;
+  }
+
+  // Read vertex attribute map names
+  map = self->mAttribMaps;
+  while(map)
+  {
+    if(_ctmStreamReadTag(self) != FOURCC("ATTR"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    _ctmStreamReadSTRING(self, &map->mName);
+    if(!_ctmStreamSkipPacked(self, self->mVertexCount, 4))
       return CTM_FALSE;
     map = map->mNext;
   }
@@ -26,10 +26,15 @@
 //-----------------------------------------------------------------------------
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <math.h>
 #include "openctm.h"
 #include "internal.h"
 
+#ifdef _CTM_USE_SSE2
+  #include <emmintrin.h>
+#endif
+
 #ifdef __DEBUG_
 #include <stdio.h>
 #endif
@@ -39,6 +44,26 @@
 #define PI 3.141592653589793238462643f
 #endif
 
+// Number of normals that are restored together (see _ctmRestoreNormals())
+#define _CTM_NORMAL_BLOCK_SIZE 256
+
+// Constants for _ctmSinCos(): pi/4 split in three parts (Cody-Waite range
+// reduction), and the largest angle that is reduced accurately
+#define _CTM_FOUR_OVER_PI 1.27323954473516268615f
+#define _CTM_PI4_A 0.78515625f
+#define _CTM_PI4_B 2.4187564849853515625e-4f
+#define _CTM_PI4_C 3.77489497744594108e-8f
+#define _CTM_SINCOS_MAX 8192.0f
+
+// Grid size limits (the grid index of a box must fit in a CTMuint)
+#define _CTM_GRID_MAX_DIVISION 0x00100000
+#define _CTM_GRID_MAX_BOXES 0x40000000
+
+// Largest number of grid divisions per axis for the space-filling curve
+// vertex orders (the curve index of a grid box must fit in 30 bits)
+#define _CTM_CURVE_BITS 10
+#define _CTM_CURVE_MAX_DIVISION (1 << _CTM_CURVE_BITS)
+
 
 //-----------------------------------------------------------------------------
 // _CTMgrid - 3D space subdivision grid.
@@ -53,14 +78,18 @@ typedef struct {
 
   // Size of each grid box.
   CTMfloat mSize[3];
+
+  // Bits per axis of the Hilbert curve index (enough for all divisions).
+  CTMuint mCurveBits;
 } _CTMgrid;
 
 //-----------------------------------------------------------------------------
 // _CTMsortvertex - Vertex information.
 //-----------------------------------------------------------------------------
 typedef struct {
-  // Vertex X coordinate (used for sorting).
-  CTMfloat x;
+  // Vertex X coordinate, as an unsigned integer with the same order as the
+  // float value (used for sorting).
+  CTMuint mSortX;
 
   // Grid index. This is the index into the 3D space subdivision grid.
   CTMuint mGridIndex;
@@ -74,28 +103,12 @@ typedef struct {
 //-----------------------------------------------------------------------------
 static void _ctmSetupGrid(_CTMcontext * self, _CTMgrid * aGrid)
 {
-  CTMuint i;
+  CTMuint i, maxDivision;
   CTMfloat factor[3], sum, wantedGrids;
+  double boxCount;
 
   // Calculate the mesh bounding box
-  aGrid->mMin[0] = aGrid->mMax[0] = self->mVertices[0];
-  aGrid->mMin[1] = aGrid->mMax[1] = self->mVertices[1];
-  aGrid->mMin[2] = aGrid->mMax[2] = self->mVertices[2];
-  for(i = 1; i < self->mVertexCount; ++ i)
-  {
-    if(self->mVertices[i * 3] < aGrid->mMin[0])
-      aGrid->mMin[0] = self->mVertices[i * 3];
-    else if(self->mVertices[i * 3] > aGrid->mMax[0])
-      aGrid->mMax[0] = self->mVertices[i * 3];
-    if(self->mVertices[i * 3 + 1] < aGrid->mMin[1])
-      aGrid->mMin[1] = self->mVertices[i * 3 + 1];
-    else if(self->mVertices[i * 3 + 1] > aGrid->mMax[1])
-      aGrid->mMax[1] = self->mVertices[i * 3 + 1];
-    if(self->mVertices[i * 3 + 2] < aGrid->mMin[2])
-      aGrid->mMin[2] = self->mVertices[i * 3 + 2];
-    else if(self->mVertices[i * 3 + 2] > aGrid->mMax[2])
-      aGrid->mMax[2] = self->mVertices[i * 3 + 2];
-  }
+  _ctmBoundingBox(self, aGrid->mMin, aGrid->mMax);
 
   // Determine optimal grid resolution, based on the number of vertices and
   // the bounding box.
@@ -111,11 +124,27 @@ static void _ctmSetupGrid(_CTMcontext * self, _CTMgrid * aGrid)
     for(i = 0; i < 3; ++ i)
       factor[i] *= sum;
     wantedGrids = powf(100.0f * self->mVertexCount, 1.0f / 3.0f);
-    for(i = 0; i < 3; ++ i)
+
+    // The grid index must fit in 32 bits, and the box coordinates must fit in
+    // the curve index for the space-filling curve orders (only very large
+    // meshes hit these limits)
+    maxDivision = (self->mVertexSortOrder == CTM_ORDER_GRID) ?
+                  _CTM_GRID_MAX_DIVISION : _CTM_CURVE_MAX_DIVISION;
+    for(;;)
     {
-      aGrid->mDivision[i] = (CTMuint) ceilf(wantedGrids * factor[i]);
-      if(aGrid->mDivision[i] < 1)
-        aGrid->mDivision[i] = 1;
+      boxCount = 1.0;
+      for(i = 0; i < 3; ++ i)
+      {
+        aGrid->mDivision[i] = (CTMuint) ceilf(wantedGrids * factor[i]);
+        if(aGrid->mDivision[i] < 1)
+          aGrid->mDivision[i] = 1;
+        if(aGrid->mDivision[i] > maxDivision)
+          aGrid->mDivision[i] = maxDivision;
+        boxCount *= aGrid->mDivision[i];
+      }
+      if(boxCount <= (double) _CTM_GRID_MAX_BOXES)
+        break;
+      wantedGrids *= 0.8f;
     }
   }
   else
@@ -131,6 +160,30 @@ static void _ctmSetupGrid(_CTMcontext * self, _CTMgrid * aGrid)
   // Calculate grid sizes
   for(i = 0; i < 3; ++ i)
     aGrid->mSize[i] = (aGrid->mMax[i] - aGrid->mMin[i]) / aGrid->mDivision[i];
+
+  // Bits per axis of the Hilbert curve
+  aGrid->mCurveBits = 1;
+  for(i = 0; i < 3; ++ i)
+  {
+    while((1u << aGrid->mCurveBits) < aGrid->mDivision[i])
+      ++ aGrid->mCurveBits;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPointToGridBox() - Get the x/y/z box coordinates of a point in the grid.
+//-----------------------------------------------------------------------------
+static void _ctmPointToGridBox(_CTMgrid * aGrid, CTMfloat * aPoint,
+  CTMuint * aBox)
+{
+  CTMuint i;
+
+  for(i = 0; i < 3; ++ i)
+  {
+    aBox[i] = (CTMuint) floorf((aPoint[i] - aGrid->mMin[i]) / aGrid->mSize[i]);
+    if(aBox[i] >= aGrid->mDivision[i])
+      aBox[i] = aGrid->mDivision[i] - 1;
+  }
 }
 
 //-----------------------------------------------------------------------------
@@ -138,16 +191,99 @@ static void _ctmSetupGrid(_CTMcontext * self, _CTMgrid * aGrid)
 //-----------------------------------------------------------------------------
 static CTMuint _ctmPointToGridIdx(_CTMgrid * aGrid, CTMfloat * aPoint)
 {
-  CTMuint i, idx[3];
+  CTMuint idx[3];
+
+  _ctmPointToGridBox(aGrid, aPoint, idx);
+  return idx[0] + aGrid->mDivision[0] * (idx[1] + aGrid->mDivision[1] * idx[2]);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmMortonSpread() - Spread the lower 10 bits of a box coordinate to every
+// third bit.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmMortonSpread(CTMuint x)
+{
+  x &= 0x000003ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8)) & 0x0300f00f;
+  x = (x | (x << 4)) & 0x030c30c3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmHilbertIndex() - Get the index of a grid box along a 3D Hilbert curve
+// with aBits bits per axis (J. Skilling, "Programming the Hilbert curve",
+// AIP Conf. Proc. 707, 2004).
+//-----------------------------------------------------------------------------
+static CTMuint _ctmHilbertIndex(const CTMuint * aBox, CTMuint aBits)
+{
+  CTMuint x[3], p, q, t, i, b, index;
 
   for(i = 0; i < 3; ++ i)
+    x[i] = aBox[i];
+
+  // Inverse undo of the rotations and reflections
+  for(q = 1u << (aBits - 1); q > 1; q >>= 1)
   {
-    idx[i] = (CTMuint) floorf((aPoint[i] - aGrid->mMin[i]) / aGrid->mSize[i]);
-    if(idx[i] >= aGrid->mDivision[i])
-      idx[i] = aGrid->mDivision[i] - 1;
+    p = q - 1;
+    for(i = 0; i < 3; ++ i)
+    {
+      if(x[i] & q)
+        x[0] ^= p;
+      else
+      {
+        t = (x[0] ^ x[i]) & p;
+        x[0] ^= t;
+        x[i] ^= t;
+      }
+    }
   }
 
-  return idx[0] + aGrid->mDivision[0] * (idx[1] + aGrid->mDivision[1] * idx[2]);
+  // Gray encode
+  for(i = 1; i < 3; ++ i)
+    x[i] ^= x[i - 1];
+  t = 0;
+  for(q = 1u << (aBits - 1); q > 1; q >>= 1)
+  {
+    if(x[2] & q)
+      t ^= q - 1;
+  }
+  for(i = 0; i < 3; ++ i)
+    x[i] ^= t;
+
+  // Interleave the bits of the transposed index
+  index = 0;
+  for(b = aBits; b > 0; -- b)
+  {
+    for(i = 0; i < 3; ++ i)
+      index = (index << 1) | ((x[i] >> (b - 1)) & 1);
+  }
+  return index;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPointToSortKey() - Get the key that orders a point by its grid box, in
+// the vertex order of the context.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmPointToSortKey(_CTMgrid * aGrid, CTMenum aOrder,
+  CTMfloat * aPoint)
+{
+  CTMuint idx[3];
+
+  _ctmPointToGridBox(aGrid, aPoint, idx);
+  switch(aOrder)
+  {
+    case CTM_ORDER_MORTON:
+      return _ctmMortonSpread(idx[0]) | (_ctmMortonSpread(idx[1]) << 1) |
+             (_ctmMortonSpread(idx[2]) << 2);
+
+    case CTM_ORDER_HILBERT:
+      return _ctmHilbertIndex(idx, aGrid->mCurveBits);
+
+    default:
+      return idx[0] + aGrid->mDivision[0] * (idx[1] + aGrid->mDivision[1] * idx[2]);
+  }
 }
 
 //-----------------------------------------------------------------------------
@@ -172,117 +308,168 @@ static void _ctmGridIdxToPoint(_CTMgrid * aGrid, CTMuint aIdx, CTMfloat * aPoint
 }
 
 //-----------------------------------------------------------------------------
-// _compareVertex() - Comparator for the vertex sorting.
+// _ctmFloatSortKey() - Convert a float to an unsigned integer that sorts in
+// the same order as the float value (negative and positive zero are equal).
 //-----------------------------------------------------------------------------
-static int _compareVertex(const void * elem1, const void * elem2)
+static CTMuint _ctmFloatSortKey(CTMfloat aValue)
 {
-  _CTMsortvertex * v1 = (_CTMsortvertex *) elem1;
-  _CTMsortvertex * v2 = (_CTMsortvertex *) elem2;
-  if(v1->mGridIndex != v2->mGridIndex)
-    return v1->mGridIndex - v2->mGridIndex;
-  else if(v1->x < v2->x)
-    return -1;
-  else if(v1->x > v2->x)
-    return 1;
+  union {
+    CTMfloat f;
+    CTMuint i;
+  } u;
+
+  u.f = aValue;
+  if(u.i == 0x80000000)
+    u.i = 0;
+  if(u.i & 0x80000000)
+    return ~u.i;
   else
-    return 0;
+    return u.i | 0x80000000;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmSortVertices() - Setup the vertex array. Assign each vertex to a grid
-// box, and sort all vertices.
+// _CTMsortargs - Arguments for the parallel loops of the vertex sorting and
+// re-indexing (see _ctmParallelFor()).
 //-----------------------------------------------------------------------------
-static void _ctmSortVertices(_CTMcontext * self, _CTMsortvertex * aSortVertices,
-  _CTMgrid * aGrid)
+typedef struct {
+  _CTMcontext * mContext;
+  _CTMsortvertex * mSortVertices;
+  _CTMgrid * mGrid;
+  CTMuint * mIndexLUT;
+  CTMuint * mIndices;
+} _CTMsortargs;
+
+//-----------------------------------------------------------------------------
+// _ctmPrepareSortVertices() - Store the properties of a part of the vertices
+// in the sort vertex array (range function).
+//-----------------------------------------------------------------------------
+static void _ctmPrepareSortVertices(void * aData, CTMuint aPart,
+  CTMuint aBegin, CTMuint aEnd)
 {
+  _CTMsortargs * args = (_CTMsortargs *) aData;
+  CTMfloat * vertices = args->mContext->mVertices;
+  _CTMsortvertex * sortVertices = args->mSortVertices;
   CTMuint i;
+  (void) aPart;
 
-  // Prepare sort vertex array
-  for(i = 0; i < self->mVertexCount; ++ i)
+  for(i = aBegin; i < aEnd; ++ i)
   {
-    // Store vertex properties in the sort vertex array
-    aSortVertices[i].x = self->mVertices[i * 3];
-    aSortVertices[i].mGridIndex = _ctmPointToGridIdx(aGrid, &self->mVertices[i * 3]);
-    aSortVertices[i].mOriginalIndex = i;
+    sortVertices[i].mSortX = _ctmFloatSortKey(vertices[i * 3]);
+    sortVertices[i].mGridIndex = _ctmPointToSortKey(args->mGrid,
+      args->mContext->mVertexSortOrder, &vertices[i * 3]);
+    sortVertices[i].mOriginalIndex = i;
   }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreGridIndices() - Replace the curve indices of a part of the sorted
+// vertices with their grid indices (range function).
+//-----------------------------------------------------------------------------
+static void _ctmRestoreGridIndices(void * aData, CTMuint aPart,
+  CTMuint aBegin, CTMuint aEnd)
+{
+  _CTMsortargs * args = (_CTMsortargs *) aData;
+  CTMfloat * vertices = args->mContext->mVertices;
+  _CTMsortvertex * sortVertices = args->mSortVertices;
+  CTMuint i;
+  (void) aPart;
 
-  // Sort vertices. The elements are first sorted by their grid indices, and
-  // scondly by their x coordinates.
-  qsort((void *) aSortVertices, self->mVertexCount, sizeof(_CTMsortvertex), _compareVertex);
+  for(i = aBegin; i < aEnd; ++ i)
+    sortVertices[i].mGridIndex = _ctmPointToGridIdx(args->mGrid,
+      &vertices[sortVertices[i].mOriginalIndex * 3]);
 }
 
 //-----------------------------------------------------------------------------
-// _ctmReIndexIndices() - Re-index all indices, based on the sorted vertices.
+// _ctmSortVertices() - Setup the vertex array. Assign each vertex to a grid
+// box, and sort all vertices. Returns CTM_FALSE if the sort buffer could not
+// be allocated.
 //-----------------------------------------------------------------------------
-static int _ctmReIndexIndices(_CTMcontext * self, _CTMsortvertex * aSortVertices,
-  CTMuint * aIndices)
+static int _ctmSortVertices(_CTMcontext * self, _CTMsortvertex * aSortVertices,
+  _CTMgrid * aGrid)
 {
-  CTMuint i, * indexLUT;
+  _CTMsortargs args;
+  CTMuint parts;
 
-  // Create temporary lookup-array, O(n)
-  indexLUT = (CTMuint *) malloc(sizeof(CTMuint) * self->mVertexCount);
-  if(!indexLUT)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
+  // Prepare sort vertex array
+  args.mContext = self;
+  args.mSortVertices = aSortVertices;
+  args.mGrid = aGrid;
+  parts = _ctmParallelParts(self, self->mVertexCount, _CTM_PARALLEL_MIN_PART);
+  _ctmParallelFor(self, self->mVertexCount, parts, _ctmPrepareSortVertices,
+    &args);
+
+  // Sort vertices. The elements are first sorted by their grid boxes (in the
+  // order of the context), and secondly by their x coordinates.
+  if(!_ctmSortRecords(self, (CTMuint *) aSortVertices, self->mVertexCount,
+       offsetof(_CTMsortvertex, mGridIndex) / sizeof(CTMuint),
+       offsetof(_CTMsortvertex, mSortX) / sizeof(CTMuint)))
     return CTM_FALSE;
-  }
-  for(i = 0; i < self->mVertexCount; ++ i)
-    indexLUT[aSortVertices[i].mOriginalIndex] = i;
-
-  // Convert old indices to new indices, O(n)
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    aIndices[i] = indexLUT[self->mIndices[i]];
 
-  // Free temporary lookup-array
-  free((void *) indexLUT);
+  // The file stores grid indices, so convert the curve indices back
+  if(self->mVertexSortOrder != CTM_ORDER_GRID)
+    _ctmParallelFor(self, self->mVertexCount, parts, _ctmRestoreGridIndices,
+      &args);
 
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _compareTriangle() - Comparator for the triangle sorting.
+// _ctmMakeIndexLUT() - Store the new index of a part of the sorted vertices
+// in the index lookup array (range function).
 //-----------------------------------------------------------------------------
-static int _compareTriangle(const void * elem1, const void * elem2)
+static void _ctmMakeIndexLUT(void * aData, CTMuint aPart, CTMuint aBegin,
+  CTMuint aEnd)
 {
-  CTMuint * tri1 = (CTMuint *) elem1;
-  CTMuint * tri2 = (CTMuint *) elem2;
-  if(tri1[0] != tri2[0])
-    return tri1[0] - tri2[0];
-  else
-    return tri1[1] - tri2[1];
+  _CTMsortargs * args = (_CTMsortargs *) aData;
+  CTMuint i;
+  (void) aPart;
+
+  for(i = aBegin; i < aEnd; ++ i)
+    args->mIndexLUT[args->mSortVertices[i].mOriginalIndex] = i;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmReArrangeTriangles() - Re-arrange all triangles for optimal
-// compression.
+// _ctmConvertIndices() - Convert a part of the old indices to new indices
+// (range function).
 //-----------------------------------------------------------------------------
-static void _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
+static void _ctmConvertIndices(void * aData, CTMuint aPart, CTMuint aBegin,
+  CTMuint aEnd)
 {
-  CTMuint * tri, tmp, i;
+  _CTMsortargs * args = (_CTMsortargs *) aData;
+  const CTMuint * oldIndices = args->mContext->mIndices;
+  CTMuint i;
+  (void) aPart;
 
-  // Step 1: Make sure that the first index of each triangle is the smallest
-  // one (rotate triangle nodes if necessary)
-  for(i = 0; i < self->mTriangleCount; ++ i)
-  {
-    tri = &aIndices[i * 3];
-    if((tri[1] < tri[0]) && (tri[1] < tri[2]))
-    {
-      tmp = tri[0];
-      tri[0] = tri[1];
-      tri[1] = tri[2];
-      tri[2] = tmp;
-    }
-    else if((tri[2] < tri[0]) && (tri[2] < tri[1]))
-    {
-      tmp = tri[0];
-      tri[0] = tri[2];
-      tri[2] = tri[1];
-      tri[1] = tmp;
-    }
-  }
+  for(i = aBegin; i < aEnd; ++ i)
+    args->mIndices[i] = args->mIndexLUT[oldIndices[i]];
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReIndexIndices() - Re-index all indices, based on the sorted vertices.
+//-----------------------------------------------------------------------------
+static int _ctmReIndexIndices(_CTMcontext * self, _CTMsortvertex * aSortVertices,
+  CTMuint * aIndices)
+{
+  _CTMsortargs args;
+
+  // Create temporary lookup-array, O(n)
+  args.mContext = self;
+  args.mSortVertices = aSortVertices;
+  args.mIndices = aIndices;
+  args.mIndexLUT = (CTMuint *) _ctmScratch(self, _CTM_SCRATCH_WORK,
+    sizeof(CTMuint) * self->mVertexCount);
+  if(!args.mIndexLUT)
+    return CTM_FALSE;
+  _ctmParallelFor(self, self->mVertexCount,
+    _ctmParallelParts(self, self->mVertexCount, _CTM_PARALLEL_MIN_PART),
+    _ctmMakeIndexLUT, &args);
+
+  // Convert old indices to new indices, O(n)
+  _ctmParallelFor(self, self->mTriangleCount * 3,
+    _ctmParallelParts(self, self->mTriangleCount * 3, _CTM_PARALLEL_MIN_PART),
+    _ctmConvertIndices, &args);
 
-  // Step 2: Sort the triangles based on the first triangle index
-  qsort((void *) aIndices, self->mTriangleCount, sizeof(CTMuint) * 3, _compareTriangle);
+  return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
@@ -415,33 +602,157 @@ static void _ctmRestoreVertices(_CTMcontext * self, CTMint * aIntVertices,
 }
 
 //-----------------------------------------------------------------------------
-// _ctmCalcSmoothNormals() - Calculate the smooth normals for a given mesh.
-// These are used as the nominal normals for normal deltas & reconstruction.
+// _CTMnormalargs - Arguments for the parallel smooth normal calculation.
 //-----------------------------------------------------------------------------
-static void _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
-  CTMuint * aIndices, CTMfloat * aSmoothNormals)
+typedef struct {
+  _CTMcontext * mContext;
+  CTMfloat * mVertices;
+  CTMuint * mIndices;
+  CTMfloat * mSmoothNormals;
+
+  // Vertex parts: part k holds the vertices mBegin[k] ... mBegin[k + 1] - 1
+  CTMuint mParts;
+  CTMuint mBegin[_CTM_MAX_THREADS + 1];
+
+  // The triangles of each vertex part (in triangle order) are
+  // mTriangles[mFirst[k]] ... mTriangles[mFirst[k + 1] - 1]. mTriangles is
+  // NULL for a single part, which visits all triangles.
+  CTMuint * mTriangles;
+  CTMuint mFirst[_CTM_MAX_THREADS + 1];
+
+  // List positions, per triangle part and vertex part (mParts x mParts)
+  CTMuint * mNext;
+} _CTMnormalargs;
+
+//-----------------------------------------------------------------------------
+// _ctmVertexPart() - Find the part of a vertex. aHint is a likely part (e.g.
+// the part of the previous vertex), which is checked first.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmVertexPart(const _CTMnormalargs * args, CTMuint aIndex,
+  CTMuint aHint)
+{
+  CTMuint lo, hi, mid;
+
+  if((aIndex - args->mBegin[aHint]) <
+     (args->mBegin[aHint + 1] - args->mBegin[aHint]))
+    return aHint;
+
+  // Binary search: mBegin[lo] <= aIndex < mBegin[hi]
+  lo = 0;
+  hi = args->mParts;
+  while(hi - lo > 1)
+  {
+    mid = (lo + hi) / 2;
+    if(aIndex < args->mBegin[mid])
+      hi = mid;
+    else
+      lo = mid;
+  }
+  return lo;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTriangleParts() - Get the distinct vertex parts of a triangle (the
+// number of parts is returned). aHint is updated with the part of the first
+// corner.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmTriangleParts(const _CTMnormalargs * args,
+  const CTMuint * aTri, CTMuint * aHint, CTMuint * aParts)
+{
+  CTMuint count = 1, part;
+
+  aParts[0] = *aHint = _ctmVertexPart(args, aTri[0], *aHint);
+  part = _ctmVertexPart(args, aTri[1], aParts[0]);
+  if(part != aParts[0])
+    aParts[count ++] = part;
+  part = _ctmVertexPart(args, aTri[2], aParts[0]);
+  if((part != aParts[0]) && (part != aParts[count - 1]))
+    aParts[count ++] = part;
+  return count;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCountPartTrianglesPart() - Count the triangles of each vertex part, for
+// a part of the triangles (range function).
+//-----------------------------------------------------------------------------
+static void _ctmCountPartTrianglesPart(void * aData, CTMuint aPart,
+  CTMuint aBegin, CTMuint aEnd)
+{
+  _CTMnormalargs * args = (_CTMnormalargs *) aData;
+  CTMuint * count = &args->mNext[aPart * args->mParts];
+  CTMuint i, k, n, hint = 0, parts[3];
+
+  for(i = aBegin; i < aEnd; ++ i)
+  {
+    n = _ctmTriangleParts(args, &args->mIndices[i * 3], &hint, parts);
+    for(k = 0; k < n; ++ k)
+      ++ count[parts[k]];
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmListPartTrianglesPart() - Add a part of the triangles to the triangle
+// lists of the vertex parts (range function).
+//-----------------------------------------------------------------------------
+static void _ctmListPartTrianglesPart(void * aData, CTMuint aPart,
+  CTMuint aBegin, CTMuint aEnd)
+{
+  _CTMnormalargs * args = (_CTMnormalargs *) aData;
+  CTMuint * next = &args->mNext[aPart * args->mParts];
+  CTMuint i, k, n, hint = 0, parts[3];
+
+  for(i = aBegin; i < aEnd; ++ i)
+  {
+    n = _ctmTriangleParts(args, &args->mIndices[i * 3], &hint, parts);
+    for(k = 0; k < n; ++ k)
+      args->mTriangles[next[parts[k]] ++] = i;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCalcSmoothNormalsPart() - Calculate the smooth normals for a part of
+// the vertices (range function). Every part visits its own triangles in order,
+// and only updates the normals of the vertices in its own range, so each
+// normal sum is accumulated in exactly the same order as in a serial run.
+//-----------------------------------------------------------------------------
+static void _ctmCalcSmoothNormalsPart(void * aData, CTMuint aPart,
+  CTMuint aBegin, CTMuint aEnd)
 {
-  CTMuint i, j, k, tri[3];
+  _CTMnormalargs * args = (_CTMnormalargs *) aData;
+  CTMfloat * vertices = args->mVertices;
+  CTMuint * indices = args->mIndices;
+  CTMfloat * smoothNormals = args->mSmoothNormals;
+  CTMuint * triangles = (CTMuint *) 0;
+  CTMuint triangleCount = args->mContext->mTriangleCount;
+  CTMuint i, j, k, t, tri[3];
   CTMfloat len;
   CTMfloat v1[3], v2[3], n[3];
 
+  // Get the triangles that touch this part
+  if(args->mTriangles)
+  {
+    triangles = &args->mTriangles[args->mFirst[aPart]];
+    triangleCount = args->mFirst[aPart + 1] - args->mFirst[aPart];
+  }
+
   // Clear smooth normals array
-  for(i = 0; i < 3 * self->mVertexCount; ++ i)
-    aSmoothNormals[i] = 0.0f;
+  for(i = aBegin * 3; i < aEnd * 3; ++ i)
+    smoothNormals[i] = 0.0f;
 
   // Calculate sums of all neigbouring triangle normals for each vertex
-  for(i = 0; i < self->mTriangleCount; ++ i)
+  for(t = 0; t < triangleCount; ++ t)
   {
     // Get triangle corner indices
+    i = triangles ? triangles[t] : t;
     for(j = 0; j < 3; ++ j)
-      tri[j] = aIndices[i * 3 + j];
+      tri[j] = indices[i * 3 + j];
 
     // Calculate the normalized cross product of two triangle edges (i.e. the
     // flat triangle normal)
     for(j = 0; j < 3; ++ j)
     {
-      v1[j] = aVertices[tri[1] * 3 + j] - aVertices[tri[0] * 3 + j];
-      v2[j] = aVertices[tri[2] * 3 + j] - aVertices[tri[0] * 3 + j];
+      v1[j] = vertices[tri[1] * 3 + j] - vertices[tri[0] * 3 + j];
+      v2[j] = vertices[tri[2] * 3 + j] - vertices[tri[0] * 3 + j];
     }
     n[0] = v1[1] * v2[2] - v1[2] * v2[1];
     n[1] = v1[2] * v2[0] - v1[0] * v2[2];
@@ -454,25 +765,120 @@ static void _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
     for(j = 0; j < 3; ++ j)
       n[j] *= len;
 
-    // Add the flat normal to all three triangle vertices
+    // Add the flat normal to the triangle vertices that belong to this part
+    // (unsigned compare: tri - aBegin < aEnd - aBegin)
     for(k = 0; k < 3; ++ k)
-      for(j = 0; j < 3; ++ j)
-        aSmoothNormals[tri[k] * 3 + j] += n[j];
+    {
+      if((tri[k] - aBegin) < (aEnd - aBegin))
+      {
+        for(j = 0; j < 3; ++ j)
+          smoothNormals[tri[k] * 3 + j] += n[j];
+      }
+    }
   }
 
   // Normalize the normal sums, which gives the unit length smooth normals
-  for(i = 0; i < self->mVertexCount; ++ i)
+  for(i = aBegin; i < aEnd; ++ i)
   {
-    len = sqrtf(aSmoothNormals[i * 3] * aSmoothNormals[i * 3] + 
-                aSmoothNormals[i * 3 + 1] * aSmoothNormals[i * 3 + 1] +
-                aSmoothNormals[i * 3 + 2] * aSmoothNormals[i * 3 + 2]);
+    len = sqrtf(smoothNormals[i * 3] * smoothNormals[i * 3] +
+                smoothNormals[i * 3 + 1] * smoothNormals[i * 3 + 1] +
+                smoothNormals[i * 3 + 2] * smoothNormals[i * 3 + 2]);
     if(len > 1e-10f)
       len = 1.0f / len;
     else
       len = 1.0f;
     for(j = 0; j < 3; ++ j)
-      aSmoothNormals[i * 3 + j] *= len;
+      smoothNormals[i * 3 + j] *= len;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCalcSmoothNormals() - Calculate the smooth normals for a given mesh.
+// These are used as the nominal normals for normal deltas & reconstruction.
+// The vertices are split into parts that are processed concurrently, and the
+// result is bit-identical to a serial run (the decoder depends on this).
+// Before that, the triangles are sorted into one list per vertex part (a
+// triangle is listed for every part that any of its corners belong to), so
+// that each part only visits its own triangles.
+//-----------------------------------------------------------------------------
+static int _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
+  CTMuint * aIndices, CTMfloat * aSmoothNormals)
+{
+  _CTMnormalargs args;
+  CTMuint i, j, k, partSize, rest, pos;
+  double start;
+
+  start = _ctmTime();
+  args.mContext = self;
+  args.mVertices = aVertices;
+  args.mIndices = aIndices;
+  args.mSmoothNormals = aSmoothNormals;
+  args.mTriangles = (CTMuint *) 0;
+  args.mNext = (CTMuint *) 0;
+  args.mParts = _ctmParallelParts(self, self->mVertexCount,
+    _CTM_PARALLEL_MIN_PART);
+  if(args.mParts > _CTM_MAX_THREADS)
+    args.mParts = _CTM_MAX_THREADS;
+
+  if(args.mParts > 1)
+  {
+    // Vertex part ranges (the same split as _ctmParallelFor() uses)
+    partSize = self->mVertexCount / args.mParts;
+    rest = self->mVertexCount % args.mParts;
+    for(k = 0; k <= args.mParts; ++ k)
+      args.mBegin[k] = k * partSize + (k < rest ? k : rest);
+
+    // Count the triangles of each vertex part, per triangle part
+    args.mNext = (CTMuint *) _ctmMalloc(self,
+      sizeof(CTMuint) * args.mParts * args.mParts);
+    if(!args.mNext)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+    for(i = 0; i < args.mParts * args.mParts; ++ i)
+      args.mNext[i] = 0;
+    _ctmParallelFor(self, self->mTriangleCount, args.mParts,
+      _ctmCountPartTrianglesPart, &args);
+
+    // Turn the counts into list positions (each list is ordered by triangle
+    // part, and hence by triangle)
+    pos = 0;
+    for(k = 0; k < args.mParts; ++ k)
+    {
+      args.mFirst[k] = pos;
+      for(j = 0; j < args.mParts; ++ j)
+      {
+        i = args.mNext[j * args.mParts + k];
+        args.mNext[j * args.mParts + k] = pos;
+        pos += i;
+      }
+    }
+    args.mFirst[args.mParts] = pos;
+
+    // List the triangles of each vertex part
+    args.mTriangles = (CTMuint *) _ctmMalloc(self,
+      sizeof(CTMuint) * (pos ? pos : 1));
+    if(!args.mTriangles)
+    {
+      _ctmFree(self, args.mNext);
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+    _ctmParallelFor(self, self->mTriangleCount, args.mParts,
+      _ctmListPartTrianglesPart, &args);
   }
+
+  // Calculate the smooth normals
+  _ctmParallelFor(self, self->mVertexCount, args.mParts,
+    _ctmCalcSmoothNormalsPart, &args);
+
+  // Free temporary resources
+  _ctmFree(self, args.mTriangles);
+  _ctmFree(self, args.mNext);
+  _ctmStatsTime(&self->mStats.mNormalTime, start);
+
+  return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
@@ -532,17 +938,16 @@ static CTMint _ctmMakeNormalDeltas(_CTMcontext * self, CTMint * aIntNormals,
   CTMfloat magn, phi, theta, scale, thetaScale;
   CTMfloat * smoothNormals, n[3], n2[3], basisAxes[9];
 
-  // Allocate temporary memory for the nominal vertex normals
-  smoothNormals = (CTMfloat *) malloc(3 * sizeof(CTMfloat) * self->mVertexCount);
+  // Get temporary memory for the nominal vertex normals
+  smoothNormals = (CTMfloat *) _ctmScratch(self, _CTM_SCRATCH_WORK,
+    3 * sizeof(CTMfloat) * self->mVertexCount);
   if(!smoothNormals)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
-  }
 
   // Calculate smooth normals (Note: aVertices and aIndices use the sorted
   // index space, so smoothNormals will too)
-  _ctmCalcSmoothNormals(self, aVertices, aIndices, smoothNormals);
+  if(!_ctmCalcSmoothNormals(self, aVertices, aIndices, smoothNormals))
+    return CTM_FALSE;
 
   // Normal scaling factor
   scale = 1.0f / self->mNormalPrecision;
@@ -600,88 +1005,398 @@ static CTMint _ctmMakeNormalDeltas(_CTMcontext * self, CTMint * aIntNormals,
     aIntNormals[i * 3 + 2] = (CTMint) floorf((theta + PI) * thetaScale + 0.5f);
   }
 
-  // Free temporary resources
-  free(smoothNormals);
-
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmRestoreNormals() - Convert the normals back to cartesian coordinates.
+// _ctmSinCos1() - Calculate sin and cos of one angle with the same method as
+// _ctmSinCos(). Angles that can not be reduced accurately (huge or not finite)
+// are passed on to the C library.
 //-----------------------------------------------------------------------------
-static CTMint _ctmRestoreNormals(_CTMcontext * self, CTMint * aIntNormals)
+static void _ctmSinCos1(CTMfloat aAngle, CTMfloat * aSin, CTMfloat * aCos)
 {
-  CTMuint i, j, intPhi;
-  CTMfloat magn, phi, theta, scale, thetaScale;
-  CTMfloat * smoothNormals, n[3], n2[3], basisAxes[9];
+  CTMfloat x, y, z, s, c, tmp;
+  CTMuint q;
 
-  // Allocate temporary memory for the nominal vertex normals
-  smoothNormals = (CTMfloat *) malloc(3 * sizeof(CTMfloat) * self->mVertexCount);
-  if(!smoothNormals)
+  x = fabsf(aAngle);
+  if(!(x <= _CTM_SINCOS_MAX))
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    *aSin = sinf(aAngle);
+    *aCos = cosf(aAngle);
+    return;
   }
 
-  // Calculate smooth normals (nominal normals)
-  _ctmCalcSmoothNormals(self, self->mVertices, self->mIndices, smoothNormals);
-
-  // Normal scaling factor
-  scale = self->mNormalPrecision;
-
-  for(i = 0; i < self->mVertexCount; ++ i)
+  // Reduce the angle to [-pi/4, pi/4], and get the quadrant
+  q = (CTMuint) (x * _CTM_FOUR_OVER_PI);
+  q = (q + 1) & ~1U;
+  y = (CTMfloat) q;
+  x = ((x - y * _CTM_PI4_A) - y * _CTM_PI4_B) - y * _CTM_PI4_C;
+  q >>= 1;
+
+  // Minimax polynomials for sin and cos in [-pi/4, pi/4]
+  z = x * x;
+  s = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) *
+      z * x + x;
+  c = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z +
+      4.166664568298827e-2f) * z * z - 0.5f * z + 1.0f;
+
+  // Select and negate according to the quadrant
+  if(q & 1)
   {
-    // Get the normal magnitude from the first of the three normal elements
-    magn = aIntNormals[i * 3] * scale;
-
-    // Get phi and theta (spherical coordinates, relative to the smooth normal).
-    intPhi = aIntNormals[i * 3 + 1];
-    phi = intPhi * (0.5f * PI) * scale;
-    if(intPhi == 0)
-      thetaScale = 0.0f;
-    else if(intPhi <= 4)
-      thetaScale = PI / 2.0f;
-    else
-      thetaScale = (2.0f * PI) / ((CTMfloat) intPhi);
-    theta = aIntNormals[i * 3 + 2] * thetaScale - PI;
-
-    // Convert the normal from the angular representation (phi, theta) back to
-    // cartesian coordinates
-    n2[0] = sinf(phi) * cosf(theta);
-    n2[1] = sinf(phi) * sinf(theta);
-    n2[2] = cosf(phi);
-    _ctmMakeNormalCoordSys(&smoothNormals[i * 3], basisAxes);
-    for(j = 0; j < 3; ++ j)
-      n[j] = basisAxes[j] * n2[0] +
-             basisAxes[3 + j] * n2[1] +
-             basisAxes[6 + j] * n2[2];
-
-    // Apply normal magnitude, and output to the normals array
-    for(j = 0; j < 3; ++ j)
-      self->mNormals[i * 3 + j] = n[j] * magn;
+    tmp = s;
+    s = c;
+    c = tmp;
   }
+  if(q & 2)
+    s = -s;
+  if((q + 1) & 2)
+    c = -c;
+  *aSin = (aAngle < 0.0f) ? -s : s;
+  *aCos = c;
+}
 
-  // Free temporary resources
-  free(smoothNormals);
-
-  return CTM_TRUE;
+#ifdef _CTM_USE_SSE2
+//-----------------------------------------------------------------------------
+// _ctmSinCos4() - Calculate sin and cos of four angles (SSE2 version of
+// _ctmSinCos1()).
+//-----------------------------------------------------------------------------
+static void _ctmSinCos4(const CTMfloat * aAngles, CTMfloat * aSin,
+  CTMfloat * aCos)
+{
+  __m128 signMask, a, x, y, z, s, c, swap, sinSign;
+  __m128i q, one, two;
+  int i, big;
+
+  signMask = _mm_castsi128_ps(_mm_set1_epi32((int) 0x80000000));
+  one = _mm_set1_epi32(1);
+  two = _mm_set1_epi32(2);
+  a = _mm_loadu_ps(aAngles);
+  x = _mm_andnot_ps(signMask, a);
+  big = _mm_movemask_ps(_mm_cmpnle_ps(x, _mm_set1_ps(_CTM_SINCOS_MAX)));
+
+  // Reduce the angle to [-pi/4, pi/4], and get the quadrant
+  q = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(_CTM_FOUR_OVER_PI)));
+  q = _mm_andnot_si128(one, _mm_add_epi32(q, one));
+  y = _mm_cvtepi32_ps(q);
+  x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(_CTM_PI4_A)));
+  x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(_CTM_PI4_B)));
+  x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(_CTM_PI4_C)));
+  q = _mm_srli_epi32(q, 1);
+
+  // Minimax polynomials for sin and cos in [-pi/4, pi/4]
+  z = _mm_mul_ps(x, x);
+  s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), z),
+                 _mm_set1_ps(8.3321608736e-3f));
+  s = _mm_sub_ps(_mm_mul_ps(s, z), _mm_set1_ps(1.6666654611e-1f));
+  s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, z), x), x);
+  c = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), z),
+                 _mm_set1_ps(1.388731625493765e-3f));
+  c = _mm_add_ps(_mm_mul_ps(c, z), _mm_set1_ps(4.166664568298827e-2f));
+  c = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(c, z), z),
+                 _mm_mul_ps(_mm_set1_ps(0.5f), z));
+  c = _mm_add_ps(c, _mm_set1_ps(1.0f));
+
+  // Select and negate according to the quadrant (bit 1 of the quadrant is
+  // shifted into the sign bit)
+  swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, one), one));
+  y = _mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s));
+  c = _mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c));
+  sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, two), 30));
+  sinSign = _mm_xor_ps(sinSign, _mm_and_ps(a, signMask));
+  s = _mm_xor_ps(y, sinSign);
+  c = _mm_xor_ps(c, _mm_castsi128_ps(_mm_slli_epi32(
+    _mm_and_si128(_mm_add_epi32(q, one), two), 30)));
+  _mm_storeu_ps(aSin, s);
+  _mm_storeu_ps(aCos, c);
+
+  // Huge or non-finite angles are handled by the C library
+  if(big)
+  {
+    for(i = 0; i < 4; ++ i)
+    {
+      if(big & (1 << i))
+        _ctmSinCos1(aAngles[i], &aSin[i], &aCos[i]);
+    }
+  }
 }
+#endif
 
 //-----------------------------------------------------------------------------
-// _ctmMakeUVCoordDeltas() - Calculate various forms of derivatives in order
-// to reduce data entropy.
+// _ctmSinCos() - Calculate sin and cos of an array of angles. The absolute
+// error is below 1e-7 for angles in [-2*PI, 2*PI] (the range used by the
+// normal decoder), which is far below any usable normal precision.
+// The result does not depend on where the array starts or ends, so normals
+// are restored identically regardless of how the work is split.
 //-----------------------------------------------------------------------------
-static void _ctmMakeUVCoordDeltas(_CTMcontext * self, _CTMfloatmap * aMap,
-  CTMint * aIntUVCoords, _CTMsortvertex * aSortVertices)
+static void _ctmSinCos(const CTMfloat * aAngles, CTMfloat * aSin,
+  CTMfloat * aCos, CTMuint aCount)
 {
-  CTMuint i, oldIdx;
-  CTMint u, v, prevU, prevV;
-  CTMfloat scale;
+  CTMuint i = 0;
+#ifdef _CTM_USE_SSE2
+  CTMfloat tmpAngles[4], tmpSin[4], tmpCos[4];
+  CTMuint j;
 
-  // UV coordinate scaling factor
-  scale = 1.0f / aMap->mPrecision;
+  for(; i + 4 <= aCount; i += 4)
+    _ctmSinCos4(&aAngles[i], &aSin[i], &aCos[i]);
 
-  prevU = prevV = 0;
+  // Process the remaining angles with the same code (padded with zeros)
+  if(i < aCount)
+  {
+    for(j = 0; j < 4; ++ j)
+      tmpAngles[j] = (i + j < aCount) ? aAngles[i + j] : 0.0f;
+    _ctmSinCos4(tmpAngles, tmpSin, tmpCos);
+    for(j = 0; i + j < aCount; ++ j)
+    {
+      aSin[i + j] = tmpSin[j];
+      aCos[i + j] = tmpCos[j];
+    }
+  }
+#else
+  for(; i < aCount; ++ i)
+    _ctmSinCos1(aAngles[i], &aSin[i], &aCos[i]);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _CTMrestoreargs - Arguments for the parallel normal restoration.
+//-----------------------------------------------------------------------------
+typedef struct {
+  _CTMcontext * mContext;
+  CTMint * mIntNormals;
+  CTMfloat * mSmoothNormals;
+} _CTMrestoreargs;
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreNormalsPart() - Convert a part of the normals back to cartesian
+// coordinates (range function). The normals are processed in blocks: first
+// the angles of all normals in the block are calculated, then sin & cos of
+// all angles, and finally the normals are rotated into place.
+//-----------------------------------------------------------------------------
+static void _ctmRestoreNormalsPart(void * aData, CTMuint aPart,
+  CTMuint aBegin, CTMuint aEnd)
+{
+  _CTMrestoreargs * args = (_CTMrestoreargs *) aData;
+  _CTMcontext * self = args->mContext;
+  CTMint * intNormals = args->mIntNormals;
+  CTMfloat * smoothNormals = args->mSmoothNormals;
+  CTMuint i, j, k, first, count, intPhi;
+  CTMfloat magn, scale, thetaScale;
+  CTMfloat n[3], n2[3], basisAxes[9];
+  CTMfloat phi[_CTM_NORMAL_BLOCK_SIZE], theta[_CTM_NORMAL_BLOCK_SIZE];
+  CTMfloat sinPhi[_CTM_NORMAL_BLOCK_SIZE], cosPhi[_CTM_NORMAL_BLOCK_SIZE];
+  CTMfloat sinTheta[_CTM_NORMAL_BLOCK_SIZE], cosTheta[_CTM_NORMAL_BLOCK_SIZE];
+  (void) aPart;
+
+  // Normal scaling factor
+  scale = self->mNormalPrecision;
+
+  for(first = aBegin; first < aEnd; first += count)
+  {
+    count = aEnd - first;
+    if(count > _CTM_NORMAL_BLOCK_SIZE)
+      count = _CTM_NORMAL_BLOCK_SIZE;
+
+    // Get phi and theta (spherical coordinates, relative to the smooth normal).
+    for(i = 0; i < count; ++ i)
+    {
+      k = first + i;
+      intPhi = intNormals[k * 3 + 1];
+      phi[i] = intPhi * (0.5f * PI) * scale;
+      if(intPhi == 0)
+        thetaScale = 0.0f;
+      else if(intPhi <= 4)
+        thetaScale = PI / 2.0f;
+      else
+        thetaScale = (2.0f * PI) / ((CTMfloat) intPhi);
+      theta[i] = intNormals[k * 3 + 2] * thetaScale - PI;
+    }
+    _ctmSinCos(phi, sinPhi, cosPhi, count);
+    _ctmSinCos(theta, sinTheta, cosTheta, count);
+
+    for(i = 0; i < count; ++ i)
+    {
+      k = first + i;
+
+      // Get the normal magnitude from the first of the three normal elements
+      magn = intNormals[k * 3] * scale;
+
+      // Convert the normal from the angular representation (phi, theta) back
+      // to cartesian coordinates
+      n2[0] = sinPhi[i] * cosTheta[i];
+      n2[1] = sinPhi[i] * sinTheta[i];
+      n2[2] = cosPhi[i];
+      _ctmMakeNormalCoordSys(&smoothNormals[k * 3], basisAxes);
+      for(j = 0; j < 3; ++ j)
+        n[j] = basisAxes[j] * n2[0] +
+               basisAxes[3 + j] * n2[1] +
+               basisAxes[6 + j] * n2[2];
+
+      // Apply normal magnitude, and output to the normals array
+      for(j = 0; j < 3; ++ j)
+        self->mNormals[k * 3 + j] = n[j] * magn;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreNormals() - Convert the normals back to cartesian coordinates.
+//-----------------------------------------------------------------------------
+static CTMint _ctmRestoreNormals(_CTMcontext * self, CTMint * aIntNormals)
+{
+  _CTMrestoreargs args;
+
+  // Allocate temporary memory for the nominal vertex normals
+  args.mContext = self;
+  args.mIntNormals = aIntNormals;
+  args.mSmoothNormals = (CTMfloat *) _ctmMalloc(self, 3 * sizeof(CTMfloat) * self->mVertexCount);
+  if(!args.mSmoothNormals)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+
+  // Calculate smooth normals (nominal normals)
+  if(!_ctmCalcSmoothNormals(self, self->mVertices, self->mIndices,
+                            args.mSmoothNormals))
+  {
+    _ctmFree(self, args.mSmoothNormals);
+    return CTM_FALSE;
+  }
+
+  // Convert the normals
+  _ctmParallelFor(self, self->mVertexCount,
+    _ctmParallelParts(self, self->mVertexCount, _CTM_PARALLEL_MIN_PART),
+    _ctmRestoreNormalsPart, &args);
+
+  // Free temporary resources
+  _ctmFree(self, args.mSmoothNormals);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreNormalsScalar() - Scalar reference of _ctmRestoreNormals(): one
+// normal at a time, with sin & cos from the C library.
+//-----------------------------------------------------------------------------
+static void _ctmRestoreNormalsScalar(_CTMcontext * self, CTMint * aIntNormals,
+  CTMfloat * aSmoothNormals, CTMfloat * aNormals)
+{
+  CTMuint i, j, intPhi;
+  CTMfloat magn, phi, theta, scale, thetaScale;
+  CTMfloat n[3], n2[3], basisAxes[9];
+
+  scale = self->mNormalPrecision;
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    magn = aIntNormals[i * 3] * scale;
+    intPhi = aIntNormals[i * 3 + 1];
+    phi = intPhi * (0.5f * PI) * scale;
+    if(intPhi == 0)
+      thetaScale = 0.0f;
+    else if(intPhi <= 4)
+      thetaScale = PI / 2.0f;
+    else
+      thetaScale = (2.0f * PI) / ((CTMfloat) intPhi);
+    theta = aIntNormals[i * 3 + 2] * thetaScale - PI;
+
+    n2[0] = sinf(phi) * cosf(theta);
+    n2[1] = sinf(phi) * sinf(theta);
+    n2[2] = cosf(phi);
+    _ctmMakeNormalCoordSys(&aSmoothNormals[i * 3], basisAxes);
+    for(j = 0; j < 3; ++ j)
+      n[j] = basisAxes[j] * n2[0] +
+             basisAxes[3 + j] * n2[1] +
+             basisAxes[6 + j] * n2[2];
+    for(j = 0; j < 3; ++ j)
+      aNormals[i * 3 + j] = n[j] * magn;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCheckNormalRestore() - Test hook for the normal decoder (see
+// ctmnormtest.c). The normals of the current mesh are converted to the MG2
+// integer representation (in the current vertex order), and restored both
+// with _ctmRestoreNormals() and with the scalar reference. aMaxDiff receives
+// the largest difference of any normal component. The mesh is not modified.
+//-----------------------------------------------------------------------------
+int _ctmCheckNormalRestore(_CTMcontext * self, CTMfloat * aMaxDiff)
+{
+  _CTMsortvertex * sortVertices;
+  CTMint * intNormals;
+  CTMfloat * smoothNormals, * refNormals, * normals, * meshNormals, diff;
+  CTMuint i, count;
+  int result = CTM_FALSE;
+
+  *aMaxDiff = 0.0f;
+  if(!self->mNormals)
+    return CTM_TRUE;
+
+  // Allocate temporary memory
+  count = self->mVertexCount;
+  sortVertices = (_CTMsortvertex *) _ctmMalloc(self, sizeof(_CTMsortvertex) * count);
+  intNormals = (CTMint *) _ctmMalloc(self, 3 * sizeof(CTMint) * count);
+  smoothNormals = (CTMfloat *) _ctmMalloc(self, 3 * sizeof(CTMfloat) * count);
+  refNormals = (CTMfloat *) _ctmMalloc(self, 3 * sizeof(CTMfloat) * count);
+  normals = (CTMfloat *) _ctmMalloc(self, 3 * sizeof(CTMfloat) * count);
+  if(!sortVertices || !intNormals || !smoothNormals || !refNormals || !normals)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    goto done;
+  }
+
+  // Convert the normals to integers
+  for(i = 0; i < count; ++ i)
+    sortVertices[i].mOriginalIndex = i;
+  if(!_ctmMakeNormalDeltas(self, intNormals, self->mVertices, self->mIndices,
+                           sortVertices))
+    goto done;
+
+  // Restore the normals with the scalar reference...
+  if(!_ctmCalcSmoothNormals(self, self->mVertices, self->mIndices,
+                            smoothNormals))
+    goto done;
+  _ctmRestoreNormalsScalar(self, intNormals, smoothNormals, refNormals);
+
+  // ...and with the decoder (into a temporary normal array)
+  meshNormals = self->mNormals;
+  self->mNormals = normals;
+  result = _ctmRestoreNormals(self, intNormals);
+  self->mNormals = meshNormals;
+  if(!result)
+    goto done;
+
+  // Compare (a NaN counts as a huge difference)
+  for(i = 0; i < 3 * count; ++ i)
+  {
+    diff = fabsf(normals[i] - refNormals[i]);
+    if(!(diff <= *aMaxDiff))
+      *aMaxDiff = (diff == diff) ? diff : 1e30f;
+  }
+
+done:
+  _ctmFree(self, normals);
+  _ctmFree(self, refNormals);
+  _ctmFree(self, smoothNormals);
+  _ctmFree(self, intNormals);
+  _ctmFree(self, sortVertices);
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmMakeUVCoordDeltas() - Calculate various forms of derivatives in order
+// to reduce data entropy.
+//-----------------------------------------------------------------------------
+static void _ctmMakeUVCoordDeltas(_CTMcontext * self, _CTMfloatmap * aMap,
+  CTMint * aIntUVCoords, _CTMsortvertex * aSortVertices)
+{
+  CTMuint i, oldIdx;
+  CTMint u, v, prevU, prevV;
+  CTMfloat scale;
+
+  // UV coordinate scaling factor
+  scale = 1.0f / aMap->mPrecision;
+
+  prevU = prevV = 0;
   for(i = 0; i < self->mVertexCount; ++ i)
   {
     // Get old UV coordinate index (before vertex sorting)
@@ -810,16 +1525,19 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
   CTMint * intVertices, * intNormals, * intUVCoords, * intAttribs;
   CTMfloat * restoredVertices;
   CTMuint i;
+  double start;
 
 #ifdef __DEBUG_
   printf("COMPRESSION METHOD: MG2\n");
 #endif
 
   // Setup 3D space subdivision grid
+  start = _ctmTime();
   _ctmSetupGrid(self, &grid);
+  _ctmStatsTime(&self->mStats.mGridTime, start);
 
   // Write MG2-specific header information to the stream
-  _ctmStreamWrite(self, (void *) "MG2H", 4);
+  _ctmStreamWriteTag(self, "MG2H");
   _ctmStreamWriteFLOAT(self, self->mVertexPrecision);
   _ctmStreamWriteFLOAT(self, self->mNormalPrecision);
   _ctmStreamWriteFLOAT(self, grid.mMin[0]);
@@ -832,207 +1550,168 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
   _ctmStreamWriteUINT(self, grid.mDivision[1]);
   _ctmStreamWriteUINT(self, grid.mDivision[2]);
 
+  // Note: All temporary arrays are scratch buffers of the context, which are
+  // reused between (and within) saves, so they are not freed here. The
+  // packed data functions are done with their input arrays when they
+  // return, so the same scratch buffer (_CTM_SCRATCH_DELTAS) is used for all
+  // the integer delta arrays.
+
   // Prepare (sort) vertices
-  sortVertices = (_CTMsortvertex *) malloc(sizeof(_CTMsortvertex) * self->mVertexCount);
+  if(!_ctmProgress(self, CTM_STAGE_SORT, 0.0f))
+    return CTM_FALSE;
+  sortVertices = (_CTMsortvertex *) _ctmScratch(self, _CTM_SCRATCH_SORT,
+    sizeof(_CTMsortvertex) * self->mVertexCount);
   if(!sortVertices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
+  start = _ctmTime();
+  if(!_ctmSortVertices(self, sortVertices, &grid))
+    return CTM_FALSE;
+  _ctmStatsTime(&self->mStats.mSortTime, start);
+
+  // Report the vertex order (if requested)
+  if(self->mVertexOrder)
+  {
+    for(i = 0; i < self->mVertexCount; ++ i)
+      self->mVertexOrder[i] = sortVertices[i].mOriginalIndex;
   }
-  _ctmSortVertices(self, sortVertices, &grid);
 
   // Convert vertices to integers and calculate vertex deltas (entropy-reduction)
-  intVertices = (CTMint *) malloc(sizeof(CTMint) * 3 * self->mVertexCount);
+  if(!_ctmProgress(self, CTM_STAGE_DELTAS, 0.0f))
+    return CTM_FALSE;
+  intVertices = (CTMint *) _ctmScratch(self, _CTM_SCRATCH_DELTAS,
+    sizeof(CTMint) * 3 * self->mVertexCount);
   if(!intVertices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
+  start = _ctmTime();
   _ctmMakeVertexDeltas(self, intVertices, sortVertices, &grid);
+  _ctmStatsTime(&self->mStats.mDeltaTime, start);
 
   // Write vertices
 #ifdef __DEBUG_
   printf("Vertices: ");
 #endif
-  _ctmStreamWrite(self, (void *) "VERT", 4);
+  _ctmStreamWriteTag(self, "VERT");
   if(!_ctmStreamWritePackedInts(self, intVertices, self->mVertexCount, 3, CTM_FALSE))
-  {
-    free((void *) intVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
 
   // Prepare grid indices (deltas)
-  gridIndices = (CTMuint *) malloc(sizeof(CTMuint) * self->mVertexCount);
+  gridIndices = (CTMuint *) _ctmScratch(self, _CTM_SCRATCH_INDICES,
+    sizeof(CTMuint) * self->mVertexCount);
   if(!gridIndices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) intVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
+  start = _ctmTime();
   gridIndices[0] = sortVertices[0].mGridIndex;
   for(i = 1; i < self->mVertexCount; ++ i)
     gridIndices[i] = sortVertices[i].mGridIndex - sortVertices[i - 1].mGridIndex;
+  _ctmStatsTime(&self->mStats.mDeltaTime, start);
   
   // Write grid indices
 #ifdef __DEBUG_
   printf("Grid indices: ");
 #endif
-  _ctmStreamWrite(self, (void *) "GIDX", 4);
+  _ctmStreamWriteTag(self, "GIDX");
   if(!_ctmStreamWritePackedInts(self, (CTMint *) gridIndices, self->mVertexCount, 1, CTM_FALSE))
-  {
-    free((void *) gridIndices);
-    free((void *) intVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
 
   // Calculate the result of the compressed -> decompressed vertices, in order
   // to use the same vertex data for calculating nominal normals as the
   // decompression routine (i.e. compensate for the vertex error when
   // calculating the normals)
-  restoredVertices = (CTMfloat *) malloc(sizeof(CTMfloat) * 3 * self->mVertexCount);
+  restoredVertices = (CTMfloat *) _ctmScratch(self, _CTM_SCRATCH_VERTICES,
+    sizeof(CTMfloat) * 3 * self->mVertexCount);
   if(!restoredVertices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) gridIndices);
-    free((void *) intVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
+  start = _ctmTime();
   for(i = 1; i < self->mVertexCount; ++ i)
     gridIndices[i] += gridIndices[i - 1];
   _ctmRestoreVertices(self, intVertices, gridIndices, &grid, restoredVertices);
+  _ctmStatsTime(&self->mStats.mDeltaTime, start);
 
-  // Free temporary resources
-  free((void *) gridIndices);
-  free((void *) intVertices);
-
-  // Perpare (sort) indices
-  indices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
+  // Perpare (sort) indices (the grid indices are no longer needed, so their
+  // scratch buffer is reused)
+  if(!_ctmProgress(self, CTM_STAGE_SORT, 0.0f))
+    return CTM_FALSE;
+  indices = (CTMuint *) _ctmScratch(self, _CTM_SCRATCH_INDICES,
+    sizeof(CTMuint) * self->mTriangleCount * 3);
   if(!indices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
+  start = _ctmTime();
   if(!_ctmReIndexIndices(self, sortVertices, indices))
-  {
-    free((void *) indices);
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
-  _ctmReArrangeTriangles(self, indices);
+  if(!_ctmReArrangeTriangles(self, indices))
+    return CTM_FALSE;
+  _ctmStatsTime(&self->mStats.mReIndexTime, start);
 
   // Calculate index deltas (entropy-reduction)
-  deltaIndices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
-  if(!indices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) indices);
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
+  if(!_ctmProgress(self, CTM_STAGE_DELTAS, 0.0f))
     return CTM_FALSE;
-  }
+  deltaIndices = (CTMuint *) _ctmScratch(self, _CTM_SCRATCH_DELTAS,
+    sizeof(CTMuint) * self->mTriangleCount * 3);
+  if(!deltaIndices)
+    return CTM_FALSE;
+  start = _ctmTime();
   for(i = 0; i < self->mTriangleCount * 3; ++ i)
     deltaIndices[i] = indices[i];
   _ctmMakeIndexDeltas(self, deltaIndices);
+  _ctmStatsTime(&self->mStats.mDeltaTime, start);
 
   // Write triangle indices
 #ifdef __DEBUG_
   printf("Indices: ");
 #endif
-  _ctmStreamWrite(self, (void *) "INDX", 4);
+  _ctmStreamWriteTag(self, "INDX");
   if(!_ctmStreamWritePackedInts(self, (CTMint *) deltaIndices, self->mTriangleCount, 3, CTM_FALSE))
-  {
-    free((void *) deltaIndices);
-    free((void *) indices);
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
-  }
-
-  // Free temporary data for the indices
-  free((void *) deltaIndices);
 
   if(self->mNormals)
   {
     // Convert normals to integers and calculate deltas (entropy-reduction)
-    intNormals = (CTMint *) malloc(sizeof(CTMint) * 3 * self->mVertexCount);
+    if(!_ctmProgress(self, CTM_STAGE_DELTAS, 0.0f))
+      return CTM_FALSE;
+    intNormals = (CTMint *) _ctmScratch(self, _CTM_SCRATCH_DELTAS,
+      sizeof(CTMint) * 3 * self->mVertexCount);
     if(!intNormals)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      free((void *) indices);
-      free((void *) restoredVertices);
-      free((void *) sortVertices);
       return CTM_FALSE;
-    }
+    start = _ctmTime();
     if(!_ctmMakeNormalDeltas(self, intNormals, restoredVertices, indices, sortVertices))
-    {
-      free((void *) indices);
-      free((void *) intNormals);
-      free((void *) restoredVertices);
-      free((void *) sortVertices);
       return CTM_FALSE;
-    }
+    _ctmStatsTime(&self->mStats.mDeltaTime, start);
 
     // Write normals
 #ifdef __DEBUG_
     printf("Normals: ");
 #endif
-    _ctmStreamWrite(self, (void *) "NORM", 4);
+    _ctmStreamWriteTag(self, "NORM");
     if(!_ctmStreamWritePackedInts(self, intNormals, self->mVertexCount, 3, CTM_FALSE))
-    {
-      free((void *) indices);
-      free((void *) intNormals);
-      free((void *) restoredVertices);
-      free((void *) sortVertices);
       return CTM_FALSE;
-    }
-
-    // Free temporary normal data
-    free((void *) intNormals);
   }
 
-  // Free restored indices and vertices
-  free((void *) indices);
-  free((void *) restoredVertices);
-
   // Write UV maps
   map = self->mUVMaps;
   while(map)
   {
     // Convert UV coordinates to integers and calculate deltas (entropy-reduction)
-    intUVCoords = (CTMint *) malloc(sizeof(CTMint) * 2 * self->mVertexCount);
+    if(!_ctmProgress(self, CTM_STAGE_DELTAS, 0.0f))
+      return CTM_FALSE;
+    intUVCoords = (CTMint *) _ctmScratch(self, _CTM_SCRATCH_DELTAS,
+      sizeof(CTMint) * 2 * self->mVertexCount);
     if(!intUVCoords)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      free((void *) sortVertices);
       return CTM_FALSE;
-    }
+    start = _ctmTime();
     _ctmMakeUVCoordDeltas(self, map, intUVCoords, sortVertices);
+    _ctmStatsTime(&self->mStats.mDeltaTime, start);
 
     // Write UV coordinates
 #ifdef __DEBUG_
     printf("Texture coordinates (%s): ", map->mName ? map->mName : "no name");
 #endif
-    _ctmStreamWrite(self, (void *) "TEXC", 4);
+    _ctmStreamWriteTag(self, "TEXC");
+    self->mBlockCodec = map->mCodec;
     _ctmStreamWriteSTRING(self, map->mName);
     _ctmStreamWriteSTRING(self, map->mFileName);
     _ctmStreamWriteFLOAT(self, map->mPrecision);
     if(!_ctmStreamWritePackedInts(self, intUVCoords, self->mVertexCount, 2, CTM_TRUE))
-    {
-      free((void *) intUVCoords);
-      free((void *) sortVertices);
       return CTM_FALSE;
-    }
-
-    // Free temporary UV coordinate data
-    free((void *) intUVCoords);
 
     map = map->mNext;
   }
@@ -1042,54 +1721,43 @@ int _ctmCompressMesh_MG2(_CTMcontext * self)
   while(map)
   {
     // Convert vertex attributes to integers and calculate deltas (entropy-reduction)
-    intAttribs = (CTMint *) malloc(sizeof(CTMint) * 4 * self->mVertexCount);
+    if(!_ctmProgress(self, CTM_STAGE_DELTAS, 0.0f))
+      return CTM_FALSE;
+    intAttribs = (CTMint *) _ctmScratch(self, _CTM_SCRATCH_DELTAS,
+      sizeof(CTMint) * 4 * self->mVertexCount);
     if(!intAttribs)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      free((void *) sortVertices);
       return CTM_FALSE;
-    }
+    start = _ctmTime();
     _ctmMakeAttribDeltas(self, map, intAttribs, sortVertices);
+    _ctmStatsTime(&self->mStats.mDeltaTime, start);
 
     // Write vertex attributes
 #ifdef __DEBUG_
     printf("Vertex attributes (%s): ", map->mName ? map->mName : "no name");
 #endif
-    _ctmStreamWrite(self, (void *) "ATTR", 4);
+    _ctmStreamWriteTag(self, "ATTR");
+    self->mBlockCodec = map->mCodec;
     _ctmStreamWriteSTRING(self, map->mName);
     _ctmStreamWriteFLOAT(self, map->mPrecision);
     if(!_ctmStreamWritePackedInts(self, intAttribs, self->mVertexCount, 4, CTM_TRUE))
-    {
-      free((void *) intAttribs);
-      free((void *) sortVertices);
       return CTM_FALSE;
-    }
-
-    // Free temporary vertex attribute data
-    free((void *) intAttribs);
 
     map = map->mNext;
   }
 
-  // Free temporary data
-  free((void *) sortVertices);
-
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmUncompressMesh_MG2() - Uncmpress the mesh from the input stream in the
-// CTM context, and store the resulting mesh in the CTM context.
+// _ctmReadGrid_MG2() - Read the MG2 header (the precision settings and the
+// 3D space subdivision grid) from the input stream.
 //-----------------------------------------------------------------------------
-int _ctmUncompressMesh_MG2(_CTMcontext * self)
+static int _ctmReadGrid_MG2(_CTMcontext * self, _CTMgrid * aGrid)
 {
-  CTMuint * gridIndices, i;
-  CTMint * intVertices, * intNormals, * intUVCoords, * intAttribs;
-  _CTMfloatmap * map;
-  _CTMgrid grid;
+  CTMuint i;
 
   // Read MG2-specific header information from the stream
-  if(_ctmStreamReadUINT(self) != FOURCC("MG2H"))
+  if(_ctmStreamReadTag(self) != FOURCC("MG2H"))
   {
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
@@ -1106,150 +1774,376 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
-  grid.mMin[0] = _ctmStreamReadFLOAT(self);
-  grid.mMin[1] = _ctmStreamReadFLOAT(self);
-  grid.mMin[2] = _ctmStreamReadFLOAT(self);
-  grid.mMax[0] = _ctmStreamReadFLOAT(self);
-  grid.mMax[1] = _ctmStreamReadFLOAT(self);
-  grid.mMax[2] = _ctmStreamReadFLOAT(self);
-  if((grid.mMax[0] < grid.mMin[0]) ||
-     (grid.mMax[1] < grid.mMin[1]) ||
-     (grid.mMax[2] < grid.mMin[2]))
+  aGrid->mMin[0] = _ctmStreamReadFLOAT(self);
+  aGrid->mMin[1] = _ctmStreamReadFLOAT(self);
+  aGrid->mMin[2] = _ctmStreamReadFLOAT(self);
+  aGrid->mMax[0] = _ctmStreamReadFLOAT(self);
+  aGrid->mMax[1] = _ctmStreamReadFLOAT(self);
+  aGrid->mMax[2] = _ctmStreamReadFLOAT(self);
+  if((aGrid->mMax[0] < aGrid->mMin[0]) ||
+     (aGrid->mMax[1] < aGrid->mMin[1]) ||
+     (aGrid->mMax[2] < aGrid->mMin[2]))
   {
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
-  grid.mDivision[0] = _ctmStreamReadUINT(self);
-  grid.mDivision[1] = _ctmStreamReadUINT(self);
-  grid.mDivision[2] = _ctmStreamReadUINT(self);
-  if((grid.mDivision[0] < 1) || (grid.mDivision[1] < 1) || (grid.mDivision[2] < 1))
+  aGrid->mDivision[0] = _ctmStreamReadUINT(self);
+  aGrid->mDivision[1] = _ctmStreamReadUINT(self);
+  aGrid->mDivision[2] = _ctmStreamReadUINT(self);
+  if((aGrid->mDivision[0] < 1) || (aGrid->mDivision[1] < 1) || (aGrid->mDivision[2] < 1))
   {
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
 
+  // The grid bounds are the bounding box of the mesh
+  for(i = 0; i < 3; ++ i)
+  {
+    self->mBoundingBox[i] = aGrid->mMin[i];
+    self->mBoundingBox[i + 3] = aGrid->mMax[i];
+  }
+  self->mHasBoundingBox = CTM_TRUE;
+
   // Initialize 3D space subdivision grid
   for(i = 0; i < 3; ++ i)
-    grid.mSize[i] = (grid.mMax[i] - grid.mMin[i]) / grid.mDivision[i];
+    aGrid->mSize[i] = (aGrid->mMax[i] - aGrid->mMin[i]) / aGrid->mDivision[i];
+
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadBlocks_MG2() - Read all the packed data blocks (that follow the MG2
+// header) from the input stream. The UV coordinate and attribute arrays hold
+// the data for all loaded maps, one after another. Blocks of arrays that were
+// not selected for loading are skipped without uncompressing them.
+//-----------------------------------------------------------------------------
+static int _ctmReadBlocks_MG2(_CTMcontext * self, CTMint * aIntVertices,
+  CTMuint * aGridIndices, CTMint * aIntNormals, CTMint * aIntUVCoords,
+  CTMint * aIntAttribs)
+{
+  _CTMfloatmap * map;
 
   // Read vertices
-  if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
+  if(_ctmStreamReadTag(self) != FOURCC("VERT"))
   {
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
-  intVertices = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 3);
-  if(!intVertices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
+  if(!_ctmStreamReadPackedInts(self, aIntVertices, self->mVertexCount, 3, CTM_FALSE))
     return CTM_FALSE;
-  }
-  if(!_ctmStreamReadPackedInts(self, intVertices, self->mVertexCount, 3, CTM_FALSE))
+
+  // Read grid indices
+  if(_ctmStreamReadTag(self) != FOURCC("GIDX"))
   {
-    free((void *) intVertices);
+    self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
+  if(!_ctmStreamReadPackedInts(self, (CTMint *) aGridIndices, self->mVertexCount, 1, CTM_FALSE))
+    return CTM_FALSE;
 
-  // Read grid indices
-  if(_ctmStreamReadUINT(self) != FOURCC("GIDX"))
+  // Read triangle indices
+  if(_ctmStreamReadTag(self) != FOURCC("INDX"))
   {
-    free((void *) intVertices);
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
-  gridIndices = (CTMuint *) malloc(sizeof(CTMuint) * self->mVertexCount);
-  if(!gridIndices)
+  if(!_ctmStreamReadPackedInts(self, (CTMint *) self->mIndices, self->mTriangleCount, 3, CTM_FALSE))
+    return CTM_FALSE;
+
+  // Read normals
+  if(self->mFileHasNormals)
+  {
+    if(_ctmStreamReadTag(self) != FOURCC("NORM"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(self->mNormals ?
+       !_ctmStreamReadPackedInts(self, aIntNormals, self->mVertexCount, 3, CTM_FALSE) :
+       !_ctmStreamSkipPacked(self, self->mVertexCount, 3))
+      return CTM_FALSE;
+  }
+
+  // Read UV maps
+  map = self->mUVMaps;
+  while(map)
+  {
+    if(_ctmStreamReadTag(self) != FOURCC("TEXC"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    _ctmStreamReadSTRING(self, &map->mName);
+    _ctmStreamReadSTRING(self, &map->mFileName);
+    map->mPrecision = _ctmStreamReadFLOAT(self);
+    if(map->mPrecision <= 0.0f)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(!map->mValues)
+    {
+      if(!_ctmStreamSkipPacked(self, self->mVertexCount, 2))
+        return CTM_FALSE;
+    }
+    else
+    {
+      if(!_ctmStreamReadPackedInts(self, aIntUVCoords, self->mVertexCount, 2, CTM_TRUE))
+        return CTM_FALSE;
+      aIntUVCoords += (size_t) self->mVertexCount * 2;
+    }
+    map = map->mNext;
+  }
+
+  // Read vertex attribute maps
+  map = self->mAttribMaps;
+  while(map)
+  {
+    if(_ctmStreamReadTag(self) != FOURCC("ATTR"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    _ctmStreamReadSTRING(self, &map->mName);
+    map->mPrecision = _ctmStreamReadFLOAT(self);
+    if(map->mPrecision <= 0.0f)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(!map->mValues)
+    {
+      if(!_ctmStreamSkipPacked(self, self->mVertexCount, 4))
+        return CTM_FALSE;
+    }
+    else
+    {
+      if(!_ctmStreamReadPackedInts(self, aIntAttribs, self->mVertexCount, 4, CTM_TRUE))
+        return CTM_FALSE;
+      aIntAttribs += (size_t) self->mVertexCount * 4;
+    }
+    map = map->mNext;
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmUncompressMesh_MG2() - Uncmpress the mesh from the input stream in the
+// CTM context, and store the resulting mesh in the CTM context.
+//-----------------------------------------------------------------------------
+int _ctmUncompressMesh_MG2(_CTMcontext * self)
+{
+  CTMuint * gridIndices, i, uvMapCount, attribMapCount;
+  CTMint * work, * intVertices, * intNormals, * intUVCoords, * intAttribs;
+  CTMint * mapValues;
+  size_t workSize;
+  _CTMfloatmap * map;
+  _CTMgrid grid;
+  double start;
+
+  // Read MG2-specific header information from the stream
+  if(!_ctmReadGrid_MG2(self, &grid))
+    return CTM_FALSE;
+
+  // Count the UV and attribute maps that are loaded (the others are skipped)
+  uvMapCount = 0;
+  for(map = self->mUVMaps; map; map = map->mNext)
+    if(map->mValues)
+      ++ uvMapCount;
+  attribMapCount = 0;
+  for(map = self->mAttribMaps; map; map = map->mNext)
+    if(map->mValues)
+      ++ attribMapCount;
+
+  // Allocate one temporary buffer for all the integer arrays that are read
+  // from the stream (vertices, grid indices, normals, UV maps and attributes)
+  workSize = 4 + (self->mNormals ? 3 : 0) + 2 * (size_t) uvMapCount +
+             4 * (size_t) attribMapCount;
+  if(workSize > ((size_t) -1) / sizeof(CTMint) / self->mVertexCount)
+    work = (CTMint *) 0;
+  else
+    work = (CTMint *) _ctmMalloc(self, sizeof(CTMint) * self->mVertexCount * workSize);
+  if(!work)
   {
     self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) intVertices);
     return CTM_FALSE;
   }
-  if(!_ctmStreamReadPackedInts(self, (CTMint *) gridIndices, self->mVertexCount, 1, CTM_FALSE))
+  intVertices = work;
+  gridIndices = (CTMuint *) &work[(size_t) self->mVertexCount * 3];
+  intNormals = &work[(size_t) self->mVertexCount * 4];
+  intUVCoords = &work[(size_t) self->mVertexCount * (self->mNormals ? 7 : 4)];
+  intAttribs = &intUVCoords[(size_t) self->mVertexCount * 2 * uvMapCount];
+
+  // Read all the packed blocks from the stream. Note: If the context has a
+  // thread pool, the blocks are uncompressed concurrently in the background,
+  // so we must wait for a block before using its data.
+  if(!_ctmReadBlocks_MG2(self, intVertices, gridIndices, intNormals,
+                         intUVCoords, intAttribs))
   {
-    free((void *) gridIndices);
-    free((void *) intVertices);
+    _ctmStreamReadDiscard(self);
+    _ctmFree(self, (void *) work);
     return CTM_FALSE;
   }
 
   // Restore grid indices (deltas)
+  if(!_ctmStreamReadWait(self, gridIndices))
+  {
+    _ctmFree(self, (void *) work);
+    return CTM_FALSE;
+  }
+  start = _ctmTime();
   for(i = 1; i < self->mVertexCount; ++ i)
     gridIndices[i] += gridIndices[i - 1];
 
   // Restore vertices
   _ctmRestoreVertices(self, intVertices, gridIndices, &grid, self->mVertices);
+  _ctmStatsTime(&self->mStats.mDeltaTime, start);
 
-  // Free temporary resources
-  free((void *) gridIndices);
-  free((void *) intVertices);
-
-  // Read triangle indices
-  if(_ctmStreamReadUINT(self) != FOURCC("INDX"))
+  // Restore indices
+  if(!_ctmStreamReadWait(self, self->mIndices))
   {
-    self->mError = CTM_BAD_FORMAT;
+    _ctmFree(self, (void *) work);
     return CTM_FALSE;
   }
-  if(!_ctmStreamReadPackedInts(self, (CTMint *) self->mIndices, self->mTriangleCount, 3, CTM_FALSE))
-    return CTM_FALSE;
-
-  // Restore indices
+  start = _ctmTime();
   _ctmRestoreIndices(self, self->mIndices);
+  _ctmStatsTime(&self->mStats.mDeltaTime, start);
 
   // Check that all indices are within range
   for(i = 0; i < (self->mTriangleCount * 3); ++ i)
   {
     if(self->mIndices[i] >= self->mVertexCount)
     {
+      _ctmStreamReadDiscard(self);
+      _ctmFree(self, (void *) work);
       self->mError = CTM_INVALID_MESH;
       return CTM_FALSE;
     }
   }
 
-  // Read normals
+  // Restore normals (needs the restored vertices and indices). Skipped normals
+  // also skip the smooth normal pass that the restore is based on.
   if(self->mNormals)
   {
-    intNormals = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 3);
-    if(!intNormals)
+    if(!_ctmStreamReadWait(self, intNormals))
     {
-      self->mError = CTM_OUT_OF_MEMORY;
+      _ctmFree(self, (void *) work);
       return CTM_FALSE;
     }
-    if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
+    start = _ctmTime();
+    if(!_ctmRestoreNormals(self, intNormals))
     {
-      self->mError = CTM_BAD_FORMAT;
-      free((void *) intNormals);
+      _ctmStreamReadDiscard(self);
+      _ctmFree(self, (void *) work);
       return CTM_FALSE;
     }
-    if(!_ctmStreamReadPackedInts(self, intNormals, self->mVertexCount, 3, CTM_FALSE))
+    _ctmStatsTime(&self->mStats.mDeltaTime, start);
+  }
+
+  // Restore UV coordinates
+  map = self->mUVMaps;
+  mapValues = intUVCoords;
+  while(map)
+  {
+    if(map->mValues)
     {
-      free((void *) intNormals);
-      return CTM_FALSE;
+      if(!_ctmStreamReadWait(self, mapValues))
+      {
+        _ctmFree(self, (void *) work);
+        return CTM_FALSE;
+      }
+      start = _ctmTime();
+      _ctmRestoreUVCoords(self, map, mapValues);
+      _ctmStatsTime(&self->mStats.mDeltaTime, start);
+      mapValues += (size_t) self->mVertexCount * 2;
     }
+    map = map->mNext;
+  }
 
-    // Restore normals
-    if(!_ctmRestoreNormals(self, intNormals))
+  // Restore vertex attributes
+  map = self->mAttribMaps;
+  mapValues = intAttribs;
+  while(map)
+  {
+    if(map->mValues)
     {
-      free((void *) intNormals);
-      return CTM_FALSE;
+      if(!_ctmStreamReadWait(self, mapValues))
+      {
+        _ctmFree(self, (void *) work);
+        return CTM_FALSE;
+      }
+      start = _ctmTime();
+      _ctmRestoreAttribs(self, map, mapValues);
+      _ctmStatsTime(&self->mStats.mDeltaTime, start);
+      mapValues += (size_t) self->mVertexCount * 4;
     }
+    map = map->mNext;
+  }
+
+  // Free temporary resources
+  _ctmFree(self, (void *) work);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadHeader_MG2() - Read the MG2 header and the UV and attribute map
+// information of an MG2 mesh from the input stream, skipping all the packed
+// data blocks (used when only the header of a file is loaded).
+//-----------------------------------------------------------------------------
+int _ctmReadHeader_MG2(_CTMcontext * self)
+{
+  _CTMfloatmap * map;
+  _CTMgrid grid;
+
+  // Read MG2-specific header information from the stream
+  if(!_ctmReadGrid_MG2(self, &grid))
+    return CTM_FALSE;
 
-    // Free temporary normals data
-    free((void *) intNormals);
+  // Skip vertices, grid indices and triangle indices
+  if(_ctmStreamReadTag(self) != FOURCC("VERT"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  if(!_ctmStreamSkipPacked(self, self->mVertexCount, 3))
+    return CTM_FALSE;
+  if(_ctmStreamReadTag(self) != FOURCC("GIDX"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  if(!_ctmStreamSkipPacked(self, self->mVertexCount, 1))
+    return CTM_FALSE;
+  if(_ctmStreamReadTag(self) != FOURCC("INDX"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
   }
+  if(!_ctmStreamSkipPacked(self, self->mTriangleCount, 3))
+    return CTM_FALSE;
 
-  // Read UV maps
-  map = self->mUVMaps;
-  while(map)
+  // Skip normals
+  if(self->mFileHasNormals)
   {
-    intUVCoords = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 2);
-    if(!intUVCoords)
+    if(_ctmStreamReadTag(self) != FOURCC("NORM"))
     {
-      self->mError = CTM_OUT_OF_MEMORY;
+      self->mError = CTM_BAD_FORMAT;
       return CTM_FALSE;
     }
-    if(_ctmStreamReadUINT(self) != FOURCC("TEXC"))
+    if(!_ctmStreamSkipPacked(self, self->mVertexCount, 3))
+      return CTM_FALSE;
+  }
+
+  // Read UV map names and precisions
+  map = self->mUVMaps;
+  while(map)
+  {
+    if(_ctmStreamReadTag(self) != FOURCC("TEXC"))
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intUVCoords);
       return CTM_FALSE;
     }
     _ctmStreamReadSTRING(self, &map->mName);
@@ -1258,38 +2152,20 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     if(map->mPrecision <= 0.0f)
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intUVCoords);
       return CTM_FALSE;
     }
-    if(!_ctmStreamReadPackedInts(self, intUVCoords, self->mVertexCount, 2, CTM_TRUE))
-    {
-      free((void *) intUVCoords);
+    if(!_ctmStreamSkipPacked(self, self->mVertexCount, 2))
       return CTM_FALSE;
-    }
-
-    // Restore UV coordinates
-    _ctmRestoreUVCoords(self, map, intUVCoords);
-
-    // Free temporary UV coordinate data
-    free((void *) intUVCoords);
-
     map = map->mNext;
   }
 
-  // Read vertex attribute maps
+  // Read vertex attribute map names and precisions
   map = self->mAttribMaps;
   while(map)
   {
-    intAttribs = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 4);
-    if(!intAttribs)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      return CTM_FALSE;
-    }
-    if(_ctmStreamReadUINT(self) != FOURCC("ATTR"))
+    if(_ctmStreamReadTag(self) != FOURCC("ATTR"))
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intAttribs);
       return CTM_FALSE;
     }
     _ctmStreamReadSTRING(self, &map->mName);
@@ -1297,21 +2173,10 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     if(map->mPrecision <= 0.0f)
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intAttribs);
       return CTM_FALSE;
     }
-    if(!_ctmStreamReadPackedInts(self, intAttribs, self->mVertexCount, 4, CTM_TRUE))
-    {
-      free((void *) intAttribs);
+    if(!_ctmStreamSkipPacked(self, self->mVertexCount, 4))
       return CTM_FALSE;
-    }
-
-    // Restore vertex attributes
-    _ctmRestoreAttribs(self, map, intAttribs);
-
-    // Free temporary vertex attribute data
-    free((void *) intAttribs);
-
     map = map->mNext;
   }
 
@@ -40,7 +40,6 @@
 //-----------------------------------------------------------------------------
 int _ctmCompressMesh_RAW(_CTMcontext * self)
 {
-  CTMuint i;
   _CTMfloatmap * map;
 
 #ifdef __DEBUG_
@@ -51,17 +50,19 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
 #ifdef __DEBUG_
   printf("Inidices: %d bytes\n", (CTMuint)(self->mTriangleCount * 3 * sizeof(CTMuint)));
 #endif
-  _ctmStreamWrite(self, (void *) "INDX", 4);
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    _ctmStreamWriteUINT(self, self->mIndices[i]);
+  _ctmStreamWriteTag(self, "INDX");
+  _ctmStreamWriteUINTArray(self, self->mIndices, self->mTriangleCount * 3);
+  if(!_ctmProgress(self, CTM_STAGE_PACK, 1.0f))
+    return 0;
 
   // Write vertices
 #ifdef __DEBUG_
   printf("Vertices: %d bytes\n", (CTMuint)(self->mVertexCount * 3 * sizeof(CTMfloat)));
 #endif
-  _ctmStreamWrite(self, (void *) "VERT", 4);
-  for(i = 0; i < self->mVertexCount * 3; ++ i)
-    _ctmStreamWriteFLOAT(self, self->mVertices[i]);
+  _ctmStreamWriteTag(self, "VERT");
+  _ctmStreamWriteFLOATArray(self, self->mVertices, self->mVertexCount * 3);
+  if(!_ctmProgress(self, CTM_STAGE_PACK, 1.0f))
+    return 0;
 
   // Write normals
   if(self->mNormals)
@@ -69,9 +70,10 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
 #ifdef __DEBUG_
     printf("Normals: %d bytes\n", (CTMuint)(self->mVertexCount * 3 * sizeof(CTMfloat)));
 #endif
-    _ctmStreamWrite(self, (void *) "NORM", 4);
-    for(i = 0; i < self->mVertexCount * 3; ++ i)
-      _ctmStreamWriteFLOAT(self, self->mNormals[i]);
+    _ctmStreamWriteTag(self, "NORM");
+    _ctmStreamWriteFLOATArray(self, self->mNormals, self->mVertexCount * 3);
+    if(!_ctmProgress(self, CTM_STAGE_PACK, 1.0f))
+      return 0;
   }
 
   // Write UV maps
@@ -81,11 +83,12 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
 #ifdef __DEBUG_
     printf("UV coordinates (%s): %d bytes\n", map->mName ? map->mName : "no name", (CTMuint)(self->mVertexCount * 2 * sizeof(CTMfloat)));
 #endif
-    _ctmStreamWrite(self, (void *) "TEXC", 4);
+    _ctmStreamWriteTag(self, "TEXC");
     _ctmStreamWriteSTRING(self, map->mName);
     _ctmStreamWriteSTRING(self, map->mFileName);
-    for(i = 0; i < self->mVertexCount * 2; ++ i)
-      _ctmStreamWriteFLOAT(self, map->mValues[i]);
+    _ctmStreamWriteFLOATArray(self, map->mValues, self->mVertexCount * 2);
+    if(!_ctmProgress(self, CTM_STAGE_PACK, 1.0f))
+      return 0;
     map = map->mNext;
   }
 
@@ -96,10 +99,11 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
 #ifdef __DEBUG_
     printf("Vertex attributes (%s): %d bytes\n", map->mName ? map->mName : "no name", (CTMuint)(self->mVertexCount * 4 * sizeof(CTMfloat)));
 #endif
-    _ctmStreamWrite(self, (void *) "ATTR", 4);
+    _ctmStreamWriteTag(self, "ATTR");
     _ctmStreamWriteSTRING(self, map->mName);
-    for(i = 0; i < self->mVertexCount * 4; ++ i)
-      _ctmStreamWriteFLOAT(self, map->mValues[i]);
+    _ctmStreamWriteFLOATArray(self, map->mValues, self->mVertexCount * 4);
+    if(!_ctmProgress(self, CTM_STAGE_PACK, 1.0f))
+      return 0;
     map = map->mNext;
   }
 
@@ -113,52 +117,67 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
 //-----------------------------------------------------------------------------
 int _ctmUncompressMesh_RAW(_CTMcontext * self)
 {
-  CTMuint i;
   _CTMfloatmap * map;
 
   // Read triangle indices
-  if(_ctmStreamReadUINT(self) != FOURCC("INDX"))
+  if(_ctmStreamReadTag(self) != FOURCC("INDX"))
   {
     self->mError = CTM_BAD_FORMAT;
     return 0;
   }
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    self->mIndices[i] = _ctmStreamReadUINT(self);
+  _ctmStreamReadUINTArray(self, self->mIndices, self->mTriangleCount * 3);
+  if(!_ctmProgress(self, CTM_STAGE_UNPACK, 1.0f))
+    return 0;
 
   // Read vertices
-  if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
+  if(_ctmStreamReadTag(self) != FOURCC("VERT"))
   {
     self->mError = CTM_BAD_FORMAT;
     return 0;
   }
-  for(i = 0; i < self->mVertexCount * 3; ++ i)
-    self->mVertices[i] = _ctmStreamReadFLOAT(self);
+  _ctmStreamReadFLOATArray(self, self->mVertices, self->mVertexCount * 3);
+  if(!_ctmProgress(self, CTM_STAGE_UNPACK, 1.0f))
+    return 0;
 
-  // Read normals
-  if(self->mNormals)
+  // Read normals (or skip them, if they were not selected for loading)
+  if(self->mFileHasNormals)
   {
-    if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
+    if(_ctmStreamReadTag(self) != FOURCC("NORM"))
     {
       self->mError = CTM_BAD_FORMAT;
       return 0;
     }
-    for(i = 0; i < self->mVertexCount * 3; ++ i)
-      self->mNormals[i] = _ctmStreamReadFLOAT(self);
+    if(self->mNormals)
+      _ctmStreamReadFLOATArray(self, self->mNormals, self->mVertexCount * 3);
+    else if(!_ctmStreamSkip(self, (size_t) self->mVertexCount * 3 * 4))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return 0;
+    }
+    if(!_ctmProgress(self, CTM_STAGE_UNPACK, 1.0f))
+      return 0;
   }
 
-  // Read UV maps
+  // Read UV maps (skipped maps have no value array)
   map = self->mUVMaps;
   while(map)
   {
-    if(_ctmStreamReadUINT(self) != FOURCC("TEXC"))
+    if(_ctmStreamReadTag(self) != FOURCC("TEXC"))
     {
       self->mError = CTM_BAD_FORMAT;
       return 0;
     }
     _ctmStreamReadSTRING(self, &map->mName);
     _ctmStreamReadSTRING(self, &map->mFileName);
-    for(i = 0; i < self->mVertexCount * 2; ++ i)
-      map->mValues[i] = _ctmStreamReadFLOAT(self);
+    if(map->mValues)
+      _ctmStreamReadFLOATArray(self, map->mValues, self->mVertexCount * 2);
+    else if(!_ctmStreamSkip(self, (size_t) self->mVertexCount * 2 * 4))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return 0;
+    }
+    if(!_ctmProgress(self, CTM_STAGE_UNPACK, 1.0f))
+      return 0;
     map = map->mNext;
   }
 
@@ -166,14 +185,91 @@ int _ctmUncompressMesh_RAW(_CTMcontext * self)
   map = self->mAttribMaps;
   while(map)
   {
-    if(_ctmStreamReadUINT(self) != FOURCC("ATTR"))
+    if(_ctmStreamReadTag(self) != FOURCC("ATTR"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return 0;
+    }
+    _ctmStreamReadSTRING(self, &map->mName);
+    if(map->mValues)
+      _ctmStreamReadFLOATArray(self, map->mValues, self->mVertexCount * 4);
+    else if(!_ctmStreamSkip(self, (size_t) self->mVertexCount * 4 * 4))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return 0;
+    }
+    if(!_ctmProgress(self, CTM_STAGE_UNPACK, 1.0f))
+      return 0;
+    map = map->mNext;
+  }
+
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadHeader_RAW() - Read the UV and attribute map information of a RAW
+// mesh from the input stream, skipping all the vertex data (used when only
+// the header of a file is loaded).
+//-----------------------------------------------------------------------------
+int _ctmReadHeader_RAW(_CTMcontext * self)
+{
+  _CTMfloatmap * map;
+
+  // Skip triangle indices and vertices
+  if((_ctmStreamReadTag(self) != FOURCC("INDX")) ||
+     !_ctmStreamSkip(self, (size_t) self->mTriangleCount * 3 * 4) ||
+     (_ctmStreamReadTag(self) != FOURCC("VERT")) ||
+     !_ctmStreamSkip(self, (size_t) self->mVertexCount * 3 * 4))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return 0;
+  }
+
+  // Skip normals
+  if(self->mFileHasNormals)
+  {
+    if((_ctmStreamReadTag(self) != FOURCC("NORM")) ||
+       !_ctmStreamSkip(self, (size_t) self->mVertexCount * 3 * 4))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return 0;
+    }
+  }
+
+  // Read UV map names
+  map = self->mUVMaps;
+  while(map)
+  {
+    if(_ctmStreamReadTag(self) != FOURCC("TEXC"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return 0;
+    }
+    _ctmStreamReadSTRING(self, &map->mName);
+    _ctmStreamReadSTRING(self, &map->mFileName);
+    if(!_ctmStreamSkip(self, (size_t) self->mVertexCount * 2 * 4))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return 0;
+    }
+    map = map->mNext;
+  }
+
+  // Read attribute map names
+  map = self->mAttribMaps;
+  while(map)
+  {
+    if(_ctmStreamReadTag(self) != FOURCC("ATTR"))
     {
       self->mError = CTM_BAD_FORMAT;
       return 0;
     }
     _ctmStreamReadSTRING(self, &map->mName);
-    for(i = 0; i < self->mVertexCount * 4; ++ i)
-      map->mValues[i] = _ctmStreamReadFLOAT(self);
+    if(!_ctmStreamSkip(self, (size_t) self->mVertexCount * 4 * 4))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return 0;
+    }
     map = map->mNext;
   }
 
@@ -0,0 +1,226 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        ctmnormtest.c
+// Description: Test of the MG2 normal decoder. The normals of a mesh are
+//              converted to the MG2 integer representation, and restored both
+//              with the (batched) decoder and with a scalar reference that
+//              uses the C library sin & cos (see _ctmCheckNormalRestore()).
+//              The test fails if any normal differs by more than the normal
+//              precision. Without arguments, a set of generated meshes is
+//              tested at a few normal precisions. Otherwise the given OpenCTM
+//              files are tested, at the normal precision of each file.
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "openctm.h"
+#include "internal.h"
+
+// Size of the generated meshes (rows x columns of vertices)
+#define TEST_ROWS 200
+#define TEST_COLUMNS 300
+
+
+//-----------------------------------------------------------------------------
+// CheckContext() - Run the normal decoder check on the mesh of a context, and
+// report the result. Returns 0 if the check passed, and 1 otherwise.
+//-----------------------------------------------------------------------------
+static int CheckContext(CTMcontext aContext, const char * aName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  CTMfloat maxDiff;
+  int failed;
+
+  if(!self->mNormals)
+  {
+    printf("%s: No normals, skipped\n", aName);
+    return 0;
+  }
+  if(!_ctmCheckNormalRestore(self, &maxDiff))
+  {
+    printf("%s: Normal restoration failed (%s)\n", aName,
+      ctmErrorString(ctmGetError(aContext)));
+    return 1;
+  }
+  failed = (maxDiff <= self->mNormalPrecision) ? 0 : 1;
+  printf("%s: %u normals, precision %g, max difference %g - %s\n", aName,
+    self->mVertexCount, self->mNormalPrecision, maxDiff,
+    failed ? "FAILED" : "OK");
+  return failed;
+}
+
+//-----------------------------------------------------------------------------
+// CheckFile() - Check the normal decoder on the mesh of an OpenCTM file.
+//-----------------------------------------------------------------------------
+static int CheckFile(const char * aFileName)
+{
+  CTMcontext ctm;
+  CTMenum err;
+  int failed = 1;
+
+  ctm = ctmNewContext(CTM_IMPORT);
+  if(!ctm)
+  {
+    printf("%s: Unable to create an OpenCTM context\n", aFileName);
+    return 1;
+  }
+  ctmLoad(ctm, aFileName);
+  err = ctmGetError(ctm);
+  if(err == CTM_NONE)
+    failed = CheckContext(ctm, aFileName);
+  else
+    printf("%s: Load failed (%s)\n", aFileName, ctmErrorString(err));
+  ctmFreeContext(ctm);
+  return failed;
+}
+
+//-----------------------------------------------------------------------------
+// CheckGenerated() - Check the normal decoder on a generated mesh: a bumpy
+// sphere with smooth normals (aNoise = 0), or with random normals of random
+// length (aNoise != 0).
+//-----------------------------------------------------------------------------
+static int CheckGenerated(int aNoise, CTMfloat aPrecision)
+{
+  CTMcontext ctm;
+  CTMfloat * vertices, * normals, theta, phi, r, * v, * n;
+  CTMuint * indices, * t, i, j, seed, vertexCount, triangleCount;
+  char name[64];
+  int failed = 1;
+
+  vertexCount = TEST_ROWS * TEST_COLUMNS;
+  triangleCount = (TEST_ROWS - 1) * TEST_COLUMNS * 2;
+  vertices = (CTMfloat *) malloc(3 * sizeof(CTMfloat) * vertexCount);
+  normals = (CTMfloat *) malloc(3 * sizeof(CTMfloat) * vertexCount);
+  indices = (CTMuint *) malloc(3 * sizeof(CTMuint) * triangleCount);
+  sprintf(name, "%s (generated)", aNoise ? "random normals" : "sphere");
+  if(!vertices || !normals || !indices)
+  {
+    printf("%s: Out of memory\n", name);
+    goto done;
+  }
+
+  // Vertices and normals
+  seed = 1;
+  v = vertices;
+  n = normals;
+  for(i = 0; i < TEST_ROWS; ++ i)
+  {
+    for(j = 0; j < TEST_COLUMNS; ++ j)
+    {
+      theta = 3.14159265f * (i + 0.5f) / TEST_ROWS;
+      phi = 6.28318531f * j / TEST_COLUMNS;
+      r = 1.0f + 0.05f * sinf(7.0f * phi) * sinf(5.0f * theta);
+      n[0] = sinf(theta) * cosf(phi);
+      n[1] = sinf(theta) * sinf(phi);
+      n[2] = cosf(theta);
+      v[0] = r * n[0];
+      v[1] = r * n[1];
+      v[2] = r * n[2];
+      if(aNoise)
+      {
+        seed = seed * 1103515245 + 12345;
+        n[0] = ((seed >> 8) & 0xffff) / 32768.0f - 1.0f;
+        seed = seed * 1103515245 + 12345;
+        n[1] = ((seed >> 8) & 0xffff) / 32768.0f - 1.0f;
+        seed = seed * 1103515245 + 12345;
+        n[2] = ((seed >> 8) & 0xffff) / 32768.0f - 1.0f;
+      }
+      v += 3;
+      n += 3;
+    }
+  }
+
+  // Triangles
+  t = indices;
+  for(i = 0; i < TEST_ROWS - 1; ++ i)
+  {
+    for(j = 0; j < TEST_COLUMNS; ++ j)
+    {
+      t[0] = i * TEST_COLUMNS + j;
+      t[1] = (i + 1) * TEST_COLUMNS + j;
+      t[2] = i * TEST_COLUMNS + (j + 1) % TEST_COLUMNS;
+      t[3] = t[2];
+      t[4] = t[1];
+      t[5] = (i + 1) * TEST_COLUMNS + (j + 1) % TEST_COLUMNS;
+      t += 6;
+    }
+  }
+
+  ctm = ctmNewContext(CTM_EXPORT);
+  if(!ctm)
+  {
+    printf("%s: Unable to create an OpenCTM context\n", name);
+    goto done;
+  }
+  ctmDefineMesh(ctm, vertices, vertexCount, indices, triangleCount, normals);
+  ctmNormalPrecision(ctm, aPrecision);
+  if(ctmGetError(ctm) == CTM_NONE)
+    failed = CheckContext(ctm, name);
+  else
+    printf("%s: Unable to define the mesh\n", name);
+  ctmFreeContext(ctm);
+
+done:
+  free(indices);
+  free(normals);
+  free(vertices);
+  return failed;
+}
+
+//-----------------------------------------------------------------------------
+// main()
+//-----------------------------------------------------------------------------
+int main(int argc, char ** argv)
+{
+  static const CTMfloat precisions[] = {
+    1.0f / 16.0f, 1.0f / 256.0f, 1.0f / 4096.0f, 1.0f / 65536.0f
+  };
+  int i, failed = 0, count = 0;
+
+  if(argc > 1)
+  {
+    for(i = 1; i < argc; ++ i)
+    {
+      failed += CheckFile(argv[i]);
+      ++ count;
+    }
+  }
+  else
+  {
+    for(i = 0; i < (int) (sizeof(precisions) / sizeof(CTMfloat)); ++ i)
+    {
+      failed += CheckGenerated(0, precisions[i]);
+      failed += CheckGenerated(1, precisions[i]);
+      count += 2;
+    }
+  }
+
+  if(failed)
+  {
+    printf("%d of %d test(s) failed\n", failed, count);
+    return 1;
+  }
+  return 0;
+}
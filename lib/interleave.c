@@ -0,0 +1,451 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        interleave.c
+// Description: Conversion between word arrays and the byte-interleaved
+//              layout that is used for packed data (with SSE2/AVX2 kernels
+//              that are selected at run time).
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include "openctm.h"
+#include "internal.h"
+
+#ifdef _CTM_USE_SSE2
+  #include <emmintrin.h>
+#endif
+
+// AVX2 needs run time detection, and a compiler that can generate AVX2 code
+// for a single function
+#if defined(_CTM_USE_SSE2) && (defined(__clang__) || \
+    (defined(__GNUC__) && ((__GNUC__ > 4) || \
+     ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))) || \
+    (defined(_MSC_VER) && (_MSC_VER >= 1700)))
+  #define _CTM_USE_AVX2
+  #include <immintrin.h>
+  #ifdef _MSC_VER
+    #include <intrin.h>
+    #define _CTM_AVX2_FUNC
+  #else
+    #define _CTM_AVX2_FUNC __attribute__((target("avx2")))
+  #endif
+#endif
+
+// Byte-interleaved layout: the bytes of word k of element i (of aCount
+// elements with aSize words each) are stored at offsets i + k * aCount +
+// p * aCount * aSize, where p = 0 for the most significant byte, and p = 3
+// for the least significant byte. The plane offsets (p * aCount * aSize) are
+// calculated as size_t, since the whole array may be larger than 4 GB.
+
+
+//-----------------------------------------------------------------------------
+// _ctmInterleaveWords_C() - Scalar (reference) version of
+// _ctmInterleaveWords(), for elements aFirst to aCount - 1.
+//-----------------------------------------------------------------------------
+static void _ctmInterleaveWords_C(unsigned char * aDst, const CTMint * aSrc,
+  CTMuint aCount, CTMuint aSize, CTMint aSignedInts, CTMuint aFirst)
+{
+  CTMuint i, k;
+  CTMint value;
+  size_t planeSize;
+
+  planeSize = (size_t) aCount * aSize;
+  for(i = aFirst; i < aCount; ++ i)
+  {
+    for(k = 0; k < aSize; ++ k)
+    {
+      value = aSrc[i * aSize + k];
+      // Convert two's complement to signed magnitude?
+      if(aSignedInts)
+        value = value < 0 ? -1 - (value << 1) : value << 1;
+      aDst[i + k * aCount + 3 * planeSize] = value & 0x000000ff;
+      aDst[i + k * aCount + 2 * planeSize] = (value >> 8) & 0x000000ff;
+      aDst[i + k * aCount + planeSize] = (value >> 16) & 0x000000ff;
+      aDst[i + k * aCount] = (value >> 24) & 0x000000ff;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmDeinterleaveWords_C() - Scalar (reference) version of
+// _ctmDeinterleaveWords(), for elements aFirst to aCount - 1.
+//-----------------------------------------------------------------------------
+static void _ctmDeinterleaveWords_C(CTMint * aDst, const unsigned char * aSrc,
+  CTMuint aCount, CTMuint aSize, CTMint aSignedInts, CTMuint aFirst)
+{
+  CTMuint i, k, x;
+  CTMint value;
+  size_t planeSize;
+
+  planeSize = (size_t) aCount * aSize;
+  for(i = aFirst; i < aCount; ++ i)
+  {
+    for(k = 0; k < aSize; ++ k)
+    {
+      value = (CTMint) aSrc[i + k * aCount + 3 * planeSize] |
+              (((CTMint) aSrc[i + k * aCount + 2 * planeSize]) << 8) |
+              (((CTMint) aSrc[i + k * aCount + planeSize]) << 16) |
+              (((CTMint) aSrc[i + k * aCount]) << 24);
+      // Convert signed magnitude to two's complement?
+      if(aSignedInts)
+      {
+        x = (CTMuint) value;
+        value = (x & 1) ? -(CTMint)((x + 1) >> 1) : (CTMint)(x >> 1);
+      }
+      aDst[i * aSize + k] = value;
+    }
+  }
+}
+
+#ifdef _CTM_USE_SSE2
+
+//-----------------------------------------------------------------------------
+// _ctmInterleaveWords_SSE2() - SSE2 version of _ctmInterleaveWords(). Blocks
+// of 16 words are split into four byte planes with mask/pack operations.
+//-----------------------------------------------------------------------------
+static void _ctmInterleaveWords_SSE2(unsigned char * aDst,
+  const CTMint * aSrc, CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+{
+  CTMuint i, j, k, n;
+  size_t planeSize;
+  CTMint w[16];
+  __m128i x[4], mask;
+  const __m128i * src;
+  int p;
+
+  mask = _mm_set1_epi32(0x000000ff);
+  planeSize = (size_t) aCount * aSize;
+  n = aCount & ~15U;
+  for(i = 0; i < n; i += 16)
+  {
+    for(k = 0; k < aSize; ++ k)
+    {
+      // Gather 16 words
+      if(aSize == 1)
+        src = (const __m128i *) &aSrc[i];
+      else
+      {
+        for(j = 0; j < 16; ++ j)
+          w[j] = aSrc[(i + j) * aSize + k];
+        src = (const __m128i *) w;
+      }
+      for(j = 0; j < 4; ++ j)
+      {
+        x[j] = _mm_loadu_si128(&src[j]);
+        // Convert two's complement to signed magnitude?
+        if(aSignedInts)
+          x[j] = _mm_xor_si128(_mm_slli_epi32(x[j], 1),
+                               _mm_srai_epi32(x[j], 31));
+      }
+
+      // Split the words into byte planes (most significant byte first)
+      for(p = 0; p < 4; ++ p)
+      {
+        __m128i b0, b1, b2, b3;
+        b0 = _mm_and_si128(_mm_srli_epi32(x[0], 24 - 8 * p), mask);
+        b1 = _mm_and_si128(_mm_srli_epi32(x[1], 24 - 8 * p), mask);
+        b2 = _mm_and_si128(_mm_srli_epi32(x[2], 24 - 8 * p), mask);
+        b3 = _mm_and_si128(_mm_srli_epi32(x[3], 24 - 8 * p), mask);
+        _mm_storeu_si128((__m128i *) &aDst[i + k * aCount + p * planeSize],
+          _mm_packus_epi16(_mm_packs_epi32(b0, b1), _mm_packs_epi32(b2, b3)));
+      }
+    }
+  }
+
+  // Remaining elements
+  _ctmInterleaveWords_C(aDst, aSrc, aCount, aSize, aSignedInts, n);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmDeinterleaveWords_SSE2() - SSE2 version of _ctmDeinterleaveWords().
+// Blocks of 16 words are joined from the four byte planes with unpack
+// operations.
+//-----------------------------------------------------------------------------
+static void _ctmDeinterleaveWords_SSE2(CTMint * aDst,
+  const unsigned char * aSrc, CTMuint aCount, CTMuint aSize,
+  CTMint aSignedInts)
+{
+  CTMuint i, j, k, n;
+  size_t planeSize;
+  CTMint w[16];
+  __m128i p0, p1, p2, p3, lo, hi, x[4], one;
+  __m128i * dst;
+
+  one = _mm_set1_epi32(1);
+  planeSize = (size_t) aCount * aSize;
+  n = aCount & ~15U;
+  for(i = 0; i < n; i += 16)
+  {
+    for(k = 0; k < aSize; ++ k)
+    {
+      // Load the byte planes (most significant byte first)
+      p0 = _mm_loadu_si128((const __m128i *) &aSrc[i + k * aCount]);
+      p1 = _mm_loadu_si128((const __m128i *) &aSrc[i + k * aCount + planeSize]);
+      p2 = _mm_loadu_si128((const __m128i *) &aSrc[i + k * aCount + 2 * planeSize]);
+      p3 = _mm_loadu_si128((const __m128i *) &aSrc[i + k * aCount + 3 * planeSize]);
+
+      // Join the bytes into words
+      lo = _mm_unpacklo_epi8(p3, p2);
+      hi = _mm_unpacklo_epi8(p1, p0);
+      x[0] = _mm_unpacklo_epi16(lo, hi);
+      x[1] = _mm_unpackhi_epi16(lo, hi);
+      lo = _mm_unpackhi_epi8(p3, p2);
+      hi = _mm_unpackhi_epi8(p1, p0);
+      x[2] = _mm_unpacklo_epi16(lo, hi);
+      x[3] = _mm_unpackhi_epi16(lo, hi);
+
+      // Scatter 16 words
+      dst = (aSize == 1) ? (__m128i *) &aDst[i] : (__m128i *) w;
+      for(j = 0; j < 4; ++ j)
+      {
+        // Convert signed magnitude to two's complement?
+        if(aSignedInts)
+          x[j] = _mm_xor_si128(_mm_srli_epi32(x[j], 1),
+            _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(x[j], one)));
+        _mm_storeu_si128(&dst[j], x[j]);
+      }
+      if(aSize != 1)
+      {
+        for(j = 0; j < 16; ++ j)
+          aDst[(i + j) * aSize + k] = w[j];
+      }
+    }
+  }
+
+  // Remaining elements
+  _ctmDeinterleaveWords_C(aDst, aSrc, aCount, aSize, aSignedInts, n);
+}
+
+#endif // _CTM_USE_SSE2
+
+#ifdef _CTM_USE_AVX2
+
+//-----------------------------------------------------------------------------
+// _ctmInterleaveWords_AVX2() - AVX2 version of _ctmInterleaveWords(), working
+// on blocks of 32 words. The AVX2 pack instructions work within 128-bit
+// lanes, so the packed words are put back in order with a permutation.
+//-----------------------------------------------------------------------------
+static _CTM_AVX2_FUNC void _ctmInterleaveWords_AVX2(unsigned char * aDst,
+  const CTMint * aSrc, CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+{
+  CTMuint i, j, k, n;
+  size_t planeSize;
+  CTMint w[32];
+  __m256i x[4], mask, order;
+  const __m256i * src;
+  int p;
+
+  mask = _mm256_set1_epi32(0x000000ff);
+  order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  planeSize = (size_t) aCount * aSize;
+  n = aCount & ~31U;
+  for(i = 0; i < n; i += 32)
+  {
+    for(k = 0; k < aSize; ++ k)
+    {
+      // Gather 32 words
+      if(aSize == 1)
+        src = (const __m256i *) &aSrc[i];
+      else
+      {
+        for(j = 0; j < 32; ++ j)
+          w[j] = aSrc[(i + j) * aSize + k];
+        src = (const __m256i *) w;
+      }
+      for(j = 0; j < 4; ++ j)
+      {
+        x[j] = _mm256_loadu_si256(&src[j]);
+        // Convert two's complement to signed magnitude?
+        if(aSignedInts)
+          x[j] = _mm256_xor_si256(_mm256_slli_epi32(x[j], 1),
+                                  _mm256_srai_epi32(x[j], 31));
+      }
+
+      // Split the words into byte planes (most significant byte first)
+      for(p = 0; p < 4; ++ p)
+      {
+        __m256i b0, b1, b2, b3, b;
+        b0 = _mm256_and_si256(_mm256_srli_epi32(x[0], 24 - 8 * p), mask);
+        b1 = _mm256_and_si256(_mm256_srli_epi32(x[1], 24 - 8 * p), mask);
+        b2 = _mm256_and_si256(_mm256_srli_epi32(x[2], 24 - 8 * p), mask);
+        b3 = _mm256_and_si256(_mm256_srli_epi32(x[3], 24 - 8 * p), mask);
+        b = _mm256_packus_epi16(_mm256_packs_epi32(b0, b1),
+                                _mm256_packs_epi32(b2, b3));
+        _mm256_storeu_si256((__m256i *) &aDst[i + k * aCount + p * planeSize],
+          _mm256_permutevar8x32_epi32(b, order));
+      }
+    }
+  }
+
+  // Remaining elements
+  _ctmInterleaveWords_C(aDst, aSrc, aCount, aSize, aSignedInts, n);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmDeinterleaveWords_AVX2() - AVX2 version of _ctmDeinterleaveWords(),
+// working on blocks of 32 words. The AVX2 unpack instructions work within
+// 128-bit lanes, so the joined words are put back in order with lane
+// permutations.
+//-----------------------------------------------------------------------------
+static _CTM_AVX2_FUNC void _ctmDeinterleaveWords_AVX2(CTMint * aDst,
+  const unsigned char * aSrc, CTMuint aCount, CTMuint aSize,
+  CTMint aSignedInts)
+{
+  CTMuint i, j, k, n;
+  size_t planeSize;
+  CTMint w[32];
+  __m256i p0, p1, p2, p3, lo, hi, r[4], x[4], one;
+  __m256i * dst;
+
+  one = _mm256_set1_epi32(1);
+  planeSize = (size_t) aCount * aSize;
+  n = aCount & ~31U;
+  for(i = 0; i < n; i += 32)
+  {
+    for(k = 0; k < aSize; ++ k)
+    {
+      // Load the byte planes (most significant byte first)
+      p0 = _mm256_loadu_si256((const __m256i *) &aSrc[i + k * aCount]);
+      p1 = _mm256_loadu_si256((const __m256i *) &aSrc[i + k * aCount + planeSize]);
+      p2 = _mm256_loadu_si256((const __m256i *) &aSrc[i + k * aCount + 2 * planeSize]);
+      p3 = _mm256_loadu_si256((const __m256i *) &aSrc[i + k * aCount + 3 * planeSize]);
+
+      // Join the bytes into words (words 0-3|16-19, 4-7|20-23, 8-11|24-27
+      // and 12-15|28-31), and put them in order
+      lo = _mm256_unpacklo_epi8(p3, p2);
+      hi = _mm256_unpacklo_epi8(p1, p0);
+      r[0] = _mm256_unpacklo_epi16(lo, hi);
+      r[1] = _mm256_unpackhi_epi16(lo, hi);
+      lo = _mm256_unpackhi_epi8(p3, p2);
+      hi = _mm256_unpackhi_epi8(p1, p0);
+      r[2] = _mm256_unpacklo_epi16(lo, hi);
+      r[3] = _mm256_unpackhi_epi16(lo, hi);
+      x[0] = _mm256_permute2x128_si256(r[0], r[1], 0x20);
+      x[1] = _mm256_permute2x128_si256(r[2], r[3], 0x20);
+      x[2] = _mm256_permute2x128_si256(r[0], r[1], 0x31);
+      x[3] = _mm256_permute2x128_si256(r[2], r[3], 0x31);
+
+      // Scatter 32 words
+      dst = (aSize == 1) ? (__m256i *) &aDst[i] : (__m256i *) w;
+      for(j = 0; j < 4; ++ j)
+      {
+        // Convert signed magnitude to two's complement?
+        if(aSignedInts)
+          x[j] = _mm256_xor_si256(_mm256_srli_epi32(x[j], 1),
+            _mm256_sub_epi32(_mm256_setzero_si256(),
+                             _mm256_and_si256(x[j], one)));
+        _mm256_storeu_si256(&dst[j], x[j]);
+      }
+      if(aSize != 1)
+      {
+        for(j = 0; j < 32; ++ j)
+          aDst[(i + j) * aSize + k] = w[j];
+      }
+    }
+  }
+
+  // Remaining elements
+  _ctmDeinterleaveWords_C(aDst, aSrc, aCount, aSize, aSignedInts, n);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmHasAVX2() - Check if the CPU (and OS) supports AVX2. The result is
+// cached (the check is cheap, so a race between threads is harmless).
+//-----------------------------------------------------------------------------
+static int _ctmHasAVX2(void)
+{
+  static volatile int hasAVX2 = -1;
+
+  if(hasAVX2 < 0)
+  {
+#ifdef _MSC_VER
+    int info[4];
+    int result = 0;
+    __cpuid(info, 0);
+    if(info[0] >= 7)
+    {
+      // OSXSAVE and AVX, and the OS saves the YMM registers?
+      __cpuid(info, 1);
+      if(((info[2] & 0x18000000) == 0x18000000) &&
+         ((_xgetbv(0) & 6) == 6))
+      {
+        __cpuidex(info, 7, 0);
+        result = (info[1] & 0x00000020) ? 1 : 0;
+      }
+    }
+    hasAVX2 = result;
+#else
+    __builtin_cpu_init();
+    hasAVX2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+#endif
+  }
+
+  return hasAVX2;
+}
+
+#endif // _CTM_USE_AVX2
+
+//-----------------------------------------------------------------------------
+// _ctmInterleaveWords() - Convert an array of aCount elements, with aSize
+// 32-bit words each, to the byte-interleaved layout. If aSignedInts is
+// non-zero, the words are converted from two's complement to signed
+// magnitude (sign in the least significant bit) first.
+//-----------------------------------------------------------------------------
+void _ctmInterleaveWords(unsigned char * aDst, const CTMint * aSrc,
+  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+{
+#ifdef _CTM_USE_AVX2
+  if(_ctmHasAVX2())
+  {
+    _ctmInterleaveWords_AVX2(aDst, aSrc, aCount, aSize, aSignedInts);
+    return;
+  }
+#endif
+#ifdef _CTM_USE_SSE2
+  _ctmInterleaveWords_SSE2(aDst, aSrc, aCount, aSize, aSignedInts);
+#else
+  _ctmInterleaveWords_C(aDst, aSrc, aCount, aSize, aSignedInts, 0);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmDeinterleaveWords() - Convert a byte-interleaved array back to aCount
+// elements with aSize 32-bit words each (the inverse of
+// _ctmInterleaveWords()).
+//-----------------------------------------------------------------------------
+void _ctmDeinterleaveWords(CTMint * aDst, const unsigned char * aSrc,
+  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+{
+#ifdef _CTM_USE_AVX2
+  // For aSize > 1, the scatter step dominates, and the SSE2 version is faster
+  if((aSize == 1) && _ctmHasAVX2())
+  {
+    _ctmDeinterleaveWords_AVX2(aDst, aSrc, aCount, aSize, aSignedInts);
+    return;
+  }
+#endif
+#ifdef _CTM_USE_SSE2
+  _ctmDeinterleaveWords_SSE2(aDst, aSrc, aCount, aSize, aSignedInts);
+#else
+  _ctmDeinterleaveWords_C(aDst, aSrc, aCount, aSize, aSignedInts, 0);
+#endif
+}
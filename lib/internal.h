@@ -34,9 +34,112 @@
 // OpenCTM file format version (v5).
 #define _CTM_FORMAT_VERSION  0x00000005
 
+// OpenCTM file format version with block-framed packed data (v6).
+#define _CTM_FORMAT_VERSION_FRAMED 0x00000006
+
+// OpenCTM file format version with a codec tag in each packed data frame (v7).
+#define _CTM_FORMAT_VERSION_CODECS 0x00000007
+
+// Size of a frame of packed data in v6 files (uncompressed bytes).
+#define _CTM_FRAME_SIZE 0x00100000
+
+// Size of the buffer for LZMA compressing aSize bytes (room for the worst
+// case expansion of incompressible data, as recommended by the LZMA SDK).
+#define _CTM_PACKED_SIZE(aSize) ((aSize) + (aSize) / 3 + 128)
+
+// Largest number of array elements that are passed to the stream in a single
+// read or write (the read/write functions take 32-bit byte counts).
+#define _CTM_STREAM_ARRAY_CHUNK 0x10000000
+
+// Largest supported vertex and triangle counts. All element indices of the
+// mesh arrays (up to four values per vertex, and three per triangle) must fit
+// in a CTMuint, while byte sizes and offsets are calculated as size_t.
+#define _CTM_MAX_VERTEX_COUNT   0x3fffffff
+#define _CTM_MAX_TRIANGLE_COUNT 0x55555555
+
+// Largest number of tiles in a tiled MG2 file.
+#define _CTM_MAX_TILE_COUNT 0x00010000
+
+// Default size of the stream read-ahead/write-behind buffer (bytes).
+#define _CTM_STREAM_BUFFER_SIZE 0x00010000
+
+// Size of the chunks of packed data that are read when LZMA uncompressing a
+// frame while reading it (bytes).
+#define _CTM_LZMA_READ_SIZE 0x00004000
+
+// Upper limit for the number of worker threads in a pool (and for the number
+// of parts of a parallel loop).
+#define _CTM_MAX_THREADS 64
+
+// Minimum number of elements per part when a loop is split between the
+// threads of the context (see _ctmParallelFor()).
+#define _CTM_PARALLEL_MIN_PART 0x00010000
+
+// Scratch buffers of the context (see _ctmScratch())
+#define _CTM_SCRATCH_SORT        0 // MG2 sorted vertices
+#define _CTM_SCRATCH_VERTICES    1 // MG2 restored vertices
+#define _CTM_SCRATCH_INDICES     2 // MG2 grid indices, re-indexed triangles
+#define _CTM_SCRATCH_DELTAS      3 // MG2 integer deltas (one array at a time)
+#define _CTM_SCRATCH_WORK        4 // MG2 helper temporaries, radix sort buffer
+#define _CTM_SCRATCH_INTERLEAVED 5 // Interleaved packed data (serial saves)
+#define _CTM_SCRATCH_PACKED      6 // Packed data (serial saves, serial MG3 loads)
+#define _CTM_SCRATCH_COUNT       7
+
 // Flags for the Mesh flags field of the file header
 #define _CTM_HAS_NORMALS_BIT 0x00000001
 
+// Can SSE2 code be used? SSE2 is always available on x86-64 (and when the
+// compiler targets it). Define OPENCTM_NO_SIMD to build scalar code only.
+#if !defined(OPENCTM_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || \
+    defined(__SSE2__) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)))
+  #define _CTM_USE_SSE2
+#endif
+
+// Is the host little endian (same byte order as the file format)?
+#if defined(__BYTE_ORDER__)
+  #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    #define _CTM_LITTLE_ENDIAN
+  #endif
+#elif defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM) || \
+      defined(_M_ARM64) || defined(__i386__) || defined(__x86_64__)
+  #define _CTM_LITTLE_ENDIAN
+#endif
+
+//-----------------------------------------------------------------------------
+// _CTMjob - A unit of work that can be executed by a thread pool. Job specific
+// structures should embed this structure as their first member.
+//-----------------------------------------------------------------------------
+typedef struct _CTMjob_struct _CTMjob;
+struct _CTMjob_struct {
+  void (* mFn)(_CTMjob * aJob); // Job function
+  int mDone;                    // Non-zero when the job has finished
+  _CTMjob * mNext;              // Next job in the queue (used by the pool)
+};
+
+//-----------------------------------------------------------------------------
+// _CTMrangefn - Function that processes the elements [aBegin, aEnd) of one
+// part of a range (see _ctmParallelFor()). aPart is the index of the part.
+//-----------------------------------------------------------------------------
+typedef void (* _CTMrangefn)(void * aData, CTMuint aPart, CTMuint aBegin,
+  CTMuint aEnd);
+
+// Opaque thread pool handle (see threads.c)
+typedef struct _CTMthreadpool_struct _CTMthreadpool;
+
+// Opaque background task handle (see threads.c)
+typedef struct _CTMtask_struct _CTMtask;
+
+//-----------------------------------------------------------------------------
+// _CTMtaskfn - Function that is run by a background task.
+//-----------------------------------------------------------------------------
+typedef void (* _CTMtaskfn)(void * aArg);
+
+// Pending (asynchronously compressed) packed data block (see stream.c)
+typedef struct _CTMpackjob_struct _CTMpackjob;
+
+// Pending (asynchronously uncompressed) packed data block (see stream.c)
+typedef struct _CTMunpackjob_struct _CTMunpackjob;
+
 //-----------------------------------------------------------------------------
 // _CTMfloatmap - Internal representation of a floating point based vertex map
 // (used for UV maps and attribute maps).
@@ -46,10 +149,17 @@ struct _CTMfloatmap_struct {
   char * mName;         // Unique name
   char * mFileName;     // File name reference (used only for UV maps)
   CTMfloat mPrecision;  // Precision for this map
+  CTMenum mCodec;       // Packed data codec for this map (see ctmCompressionCodec())
   CTMfloat * mValues;   // Attribute/UV coordinate values (per vertex)
   _CTMfloatmap * mNext; // Pointer to the next map in the list (linked list)
 };
 
+//-----------------------------------------------------------------------------
+// _CTMseekfn - Skip aCount bytes forward in an input stream. Returns non-zero
+// on success.
+//-----------------------------------------------------------------------------
+typedef int (* _CTMseekfn)(size_t aCount, void * aUserData);
+
 //-----------------------------------------------------------------------------
 // _CTMcontext - Internal CTM context structure.
 //-----------------------------------------------------------------------------
@@ -68,6 +178,21 @@ typedef struct {
   // Normals (optional)
   CTMfloat * mNormals;
 
+  // Non-zero if the loaded file contains normals (even if they were skipped)
+  CTMuint mFileHasNormals;
+
+  // Non-zero if only the header of a file was loaded (no vertex data)
+  CTMuint mHeaderOnly;
+
+  // Non-zero if the loaded file is a tiled MG2 file, and its number of tiles
+  CTMuint mTiled;
+  CTMuint mTileCount;
+
+  // Bounding box that is stored in a loaded file (min x, y, z, max x, y, z),
+  // and non-zero if the file had one (MG2 only)
+  CTMfloat mBoundingBox[6];
+  CTMuint mHasBoundingBox;
+
   // Multiple sets of UV coordinate maps (optional)
   CTMuint mUVMapCount;
   _CTMfloatmap * mUVMaps;
@@ -76,15 +201,68 @@ typedef struct {
   CTMuint mAttribMapCount;
   _CTMfloatmap * mAttribMaps;
 
+  // Tile division of the bounding box when saving with the MG2 method
+  // (1 x 1 x 1 = not tiled)
+  CTMuint mTileDivision[3];
+
+  // Region of interest for loading tiled files (min x, y, z, max x, y, z), and
+  // non-zero if a region has been set
+  CTMfloat mRegion[6];
+  CTMuint mHasRegion;
+
+  // If not NULL, the MG2 encoder stores the original index of each vertex
+  // here, in the order that the vertices are written (used for tiles)
+  CTMuint * mVertexOrder;
+
+  // Arrays to skip when loading a file: normals (0 = load, 1 = skip), and
+  // UV / attribute maps (bit i set = skip map i + 1)
+  CTMuint mSkipNormals;
+  CTMuint mSkipUVMaps;
+  CTMuint mSkipAttribMaps;
+
   // Last error code
   CTMenum mError;
 
+  // Progress callback (NULL = no progress reports), and its user data
+  CTMprogressfn mProgressFn;
+  void * mProgressUserData;
+
+  // Cancellation flag of the current operation (set by ctmCancel() or by the
+  // progress callback), and the flag that is checked during the operation
+  // (tile contexts use the flag of the context that created them)
+  volatile CTMuint mCancel;
+  volatile CTMuint * mCancelFlag;
+
+  // Background task of ctmLoadAsync() / ctmSaveAsync() (NULL = none), the
+  // file name and non-zero for a save
+  _CTMtask * mTask;
+  char * mTaskFileName;
+  CTMuint mTaskSave;
+
+  // Statistics of the last load / save operation (see ctmGetStats()), and the
+  // FOURCC of the block that is currently being read or written (which also
+  // selects the LZMA settings of the block)
+  CTMstats mStats;
+  CTMuint mBlockTag;
+
+  // Packed data codecs for the vertices (VERT and GIDX blocks), the indices
+  // and the normals (see ctmCompressionCodec()), and the codec of the block
+  // that is currently being written (CTM_CODEC_DEFAULT = the default codec of
+  // the method)
+  CTMenum mVertexCodec;
+  CTMenum mIndexCodec;
+  CTMenum mNormalCodec;
+  CTMenum mBlockCodec;
+
   // The selected compression method
   CTMenum mMethod;
 
   // The selected compression level
   CTMuint mCompressionLevel;
 
+  // File format version (to write, or of the loaded file)
+  CTMuint mFileFormat;
+
   // Vertex coordinate precision
   CTMfloat mVertexPrecision;
 
@@ -97,11 +275,64 @@ typedef struct {
   // Read() function pointer
   CTMreadfn mReadFn;
 
+  // Seek function pointer (NULL = skip data by reading it)
+  _CTMseekfn mSeekFn;
+
   // Write() function pointer
   CTMwritefn mWriteFn;
 
   // User data (for stream read/write - usually the stream handle)
   void * mUserData;
+
+  // Stream buffer (read-ahead when loading, write-behind when saving), its
+  // size (0 = unbuffered), the read position and the number of valid bytes
+  unsigned char * mStreamBuffer;
+  CTMuint mStreamBufferSize;
+  CTMuint mStreamBufferPos;
+  CTMuint mStreamBufferFill;
+
+  // Non-zero if the current stream goes through the stream buffer. File
+  // streams are always buffered, while custom streams are only buffered if
+  // the buffer size has been set with ctmStreamBufferSize() (read-ahead may
+  // consume data after the end of the file from a custom stream).
+  CTMuint mStreamBuffered;
+  CTMuint mStreamBufferCustom;
+
+  // Memory allocation functions (NULL = malloc/free), and their user data
+  CTMallocfn mAllocFn;
+  CTMfreefn mFreeFn;
+  void * mAllocUserData;
+
+  // Scratch buffers for temporary arrays, and their sizes (kept until the
+  // context is freed, so that repeated saves reuse the same memory)
+  void * mScratch[_CTM_SCRATCH_COUNT];
+  size_t mScratchSize[_CTM_SCRATCH_COUNT];
+
+  // Number of threads to use for (un)compression (0 = one per CPU)
+  CTMuint mThreadCount;
+
+  // Number of threads to use for the LZMA match finder (1 or 2)
+  CTMuint mLZMAThreads;
+
+  // Non-zero if several LZMA settings are tried for each packed block
+  CTMuint mLZMASearch;
+
+  // Order of the grid boxes when sorting MG2/MG3 vertices (CTM_ORDER_*)
+  CTMenum mVertexSortOrder;
+
+  // Worker thread pool (created on demand, NULL = serial operation)
+  _CTMthreadpool * mThreadPool;
+
+  // Queue of packed blocks that are being compressed by the thread pool, and
+  // that have not yet been written to the stream
+  _CTMpackjob * mPackHead;
+  _CTMpackjob * mPackTail;
+  CTMuint mPackCount;
+
+  // Queue of packed blocks that have been read from the stream, and that are
+  // being uncompressed by the thread pool
+  _CTMunpackjob * mUnpackHead;
+  _CTMunpackjob * mUnpackTail;
 } _CTMcontext;
 
 //-----------------------------------------------------------------------------
@@ -110,38 +341,117 @@ typedef struct {
 #define FOURCC(str) (((CTMuint) str[0]) | (((CTMuint) str[1]) << 8) | \
                     (((CTMuint) str[2]) << 16) | (((CTMuint) str[3]) << 24))
 
+//-----------------------------------------------------------------------------
+// Funcion prototypes for openctm.c
+//-----------------------------------------------------------------------------
+void * _ctmMalloc(_CTMcontext * self, size_t aSize);
+void _ctmFree(_CTMcontext * self, void * aPtr);
+void * _ctmScratch(_CTMcontext * self, CTMuint aSlot, size_t aSize);
+int _ctmAllocateMesh(_CTMcontext * self);
+int _ctmProgress(_CTMcontext * self, CTMenum aStage, CTMfloat aProgress);
+void _ctmStatsTime(CTMfloat * aTime, double aStart);
+void _ctmStatsBlock(_CTMcontext * self, CTMuint aTag, size_t aRawSize,
+  size_t aPackedSize, CTMuint aLZMACalls, CTMfloat aLZMATime);
+void _ctmStatsMerge(_CTMcontext * self, _CTMcontext * aChild);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for threads.c
+//-----------------------------------------------------------------------------
+CTMuint _ctmCPUCount(void);
+_CTMthreadpool * _ctmThreadPoolCreate(CTMuint aThreadCount);
+void _ctmThreadPoolDestroy(_CTMthreadpool * aPool);
+void _ctmThreadPoolSubmit(_CTMthreadpool * aPool, _CTMjob * aJob);
+void _ctmThreadPoolWait(_CTMthreadpool * aPool, _CTMjob * aJob);
+int _ctmThreadPoolIsDone(_CTMthreadpool * aPool, _CTMjob * aJob);
+CTMuint _ctmThreadCount(_CTMcontext * self);
+_CTMthreadpool * _ctmGetThreadPool(_CTMcontext * self);
+CTMuint _ctmParallelParts(_CTMcontext * self, CTMuint aCount, CTMuint aMinPartSize);
+void _ctmParallelFor(_CTMcontext * self, CTMuint aCount, CTMuint aParts, _CTMrangefn aFn, void * aData);
+_CTMtask * _ctmTaskStart(_CTMtaskfn aFn, void * aArg);
+void _ctmTaskWait(_CTMtask * aTask);
+double _ctmTime(void);
+
 //-----------------------------------------------------------------------------
 // Funcion prototypes for stream.c
 //-----------------------------------------------------------------------------
+void _ctmStreamReset(_CTMcontext * self);
 CTMuint _ctmStreamRead(_CTMcontext * self, void * aBuf, CTMuint aCount);
 CTMuint _ctmStreamWrite(_CTMcontext * self, void * aBuf, CTMuint aCount);
+int _ctmStreamFlush(_CTMcontext * self);
+int _ctmStreamReadWait(_CTMcontext * self, const void * aData);
+int _ctmStreamReadSync(_CTMcontext * self);
+void _ctmStreamReadDiscard(_CTMcontext * self);
 CTMuint _ctmStreamReadUINT(_CTMcontext * self);
 void _ctmStreamWriteUINT(_CTMcontext * self, CTMuint aValue);
+CTMuint _ctmStreamReadTag(_CTMcontext * self);
+void _ctmStreamWriteTag(_CTMcontext * self, const char * aTag);
 CTMfloat _ctmStreamReadFLOAT(_CTMcontext * self);
 void _ctmStreamWriteFLOAT(_CTMcontext * self, CTMfloat aValue);
+void _ctmStreamReadUINTArray(_CTMcontext * self, CTMuint * aArray, size_t aCount);
+void _ctmStreamWriteUINTArray(_CTMcontext * self, const CTMuint * aArray, size_t aCount);
+void _ctmStreamReadFLOATArray(_CTMcontext * self, CTMfloat * aArray, size_t aCount);
+void _ctmStreamWriteFLOATArray(_CTMcontext * self, const CTMfloat * aArray, size_t aCount);
 void _ctmStreamReadSTRING(_CTMcontext * self, char ** aValue);
 void _ctmStreamWriteSTRING(_CTMcontext * self, const char * aValue);
 int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData, CTMuint aCount, CTMuint aSize, CTMint aSignedInts);
 int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData, CTMuint aCount, CTMuint aSize, CTMint aSignedInts);
 int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData, CTMuint aCount, CTMuint aSize);
 int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData, CTMuint aCount, CTMuint aSize);
+int _ctmStreamSkip(_CTMcontext * self, size_t aCount);
+int _ctmStreamSkipPacked(_CTMcontext * self, CTMuint aCount, CTMuint aSize);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for rans.c
+//-----------------------------------------------------------------------------
+int _ctmRansEncode(_CTMcontext * self, unsigned char * aDest, size_t * aDestSize, const unsigned char * aSrc, size_t aSize, size_t aOffset, size_t aPlaneSize, CTMuint aLevel);
+CTMenum _ctmRansDecode(_CTMcontext * self, unsigned char * aDest, size_t aSize, const unsigned char * aSrc, size_t aSrcSize);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for interleave.c
+//-----------------------------------------------------------------------------
+void _ctmInterleaveWords(unsigned char * aDst, const CTMint * aSrc, CTMuint aCount, CTMuint aSize, CTMint aSignedInts);
+void _ctmDeinterleaveWords(CTMint * aDst, const unsigned char * aSrc, CTMuint aCount, CTMuint aSize, CTMint aSignedInts);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for sort.c
+//-----------------------------------------------------------------------------
+int _ctmSortRecords(_CTMcontext * self, CTMuint * aRecords, CTMuint aCount, CTMuint aMajor, CTMuint aMinor);
+int _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for reduce.c
+//-----------------------------------------------------------------------------
+int _ctmCheckMeshData(_CTMcontext * self);
+void _ctmBoundingBox(_CTMcontext * self, CTMfloat * aMin, CTMfloat * aMax);
+double _ctmSumEdgeLengths(_CTMcontext * self);
 
 //-----------------------------------------------------------------------------
 // Funcion prototypes for compressRAW.c
 //-----------------------------------------------------------------------------
 int _ctmCompressMesh_RAW(_CTMcontext * self);
 int _ctmUncompressMesh_RAW(_CTMcontext * self);
+int _ctmReadHeader_RAW(_CTMcontext * self);
 
 //-----------------------------------------------------------------------------
 // Funcion prototypes for compressMG1.c
 //-----------------------------------------------------------------------------
 int _ctmCompressMesh_MG1(_CTMcontext * self);
 int _ctmUncompressMesh_MG1(_CTMcontext * self);
+int _ctmReadHeader_MG1(_CTMcontext * self);
 
 //-----------------------------------------------------------------------------
 // Funcion prototypes for compressMG2.c
 //-----------------------------------------------------------------------------
 int _ctmCompressMesh_MG2(_CTMcontext * self);
 int _ctmUncompressMesh_MG2(_CTMcontext * self);
+int _ctmReadHeader_MG2(_CTMcontext * self);
+int _ctmCheckNormalRestore(_CTMcontext * self, CTMfloat * aMaxDiff);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for tiles.c
+//-----------------------------------------------------------------------------
+int _ctmCompressMesh_Tiles(_CTMcontext * self);
+int _ctmUncompressMesh_Tiles(_CTMcontext * self);
+int _ctmReadHeader_Tiles(_CTMcontext * self);
 
 #endif // __OPENCTM_INTERNAL_H_
@@ -37,6 +37,56 @@
 #define Hc3Zip_MatchFinder_Skip _ctm_Hc3Zip_MatchFinder_Skip
 #define MatchFinder_CreateVTable _ctm_MatchFinder_CreateVTable
 
+/* LzFindMt.c */
+#define MtSync_Construct _ctm_MtSync_Construct
+#define MtSync_GetNextBlock _ctm_MtSync_GetNextBlock
+#define MtSync_StopWriting _ctm_MtSync_StopWriting
+#define MtSync_Destruct _ctm_MtSync_Destruct
+#define MtSync_Init _ctm_MtSync_Init
+#define HashThreadFunc _ctm_HashThreadFunc
+#define MatchFinderMt_GetNextBlock_Hash _ctm_MatchFinderMt_GetNextBlock_Hash
+#define BtGetMatches _ctm_BtGetMatches
+#define BtFillBlock _ctm_BtFillBlock
+#define BtThreadFunc _ctm_BtThreadFunc
+#define MatchFinderMt_Construct _ctm_MatchFinderMt_Construct
+#define MatchFinderMt_FreeMem _ctm_MatchFinderMt_FreeMem
+#define MatchFinderMt_Destruct _ctm_MatchFinderMt_Destruct
+#define MatchFinderMt_Create _ctm_MatchFinderMt_Create
+#define MatchFinderMt_Init _ctm_MatchFinderMt_Init
+#define MatchFinderMt_ReleaseStream _ctm_MatchFinderMt_ReleaseStream
+#define MatchFinderMt_Normalize _ctm_MatchFinderMt_Normalize
+#define MatchFinderMt_GetNextBlock_Bt _ctm_MatchFinderMt_GetNextBlock_Bt
+#define MatchFinderMt_GetPointerToCurrentPos _ctm_MatchFinderMt_GetPointerToCurrentPos
+#define MatchFinderMt_GetNumAvailableBytes _ctm_MatchFinderMt_GetNumAvailableBytes
+#define MatchFinderMt_GetIndexByte _ctm_MatchFinderMt_GetIndexByte
+#define MixMatches2 _ctm_MixMatches2
+#define MixMatches3 _ctm_MixMatches3
+#define MatchFinderMt2_GetMatches _ctm_MatchFinderMt2_GetMatches
+#define MatchFinderMt_GetMatches _ctm_MatchFinderMt_GetMatches
+#define MatchFinderMt0_Skip _ctm_MatchFinderMt0_Skip
+#define MatchFinderMt2_Skip _ctm_MatchFinderMt2_Skip
+#define MatchFinderMt3_Skip _ctm_MatchFinderMt3_Skip
+#define MatchFinderMt_CreateVTable _ctm_MatchFinderMt_CreateVTable
+
+/* Threads.c */
+#define Thread_Create _ctm_Thread_Create
+#define Thread_Wait _ctm_Thread_Wait
+#define Thread_Close _ctm_Thread_Close
+#define ManualResetEvent_Create _ctm_ManualResetEvent_Create
+#define ManualResetEvent_CreateNotSignaled _ctm_ManualResetEvent_CreateNotSignaled
+#define AutoResetEvent_Create _ctm_AutoResetEvent_Create
+#define AutoResetEvent_CreateNotSignaled _ctm_AutoResetEvent_CreateNotSignaled
+#define Event_Set _ctm_Event_Set
+#define Event_Reset _ctm_Event_Reset
+#define Event_Wait _ctm_Event_Wait
+#define Event_Close _ctm_Event_Close
+#define Semaphore_Create _ctm_Semaphore_Create
+#define Semaphore_ReleaseN _ctm_Semaphore_ReleaseN
+#define Semaphore_Release1 _ctm_Semaphore_Release1
+#define Semaphore_Wait _ctm_Semaphore_Wait
+#define Semaphore_Close _ctm_Semaphore_Close
+#define CriticalSection_Init _ctm_CriticalSection_Init
+
 /* LzmaDec.c */
 #define LzmaDec_InitDicAndState _ctm_LzmaDec_InitDicAndState
 #define LzmaDec_Init _ctm_LzmaDec_Init
@@ -0,0 +1,117 @@
+/* Threads.h -- multithreading library
+2008-11-22 : Igor Pavlov : Public domain
+2009-05-01 : POSIX threads version for OpenCTM : Public domain */
+
+#ifndef __7Z_THRESDS_H
+#define __7Z_THRESDS_H
+
+#include "Types.h"
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+typedef struct _CThread
+{
+  HANDLE handle;
+} CThread;
+
+#define Thread_Construct(thread) (thread)->handle = NULL
+#define Thread_WasCreated(thread) ((thread)->handle != NULL)
+
+typedef struct _CEvent
+{
+  HANDLE handle;
+} CEvent;
+
+#define Event_Construct(event) (event)->handle = NULL
+#define Event_IsCreated(event) ((event)->handle != NULL)
+
+typedef struct _CSemaphore
+{
+  HANDLE handle;
+} CSemaphore;
+
+#define Semaphore_Construct(p) (p)->handle = NULL
+
+typedef CRITICAL_SECTION CCriticalSection;
+
+#define CriticalSection_Delete(p) DeleteCriticalSection(p)
+#define CriticalSection_Enter(p) EnterCriticalSection(p)
+#define CriticalSection_Leave(p) LeaveCriticalSection(p)
+
+#else
+
+#include <pthread.h>
+
+typedef struct _CThread
+{
+  pthread_t tid;
+  int created;
+  unsigned (MY_STD_CALL *startAddress)(void *);
+  void *parameter;
+} CThread;
+
+#define Thread_Construct(thread) (thread)->created = 0
+#define Thread_WasCreated(thread) ((thread)->created != 0)
+
+typedef struct _CEvent
+{
+  int created;
+  int manualReset;
+  int state;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} CEvent;
+
+#define Event_Construct(event) (event)->created = 0
+#define Event_IsCreated(event) ((event)->created != 0)
+
+typedef struct _CSemaphore
+{
+  int created;
+  UInt32 count;
+  UInt32 maxCount;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} CSemaphore;
+
+#define Semaphore_Construct(p) (p)->created = 0
+
+typedef pthread_mutex_t CCriticalSection;
+
+#define CriticalSection_Delete(p) pthread_mutex_destroy(p)
+#define CriticalSection_Enter(p) pthread_mutex_lock(p)
+#define CriticalSection_Leave(p) pthread_mutex_unlock(p)
+
+#endif
+
+typedef unsigned THREAD_FUNC_RET_TYPE;
+#define THREAD_FUNC_CALL_TYPE MY_STD_CALL
+#define THREAD_FUNC_DECL THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE
+
+WRes Thread_Create(CThread *thread, THREAD_FUNC_RET_TYPE (THREAD_FUNC_CALL_TYPE *startAddress)(void *), void *parameter);
+WRes Thread_Wait(CThread *thread);
+WRes Thread_Close(CThread *thread);
+
+typedef CEvent CAutoResetEvent;
+typedef CEvent CManualResetEvent;
+
+WRes ManualResetEvent_Create(CManualResetEvent *event, int initialSignaled);
+WRes ManualResetEvent_CreateNotSignaled(CManualResetEvent *event);
+WRes AutoResetEvent_Create(CAutoResetEvent *event, int initialSignaled);
+WRes AutoResetEvent_CreateNotSignaled(CAutoResetEvent *event);
+WRes Event_Set(CEvent *event);
+WRes Event_Reset(CEvent *event);
+WRes Event_Wait(CEvent *event);
+WRes Event_Close(CEvent *event);
+
+WRes Semaphore_Create(CSemaphore *p, UInt32 initiallyCount, UInt32 maxCount);
+WRes Semaphore_ReleaseN(CSemaphore *p, UInt32 num);
+WRes Semaphore_Release1(CSemaphore *p);
+WRes Semaphore_Wait(CSemaphore *p);
+WRes Semaphore_Close(CSemaphore *p);
+
+WRes CriticalSection_Init(CCriticalSection *p);
+
+#endif
@@ -33,13 +33,30 @@
 #include "internal.h"
 
 
-// The C99 macro isfinite() is not supported on all platforms (specifically,
-// MS Visual Studio does not support C99)
-#if !defined(isfinite) && defined(_MSC_VER)
-  #include <float.h>
-  #define isfinite(x) _finite(x)
-#endif
+//-----------------------------------------------------------------------------
+// _ctmMalloc() - Allocate memory with the allocation function of the context
+// (or malloc(), if no allocator has been set).
+//-----------------------------------------------------------------------------
+void * _ctmMalloc(_CTMcontext * self, size_t aSize)
+{
+  if(self->mAllocFn)
+    return self->mAllocFn(aSize, self->mAllocUserData);
+  return malloc(aSize);
+}
 
+//-----------------------------------------------------------------------------
+// _ctmFree() - Free memory that was allocated with _ctmMalloc(). NULL pointers
+// are ignored.
+//-----------------------------------------------------------------------------
+void _ctmFree(_CTMcontext * self, void * aPtr)
+{
+  if(!aPtr)
+    return;
+  if(self->mFreeFn)
+    self->mFreeFn(aPtr, self->mAllocUserData);
+  else
+    free(aPtr);
+}
 
 //-----------------------------------------------------------------------------
 // _ctmFreeMapList() - Free a float map list.
@@ -52,18 +69,18 @@ static void _ctmFreeMapList(_CTMcontext * self, _CTMfloatmap * aMapList)
   {
     // Free internally allocated array (if we are in import mode)
     if((self->mMode == CTM_IMPORT) && map->mValues)
-      free(map->mValues);
+      _ctmFree(self, map->mValues);
 
     // Free map name
     if(map->mName)
-      free(map->mName);
+      _ctmFree(self, map->mName);
 
     // Free file name
     if(map->mFileName)
-      free(map->mFileName);
+      _ctmFree(self, map->mFileName);
 
     nextMap = map->mNext;
-    free(map);
+    _ctmFree(self, map);
     map = nextMap;
   }
 }
@@ -77,11 +94,11 @@ static void _ctmClearMesh(_CTMcontext * self)
   if(self->mMode == CTM_IMPORT)
   {
     if(self->mVertices)
-      free(self->mVertices);
+      _ctmFree(self, self->mVertices);
     if(self->mIndices)
-      free(self->mIndices);
+      _ctmFree(self, self->mIndices);
     if(self->mNormals)
-      free(self->mNormals);
+      _ctmFree(self, self->mNormals);
   }
 
   // Clear externally assigned mesh arrays
@@ -90,6 +107,11 @@ static void _ctmClearMesh(_CTMcontext * self)
   self->mIndices = (CTMuint *) 0;
   self->mTriangleCount = 0;
   self->mNormals = (CTMfloat *) 0;
+  self->mFileHasNormals = 0;
+  self->mHeaderOnly = 0;
+  self->mHasBoundingBox = 0;
+  self->mTiled = 0;
+  self->mTileCount = 0;
 
   // Free UV coordinate map list
   _ctmFreeMapList(self, self->mUVMaps);
@@ -103,81 +125,205 @@ static void _ctmClearMesh(_CTMcontext * self)
 }
 
 //-----------------------------------------------------------------------------
-// _ctmCheckMeshIntegrity() - Check if a mesh is valid (i.e. is non-empty, and
-// contains valid data).
+// _ctmScratch() - Get scratch buffer aSlot of the context, with room for at
+// least aSize bytes. The buffer is only reallocated when it needs to grow, and
+// is kept until the context is freed. The contents of the buffer are
+// undefined. Returns NULL (and sets the error code) if out of memory.
 //-----------------------------------------------------------------------------
-
-static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
+void * _ctmScratch(_CTMcontext * self, CTMuint aSlot, size_t aSize)
 {
+  size_t total;
   CTMuint i;
-  _CTMfloatmap * map;
 
-  // Check that we have all the mandatory data
-  if(!self->mVertices || !self->mIndices || (self->mVertexCount < 1) ||
-     (self->mTriangleCount < 1))
-  {
-    return CTM_FALSE;
-  }
+  if(aSize == 0)
+    aSize = 1;
 
-  // Check that all indices are within range
-  for(i = 0; i < (self->mTriangleCount * 3); ++ i)
+  if(aSize > self->mScratchSize[aSlot])
   {
-    if(self->mIndices[i] >= self->mVertexCount)
+    if(self->mScratch[aSlot])
+      _ctmFree(self, self->mScratch[aSlot]);
+    self->mScratch[aSlot] = _ctmMalloc(self, aSize);
+    if(!self->mScratch[aSlot])
     {
-      return CTM_FALSE;
+      self->mScratchSize[aSlot] = 0;
+      self->mError = CTM_OUT_OF_MEMORY;
+      return (void *) 0;
     }
+    self->mScratchSize[aSlot] = aSize;
+
+    // Keep track of the peak scratch memory (see ctmGetStats())
+    total = 0;
+    for(i = 0; i < _CTM_SCRATCH_COUNT; ++ i)
+      total += self->mScratchSize[i];
+    if(total > self->mStats.mPeakScratch)
+      self->mStats.mPeakScratch = total;
   }
 
-  // Check that all vertices are finite (non-NaN, non-inf)
-  for(i = 0; i < self->mVertexCount * 3; ++ i)
+  return self->mScratch[aSlot];
+}
+
+//-----------------------------------------------------------------------------
+// _ctmProgress() - Report the progress of the current operation to the
+// progress callback (if any), and check if the operation has been cancelled.
+// Returns CTM_FALSE (and sets the error code to CTM_CANCELLED) if the
+// operation should stop.
+//-----------------------------------------------------------------------------
+int _ctmProgress(_CTMcontext * self, CTMenum aStage, CTMfloat aProgress)
+{
+  if(!*self->mCancelFlag && self->mProgressFn &&
+     !self->mProgressFn(aStage, aProgress, self->mProgressUserData))
+    *self->mCancelFlag = CTM_TRUE;
+
+  if(*self->mCancelFlag)
   {
-    if(!isfinite(self->mVertices[i]))
-    {
-      return CTM_FALSE;
-    }
+    self->mError = CTM_CANCELLED;
+    return CTM_FALSE;
   }
+  return CTM_TRUE;
+}
 
-  // Check that all normals are finite (non-NaN, non-inf)
-  if(self->mNormals)
+//-----------------------------------------------------------------------------
+// _ctmStatsReset() - Clear the statistics of the context (at the start of a
+// load or save). Scratch buffers that are kept from earlier operations count
+// towards the peak scratch memory.
+//-----------------------------------------------------------------------------
+static void _ctmStatsReset(_CTMcontext * self)
+{
+  CTMuint i;
+
+  memset(&self->mStats, 0, sizeof(CTMstats));
+  for(i = 0; i < _CTM_SCRATCH_COUNT; ++ i)
+    self->mStats.mPeakScratch += self->mScratchSize[i];
+  self->mBlockTag = 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStatsTime() - Add the time since aStart (from _ctmTime()) to a stage
+// time of the statistics.
+//-----------------------------------------------------------------------------
+void _ctmStatsTime(CTMfloat * aTime, double aStart)
+{
+  *aTime += (CTMfloat) (_ctmTime() - aStart);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStatsBlock() - Add a data block to the statistics of the context. All
+// blocks of the same type (FOURCC) share one entry. Blocks of new types are
+// only counted in the totals when all entries are used.
+//-----------------------------------------------------------------------------
+void _ctmStatsBlock(_CTMcontext * self, CTMuint aTag, size_t aRawSize,
+  size_t aPackedSize, CTMuint aLZMACalls, CTMfloat aLZMATime)
+{
+  CTMstats * stats = &self->mStats;
+  CTMstatsblock * block;
+  CTMuint i;
+
+  stats->mLZMACalls += aLZMACalls;
+  stats->mLZMATime += aLZMATime;
+
+  // Find (or add) the entry for this block type
+  for(i = 0; i < stats->mBlockCount; ++ i)
   {
-    for(i = 0; i < self->mVertexCount * 3; ++ i)
-    {
-      if(!isfinite(self->mNormals[i]))
-      {
-        return CTM_FALSE;
-      }
-    }
+    if(stats->mBlocks[i].mFourCC == aTag)
+      break;
+  }
+  if(i == stats->mBlockCount)
+  {
+    if(i >= CTM_STATS_MAX_BLOCKS)
+      return;
+    memset(&stats->mBlocks[i], 0, sizeof(CTMstatsblock));
+    stats->mBlocks[i].mFourCC = aTag;
+    ++ stats->mBlockCount;
   }
 
-  // Check that all UV maps are finite (non-NaN, non-inf)
-  map = self->mUVMaps;
-  while(map)
+  block = &stats->mBlocks[i];
+  block->mLZMACalls += aLZMACalls;
+  block->mLZMATime += aLZMATime;
+  block->mRawSize += aRawSize;
+  block->mPackedSize += aPackedSize;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStatsMerge() - Add the statistics of a tile context to the statistics
+// of the context that created it (the total time and peak scratch memory of
+// the tile are part of the operation of the parent context).
+//-----------------------------------------------------------------------------
+void _ctmStatsMerge(_CTMcontext * self, _CTMcontext * aChild)
+{
+  CTMstats * stats = &self->mStats;
+  CTMstats * child = &aChild->mStats;
+  size_t peak;
+  CTMuint i;
+
+  stats->mGridTime += child->mGridTime;
+  stats->mSortTime += child->mSortTime;
+  stats->mReIndexTime += child->mReIndexTime;
+  stats->mDeltaTime += child->mDeltaTime;
+  stats->mNormalTime += child->mNormalTime;
+  stats->mCheckTime += child->mCheckTime;
+  for(i = 0; i < child->mBlockCount; ++ i)
+  {
+    _ctmStatsBlock(self, child->mBlocks[i].mFourCC,
+      child->mBlocks[i].mRawSize, child->mBlocks[i].mPackedSize,
+      child->mBlocks[i].mLZMACalls, child->mBlocks[i].mLZMATime);
+  }
+
+  // The scratch buffers of the tile exist next to those of the parent
+  peak = child->mPeakScratch;
+  for(i = 0; i < _CTM_SCRATCH_COUNT; ++ i)
+    peak += self->mScratchSize[i];
+  if(peak > stats->mPeakScratch)
+    stats->mPeakScratch = peak;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCheckMeshSize() - Check that the vertex and triangle counts of a mesh
+// are supported. If a count is above the limits of the library, aLimitError
+// is reported. If the mesh arrays (and the temporary arrays of the coders,
+// which need less than 32 bytes per vertex or triangle) are too large for the
+// address space of the host, CTM_OUT_OF_MEMORY is reported.
+//-----------------------------------------------------------------------------
+static CTMint _ctmCheckMeshSize(_CTMcontext * self, CTMuint aVertexCount,
+  CTMuint aTriangleCount, CTMenum aLimitError)
+{
+  if((aVertexCount > _CTM_MAX_VERTEX_COUNT) ||
+     (aTriangleCount > _CTM_MAX_TRIANGLE_COUNT))
   {
-    for(i = 0; i < self->mVertexCount * 2; ++ i)
-    {
-      if(!isfinite(map->mValues[i]))
-      {
-        return CTM_FALSE;
-      }
-    }
-    map = map->mNext;
+    self->mError = aLimitError;
+    return CTM_FALSE;
+  }
+  if((((size_t) aVertexCount * 32) / 32 != aVertexCount) ||
+     (((size_t) aTriangleCount * 32) / 32 != aTriangleCount))
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
   }
+  return CTM_TRUE;
+}
 
-  // Check that all attribute maps are finite (non-NaN, non-inf)
-  map = self->mAttribMaps;
-  while(map)
+//-----------------------------------------------------------------------------
+// _ctmCheckMeshIntegrity() - Check if a mesh is valid (i.e. is non-empty, and
+// contains valid data).
+//-----------------------------------------------------------------------------
+
+static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
+{
+  double start;
+  CTMint result;
+
+  // Check that we have all the mandatory data
+  if(!self->mVertices || !self->mIndices || (self->mVertexCount < 1) ||
+     (self->mTriangleCount < 1))
   {
-    for(i = 0; i < self->mVertexCount * 4; ++ i)
-    {
-      if(!isfinite(map->mValues[i]))
-      {
-        return CTM_FALSE;
-      }
-    }
-    map = map->mNext;
+    return CTM_FALSE;
   }
 
-  return CTM_TRUE;
+  // Check that all indices are within range, and that all vertices,
+  // normals, UV coordinates and attributes are finite (non-NaN, non-inf)
+  start = _ctmTime();
+  result = _ctmCheckMeshData(self);
+  _ctmStatsTime(&self->mStats.mCheckTime, start);
+  return result;
 }
 
 //-----------------------------------------------------------------------------
@@ -196,8 +342,21 @@ CTMEXPORT CTMcontext CTMCALL ctmNewContext(CTMenum aMode)
   self->mError = CTM_NONE;
   self->mMethod = CTM_METHOD_MG1;
   self->mCompressionLevel = 1;
+  self->mFileFormat = _CTM_FORMAT_VERSION;
   self->mVertexPrecision = 1.0f / 1024.0f;
   self->mNormalPrecision = 1.0f / 256.0f;
+  self->mThreadCount = 1;
+  self->mLZMAThreads = 1;
+  self->mVertexSortOrder = CTM_ORDER_GRID;
+  self->mVertexCodec = CTM_CODEC_DEFAULT;
+  self->mIndexCodec = CTM_CODEC_DEFAULT;
+  self->mNormalCodec = CTM_CODEC_DEFAULT;
+  self->mBlockCodec = CTM_CODEC_DEFAULT;
+  self->mStreamBufferSize = _CTM_STREAM_BUFFER_SIZE;
+  self->mTileDivision[0] = 1;
+  self->mTileDivision[1] = 1;
+  self->mTileDivision[2] = 1;
+  self->mCancelFlag = &self->mCancel;
 
   return (CTMcontext) self;
 }
@@ -208,14 +367,36 @@ CTMEXPORT CTMcontext CTMCALL ctmNewContext(CTMenum aMode)
 CTMEXPORT void CTMCALL ctmFreeContext(CTMcontext aContext)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
+  CTMuint i;
   if(!self) return;
 
+  // Stop any asynchronous load or save
+  if(self->mTask)
+  {
+    self->mCancel = CTM_TRUE;
+    ctmWait(aContext);
+  }
+
   // Free all mesh resources
   _ctmClearMesh(self);
 
   // Free the file comment
   if(self->mFileComment)
-    free(self->mFileComment);
+    _ctmFree(self, self->mFileComment);
+
+  // Stop the worker threads
+  _ctmThreadPoolDestroy(self->mThreadPool);
+
+  // Free the stream buffer
+  if(self->mStreamBuffer)
+    _ctmFree(self, self->mStreamBuffer);
+
+  // Free the scratch buffers
+  for(i = 0; i < _CTM_SCRATCH_COUNT; ++ i)
+  {
+    if(self->mScratch[i])
+      _ctmFree(self, self->mScratch[i]);
+  }
 
   // Free the context
   free(self);
@@ -264,6 +445,8 @@ CTMEXPORT const char * CTMCALL ctmErrorString(CTMenum aError)
       return "CTM_INTERNAL_ERROR";
     case CTM_UNSUPPORTED_FORMAT_VERSION:
       return "CTM_UNSUPPORTED_FORMAT_VERSION";
+    case CTM_CANCELLED:
+      return "CTM_CANCELLED";
     default:
       return "Unknown error code";
   }
@@ -292,11 +475,34 @@ CTMEXPORT CTMuint CTMCALL ctmGetInteger(CTMcontext aContext, CTMenum aProperty)
       return self->mAttribMapCount;
 
     case CTM_HAS_NORMALS:
+      if(self->mHeaderOnly)
+        return self->mFileHasNormals ? CTM_TRUE : CTM_FALSE;
       return self->mNormals ? CTM_TRUE : CTM_FALSE;
 
     case CTM_COMPRESSION_METHOD:
       return (CTMuint) self->mMethod;
 
+    case CTM_COMPRESSION_THREADS:
+      return self->mThreadCount;
+
+    case CTM_FILE_FORMAT:
+      return self->mFileFormat;
+
+    case CTM_LZMA_THREADS:
+      return self->mLZMAThreads;
+
+    case CTM_STREAM_BUFFER_SIZE:
+      return self->mStreamBufferSize;
+
+    case CTM_TILE_COUNT:
+      return self->mTileCount;
+
+    case CTM_LZMA_SEARCH:
+      return self->mLZMASearch;
+
+    case CTM_VERTEX_ORDER:
+      return self->mVertexSortOrder;
+
     default:
       self->mError = CTM_INVALID_ARGUMENT;
   }
@@ -405,6 +611,9 @@ CTMEXPORT const CTMfloat * CTMCALL ctmGetFloatArray(CTMcontext aContext,
     case CTM_NORMALS:
       return self->mNormals;
 
+    case CTM_BOUNDING_BOX:
+      return self->mHasBoundingBox ? self->mBoundingBox : (CTMfloat *) 0;
+
     default:
       self->mError = CTM_INVALID_ARGUMENT;
   }
@@ -656,7 +865,7 @@ CTMEXPORT void CTMCALL ctmCompressionMethod(CTMcontext aContext,
 
   // Check arguments
   if((aMethod != CTM_METHOD_RAW) && (aMethod != CTM_METHOD_MG1) &&
-     (aMethod != CTM_METHOD_MG2))
+     (aMethod != CTM_METHOD_MG2) && (aMethod != CTM_METHOD_MG3))
   {
     self->mError = CTM_INVALID_ARGUMENT;
     return;
@@ -694,41 +903,39 @@ CTMEXPORT void CTMCALL ctmCompressionLevel(CTMcontext aContext,
 }
 
 //-----------------------------------------------------------------------------
-// ctmVertexPrecision()
+// ctmCompressionThreads()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmVertexPrecision(CTMcontext aContext,
-  CTMfloat aPrecision)
+CTMEXPORT void CTMCALL ctmCompressionThreads(CTMcontext aContext,
+  CTMuint aThreadCount)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
   if(!self) return;
 
-  // You are only allowed to change compression attributes in export mode
-  if(self->mMode != CTM_EXPORT)
+  // Check arguments
+  if(aThreadCount > 64)
   {
-    self->mError = CTM_INVALID_OPERATION;
+    self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
 
-  // Check arguments
-  if(aPrecision <= 0.0f)
+  // Stop the old worker threads (a new pool is created when needed)
+  if(aThreadCount != self->mThreadCount)
   {
-    self->mError = CTM_INVALID_ARGUMENT;
-    return;
+    _ctmThreadPoolDestroy(self->mThreadPool);
+    self->mThreadPool = (_CTMthreadpool *) 0;
   }
 
-  // Set precision
-  self->mVertexPrecision = aPrecision;
+  // Set the thread count
+  self->mThreadCount = aThreadCount;
 }
 
 //-----------------------------------------------------------------------------
-// ctmVertexPrecisionRel()
+// ctmLZMAThreads()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmVertexPrecisionRel(CTMcontext aContext,
-  CTMfloat aRelPrecision)
+CTMEXPORT void CTMCALL ctmLZMAThreads(CTMcontext aContext,
+  CTMuint aThreadCount)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
-  CTMfloat avgEdgeLength, * p1, * p2;
-  CTMuint edgeCount, i, j;
   if(!self) return;
 
   // You are only allowed to change compression attributes in export mode
@@ -739,45 +946,39 @@ CTMEXPORT void CTMCALL ctmVertexPrecisionRel(CTMcontext aContext,
   }
 
   // Check arguments
-  if(aRelPrecision <= 0.0f)
+  if((aThreadCount < 1) || (aThreadCount > 2))
   {
     self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
 
-  // Calculate the average edge length (Note: we actually sum up all the half-
-  // edges, so in a proper solid mesh all connected edges are counted twice)
-  avgEdgeLength = 0.0f;
-  edgeCount = 0;
-  for(i = 0; i < self->mTriangleCount; ++ i)
-  {
-    p1 = &self->mVertices[self->mIndices[i * 3 + 2] * 3];
-    for(j = 0; j < 3; ++ j)
-    {
-      p2 = &self->mVertices[self->mIndices[i * 3 + j] * 3];
-      avgEdgeLength += sqrtf((p2[0] - p1[0]) * (p2[0] - p1[0]) +
-                             (p2[1] - p1[1]) * (p2[1] - p1[1]) +
-                             (p2[2] - p1[2]) * (p2[2] - p1[2]));
-      p1 = p2;
-      ++ edgeCount;
-    }
-  }
-  if(edgeCount == 0)
+  // Set the number of match finder threads
+  self->mLZMAThreads = aThreadCount;
+}
+
+//-----------------------------------------------------------------------------
+// ctmLZMASearch()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLZMASearch(CTMcontext aContext, CTMuint aSearch)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
   {
-    self->mError = CTM_INVALID_MESH;
+    self->mError = CTM_INVALID_OPERATION;
     return;
   }
-  avgEdgeLength /= (CTMfloat) edgeCount;
 
-  // Set precision
-  self->mVertexPrecision = aRelPrecision * avgEdgeLength;
+  // Enable or disable the search
+  self->mLZMASearch = aSearch ? CTM_TRUE : CTM_FALSE;
 }
 
 //-----------------------------------------------------------------------------
-// ctmNormalPrecision()
+// ctmVertexOrder()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmNormalPrecision(CTMcontext aContext,
-  CTMfloat aPrecision)
+CTMEXPORT void CTMCALL ctmVertexOrder(CTMcontext aContext, CTMenum aOrder)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
   if(!self) return;
@@ -790,21 +991,22 @@ CTMEXPORT void CTMCALL ctmNormalPrecision(CTMcontext aContext,
   }
 
   // Check arguments
-  if(aPrecision <= 0.0f)
+  if((aOrder != CTM_ORDER_GRID) && (aOrder != CTM_ORDER_MORTON) &&
+     (aOrder != CTM_ORDER_HILBERT))
   {
     self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
 
-  // Set precision
-  self->mNormalPrecision = aPrecision;
+  // Set the vertex order
+  self->mVertexSortOrder = aOrder;
 }
 
 //-----------------------------------------------------------------------------
-// ctmUVCoordPrecision()
+// ctmCompressionCodec()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmUVCoordPrecision(CTMcontext aContext,
-  CTMenum aUVMap, CTMfloat aPrecision)
+CTMEXPORT void CTMCALL ctmCompressionCodec(CTMcontext aContext,
+  CTMenum aArray, CTMenum aCodec)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
   _CTMfloatmap * map;
@@ -819,19 +1021,45 @@ CTMEXPORT void CTMCALL ctmUVCoordPrecision(CTMcontext aContext,
   }
 
   // Check arguments
-  if(aPrecision <= 0.0f)
+  if((aCodec != CTM_CODEC_DEFAULT) && (aCodec != CTM_CODEC_LZMA) &&
+     (aCodec != CTM_CODEC_RANS) && (aCodec != CTM_CODEC_STORE))
   {
     self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
 
-  // Find the indicated map
-  map = self->mUVMaps;
-  i = CTM_UV_MAP_1;
-  while(map && (i != aUVMap))
+  // Which array?
+  switch(aArray)
   {
-    ++ i;
-    map = map->mNext;
+    case CTM_VERTICES:
+      self->mVertexCodec = aCodec;
+      return;
+
+    case CTM_INDICES:
+      self->mIndexCodec = aCodec;
+      return;
+
+    case CTM_NORMALS:
+      self->mNormalCodec = aCodec;
+      return;
+
+    default:
+      break;
+  }
+
+  // Find the indicated UV or attribute map
+  map = (_CTMfloatmap *) 0;
+  if((aArray >= CTM_UV_MAP_1) && (aArray <= CTM_UV_MAP_8))
+  {
+    map = self->mUVMaps;
+    for(i = CTM_UV_MAP_1; map && (i != aArray); ++ i)
+      map = map->mNext;
+  }
+  else if((aArray >= CTM_ATTRIB_MAP_1) && (aArray <= CTM_ATTRIB_MAP_8))
+  {
+    map = self->mAttribMaps;
+    for(i = CTM_ATTRIB_MAP_1; map && (i != aArray); ++ i)
+      map = map->mNext;
   }
   if(!map)
   {
@@ -839,22 +1067,19 @@ CTMEXPORT void CTMCALL ctmUVCoordPrecision(CTMcontext aContext,
     return;
   }
 
-  // Update the precision
-  map->mPrecision = aPrecision;
+  // Update the codec
+  map->mCodec = aCodec;
 }
 
 //-----------------------------------------------------------------------------
-// ctmAttribPrecision()
+// ctmFileFormat()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmAttribPrecision(CTMcontext aContext,
-  CTMenum aAttribMap, CTMfloat aPrecision)
+CTMEXPORT void CTMCALL ctmFileFormat(CTMcontext aContext, CTMuint aVersion)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
-  _CTMfloatmap * map;
-  CTMuint i;
   if(!self) return;
 
-  // You are only allowed to change compression attributes in export mode
+  // You are only allowed to change the file format in export mode
   if(self->mMode != CTM_EXPORT)
   {
     self->mError = CTM_INVALID_OPERATION;
@@ -862,461 +1087,1239 @@ CTMEXPORT void CTMCALL ctmAttribPrecision(CTMcontext aContext,
   }
 
   // Check arguments
-  if(aPrecision <= 0.0f)
+  if((aVersion != _CTM_FORMAT_VERSION) &&
+     (aVersion != _CTM_FORMAT_VERSION_FRAMED) &&
+     (aVersion != _CTM_FORMAT_VERSION_CODECS))
   {
     self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
 
-  // Find the indicated map
-  map = self->mAttribMaps;
-  i = CTM_ATTRIB_MAP_1;
-  while(map && (i != aAttribMap))
+  // Set the file format version
+  self->mFileFormat = aVersion;
+}
+
+//-----------------------------------------------------------------------------
+// ctmStreamBufferSize()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmStreamBufferSize(CTMcontext aContext, CTMuint aSize)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // Free the old buffer (a new buffer is allocated when needed)
+  if(aSize != self->mStreamBufferSize)
   {
-    ++ i;
-    map = map->mNext;
+    if(self->mStreamBuffer)
+      _ctmFree(self, self->mStreamBuffer);
+    self->mStreamBuffer = (unsigned char *) 0;
   }
-  if(!map)
+
+  // Set the buffer size (this also enables the buffer for custom streams)
+  self->mStreamBufferSize = aSize;
+  self->mStreamBufferCustom = CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadSelect()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadSelect(CTMcontext aContext, CTMenum aArray,
+  CTMuint aLoad)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  CTMuint * skip, bit;
+  if(!self) return;
+
+  // Array selection only applies to loading, i.e. import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Which array? (vertices and indices are always loaded)
+  if(aArray == CTM_NORMALS)
+  {
+    skip = &self->mSkipNormals;
+    bit = 1;
+  }
+  else if((aArray >= CTM_UV_MAP_1) && (aArray <= CTM_UV_MAP_8))
+  {
+    skip = &self->mSkipUVMaps;
+    bit = 1u << (aArray - CTM_UV_MAP_1);
+  }
+  else if((aArray >= CTM_ATTRIB_MAP_1) && (aArray <= CTM_ATTRIB_MAP_8))
+  {
+    skip = &self->mSkipAttribMaps;
+    bit = 1u << (aArray - CTM_ATTRIB_MAP_1);
+  }
+  else
   {
     self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
 
-  // Update the precision
-  map->mPrecision = aPrecision;
+  // Update the selection
+  if(aLoad)
+    *skip &= ~bit;
+  else
+    *skip |= bit;
 }
 
 //-----------------------------------------------------------------------------
-// ctmFileComment()
+// ctmTileDivision()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmFileComment(CTMcontext aContext,
-  const char * aFileComment)
+CTMEXPORT void CTMCALL ctmTileDivision(CTMcontext aContext, CTMuint aX,
+  CTMuint aY, CTMuint aZ)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
-  int len;
   if(!self) return;
 
-  // You are only allowed to change file attributes in export mode
+  // You are only allowed to change the tile division in export mode
   if(self->mMode != CTM_EXPORT)
   {
     self->mError = CTM_INVALID_OPERATION;
     return;
   }
 
-  // Free the old comment string, if necessary
-  if(self->mFileComment)
-  {
-    free(self->mFileComment);
-    self->mFileComment = (char *) 0;
-  }
-
-  // Get length of string (if empty, do nothing)
-  if(!aFileComment)
-    return;
-  len = strlen(aFileComment);
-  if(!len)
-    return;
-
-  // Copy the string
-  self->mFileComment = (char *) malloc(len + 1);
-  if(!self->mFileComment)
+  // Check arguments
+  if((aX < 1) || (aY < 1) || (aZ < 1) || (aX > _CTM_MAX_TILE_COUNT) ||
+     (aY > _CTM_MAX_TILE_COUNT / aX) || (aZ > _CTM_MAX_TILE_COUNT / (aX * aY)))
   {
-    self->mError = CTM_OUT_OF_MEMORY;
+    self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
-  strcpy(self->mFileComment, aFileComment);
+
+  // Set the tile division
+  self->mTileDivision[0] = aX;
+  self->mTileDivision[1] = aY;
+  self->mTileDivision[2] = aZ;
 }
 
 //-----------------------------------------------------------------------------
-// ctmDefineMesh()
+// ctmLoadRegion()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmDefineMesh(CTMcontext aContext,
-  const CTMfloat * aVertices, CTMuint aVertexCount, const CTMuint * aIndices,
-  CTMuint aTriangleCount, const CTMfloat * aNormals)
+CTMEXPORT void CTMCALL ctmLoadRegion(CTMcontext aContext,
+  const CTMfloat * aMin, const CTMfloat * aMax)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
+  CTMuint i;
   if(!self) return;
 
-  // You are only allowed to (re)define the mesh in export mode
-  if(self->mMode != CTM_EXPORT)
+  // The region of interest only applies to loading, i.e. import mode
+  if(self->mMode != CTM_IMPORT)
   {
     self->mError = CTM_INVALID_OPERATION;
     return;
   }
 
-  // Check arguments
-  if(!aVertices || !aIndices || !aVertexCount || !aTriangleCount)
+  // No region = load the whole mesh
+  if(!aMin || !aMax)
   {
-    self->mError = CTM_INVALID_ARGUMENT;
+    self->mHasRegion = CTM_FALSE;
     return;
   }
 
-  // Clear the old mesh, if any
-  _ctmClearMesh(self);
-
-  // Set vertex array pointer
-  self->mVertices = (CTMfloat *) aVertices;
-  self->mVertexCount = aVertexCount;
-
-  // Set index array pointer
-  self->mIndices = (CTMuint *) aIndices;
-  self->mTriangleCount = aTriangleCount;
+  // Check arguments
+  for(i = 0; i < 3; ++ i)
+  {
+    if(!(aMin[i] <= aMax[i]))
+    {
+      self->mError = CTM_INVALID_ARGUMENT;
+      return;
+    }
+  }
 
-  // Set normal array pointer
-  self->mNormals = (CTMfloat *) aNormals;
+  // Set the region
+  for(i = 0; i < 3; ++ i)
+  {
+    self->mRegion[i] = aMin[i];
+    self->mRegion[i + 3] = aMax[i];
+  }
+  self->mHasRegion = CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmAddFloatMap()
+// ctmSetAllocator()
 //-----------------------------------------------------------------------------
-static _CTMfloatmap * _ctmAddFloatMap(_CTMcontext * self,
-  const CTMfloat * aValues, const char * aName, const char * aFileName,
-  _CTMfloatmap ** aList)
+CTMEXPORT void CTMCALL ctmSetAllocator(CTMcontext aContext,
+  CTMallocfn aAllocFn, CTMfreefn aFreeFn, void * aUserData)
 {
-  _CTMfloatmap * map;
-  CTMuint len;
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  CTMuint i;
+  if(!self) return;
 
-  // Allocate memory for a new map list item and append it to the list
-  if(!*aList)
+  // Check arguments
+  if((aAllocFn && !aFreeFn) || (!aAllocFn && aFreeFn))
   {
-    *aList = (_CTMfloatmap *) malloc(sizeof(_CTMfloatmap));
-    map = *aList;
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
   }
-  else
+
+  // Memory that was allocated with the old allocator must not be freed with
+  // the new one, so the context may not hold any mesh data
+  if(self->mVertices || self->mIndices || self->mUVMaps ||
+     self->mAttribMaps || self->mFileComment)
   {
-    map = *aList;
-    while(map->mNext)
-      map = map->mNext;
-    map->mNext = (_CTMfloatmap *) malloc(sizeof(_CTMfloatmap));
-    map = map->mNext;
+    self->mError = CTM_INVALID_OPERATION;
+    return;
   }
-  if(!map)
+
+  // Free the stream buffer and the scratch buffers (they are allocated again
+  // with the new allocator when needed)
+  _ctmFree(self, self->mStreamBuffer);
+  self->mStreamBuffer = (unsigned char *) 0;
+  for(i = 0; i < _CTM_SCRATCH_COUNT; ++ i)
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return (_CTMfloatmap *) 0;
+    _ctmFree(self, self->mScratch[i]);
+    self->mScratch[i] = (void *) 0;
+    self->mScratchSize[i] = 0;
   }
 
-  // Init the map item
-  memset(map, 0, sizeof(_CTMfloatmap));
-  map->mPrecision = 1.0f / 1024.0f;
-  map->mValues = (CTMfloat *) aValues;
+  // Set the allocator
+  self->mAllocFn = aAllocFn;
+  self->mFreeFn = aFreeFn;
+  self->mAllocUserData = aUserData;
+}
 
-  // Set name of the map
-  if(aName)
-  {
-    // Get length of string (if empty, do nothing)
-    len = strlen(aName);
-    if(len)
-    {
-      // Copy the string
-      map->mName = (char *) malloc(len + 1);
-      if(!map->mName)
-      {
-        self->mError = CTM_OUT_OF_MEMORY;
-        free(map);
-        return (_CTMfloatmap *) 0;
-      }
-      strcpy(map->mName, aName);
-    }
-  }
+//-----------------------------------------------------------------------------
+// ctmProgressCallback()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmProgressCallback(CTMcontext aContext,
+  CTMprogressfn aProgressFn, void * aUserData)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
 
-  // Set file name reference for the map
-  if(aFileName)
-  {
-    // Get length of string (if empty, do nothing)
-    len = strlen(aFileName);
-    if(len)
-    {
-      // Copy the string
-      map->mFileName = (char *) malloc(len + 1);
-      if(!map->mFileName)
-      {
-        self->mError = CTM_OUT_OF_MEMORY;
-        if(map->mName)
-          free(map->mName);
-        free(map);
-        return (_CTMfloatmap *) 0;
-      }
-      strcpy(map->mFileName, aFileName);
-    }
-  }
+  self->mProgressFn = aProgressFn;
+  self->mProgressUserData = aUserData;
+}
 
-  return map;
+//-----------------------------------------------------------------------------
+// ctmCancel()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmCancel(CTMcontext aContext)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  self->mCancel = CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// ctmAddUVMap()
+// ctmGetStats()
 //-----------------------------------------------------------------------------
-CTMEXPORT CTMenum CTMCALL ctmAddUVMap(CTMcontext aContext,
-  const CTMfloat * aUVCoords, const char * aName, const char * aFileName)
+CTMEXPORT void CTMCALL ctmGetStats(CTMcontext aContext, CTMstats * aStats)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
-  _CTMfloatmap * map;
-  if(!self) return CTM_NONE;
+  if(!self) return;
 
-  // Add a new UV map to the UV map list
-  map = _ctmAddFloatMap(self, aUVCoords, aName, aFileName, &self->mUVMaps);
-  if(!map)
-    return CTM_NONE;
-  else
+  if(!aStats)
   {
-    // The default UV coordinate precision is 2^-12
-    map->mPrecision = 1.0f / 4096.0f;
-    ++ self->mUVMapCount;
-    return CTM_UV_MAP_1 + self->mUVMapCount - 1;
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
   }
+  *aStats = self->mStats;
 }
 
 //-----------------------------------------------------------------------------
-// ctmAddAttribMap()
+// ctmVertexPrecision()
 //-----------------------------------------------------------------------------
-CTMEXPORT CTMenum CTMCALL ctmAddAttribMap(CTMcontext aContext,
-  const CTMfloat * aAttribValues, const char * aName)
+CTMEXPORT void CTMCALL ctmVertexPrecision(CTMcontext aContext,
+  CTMfloat aPrecision)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
-  _CTMfloatmap * map;
-  if(!self) return CTM_NONE;
+  if(!self) return;
 
-  // Add a new attribute map to the attribute map list
-  map = _ctmAddFloatMap(self, aAttribValues, aName, (const char *) 0,
-                        &self->mAttribMaps);
-  if(!map)
-    return CTM_NONE;
-  else
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
   {
-    // The default vertex attribute precision is 2^-8
-    map->mPrecision = 1.0f / 256.0f;
-    ++ self->mAttribMapCount;
-    return CTM_ATTRIB_MAP_1 + self->mAttribMapCount - 1;
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if(aPrecision <= 0.0f)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
   }
+
+  // Set precision
+  self->mVertexPrecision = aPrecision;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmDefaultRead()
+// ctmVertexPrecisionRel()
 //-----------------------------------------------------------------------------
-static CTMuint CTMCALL _ctmDefaultRead(void * aBuf, CTMuint aCount,
-  void * aUserData)
+CTMEXPORT void CTMCALL ctmVertexPrecisionRel(CTMcontext aContext,
+  CTMfloat aRelPrecision)
 {
-  return (CTMuint) fread(aBuf, 1, (size_t) aCount, (FILE *) aUserData);
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  CTMfloat avgEdgeLength;
+  CTMuint edgeCount;
+  if(!self) return;
+
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if(aRelPrecision <= 0.0f)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Calculate the average edge length (Note: we actually sum up all the half-
+  // edges, so in a proper solid mesh all connected edges are counted twice)
+  edgeCount = self->mTriangleCount * 3;
+  if(edgeCount == 0)
+  {
+    self->mError = CTM_INVALID_MESH;
+    return;
+  }
+  avgEdgeLength = (CTMfloat) (_ctmSumEdgeLengths(self) / (double) edgeCount);
+
+  // Set precision
+  self->mVertexPrecision = aRelPrecision * avgEdgeLength;
 }
 
 //-----------------------------------------------------------------------------
-// ctmLoad()
+// ctmNormalPrecision()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmLoad(CTMcontext aContext, const char * aFileName)
+CTMEXPORT void CTMCALL ctmNormalPrecision(CTMcontext aContext,
+  CTMfloat aPrecision)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
-  FILE * f;
   if(!self) return;
 
-  // You are only allowed to load data in import mode
-  if(self->mMode != CTM_IMPORT)
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
   {
     self->mError = CTM_INVALID_OPERATION;
     return;
   }
 
-  // Open file stream
-  f = fopen(aFileName, "rb");
-  if(!f)
+  // Check arguments
+  if(aPrecision <= 0.0f)
   {
-    self->mError = CTM_FILE_ERROR;
+    self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
 
-  // Load the file
-  ctmLoadCustom(self, _ctmDefaultRead, (void *) f);
-
-  // Close file stream
-  fclose(f);
+  // Set precision
+  self->mNormalPrecision = aPrecision;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmAllocateFloatMaps()
+// ctmUVCoordPrecision()
 //-----------------------------------------------------------------------------
-static CTMuint _ctmAllocateFloatMaps(_CTMcontext * self,
-  _CTMfloatmap ** aMapListPtr, CTMuint aCount, CTMuint aChannels)
+CTMEXPORT void CTMCALL ctmUVCoordPrecision(CTMcontext aContext,
+  CTMenum aUVMap, CTMfloat aPrecision)
 {
-  _CTMfloatmap ** mapListPtr;
-  CTMuint i, size;
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  _CTMfloatmap * map;
+  CTMuint i;
+  if(!self) return;
 
-  mapListPtr = aMapListPtr;
-  for(i = 0; i < aCount; ++ i)
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
   {
-    // Allocate & clear memory for this map
-    *mapListPtr = (_CTMfloatmap *) malloc(sizeof(_CTMfloatmap));
-    if(!*mapListPtr)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      return CTM_FALSE;
-    }
-    memset(*mapListPtr, 0, sizeof(_CTMfloatmap));
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if(aPrecision <= 0.0f)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Find the indicated map
+  map = self->mUVMaps;
+  i = CTM_UV_MAP_1;
+  while(map && (i != aUVMap))
+  {
+    ++ i;
+    map = map->mNext;
+  }
+  if(!map)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Update the precision
+  map->mPrecision = aPrecision;
+}
+
+//-----------------------------------------------------------------------------
+// ctmAttribPrecision()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmAttribPrecision(CTMcontext aContext,
+  CTMenum aAttribMap, CTMfloat aPrecision)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  _CTMfloatmap * map;
+  CTMuint i;
+  if(!self) return;
+
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if(aPrecision <= 0.0f)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Find the indicated map
+  map = self->mAttribMaps;
+  i = CTM_ATTRIB_MAP_1;
+  while(map && (i != aAttribMap))
+  {
+    ++ i;
+    map = map->mNext;
+  }
+  if(!map)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Update the precision
+  map->mPrecision = aPrecision;
+}
+
+//-----------------------------------------------------------------------------
+// ctmFileComment()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmFileComment(CTMcontext aContext,
+  const char * aFileComment)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  int len;
+  if(!self) return;
+
+  // You are only allowed to change file attributes in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Free the old comment string, if necessary
+  if(self->mFileComment)
+  {
+    _ctmFree(self, self->mFileComment);
+    self->mFileComment = (char *) 0;
+  }
+
+  // Get length of string (if empty, do nothing)
+  if(!aFileComment)
+    return;
+  len = strlen(aFileComment);
+  if(!len)
+    return;
+
+  // Copy the string
+  self->mFileComment = (char *) _ctmMalloc(self, len + 1);
+  if(!self->mFileComment)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return;
+  }
+  strcpy(self->mFileComment, aFileComment);
+}
+
+//-----------------------------------------------------------------------------
+// ctmDefineMesh()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmDefineMesh(CTMcontext aContext,
+  const CTMfloat * aVertices, CTMuint aVertexCount, const CTMuint * aIndices,
+  CTMuint aTriangleCount, const CTMfloat * aNormals)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to (re)define the mesh in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if(!aVertices || !aIndices || !aVertexCount || !aTriangleCount)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+  if(!_ctmCheckMeshSize(self, aVertexCount, aTriangleCount, CTM_INVALID_ARGUMENT))
+    return;
+
+  // Clear the old mesh, if any
+  _ctmClearMesh(self);
+
+  // Set vertex array pointer
+  self->mVertices = (CTMfloat *) aVertices;
+  self->mVertexCount = aVertexCount;
+
+  // Set index array pointer
+  self->mIndices = (CTMuint *) aIndices;
+  self->mTriangleCount = aTriangleCount;
+
+  // Set normal array pointer
+  self->mNormals = (CTMfloat *) aNormals;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAddFloatMap()
+//-----------------------------------------------------------------------------
+static _CTMfloatmap * _ctmAddFloatMap(_CTMcontext * self,
+  const CTMfloat * aValues, const char * aName, const char * aFileName,
+  _CTMfloatmap ** aList)
+{
+  _CTMfloatmap * map;
+  CTMuint len;
+
+  // Allocate memory for a new map list item and append it to the list
+  if(!*aList)
+  {
+    *aList = (_CTMfloatmap *) _ctmMalloc(self, sizeof(_CTMfloatmap));
+    map = *aList;
+  }
+  else
+  {
+    map = *aList;
+    while(map->mNext)
+      map = map->mNext;
+    map->mNext = (_CTMfloatmap *) _ctmMalloc(self, sizeof(_CTMfloatmap));
+    map = map->mNext;
+  }
+  if(!map)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return (_CTMfloatmap *) 0;
+  }
+
+  // Init the map item
+  memset(map, 0, sizeof(_CTMfloatmap));
+  map->mPrecision = 1.0f / 1024.0f;
+  map->mCodec = CTM_CODEC_DEFAULT;
+  map->mValues = (CTMfloat *) aValues;
+
+  // Set name of the map
+  if(aName)
+  {
+    // Get length of string (if empty, do nothing)
+    len = strlen(aName);
+    if(len)
+    {
+      // Copy the string
+      map->mName = (char *) _ctmMalloc(self, len + 1);
+      if(!map->mName)
+      {
+        self->mError = CTM_OUT_OF_MEMORY;
+        _ctmFree(self, map);
+        return (_CTMfloatmap *) 0;
+      }
+      strcpy(map->mName, aName);
+    }
+  }
+
+  // Set file name reference for the map
+  if(aFileName)
+  {
+    // Get length of string (if empty, do nothing)
+    len = strlen(aFileName);
+    if(len)
+    {
+      // Copy the string
+      map->mFileName = (char *) _ctmMalloc(self, len + 1);
+      if(!map->mFileName)
+      {
+        self->mError = CTM_OUT_OF_MEMORY;
+        if(map->mName)
+          _ctmFree(self, map->mName);
+        _ctmFree(self, map);
+        return (_CTMfloatmap *) 0;
+      }
+      strcpy(map->mFileName, aFileName);
+    }
+  }
+
+  return map;
+}
+
+//-----------------------------------------------------------------------------
+// ctmAddUVMap()
+//-----------------------------------------------------------------------------
+CTMEXPORT CTMenum CTMCALL ctmAddUVMap(CTMcontext aContext,
+  const CTMfloat * aUVCoords, const char * aName, const char * aFileName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  _CTMfloatmap * map;
+  if(!self) return CTM_NONE;
+
+  // Add a new UV map to the UV map list
+  map = _ctmAddFloatMap(self, aUVCoords, aName, aFileName, &self->mUVMaps);
+  if(!map)
+    return CTM_NONE;
+  else
+  {
+    // The default UV coordinate precision is 2^-12
+    map->mPrecision = 1.0f / 4096.0f;
+    ++ self->mUVMapCount;
+    return CTM_UV_MAP_1 + self->mUVMapCount - 1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// ctmAddAttribMap()
+//-----------------------------------------------------------------------------
+CTMEXPORT CTMenum CTMCALL ctmAddAttribMap(CTMcontext aContext,
+  const CTMfloat * aAttribValues, const char * aName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  _CTMfloatmap * map;
+  if(!self) return CTM_NONE;
+
+  // Add a new attribute map to the attribute map list
+  map = _ctmAddFloatMap(self, aAttribValues, aName, (const char *) 0,
+                        &self->mAttribMaps);
+  if(!map)
+    return CTM_NONE;
+  else
+  {
+    // The default vertex attribute precision is 2^-8
+    map->mPrecision = 1.0f / 256.0f;
+    ++ self->mAttribMapCount;
+    return CTM_ATTRIB_MAP_1 + self->mAttribMapCount - 1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAllocateFloatMaps() - Allocate aCount maps. Maps that have their bit
+// set in aSkipMask get no value array (they are skipped when loading).
+//-----------------------------------------------------------------------------
+static CTMuint _ctmAllocateFloatMaps(_CTMcontext * self,
+  _CTMfloatmap ** aMapListPtr, CTMuint aCount, CTMuint aChannels,
+  CTMuint aSkipMask)
+{
+  _CTMfloatmap ** mapListPtr;
+  CTMuint i;
+  size_t size;
+
+  mapListPtr = aMapListPtr;
+  for(i = 0; i < aCount; ++ i)
+  {
+    // Allocate & clear memory for this map
+    *mapListPtr = (_CTMfloatmap *) _ctmMalloc(self, sizeof(_CTMfloatmap));
+    if(!*mapListPtr)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+    memset(*mapListPtr, 0, sizeof(_CTMfloatmap));
+
+    // Allocate & clear memory for the float array (unless skipped)
+    if((i < 32) && (aSkipMask & (1u << i)))
+    {
+      mapListPtr = &(*mapListPtr)->mNext;
+      continue;
+    }
+    size = (size_t) aChannels * sizeof(CTMfloat) * self->mVertexCount;
+    (*mapListPtr)->mValues = (CTMfloat *) _ctmMalloc(self, size);
+    if(!(*mapListPtr)->mValues)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+    memset((*mapListPtr)->mValues, 0, size);
+
+    // Next map...
+    mapListPtr = &(*mapListPtr)->mNext;
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAllocateMesh() - Allocate the mesh arrays of an import context, for the
+// vertex and triangle counts of the context. Arrays that are skipped (see
+// ctmLoadSelect()) are not allocated.
+//-----------------------------------------------------------------------------
+int _ctmAllocateMesh(_CTMcontext * self)
+{
+  self->mVertices = (CTMfloat *) _ctmMalloc(self, self->mVertexCount * sizeof(CTMfloat) * 3);
+  if(!self->mVertices)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  self->mIndices = (CTMuint *) _ctmMalloc(self, self->mTriangleCount * sizeof(CTMuint) * 3);
+  if(!self->mIndices)
+  {
+    _ctmClearMesh(self);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  if(self->mFileHasNormals && !self->mSkipNormals)
+  {
+    self->mNormals = (CTMfloat *) _ctmMalloc(self, self->mVertexCount * sizeof(CTMfloat) * 3);
+    if(!self->mNormals)
+    {
+      _ctmClearMesh(self);
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+  }
+
+  // Allocate memory for the UV and attribute maps (if any, and not skipped)
+  if(!_ctmAllocateFloatMaps(self, &self->mUVMaps, self->mUVMapCount, 2,
+                            self->mSkipUVMaps))
+  {
+    _ctmClearMesh(self);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  if(!_ctmAllocateFloatMaps(self, &self->mAttribMaps, self->mAttribMapCount, 4,
+                            self->mSkipAttribMaps))
+  {
+    _ctmClearMesh(self);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLoadHeader() - Read the map information that follows the file header,
+// without loading any vertex data.
+//-----------------------------------------------------------------------------
+static void _ctmLoadHeader(_CTMcontext * self)
+{
+  self->mHeaderOnly = CTM_TRUE;
+
+  // Create the UV and attribute maps without any value arrays
+  if(!_ctmAllocateFloatMaps(self, &self->mUVMaps, self->mUVMapCount, 2,
+                            ~((CTMuint) 0)) ||
+     !_ctmAllocateFloatMaps(self, &self->mAttribMaps, self->mAttribMapCount, 4,
+                            ~((CTMuint) 0)))
+  {
+    _ctmClearMesh(self);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return;
+  }
+
+  // Read the map information (skipping the vertex data)
+  if(self->mTiled)
+  {
+    _ctmReadHeader_Tiles(self);
+    return;
+  }
+  switch(self->mMethod)
+  {
+    case CTM_METHOD_RAW:
+      _ctmReadHeader_RAW(self);
+      break;
+
+    case CTM_METHOD_MG1:
+      _ctmReadHeader_MG1(self);
+      break;
+
+    case CTM_METHOD_MG2:
+    case CTM_METHOD_MG3:
+      _ctmReadHeader_MG2(self);
+      break;
+
+    default:
+      self->mError = CTM_INTERNAL_ERROR;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLoadMesh() - Load a mesh from a stream. aSeekFn is optional (NULL =
+// skip data by reading it). If aHeaderOnly is true, only the file header and
+// the map information is loaded, and all the vertex data is skipped.
+//-----------------------------------------------------------------------------
+static void _ctmLoadMesh(_CTMcontext * self, CTMreadfn aReadFn,
+  _CTMseekfn aSeekFn, void * aUserData, CTMuint aHeaderOnly)
+{
+  CTMuint formatVersion, flags, method;
+
+  // You are only allowed to load data in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Initialize stream
+  self->mReadFn = aReadFn;
+  self->mSeekFn = aSeekFn;
+  self->mUserData = aUserData;
+  _ctmStreamReset(self);
+
+  // Clear any old mesh arrays
+  _ctmClearMesh(self);
+
+  // Read header from stream
+  if(_ctmStreamReadUINT(self) != FOURCC("OCTM"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return;
+  }
+  formatVersion = _ctmStreamReadUINT(self);
+  if((formatVersion != _CTM_FORMAT_VERSION) &&
+     (formatVersion != _CTM_FORMAT_VERSION_FRAMED) &&
+     (formatVersion != _CTM_FORMAT_VERSION_CODECS))
+  {
+    self->mError = CTM_UNSUPPORTED_FORMAT_VERSION;
+    return;
+  }
+  self->mFileFormat = formatVersion;
+  method = _ctmStreamReadUINT(self);
+  if(method == FOURCC("RAW\0"))
+    self->mMethod = CTM_METHOD_RAW;
+  else if(method == FOURCC("MG1\0"))
+    self->mMethod = CTM_METHOD_MG1;
+  else if(method == FOURCC("MG2\0"))
+    self->mMethod = CTM_METHOD_MG2;
+  else if(method == FOURCC("MG2T"))
+  {
+    self->mMethod = CTM_METHOD_MG2;
+    self->mTiled = CTM_TRUE;
+  }
+  else if(method == FOURCC("MG3\0"))
+    self->mMethod = CTM_METHOD_MG3;
+  else if(method == FOURCC("MG3T"))
+  {
+    self->mMethod = CTM_METHOD_MG3;
+    self->mTiled = CTM_TRUE;
+  }
+  else
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return;
+  }
+  self->mVertexCount = _ctmStreamReadUINT(self);
+  if(self->mVertexCount == 0)
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return;
+  }
+  self->mTriangleCount = _ctmStreamReadUINT(self);
+  if(self->mTriangleCount == 0)
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return;
+  }
+  if(!_ctmCheckMeshSize(self, self->mVertexCount, self->mTriangleCount, CTM_BAD_FORMAT))
+    return;
+  self->mUVMapCount = _ctmStreamReadUINT(self);
+  self->mAttribMapCount = _ctmStreamReadUINT(self);
+  flags = _ctmStreamReadUINT(self);
+  _ctmStreamReadSTRING(self, &self->mFileComment);
+
+  self->mFileHasNormals = (flags & _CTM_HAS_NORMALS_BIT) ? 1 : 0;
+
+  // Only read the map information?
+  if(aHeaderOnly)
+  {
+    _ctmLoadHeader(self);
+    return;
+  }
+
+  // Allocate memory for the mesh arrays (tiled files allocate them while
+  // loading, since the size of the mesh depends on which tiles are loaded)
+  if(!self->mTiled && !_ctmAllocateMesh(self))
+    return;
+
+  // Uncompress from stream
+  if(self->mTiled)
+  {
+    if(!_ctmUncompressMesh_Tiles(self))
+    {
+      _ctmStreamReadDiscard(self);
+      if(*self->mCancelFlag)
+        _ctmClearMesh(self);
+      return;
+    }
+  }
+  else
+  {
+    switch(self->mMethod)
+    {
+      case CTM_METHOD_RAW:
+        _ctmUncompressMesh_RAW(self);
+        break;
+
+      case CTM_METHOD_MG1:
+        _ctmUncompressMesh_MG1(self);
+        break;
+
+      case CTM_METHOD_MG2:
+      case CTM_METHOD_MG3:
+        _ctmUncompressMesh_MG2(self);
+        break;
+
+      default:
+        self->mError = CTM_INTERNAL_ERROR;
+    }
+  }
+
+  // Make sure that no packed blocks are still being uncompressed
+  _ctmStreamReadDiscard(self);
+
+  // A cancelled load leaves no (partial) mesh behind
+  if(*self->mCancelFlag)
+  {
+    _ctmClearMesh(self);
+    self->mError = CTM_CANCELLED;
+    return;
+  }
+
+  // Check mesh integrity
+  if(!_ctmCheckMeshIntegrity(self))
+  {
+    self->mError = CTM_INVALID_MESH;
+    return;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLoadStream() - Load a mesh from a stream (see _ctmLoadMesh()), and
+// collect the statistics of the load.
+//-----------------------------------------------------------------------------
+static void _ctmLoadStream(_CTMcontext * self, CTMreadfn aReadFn,
+  _CTMseekfn aSeekFn, void * aUserData, CTMuint aHeaderOnly)
+{
+  double start;
+
+  _ctmStatsReset(self);
+  start = _ctmTime();
+  _ctmLoadMesh(self, aReadFn, aSeekFn, aUserData, aHeaderOnly);
+  _ctmStatsTime(&self->mStats.mTotalTime, start);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmDefaultRead()
+//-----------------------------------------------------------------------------
+static CTMuint CTMCALL _ctmDefaultRead(void * aBuf, CTMuint aCount,
+  void * aUserData)
+{
+  return (CTMuint) fread(aBuf, 1, (size_t) aCount, (FILE *) aUserData);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmDefaultSeek()
+//-----------------------------------------------------------------------------
+static int _ctmDefaultSeek(size_t aCount, void * aUserData)
+{
+  long offset;
+
+  // Seek in steps that fit in a long (which may be 32 bits wide)
+  while(aCount > 0)
+  {
+    offset = aCount < 0x40000000 ? (long) aCount : 0x40000000L;
+    if(fseek((FILE *) aUserData, offset, SEEK_CUR) != 0)
+      return CTM_FALSE;
+    aCount -= (size_t) offset;
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLoadFile() - Load a mesh (or only its header) from a file.
+//-----------------------------------------------------------------------------
+static void _ctmLoadFile(_CTMcontext * self, const char * aFileName,
+  CTMuint aHeaderOnly)
+{
+  FILE * f;
+
+  // You are only allowed to load data in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Open file stream
+  f = fopen(aFileName, "rb");
+  if(!f)
+  {
+    self->mError = CTM_FILE_ERROR;
+    return;
+  }
+
+  // Load the file (for a header, the vertex data is seeked past)
+  self->mStreamBuffered = CTM_TRUE;
+  _ctmLoadStream(self, _ctmDefaultRead, _ctmDefaultSeek, (void *) f, aHeaderOnly);
+
+  // Close file stream
+  fclose(f);
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoad()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoad(CTMcontext aContext, const char * aFileName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  self->mCancel = CTM_FALSE;
+  _ctmLoadFile(self, aFileName, CTM_FALSE);
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadCustom()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
+  void * aUserData)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  self->mCancel = CTM_FALSE;
+  self->mStreamBuffered = self->mStreamBufferCustom;
+  _ctmLoadStream(self, aReadFn, (_CTMseekfn) 0, aUserData, CTM_FALSE);
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadHeader()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadHeader(CTMcontext aContext,
+  const char * aFileName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  self->mCancel = CTM_FALSE;
+  _ctmLoadFile(self, aFileName, CTM_TRUE);
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadHeaderCustom()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadHeaderCustom(CTMcontext aContext,
+  CTMreadfn aReadFn, void * aUserData)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  self->mCancel = CTM_FALSE;
+  self->mStreamBuffered = self->mStreamBufferCustom;
+  _ctmLoadStream(self, aReadFn, (_CTMseekfn) 0, aUserData, CTM_TRUE);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmDefaultWrite()
+//-----------------------------------------------------------------------------
+static CTMuint CTMCALL _ctmDefaultWrite(const void * aBuf, CTMuint aCount,
+  void * aUserData)
+{
+  return (CTMuint) fwrite(aBuf, 1, (size_t) aCount, (FILE *) aUserData);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmHasCodecs() - Check if any array of the mesh is to be compressed with a
+// codec other than the default codec of the method (see
+// ctmCompressionCodec()).
+//-----------------------------------------------------------------------------
+static int _ctmHasCodecs(_CTMcontext * self)
+{
+  _CTMfloatmap * map;
 
-    // Allocate & clear memory for the float array
-    size = aChannels * sizeof(CTMfloat) * self->mVertexCount;
-    (*mapListPtr)->mValues = (CTMfloat *) malloc(size);
-    if(!(*mapListPtr)->mValues)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      return CTM_FALSE;
-    }
-    memset((*mapListPtr)->mValues, 0, size);
+  // The RAW method does not compress anything
+  if(self->mMethod == CTM_METHOD_RAW)
+    return CTM_FALSE;
 
-    // Next map...
-    mapListPtr = &(*mapListPtr)->mNext;
+  if((self->mVertexCodec != CTM_CODEC_DEFAULT) ||
+     (self->mIndexCodec != CTM_CODEC_DEFAULT) ||
+     (self->mNormalCodec != CTM_CODEC_DEFAULT))
+    return CTM_TRUE;
+  for(map = self->mUVMaps; map; map = map->mNext)
+  {
+    if(map->mCodec != CTM_CODEC_DEFAULT)
+      return CTM_TRUE;
+  }
+  for(map = self->mAttribMaps; map; map = map->mNext)
+  {
+    if(map->mCodec != CTM_CODEC_DEFAULT)
+      return CTM_TRUE;
   }
+  return CTM_FALSE;
+}
 
-  return CTM_TRUE;
+//-----------------------------------------------------------------------------
+// _ctmNeedsFrames() - Check if a packed data stream of the mesh may be too
+// large for a single block with a 32-bit size field (i.e. a v5 file).
+//-----------------------------------------------------------------------------
+static int _ctmNeedsFrames(_CTMcontext * self)
+{
+  double elements;
+
+  // The RAW method does not pack anything
+  if(self->mMethod == CTM_METHOD_RAW)
+    return CTM_FALSE;
+
+  // Largest array: the triangle indices, the vertices (or normals), or the
+  // custom attributes (all arrays hold 32-bit elements)
+  elements = 3.0 * self->mTriangleCount;
+  if(3.0 * self->mVertexCount > elements)
+    elements = 3.0 * self->mVertexCount;
+  if((self->mAttribMapCount > 0) && (4.0 * self->mVertexCount > elements))
+    elements = 4.0 * self->mVertexCount;
+
+  // Worst case packed size (incompressible data)
+  return _CTM_PACKED_SIZE(4.0 * elements) > 4294967295.0;
 }
 
 //-----------------------------------------------------------------------------
-// ctmLoadCustom()
+// _ctmSaveMesh() - Save the mesh to a stream.
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
+static void _ctmSaveMesh(_CTMcontext * self, CTMwritefn aWriteFn,
   void * aUserData)
 {
-  _CTMcontext * self = (_CTMcontext *) aContext;
-  CTMuint formatVersion, flags, method;
-  if(!self) return;
+  CTMuint flags, fileFormat;
 
-  // You are only allowed to load data in import mode
-  if(self->mMode != CTM_IMPORT)
+  // You are only allowed to save data in export mode
+  if(self->mMode != CTM_EXPORT)
   {
     self->mError = CTM_INVALID_OPERATION;
     return;
   }
 
+  // Check mesh integrity
+  if(!_ctmCheckMeshIntegrity(self))
+  {
+    self->mError = CTM_INVALID_MESH;
+    return;
+  }
+
   // Initialize stream
-  self->mReadFn = aReadFn;
+  self->mWriteFn = aWriteFn;
   self->mUserData = aUserData;
+  _ctmStreamReset(self);
 
-  // Clear any old mesh arrays
-  _ctmClearMesh(self);
+  // Determine flags
+  flags = 0;
+  if(self->mNormals)
+    flags |= _CTM_HAS_NORMALS_BIT;
 
-  // Read header from stream
-  if(_ctmStreamReadUINT(self) != FOURCC("OCTM"))
-  {
-    self->mError = CTM_BAD_FORMAT;
-    return;
-  }
-  formatVersion = _ctmStreamReadUINT(self);
-  if(formatVersion != _CTM_FORMAT_VERSION)
-  {
-    self->mError = CTM_UNSUPPORTED_FORMAT_VERSION;
-    return;
-  }
-  method = _ctmStreamReadUINT(self);
-  if(method == FOURCC("RAW\0"))
-    self->mMethod = CTM_METHOD_RAW;
-  else if(method == FOURCC("MG1\0"))
-    self->mMethod = CTM_METHOD_MG1;
-  else if(method == FOURCC("MG2\0"))
-    self->mMethod = CTM_METHOD_MG2;
-  else
-  {
-    self->mError = CTM_BAD_FORMAT;
-    return;
-  }
-  self->mVertexCount = _ctmStreamReadUINT(self);
-  if(self->mVertexCount == 0)
-  {
-    self->mError = CTM_BAD_FORMAT;
-    return;
-  }
-  self->mTriangleCount = _ctmStreamReadUINT(self);
-  if(self->mTriangleCount == 0)
-  {
-    self->mError = CTM_BAD_FORMAT;
-    return;
-  }
-  self->mUVMapCount = _ctmStreamReadUINT(self);
-  self->mAttribMapCount = _ctmStreamReadUINT(self);
-  flags = _ctmStreamReadUINT(self);
-  _ctmStreamReadSTRING(self, &self->mFileComment);
+  // Frames with other codecs than the default need codec tags, i.e. a v7
+  // file, and streams that may not fit in a single block need frames, i.e. a
+  // v6 file (the selected version is restored when the save is done)
+  fileFormat = self->mFileFormat;
+  if(_ctmHasCodecs(self) && (self->mFileFormat < _CTM_FORMAT_VERSION_CODECS))
+    self->mFileFormat = _CTM_FORMAT_VERSION_CODECS;
+  else if(_ctmNeedsFrames(self) && (self->mFileFormat < _CTM_FORMAT_VERSION_FRAMED))
+    self->mFileFormat = _CTM_FORMAT_VERSION_FRAMED;
 
-  // Allocate memory for the mesh arrays
-  self->mVertices = (CTMfloat *) malloc(self->mVertexCount * sizeof(CTMfloat) * 3);
-  if(!self->mVertices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return;
-  }
-  self->mIndices = (CTMuint *) malloc(self->mTriangleCount * sizeof(CTMuint) * 3);
-  if(!self->mIndices)
-  {
-    _ctmClearMesh(self);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return;
-  }
-  if(flags & _CTM_HAS_NORMALS_BIT)
+  // Write header to stream
+  _ctmStreamWrite(self, (void *) "OCTM", 4);
+  _ctmStreamWriteUINT(self, self->mFileFormat);
+  switch(self->mMethod)
   {
-    self->mNormals = (CTMfloat *) malloc(self->mVertexCount * sizeof(CTMfloat) * 3);
-    if(!self->mNormals)
-    {
-      _ctmClearMesh(self);
-      self->mError = CTM_OUT_OF_MEMORY;
-      return;
-    }
-  }
+    case CTM_METHOD_RAW:
+      _ctmStreamWrite(self, (void *) "RAW\0", 4);
+      break;
 
-  // Allocate memory for the UV and attribute maps (if any)
-  if(!_ctmAllocateFloatMaps(self, &self->mUVMaps, self->mUVMapCount, 2))
-  {
-    _ctmClearMesh(self);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return;
-  }
-  if(!_ctmAllocateFloatMaps(self, &self->mAttribMaps, self->mAttribMapCount, 4))
-  {
-    _ctmClearMesh(self);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return;
+    case CTM_METHOD_MG1:
+      _ctmStreamWrite(self, (void *) "MG1\0", 4);
+      break;
+
+    case CTM_METHOD_MG2:
+      if(self->mTileDivision[0] * self->mTileDivision[1] * self->mTileDivision[2] > 1)
+        _ctmStreamWrite(self, (void *) "MG2T", 4);
+      else
+        _ctmStreamWrite(self, (void *) "MG2\0", 4);
+      break;
+
+    case CTM_METHOD_MG3:
+      if(self->mTileDivision[0] * self->mTileDivision[1] * self->mTileDivision[2] > 1)
+        _ctmStreamWrite(self, (void *) "MG3T", 4);
+      else
+        _ctmStreamWrite(self, (void *) "MG3\0", 4);
+      break;
+
+    default:
+      self->mError = CTM_INTERNAL_ERROR;
+      self->mFileFormat = fileFormat;
+      return;
   }
+  _ctmStreamWriteUINT(self, self->mVertexCount);
+  _ctmStreamWriteUINT(self, self->mTriangleCount);
+  _ctmStreamWriteUINT(self, self->mUVMapCount);
+  _ctmStreamWriteUINT(self, self->mAttribMapCount);
+  _ctmStreamWriteUINT(self, flags);
+  _ctmStreamWriteSTRING(self, self->mFileComment);
 
-  // Uncompress from stream
+  // Compress to stream
   switch(self->mMethod)
   {
     case CTM_METHOD_RAW:
-      _ctmUncompressMesh_RAW(self);
+      _ctmCompressMesh_RAW(self);
       break;
 
     case CTM_METHOD_MG1:
-      _ctmUncompressMesh_MG1(self);
+      _ctmCompressMesh_MG1(self);
       break;
 
     case CTM_METHOD_MG2:
-      _ctmUncompressMesh_MG2(self);
+    case CTM_METHOD_MG3:
+      if(self->mTileDivision[0] * self->mTileDivision[1] * self->mTileDivision[2] > 1)
+        _ctmCompressMesh_Tiles(self);
+      else
+        _ctmCompressMesh_MG2(self);
       break;
 
     default:
       self->mError = CTM_INTERNAL_ERROR;
   }
 
-  // Check mesh integrity
-  if(!_ctmCheckMeshIntegrity(self))
-  {
-    self->mError = CTM_INVALID_MESH;
-    return;
-  }
+  // Write any pending (asynchronously compressed) data blocks, and any
+  // buffered data
+  _ctmStreamFlush(self);
+  self->mFileFormat = fileFormat;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmDefaultWrite()
+// _ctmSaveStream() - Save the mesh to a stream (see _ctmSaveMesh()), and
+// collect the statistics of the save.
 //-----------------------------------------------------------------------------
-static CTMuint CTMCALL _ctmDefaultWrite(const void * aBuf, CTMuint aCount,
+static void _ctmSaveStream(_CTMcontext * self, CTMwritefn aWriteFn,
   void * aUserData)
 {
-  return (CTMuint) fwrite(aBuf, 1, (size_t) aCount, (FILE *) aUserData);
+  double start;
+
+  _ctmStatsReset(self);
+  start = _ctmTime();
+  _ctmSaveMesh(self, aWriteFn, aUserData);
+  _ctmStatsTime(&self->mStats.mTotalTime, start);
 }
 
 //-----------------------------------------------------------------------------
-// ctmSave()
+// _ctmSaveFile() - Save the mesh to a file.
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmSave(CTMcontext aContext, const char * aFileName)
+static void _ctmSaveFile(_CTMcontext * self, const char * aFileName)
 {
-  _CTMcontext * self = (_CTMcontext *) aContext;
   FILE * f;
-  if(!self) return;
 
   // You are only allowed to save data in export mode
   if(self->mMode != CTM_EXPORT)
@@ -1334,12 +2337,25 @@ CTMEXPORT void CTMCALL ctmSave(CTMcontext aContext, const char * aFileName)
   }
 
   // Save the file
-  ctmSaveCustom(self, _ctmDefaultWrite, (void *) f);
+  self->mStreamBuffered = CTM_TRUE;
+  _ctmSaveStream(self, _ctmDefaultWrite, (void *) f);
 
   // Close file stream
   fclose(f);
 }
 
+//-----------------------------------------------------------------------------
+// ctmSave()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmSave(CTMcontext aContext, const char * aFileName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  self->mCancel = CTM_FALSE;
+  _ctmSaveFile(self, aFileName);
+}
+
 //-----------------------------------------------------------------------------
 // _ctmWriteToBuffer()
 //-----------------------------------------------------------------------------
@@ -1355,15 +2371,28 @@ static CTMuint CTMCALL _ctmWriteToBuffer(const void * aBuf, CTMuint aCount,
 {
   _CTMdynbuf *dynBuf = (_CTMdynbuf*)aUserData;
   void * newBuf = NULL;
-  // if there enough space ?
+  // if there enough space ? (a write that would overflow the size fails)
   size_t needSpace = dynBuf->size + aCount;
+  if (!dynBuf->buffer || (needSpace < dynBuf->size))
+    return 0;
   if (dynBuf->capacity < needSpace)
   {
-    // create new buffer twice as big as required
+    // create new buffer twice as big as required (or just as big as required,
+    // if doubling the size would overflow)
     size_t newSize = dynBuf->capacity * 2;
-    while (newSize < needSpace)
+    while ((newSize < needSpace) && (newSize <= ((size_t) -1) / 2))
       newSize *= 2;
+    if (newSize < needSpace)
+      newSize = needSpace;
     newBuf = malloc(newSize);
+    if (!newBuf)
+    {
+      // drop the buffer, so that the save fails
+      free(dynBuf->buffer);
+      dynBuf->buffer = NULL;
+      dynBuf->size = 0;
+      return 0;
+    }
     // copy old buffer to new, free old buffer
     memcpy(newBuf, dynBuf->buffer, dynBuf->size);
     free(dynBuf->buffer);
@@ -1398,6 +2427,8 @@ CTMEXPORT void * CTMCALL ctmSaveToBuffer(CTMcontext aContext, size_t *aBufferSiz
 
   // Save the file
   ctmSaveCustom(self, _ctmWriteToBuffer, &dynBuf);
+  if (!dynBuf.buffer && (self->mError == CTM_NONE))
+    self->mError = CTM_OUT_OF_MEMORY;
   if (aBufferSize)
       *aBufferSize = dynBuf.size;
   return dynBuf.buffer;
@@ -1415,77 +2446,103 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
   void * aUserData)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
-  CTMuint flags;
   if(!self) return;
 
-  // You are only allowed to save data in export mode
-  if(self->mMode != CTM_EXPORT)
+  self->mCancel = CTM_FALSE;
+  self->mStreamBuffered = self->mStreamBufferCustom;
+  _ctmSaveStream(self, aWriteFn, aUserData);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTaskRun() - Run an asynchronous load or save (background task function).
+//-----------------------------------------------------------------------------
+static void _ctmTaskRun(void * aArg)
+{
+  _CTMcontext * self = (_CTMcontext *) aArg;
+
+  if(self->mTaskSave)
+    _ctmSaveFile(self, self->mTaskFileName);
+  else
+    _ctmLoadFile(self, self->mTaskFileName, CTM_FALSE);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStartTask() - Start an asynchronous load or save of a file. If the task
+// can not be run by a background thread, it is run right away.
+//-----------------------------------------------------------------------------
+static void _ctmStartTask(_CTMcontext * self, const char * aFileName,
+  CTMuint aSave)
+{
+  size_t len;
+
+  // Only one operation at a time
+  ctmWait((CTMcontext) self);
+
+  // Check arguments
+  if(!aFileName)
   {
-    self->mError = CTM_INVALID_OPERATION;
+    self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
 
-  // Check mesh integrity
-  if(!_ctmCheckMeshIntegrity(self))
+  // Keep a copy of the file name (the caller's string may go away)
+  len = strlen(aFileName) + 1;
+  self->mTaskFileName = (char *) _ctmMalloc(self, len);
+  if(!self->mTaskFileName)
   {
-    self->mError = CTM_INVALID_MESH;
+    self->mError = CTM_OUT_OF_MEMORY;
     return;
   }
+  memcpy(self->mTaskFileName, aFileName, len);
+  self->mTaskSave = aSave;
 
-  // Initialize stream
-  self->mWriteFn = aWriteFn;
-  self->mUserData = aUserData;
-
-  // Determine flags
-  flags = 0;
-  if(self->mNormals)
-    flags |= _CTM_HAS_NORMALS_BIT;
-
-  // Write header to stream
-  _ctmStreamWrite(self, (void *) "OCTM", 4);
-  _ctmStreamWriteUINT(self, _CTM_FORMAT_VERSION);
-  switch(self->mMethod)
+  // Start the task
+  self->mCancel = CTM_FALSE;
+  self->mTask = _ctmTaskStart(_ctmTaskRun, (void *) self);
+  if(!self->mTask)
   {
-    case CTM_METHOD_RAW:
-      _ctmStreamWrite(self, (void *) "RAW\0", 4);
-      break;
-
-    case CTM_METHOD_MG1:
-      _ctmStreamWrite(self, (void *) "MG1\0", 4);
-      break;
+    _ctmTaskRun((void *) self);
+    _ctmFree(self, self->mTaskFileName);
+    self->mTaskFileName = (char *) 0;
+  }
+}
 
-    case CTM_METHOD_MG2:
-      _ctmStreamWrite(self, (void *) "MG2\0", 4);
-      break;
+//-----------------------------------------------------------------------------
+// ctmLoadAsync()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadAsync(CTMcontext aContext,
+  const char * aFileName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
 
-    default:
-      self->mError = CTM_INTERNAL_ERROR;
-      return;
-  }
-  _ctmStreamWriteUINT(self, self->mVertexCount);
-  _ctmStreamWriteUINT(self, self->mTriangleCount);
-  _ctmStreamWriteUINT(self, self->mUVMapCount);
-  _ctmStreamWriteUINT(self, self->mAttribMapCount);
-  _ctmStreamWriteUINT(self, flags);
-  _ctmStreamWriteSTRING(self, self->mFileComment);
+  _ctmStartTask(self, aFileName, CTM_FALSE);
+}
 
-  // Compress to stream
-  switch(self->mMethod)
-  {
-    case CTM_METHOD_RAW:
-      _ctmCompressMesh_RAW(self);
-      break;
+//-----------------------------------------------------------------------------
+// ctmSaveAsync()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmSaveAsync(CTMcontext aContext,
+  const char * aFileName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
 
-    case CTM_METHOD_MG1:
-      _ctmCompressMesh_MG1(self);
-      break;
+  _ctmStartTask(self, aFileName, CTM_TRUE);
+}
 
-    case CTM_METHOD_MG2:
-      _ctmCompressMesh_MG2(self);
-      break;
+//-----------------------------------------------------------------------------
+// ctmWait()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmWait(CTMcontext aContext)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
 
-    default:
-      self->mError = CTM_INTERNAL_ERROR;
-      return;
-  }
+  if(!self->mTask)
+    return;
+  _ctmTaskWait(self->mTask);
+  self->mTask = (_CTMtask *) 0;
+  _ctmFree(self, self->mTaskFileName);
+  self->mTaskFileName = (char *) 0;
 }
@@ -206,6 +206,7 @@ typedef enum {
   CTM_LZMA_ERROR        = 0x0008, ///< An error occured within the LZMA library.
   CTM_INTERNAL_ERROR    = 0x0009, ///< An internal error occured (indicates a bug).
   CTM_UNSUPPORTED_FORMAT_VERSION = 0x000A, ///< Unsupported file format version.
+  CTM_CANCELLED         = 0x000B, ///< The operation was cancelled (see ctmCancel()).
 
   // OpenCTM context modes
   CTM_IMPORT            = 0x0101, ///< The OpenCTM context will be used for importing data.
@@ -215,6 +216,7 @@ typedef enum {
   CTM_METHOD_RAW        = 0x0201, ///< Just store the raw data.
   CTM_METHOD_MG1        = 0x0202, ///< Lossless compression (floating point).
   CTM_METHOD_MG2        = 0x0203, ///< Lossless compression (fixed point).
+  CTM_METHOD_MG3        = 0x0204, ///< Fixed point compression like MG2, but with a faster decoder.
 
   // Context queries
   CTM_VERTEX_COUNT      = 0x0301, ///< Number of vertices in the mesh (integer).
@@ -226,6 +228,13 @@ typedef enum {
   CTM_NORMAL_PRECISION  = 0x0307, ///< Normal precision - for MG2 (float).
   CTM_COMPRESSION_METHOD = 0x0308, ///< Compression method (integer).
   CTM_FILE_COMMENT      = 0x0309, ///< File comment (string).
+  CTM_COMPRESSION_THREADS = 0x030A, ///< Number of (de)compression threads, 0 = one per CPU (integer).
+  CTM_FILE_FORMAT       = 0x030B, ///< File format version, 5, 6 or 7 (integer).
+  CTM_LZMA_THREADS      = 0x030C, ///< Number of LZMA match finder threads (integer).
+  CTM_STREAM_BUFFER_SIZE = 0x030D, ///< Stream buffer size in bytes, 0 = unbuffered (integer).
+  CTM_TILE_COUNT        = 0x030E, ///< Number of tiles in a loaded tiled MG2 file, 0 = not tiled (integer).
+  CTM_LZMA_SEARCH       = 0x030F, ///< CTM_TRUE if several LZMA settings are tried per block (integer).
+  CTM_VERTEX_ORDER      = 0x0310, ///< Vertex order of the MG2 and MG3 methods (integer).
 
   // UV/attribute map queries
   CTM_NAME              = 0x0501, ///< Unique name (UV/attrib map string).
@@ -236,6 +245,7 @@ typedef enum {
   CTM_INDICES           = 0x0601, ///< Triangle indices (integer array).
   CTM_VERTICES          = 0x0602, ///< Vertex point coordinates (float array).
   CTM_NORMALS           = 0x0603, ///< Per vertex normals (float array).
+  CTM_BOUNDING_BOX      = 0x0604, ///< Bounding box of a loaded MG2 file: min x, y, z, max x, y, z (float array).
   CTM_UV_MAP_1          = 0x0700, ///< Per vertex UV map 1 (float array).
   CTM_UV_MAP_2          = 0x0701, ///< Per vertex UV map 2 (float array).
   CTM_UV_MAP_3          = 0x0702, ///< Per vertex UV map 3 (float array).
@@ -251,7 +261,24 @@ typedef enum {
   CTM_ATTRIB_MAP_5      = 0x0804, ///< Per vertex attribute map 5 (float array).
   CTM_ATTRIB_MAP_6      = 0x0805, ///< Per vertex attribute map 6 (float array).
   CTM_ATTRIB_MAP_7      = 0x0806, ///< Per vertex attribute map 7 (float array).
-  CTM_ATTRIB_MAP_8      = 0x0807  ///< Per vertex attribute map 8 (float array).
+  CTM_ATTRIB_MAP_8      = 0x0807, ///< Per vertex attribute map 8 (float array).
+
+  // Load/save progress stages (see CTMprogressfn)
+  CTM_STAGE_SORT        = 0x0901, ///< Sorting vertices or triangles.
+  CTM_STAGE_DELTAS      = 0x0902, ///< Calculating delta values.
+  CTM_STAGE_PACK        = 0x0903, ///< LZMA compressing a packed data block.
+  CTM_STAGE_UNPACK      = 0x0904, ///< Reading and uncompressing a packed data array.
+
+  // Packed data codecs (see ctmCompressionCodec())
+  CTM_CODEC_DEFAULT     = 0x0A01, ///< The default codec of the compression method.
+  CTM_CODEC_LZMA        = 0x0A02, ///< LZMA (default for MG1 and MG2).
+  CTM_CODEC_RANS        = 0x0A03, ///< LZ77 + rANS, fast decoding (default for MG3).
+  CTM_CODEC_STORE       = 0x0A04, ///< No compression.
+
+  // Vertex orders (see ctmVertexOrder())
+  CTM_ORDER_GRID        = 0x0B01, ///< Grid boxes in row order (default).
+  CTM_ORDER_MORTON      = 0x0B02, ///< Grid boxes along a Morton (Z-order) curve.
+  CTM_ORDER_HILBERT     = 0x0B03  ///< Grid boxes along a Hilbert curve.
 } CTMenum;
 
 /// Stream read() function pointer.
@@ -273,6 +300,68 @@ typedef CTMuint (CTMCALL * CTMreadfn)(void * aBuf, CTMuint aCount, void * aUserD
 ///         indicates that an error occured).
 typedef CTMuint (CTMCALL * CTMwritefn)(const void * aBuf, CTMuint aCount, void * aUserData);
 
+/// Memory allocation function pointer (see ctmSetAllocator()).
+/// @param[in] aSize The number of bytes to allocate.
+/// @param[in] aUserData The custom user data that was passed to the
+///            ctmSetAllocator() function.
+/// @return A pointer to the allocated memory, or NULL if the memory could not
+///         be allocated.
+typedef void * (CTMCALL * CTMallocfn)(size_t aSize, void * aUserData);
+
+/// Memory free function pointer (see ctmSetAllocator()).
+/// @param[in] aPtr Pointer to memory that was allocated by the corresponding
+///            allocation function (never NULL).
+/// @param[in] aUserData The custom user data that was passed to the
+///            ctmSetAllocator() function.
+typedef void (CTMCALL * CTMfreefn)(void * aPtr, void * aUserData);
+
+/// Progress callback function pointer (see ctmProgressCallback()).
+/// @param[in] aStage The current stage of the operation (CTM_STAGE_SORT,
+///            CTM_STAGE_DELTAS, CTM_STAGE_PACK or CTM_STAGE_UNPACK).
+/// @param[in] aProgress How much of the current step is done (0.0 to 1.0).
+///            For CTM_STAGE_PACK this is the fraction of the current packed
+///            block, and for CTM_STAGE_UNPACK the fraction of the current
+///            array (RAW files report 1.0 once per written or read array).
+///            The other stages are reported once, when they start.
+/// @param[in] aUserData The custom user data that was passed to the
+///            ctmProgressCallback() function.
+/// @return CTM_TRUE to continue, or CTM_FALSE to cancel the operation (which
+///         then fails with CTM_CANCELLED).
+typedef CTMuint (CTMCALL * CTMprogressfn)(CTMenum aStage, CTMfloat aProgress,
+  void * aUserData);
+
+/// Maximum number of different block types in CTMstats.
+#define CTM_STATS_MAX_BLOCKS 16
+
+/// Statistics of the data blocks of one type (FOURCC) in a file (see
+/// CTMstats). Several blocks of the same type (e.g. one per UV map, or one per
+/// tile) are added up.
+typedef struct {
+  CTMuint mFourCC;        ///< Block type (e.g. 'V','E','R','T' = 0x54524556).
+  CTMuint mLZMACalls;     ///< Number of LZMA (un)compressed frames.
+  CTMfloat mLZMATime;     ///< Time spent in LZMA (seconds).
+  size_t mRawSize;        ///< Size of the uncompressed data (bytes).
+  size_t mPackedSize;     ///< Size of the data in the file (bytes).
+} CTMstatsblock;
+
+/// Statistics of the last load or save operation (see ctmGetStats()). All
+/// times are in seconds. The LZMA times are the sum over all threads, so
+/// with several compression threads they can exceed the total time.
+typedef struct {
+  CTMfloat mTotalTime;    ///< Wall time of the whole operation.
+  CTMfloat mGridTime;     ///< MG2 space subdivision grid (and tile) setup.
+  CTMfloat mSortTime;     ///< Sorting of vertices and triangles.
+  CTMfloat mReIndexTime;  ///< Re-indexing and re-arranging of vertices.
+  CTMfloat mDeltaTime;    ///< Delta coding (or restoring) of all arrays.
+  CTMfloat mNormalTime;   ///< Smooth normal calculation (MG2 normals, part of mDeltaTime).
+  CTMfloat mLZMATime;     ///< LZMA (un)compression (all blocks).
+  CTMfloat mCheckTime;    ///< Mesh integrity check.
+  CTMuint mLZMACalls;     ///< Number of LZMA (un)compressed frames.
+  size_t mPeakScratch;    ///< Peak size of the internal scratch buffers (bytes).
+  CTMuint mBlockCount;    ///< Number of used entries in mBlocks.
+  CTMstatsblock mBlocks[CTM_STATS_MAX_BLOCKS]; ///< Per block type statistics.
+} CTMstats;
+
 /// Create a new OpenCTM context. The context is used for all subsequent
 /// OpenCTM function calls. Several contexts can coexist at the same time.
 /// @param[in] aMode An OpenCTM context mode. Set this to CTM_IMPORT if the
@@ -456,9 +545,14 @@ CTMEXPORT const char * CTMCALL ctmGetString(CTMcontext aContext,
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aMethod Which compression method to use: CTM_METHOD_RAW,
-///            CTM_METHOD_MG1 or CTM_METHOD_MG2 (the default method is
-///            CTM_METHOD_MG1).
-/// @see CTM_METHOD_RAW, CTM_METHOD_MG1, CTM_METHOD_MG2
+///            CTM_METHOD_MG1, CTM_METHOD_MG2 or CTM_METHOD_MG3 (the default
+///            method is CTM_METHOD_MG1).
+/// @note CTM_METHOD_MG3 stores the same data as CTM_METHOD_MG2, but codes it
+///       with an LZ77 + rANS coder instead of LZMA. The files are usually a
+///       little larger than MG2 files, but they load several times faster.
+///       For MG3, the compression level only controls the match search depth
+///       (the other LZMA settings do not apply).
+/// @see CTM_METHOD_RAW, CTM_METHOD_MG1, CTM_METHOD_MG2, CTM_METHOD_MG3
 CTMEXPORT void CTMCALL ctmCompressionMethod(CTMcontext aContext,
   CTMenum aMethod);
 
@@ -472,8 +566,236 @@ CTMEXPORT void CTMCALL ctmCompressionMethod(CTMcontext aContext,
 CTMEXPORT void CTMCALL ctmCompressionLevel(CTMcontext aContext,
   CTMuint aLevel);
 
-/// Set the vertex coordinate precision (only used by the MG2 compression
-/// method).
+/// Set how many threads to use for LZMA compression and decompression. When
+/// more than one thread is used, the packed data streams of the mesh
+/// (vertices, indices, normals, UV maps, etc) are compressed (when saving) or
+/// uncompressed (when loading) concurrently, and the MG1 and MG2 methods sort
+/// and re-index the vertices and triangles of large meshes with several
+/// threads. The resulting file is identical
+/// to the file that is produced when using a single thread. The default is
+/// one thread. Note that concurrent loading keeps the packed data of the
+/// streams in memory until it has been uncompressed, while a single thread
+/// uncompresses the packed data as it is read, which uses less memory.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aThreadCount Number of threads to use (1 to 64), or 0 to use one
+///            thread per logical CPU in the system.
+CTMEXPORT void CTMCALL ctmCompressionThreads(CTMcontext aContext,
+  CTMuint aThreadCount);
+
+/// Set how many threads the LZMA encoder uses for each packed data stream.
+/// With two threads, the match finder of the LZMA encoder runs in separate
+/// threads, which makes compression at levels 1 to 9 roughly twice as fast
+/// (compression level 0 always uses a single thread). This is independent of
+/// ctmCompressionThreads(), which controls how many streams are compressed at
+/// the same time. The packed data is valid LZMA data regardless of the thread
+/// count, but is not necessarily identical to the single threaded result. If
+/// the library was built without threading support, the setting has no
+/// effect. The default is one thread.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aThreadCount Number of LZMA encoder threads (1 or 2).
+CTMEXPORT void CTMCALL ctmLZMAThreads(CTMcontext aContext,
+  CTMuint aThreadCount);
+
+/// Enable or disable the LZMA settings search. The packed data blocks are
+/// normally compressed with the default LZMA settings (literal context and
+/// position bits). In search mode, every block is also compressed with a few
+/// other settings, and the smallest result is kept. This can make the file
+/// slightly smaller, at the cost of compressing each block up to five times.
+/// The settings are stored with each block, so the files can be read by any
+/// OpenCTM reader. The default is no search.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aSearch CTM_TRUE to enable the search, or CTM_FALSE to disable
+///            it.
+CTMEXPORT void CTMCALL ctmLZMASearch(CTMcontext aContext, CTMuint aSearch);
+
+/// Select the order in which the MG2 and MG3 methods store the vertices. The
+/// vertices are sorted by the box of the space subdivision grid that they
+/// belong to. By default the boxes are visited row by row. With the Morton
+/// or Hilbert order the boxes are visited along a space-filling curve
+/// instead, which keeps vertices that are close in space close in the vertex
+/// array. This trades file size for memory locality: the loaded mesh is
+/// more cache friendly to process, but the files are typically a few percent
+/// larger (mostly in the grid index block, which no longer increases row by
+/// row). The files can be read by any OpenCTM reader. The setting has no
+/// effect on the MG1 and RAW methods.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aOrder CTM_ORDER_GRID (default), CTM_ORDER_MORTON or
+///            CTM_ORDER_HILBERT.
+CTMEXPORT void CTMCALL ctmVertexOrder(CTMcontext aContext, CTMenum aOrder);
+
+/// Select the codec that is used for the packed data of a mesh array. By
+/// default, all arrays are compressed with the codec of the compression
+/// method (LZMA for MG1 and MG2, and LZ77 + rANS for MG3). Selecting another
+/// codec for some arrays lets you trade compression ratio for loading speed
+/// per type of data, e.g. CTM_CODEC_RANS for the vertices and CTM_CODEC_LZMA
+/// for the indices. If any array uses a codec other than CTM_CODEC_DEFAULT,
+/// the file is saved in file format version 7 (see ctmFileFormat()), where
+/// each packed data frame is tagged with its codec. The codecs do not apply
+/// to the RAW compression method.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aArray Which array: CTM_VERTICES, CTM_INDICES, CTM_NORMALS, or
+///            a UV or attribute map specifier for a defined map
+///            (CTM_UV_MAP_n or CTM_ATTRIB_MAP_n).
+/// @param[in] aCodec Which codec to use: CTM_CODEC_DEFAULT, CTM_CODEC_LZMA,
+///            CTM_CODEC_RANS or CTM_CODEC_STORE.
+CTMEXPORT void CTMCALL ctmCompressionCodec(CTMcontext aContext,
+  CTMenum aArray, CTMenum aCodec);
+
+/// Set which version of the OpenCTM file format to write. Version 5 is the
+/// default, and can be read by all OpenCTM 1.0 readers. In version 6 files,
+/// each packed data stream is split into fixed size frames that are
+/// compressed individually, which lets a single large stream (e.g. the
+/// vertices or the indices of a big mesh) be compressed and uncompressed by
+/// several threads (see ctmCompressionThreads()), at the cost of a slightly
+/// lower compression ratio. Version 5 files store each packed data stream
+/// as a single LZMA block, which can be at most 4 GB, while version 6 files
+/// have no such limit (meshes that are too large for a version 5 file are
+/// saved as version 6 automatically). Version 7 files use the version 6
+/// layout, but each frame is also tagged with the codec that it is compressed
+/// with (see ctmCompressionCodec(), which selects version 7 automatically).
+/// All versions can be loaded. For an import context, the version of the
+/// loaded file can be queried with ctmGetInteger(CTM_FILE_FORMAT).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aVersion File format version (5, 6 or 7).
+CTMEXPORT void CTMCALL ctmFileFormat(CTMcontext aContext, CTMuint aVersion);
+
+/// Set the size of the stream buffer. When loading or saving, the stream is
+/// read ahead or written behind through a buffer of this size, so that the
+/// stream read() and write() functions are called with large chunks of data
+/// rather than with many small header fields and block headers. By default
+/// only ctmLoad() and ctmSave() (and the other file name based functions)
+/// use a buffer, of 64 KB. Calling this function also enables the buffer for
+/// custom streams (ctmLoadCustom() and ctmSaveCustom()), which matters mostly
+/// for streams with a high per-call cost (e.g. language bindings, network
+/// streams or unbuffered file handles). Note that when loading from a
+/// buffered custom stream, more data than the OpenCTM file contains may be
+/// read from the stream, so the stream position after the load is undefined.
+/// Do not enable the buffer if the file is embedded in a larger stream, and
+/// the data after it is needed.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aSize Stream buffer size in bytes, or 0 to call the stream
+///            functions directly for each data item (unbuffered).
+CTMEXPORT void CTMCALL ctmStreamBufferSize(CTMcontext aContext, CTMuint aSize);
+
+/// Select whether an optional vertex array is loaded by the following
+/// ctmLoad() / ctmLoadCustom() calls. By default all arrays are loaded. The
+/// packed blocks of arrays that are not loaded are skipped in the stream
+/// without uncompressing them, and no memory is allocated for them. Skipping
+/// the normals of an MG2 file also saves the smooth normal calculation that
+/// is needed to restore them. Skipped normals are reported as missing (i.e.
+/// CTM_HAS_NORMALS is CTM_FALSE). Skipped UV / attribute maps still count in
+/// CTM_UV_MAP_COUNT / CTM_ATTRIB_MAP_COUNT, and their names and precisions
+/// are available, but ctmGetFloatArray() returns NULL for them. The selection
+/// is kept for all following loads with the same context.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext() in import mode.
+/// @param[in] aArray Which array to select: CTM_NORMALS, CTM_UV_MAP_n or
+///            CTM_ATTRIB_MAP_n (vertices and indices are always loaded).
+/// @param[in] aLoad CTM_TRUE to load the array, or CTM_FALSE to skip it.
+CTMEXPORT void CTMCALL ctmLoadSelect(CTMcontext aContext, CTMenum aArray,
+  CTMuint aLoad);
+
+/// Set the tile division for saving with the MG2 or MG3 compression method.
+/// If more than one tile is used, the bounding box of the mesh is divided
+/// into aX x aY x aZ equally sized tiles, and the triangles of each tile are
+/// compressed independently of the other tiles. A tiled file can be loaded
+/// in whole like any other file, or a reader can load only the tiles that
+/// intersect a region of interest (see ctmLoadRegion()). Vertices that are
+/// used by triangles in several tiles are stored once per tile, so tiling
+/// gives slightly larger files. Tiled files can only be loaded by readers
+/// that support them. The default is 1 x 1 x 1 (not tiled).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext() in export mode.
+/// @param[in] aX Number of tiles along the x axis (at least 1).
+/// @param[in] aY Number of tiles along the y axis (at least 1).
+/// @param[in] aZ Number of tiles along the z axis (at least 1).
+/// @note The total number of tiles (aX * aY * aZ) must not exceed 65536.
+CTMEXPORT void CTMCALL ctmTileDivision(CTMcontext aContext, CTMuint aX,
+  CTMuint aY, CTMuint aZ);
+
+/// Set the region of interest for the following ctmLoad() / ctmLoadCustom()
+/// calls. When a tiled MG2 or MG3 file (see ctmTileDivision()) is loaded,
+/// only the tiles whose bounding box intersects the region are uncompressed,
+/// and the other tiles are skipped in the stream. The loaded mesh contains
+/// all the triangles of the selected tiles, and thus usually extends somewhat
+/// beyond the region. Files that are not tiled are always loaded in whole.
+/// The region is kept for all following loads with the same context.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext() in import mode.
+/// @param[in] aMin Lower corner of the region (x, y, z), or NULL to load
+///            the whole mesh.
+/// @param[in] aMax Upper corner of the region (x, y, z), or NULL to load
+///            the whole mesh.
+/// @note If no tile intersects the region, the load fails with
+///       CTM_INVALID_MESH.
+CTMEXPORT void CTMCALL ctmLoadRegion(CTMcontext aContext,
+  const CTMfloat * aMin, const CTMfloat * aMax);
+
+/// Set the memory allocation functions of a context. All memory that the
+/// context allocates (mesh arrays, temporary buffers and the LZMA encoder and
+/// decoder state) is allocated with these functions, except for the context
+/// structure itself, internal thread pool bookkeeping and the buffer that is
+/// returned by ctmSaveToBuffer(). The functions may be called concurrently
+/// from several threads if more than one compression thread is used (see
+/// ctmCompressionThreads()). The allocator can only be changed while the
+/// context holds no mesh data or file comment (i.e. right after
+/// ctmNewContext()), otherwise CTM_INVALID_OPERATION is set.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aAllocFn Memory allocation function, or NULL to use malloc().
+/// @param[in] aFreeFn Memory free function, or NULL to use free() (must be
+///            NULL if and only if aAllocFn is NULL).
+/// @param[in] aUserData Custom user data, which is passed as a parameter to
+///            the allocation and free functions.
+CTMEXPORT void CTMCALL ctmSetAllocator(CTMcontext aContext,
+  CTMallocfn aAllocFn, CTMfreefn aFreeFn, void * aUserData);
+
+/// Set a function that is called to report the progress of the following
+/// load and save operations. The function is called between the stages of
+/// the operation, and regularly while a packed data block is compressed, by
+/// the thread that runs the operation (i.e. the background thread of
+/// ctmLoadAsync() / ctmSaveAsync()). Blocks that are compressed by other
+/// threads (see ctmCompressionThreads()) are reported when they are done.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aProgressFn Progress function, or NULL for no progress reports.
+/// @param[in] aUserData Custom user data, which is passed as a parameter to
+///            the progress function.
+/// @see CTMprogressfn.
+CTMEXPORT void CTMCALL ctmProgressCallback(CTMcontext aContext,
+  CTMprogressfn aProgressFn, void * aUserData);
+
+/// Cancel the current load or save operation. This function may be called
+/// from any thread (e.g. while ctmLoadAsync() or ctmSaveAsync() is running,
+/// or from a progress callback). The operation stops at the next stage or
+/// LZMA progress check, and fails with CTM_CANCELLED. When a load is
+/// cancelled, the context holds no mesh; when a save is cancelled, the
+/// output is incomplete. Calling ctmCancel() when no operation is running
+/// has no effect.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+CTMEXPORT void CTMCALL ctmCancel(CTMcontext aContext);
+
+/// Get statistics (time per stage, and raw and packed size per block type)
+/// of the last load or save operation of the context. The statistics are
+/// reset when a new load or save starts, and are also available after a
+/// failed operation.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[out] aStats Pointer to a CTMstats structure that receives the
+///             statistics.
+/// @see CTMstats.
+CTMEXPORT void CTMCALL ctmGetStats(CTMcontext aContext, CTMstats * aStats);
+
+/// Set the vertex coordinate precision (only used by the MG2 and MG3
+/// compression methods).
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aPrecision Fixed point precision. For instance, if this value is
@@ -483,7 +805,7 @@ CTMEXPORT void CTMCALL ctmVertexPrecision(CTMcontext aContext,
   CTMfloat aPrecision);
 
 /// Set the vertex coordinate precision, relative to the mesh dimensions (only
-/// used by the MG2 compression method).
+/// used by the MG2 and MG3 compression methods).
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aRelPrecision Relative precision. This factor is multiplied by the
@@ -497,9 +819,10 @@ CTMEXPORT void CTMCALL ctmVertexPrecision(CTMcontext aContext,
 CTMEXPORT void CTMCALL ctmVertexPrecisionRel(CTMcontext aContext,
   CTMfloat aRelPrecision);
 
-/// Set the normal precision (only used by the MG2 compression method). The
-/// normal is represented in spherical coordinates in the MG2 compression
-/// method, and the normal precision controls the angular and radial resolution.
+/// Set the normal precision (only used by the MG2 and MG3 compression
+/// methods). The normal is represented in spherical coordinates in the MG2
+/// compression method, and the normal precision controls the angular and
+/// radial resolution.
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aPrecision Fixed point precision. For the angular information,
@@ -512,7 +835,7 @@ CTMEXPORT void CTMCALL ctmNormalPrecision(CTMcontext aContext,
   CTMfloat aPrecision);
 
 /// Set the coordinate precision for the specified UV map (only used by the
-/// MG2 compression method).
+/// MG2 and MG3 compression methods).
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aUVMap A UV map specifier for a defined UV map
@@ -525,7 +848,7 @@ CTMEXPORT void CTMCALL ctmUVCoordPrecision(CTMcontext aContext,
   CTMenum aUVMap, CTMfloat aPrecision);
 
 /// Set the attribute value precision for the specified attribute map (only
-/// used by the MG2 compression method).
+/// used by the MG2 and MG3 compression methods).
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aAttribMap An attribute map specifier for a defined attribute map
@@ -545,7 +868,14 @@ CTMEXPORT void CTMCALL ctmAttribPrecision(CTMcontext aContext,
 CTMEXPORT void CTMCALL ctmFileComment(CTMcontext aContext,
   const char * aFileComment);
 
-/// Define a triangle mesh.
+/// Define a triangle mesh. Meshes with up to 2^30 - 1 vertices and
+/// (2^32 - 1) / 3 triangles are supported (on 64-bit hosts), which is enough
+/// for billion-triangle meshes. Larger counts, or meshes that do not fit in
+/// the address space of the host, are rejected.
+/// @note When such a large mesh is saved with the MG1 or MG2 method, a
+///       compressed array may exceed the 4 GB limit of a version 5 file
+///       (the save then fails with CTM_INVALID_OPERATION). Use file format
+///       version 6 for very large meshes (see ctmFileFormat()).
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aVertices An array of vertices (three consecutive floats make
@@ -619,10 +949,41 @@ CTMEXPORT void CTMCALL ctmLoad(CTMcontext aContext, const char * aFileName);
 ///            handle, C++ istream object, or a custom object pointer
 ///            of any type. The user data pointer will be passed to the
 ///            custom stream read function.
+/// @note The read function is never asked for data beyond the end of the
+///       OpenCTM file, unless a read-ahead buffer has been enabled with
+///       ctmStreamBufferSize().
 /// @see CTMreadfn.
 CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
   void * aUserData);
 
+/// Load only the header of an OpenCTM format file into the context. The
+/// compression method, the vertex and triangle counts, whether the mesh has
+/// normals, the file comment, the names and precisions of the UV and
+/// attribute maps and (for MG2 and MG3 files) the vertex and normal
+/// precisions and the bounding box (CTM_BOUNDING_BOX) can then be retrieved
+/// with the various ctmGet functions, but no vertex data is loaded (all mesh
+/// arrays are NULL).
+/// The compressed data blocks are seeked past without being read, so the time
+/// that this takes does not depend on the size of the mesh.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aFileName The name of the file to be probed.
+CTMEXPORT void CTMCALL ctmLoadHeader(CTMcontext aContext,
+  const char * aFileName);
+
+/// Load only the header of an OpenCTM format file using a custom stream read
+/// function (see ctmLoadHeader()). Since the map information is stored after
+/// the vertex data of each array, the stream is read up to the last map,
+/// but none of the data is uncompressed.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aReadFn Pointer to a custom stream read function.
+/// @param[in] aUserData Custom user data, which will be passed to the custom
+///            stream read function.
+/// @see CTMreadfn.
+CTMEXPORT void CTMCALL ctmLoadHeaderCustom(CTMcontext aContext,
+  CTMreadfn aReadFn, void * aUserData);
+
 /// Save an OpenCTM format file. The mesh must have been defined by
 /// ctmDefineMesh().
 /// @param[in] aContext An OpenCTM context that has been created by
@@ -630,6 +991,35 @@ CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
 /// @param[in] aFileName The name of the file to be saved.
 CTMEXPORT void CTMCALL ctmSave(CTMcontext aContext, const char * aFileName);
 
+/// Start loading an OpenCTM format file on a background thread (see
+/// ctmLoad()), and return right away. While the load is running, only
+/// ctmCancel(), ctmWait() and ctmFreeContext() may be called for the context.
+/// Call ctmWait() to wait for the load to finish, and then ctmGetError() to
+/// check the result. If threads are not available, the file is loaded before
+/// the function returns.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aFileName The name of the file to be loaded (the name is copied).
+CTMEXPORT void CTMCALL ctmLoadAsync(CTMcontext aContext,
+  const char * aFileName);
+
+/// Start saving an OpenCTM format file on a background thread (see ctmSave()),
+/// and return right away. The same rules as for ctmLoadAsync() apply, and the
+/// mesh arrays that were passed to ctmDefineMesh() (and the UV / attribute
+/// map arrays) must stay unchanged until ctmWait() has returned.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aFileName The name of the file to be saved (the name is copied).
+CTMEXPORT void CTMCALL ctmSaveAsync(CTMcontext aContext,
+  const char * aFileName);
+
+/// Wait for a load or save that was started by ctmLoadAsync() or
+/// ctmSaveAsync() to finish. The result can then be checked with
+/// ctmGetError(). Returns right away if no operation is running.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+CTMEXPORT void CTMCALL ctmWait(CTMcontext aContext);
+
 /// Save an OpenCTM format file to buffer allocated by malloc.
 /// The mesh must have been defined by ctmDefineMesh().
 /// @param[in] aContext An OpenCTM context that has been created by
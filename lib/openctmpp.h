@@ -199,6 +199,70 @@ class CTMimporter {
       return res;
     }
 
+    /// Wrapper for ctmCompressionThreads()
+    void CompressionThreads(CTMuint aThreadCount)
+    {
+      ctmCompressionThreads(mContext, aThreadCount);
+      CheckError();
+    }
+
+    /// Wrapper for ctmStreamBufferSize()
+    void StreamBufferSize(CTMuint aSize)
+    {
+      ctmStreamBufferSize(mContext, aSize);
+      CheckError();
+    }
+
+    /// Wrapper for ctmSetAllocator()
+    void SetAllocator(CTMallocfn aAllocFn, CTMfreefn aFreeFn, void * aUserData)
+    {
+      ctmSetAllocator(mContext, aAllocFn, aFreeFn, aUserData);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadSelect()
+    void LoadSelect(CTMenum aArray, CTMuint aLoad)
+    {
+      ctmLoadSelect(mContext, aArray, aLoad);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadRegion()
+    void LoadRegion(const CTMfloat * aMin, const CTMfloat * aMax)
+    {
+      ctmLoadRegion(mContext, aMin, aMax);
+      CheckError();
+    }
+
+    /// Wrapper for ctmProgressCallback()
+    void ProgressCallback(CTMprogressfn aProgressFn, void * aUserData)
+    {
+      ctmProgressCallback(mContext, aProgressFn, aUserData);
+      CheckError();
+    }
+
+    /// Wrapper for ctmCancel() (may be called while an asynchronous load is
+    /// running, so the error state is not checked)
+    void Cancel()
+    {
+      ctmCancel(mContext);
+    }
+
+    /// Wrapper for ctmWait() (throws an exception if the asynchronous load
+    /// failed)
+    void Wait()
+    {
+      ctmWait(mContext);
+      CheckError();
+    }
+
+    /// Wrapper for ctmGetStats() (statistics of the last load)
+    void GetStats(CTMstats * aStats)
+    {
+      ctmGetStats(mContext, aStats);
+      CheckError();
+    }
+
     /// Wrapper for ctmLoad()
     void Load(const char * aFileName)
     {
@@ -206,6 +270,12 @@ class CTMimporter {
       CheckError();
     }
 
+    /// Wrapper for ctmLoadAsync() (errors are reported by Wait())
+    void LoadAsync(const char * aFileName)
+    {
+      ctmLoadAsync(mContext, aFileName);
+    }
+
     /// Wrapper for ctmLoadCustom()
     void LoadCustom(CTMreadfn aReadFn, void * aUserData)
     {
@@ -213,6 +283,20 @@ class CTMimporter {
       CheckError();
     }
 
+    /// Wrapper for ctmLoadHeader()
+    void LoadHeader(const char * aFileName)
+    {
+      ctmLoadHeader(mContext, aFileName);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadHeaderCustom()
+    void LoadHeaderCustom(CTMreadfn aReadFn, void * aUserData)
+    {
+      ctmLoadHeaderCustom(mContext, aReadFn, aUserData);
+      CheckError();
+    }
+
     // You can not copy nor assign from one CTMimporter object to another, since
     // the object contains hidden state. By declaring these dummy prototypes
     // without an implementation, you will at least get linker errors if you try
@@ -281,6 +365,69 @@ class CTMexporter {
       CheckError();
     }
 
+    /// Wrapper for ctmCompressionThreads()
+    void CompressionThreads(CTMuint aThreadCount)
+    {
+      ctmCompressionThreads(mContext, aThreadCount);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLZMAThreads()
+    void LZMAThreads(CTMuint aThreadCount)
+    {
+      ctmLZMAThreads(mContext, aThreadCount);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLZMASearch()
+    void LZMASearch(CTMuint aSearch)
+    {
+      ctmLZMASearch(mContext, aSearch);
+      CheckError();
+    }
+
+    /// Wrapper for ctmCompressionCodec()
+    void CompressionCodec(CTMenum aArray, CTMenum aCodec)
+    {
+      ctmCompressionCodec(mContext, aArray, aCodec);
+      CheckError();
+    }
+
+    /// Wrapper for ctmVertexOrder()
+    void VertexOrder(CTMenum aOrder)
+    {
+      ctmVertexOrder(mContext, aOrder);
+      CheckError();
+    }
+
+    /// Wrapper for ctmFileFormat()
+    void FileFormat(CTMuint aVersion)
+    {
+      ctmFileFormat(mContext, aVersion);
+      CheckError();
+    }
+
+    /// Wrapper for ctmStreamBufferSize()
+    void StreamBufferSize(CTMuint aSize)
+    {
+      ctmStreamBufferSize(mContext, aSize);
+      CheckError();
+    }
+
+    /// Wrapper for ctmSetAllocator()
+    void SetAllocator(CTMallocfn aAllocFn, CTMfreefn aFreeFn, void * aUserData)
+    {
+      ctmSetAllocator(mContext, aAllocFn, aFreeFn, aUserData);
+      CheckError();
+    }
+
+    /// Wrapper for ctmTileDivision()
+    void TileDivision(CTMuint aX, CTMuint aY, CTMuint aZ)
+    {
+      ctmTileDivision(mContext, aX, aY, aZ);
+      CheckError();
+    }
+
     /// Wrapper for ctmVertexPrecision()
     void VertexPrecision(CTMfloat aPrecision)
     {
@@ -350,6 +497,35 @@ class CTMexporter {
       return res;
     }
 
+    /// Wrapper for ctmProgressCallback()
+    void ProgressCallback(CTMprogressfn aProgressFn, void * aUserData)
+    {
+      ctmProgressCallback(mContext, aProgressFn, aUserData);
+      CheckError();
+    }
+
+    /// Wrapper for ctmCancel() (may be called while an asynchronous save is
+    /// running, so the error state is not checked)
+    void Cancel()
+    {
+      ctmCancel(mContext);
+    }
+
+    /// Wrapper for ctmWait() (throws an exception if the asynchronous save
+    /// failed)
+    void Wait()
+    {
+      ctmWait(mContext);
+      CheckError();
+    }
+
+    /// Wrapper for ctmGetStats() (statistics of the last save)
+    void GetStats(CTMstats * aStats)
+    {
+      ctmGetStats(mContext, aStats);
+      CheckError();
+    }
+
     /// Wrapper for ctmSave()
     void Save(const char * aFileName)
     {
@@ -357,6 +533,12 @@ class CTMexporter {
       CheckError();
     }
 
+    /// Wrapper for ctmSaveAsync() (errors are reported by Wait())
+    void SaveAsync(const char * aFileName)
+    {
+      ctmSaveAsync(mContext, aFileName);
+    }
+
     /// Wrapper for ctmSaveCustom()
     void SaveCustom(CTMwritefn aWriteFn, void * aUserData)
     {
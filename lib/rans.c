@@ -0,0 +1,1018 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        rans.c
+// Description: LZ77 + rANS coder for the packed data arrays of the MG3
+//              compression method. Repeats are removed with a simple LZ77
+//              parser, and the resulting streams (literals, tokens, lengths
+//              and offsets) are coded with static order-0 rANS models, which
+//              is much faster to decode than LZMA.
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+#include "openctm.h"
+#include "internal.h"
+
+//-----------------------------------------------------------------------------
+// Layout of a coded frame
+//
+// A frame is split into blocks of (at most) _CTM_LZ_BLOCK_SIZE bytes, which
+// are coded independently. Each block starts with a mode byte:
+//
+//   _CTM_LZ_STORED - The raw block follows.
+//   _CTM_LZ_CODED  - Four varints follow, giving the sizes of the literal,
+//                    token, length and offset streams (the offset stream size
+//                    is the number of offsets). Then the streams follow, in
+//                    that order. The offsets are stored as three byte planes
+//                    (low, middle and high byte).
+//
+// Each stream is a sequence of segments, each with its own rANS model. A
+// segment starts with a mode byte and a varint with the number of bytes in the
+// segment:
+//
+//   _CTM_RANS_STORED - The raw bytes follow.
+//   _CTM_RANS_SINGLE - All bytes are the same, and the byte follows.
+//   _CTM_RANS_CODED  - The frequency table follows (the symbol count minus one,
+//                      the symbols as a list or a 256 bit mask, and the
+//                      frequencies minus one as varints), then the payload
+//                      size as a varint, and the payload (the final states of
+//                      the four interleaved coders, followed by the
+//                      renormalization bytes).
+//
+// The block is parsed as a sequence of tokens: the high nibble of a token is
+// the number of literals, and the low nibble is the match length minus
+// _CTM_LZ_MIN_MATCH. A nibble of 15 is extended with bytes from the length
+// stream (255 means that another byte follows). The literals are followed by
+// a match, unless they end the block. An offset of zero repeats the previous
+// offset (initially one).
+//-----------------------------------------------------------------------------
+
+#define _CTM_RANS_BITS 12
+#define _CTM_RANS_TOTAL (1 << _CTM_RANS_BITS)
+#define _CTM_RANS_LOW 0x00800000
+
+#define _CTM_RANS_STORED 0
+#define _CTM_RANS_SINGLE 1
+#define _CTM_RANS_CODED  2
+
+// Minimum size of a literal segment (in source bytes, rounded up to whole
+// byte planes), and of the literals between two segment cuts
+#define _CTM_RANS_MIN_SEGMENT 0x1000
+#define _CTM_RANS_MIN_CUT     0x100
+
+// Largest possible frequency table (count, bit mask and 256 varints)
+#define _CTM_RANS_TABLE_SIZE (1 + 32 + 256 * 2)
+
+#define _CTM_LZ_STORED 0
+#define _CTM_LZ_CODED  1
+
+#define _CTM_LZ_BLOCK_SIZE 0x00100000
+#define _CTM_LZ_MIN_MATCH  4
+#define _CTM_LZ_HASH_BITS  16
+#define _CTM_LZ_MAX_CUTS   ((_CTM_LZ_BLOCK_SIZE / _CTM_RANS_MIN_SEGMENT) + 2)
+
+//-----------------------------------------------------------------------------
+// _ctmRansPutVarint() - Write a varint to aDest. Returns the number of bytes
+// written.
+//-----------------------------------------------------------------------------
+static size_t _ctmRansPutVarint(unsigned char * aDest, size_t aValue)
+{
+  size_t n = 0;
+
+  while(aValue >= 0x80)
+  {
+    aDest[n ++] = (unsigned char) ((aValue & 0x7f) | 0x80);
+    aValue >>= 7;
+  }
+  aDest[n ++] = (unsigned char) aValue;
+
+  return n;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRansGetVarint() - Read a varint from aSrc (ending at aEnd). Returns
+// CTM_FALSE if the varint is truncated or too large.
+//-----------------------------------------------------------------------------
+static int _ctmRansGetVarint(const unsigned char ** aSrc,
+  const unsigned char * aEnd, size_t * aValue)
+{
+  const unsigned char * src = *aSrc;
+  size_t value = 0;
+  CTMuint shift = 0;
+
+  do
+  {
+    if((src >= aEnd) || (shift >= sizeof(size_t) * 8))
+      return CTM_FALSE;
+    value |= ((size_t) (*src & 0x7f)) << shift;
+    shift += 7;
+  } while(*src ++ & 0x80);
+
+  *aSrc = src;
+  *aValue = value;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRansNormalize() - Scale the symbol counts of a segment to frequencies
+// that add up to _CTM_RANS_TOTAL (all used symbols get a non-zero frequency).
+//-----------------------------------------------------------------------------
+static void _ctmRansNormalize(const size_t * aCounts, size_t aSize,
+  CTMuint * aFreq)
+{
+  CTMuint i, sum, best;
+  int diff;
+
+  sum = 0;
+  best = 0;
+  for(i = 0; i < 256; ++ i)
+  {
+    aFreq[i] = 0;
+    if(aCounts[i] > 0)
+    {
+      aFreq[i] = (CTMuint) ((double) aCounts[i] * _CTM_RANS_TOTAL /
+                            (double) aSize + 0.5);
+      if(aFreq[i] == 0)
+        aFreq[i] = 1;
+      sum += aFreq[i];
+      if(aCounts[i] > aCounts[best])
+        best = i;
+    }
+  }
+
+  // Let the most common symbol absorb the rounding error (it is the cheapest
+  // one to change), unless that would leave it without a frequency
+  diff = (int) _CTM_RANS_TOTAL - (int) sum;
+  if((int) aFreq[best] + diff >= 1)
+  {
+    aFreq[best] = (CTMuint) ((int) aFreq[best] + diff);
+    return;
+  }
+
+  // Otherwise take one from the largest frequency at a time
+  while(sum > _CTM_RANS_TOTAL)
+  {
+    best = 0;
+    for(i = 1; i < 256; ++ i)
+    {
+      if(aFreq[i] > aFreq[best])
+        best = i;
+    }
+    -- aFreq[best];
+    -- sum;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRansPutTable() - Write the frequency table of a segment to aDest.
+// Returns the number of bytes written.
+//-----------------------------------------------------------------------------
+static size_t _ctmRansPutTable(unsigned char * aDest, const CTMuint * aFreq)
+{
+  CTMuint i, count;
+  size_t n;
+
+  count = 0;
+  for(i = 0; i < 256; ++ i)
+  {
+    if(aFreq[i] > 0)
+      ++ count;
+  }
+  n = 0;
+  aDest[n ++] = (unsigned char) (count - 1);
+
+  // Symbols
+  if(count < 32)
+  {
+    for(i = 0; i < 256; ++ i)
+    {
+      if(aFreq[i] > 0)
+        aDest[n ++] = (unsigned char) i;
+    }
+  }
+  else
+  {
+    memset(&aDest[n], 0, 32);
+    for(i = 0; i < 256; ++ i)
+    {
+      if(aFreq[i] > 0)
+        aDest[n + (i >> 3)] |= (unsigned char) (1 << (i & 7));
+    }
+    n += 32;
+  }
+
+  // Frequencies
+  for(i = 0; i < 256; ++ i)
+  {
+    if(aFreq[i] > 0)
+      n += _ctmRansPutVarint(&aDest[n], aFreq[i] - 1);
+  }
+
+  return n;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRansEncodeSegment() - Code one segment of a frame to aDest, which must
+// have room for aSize + 11 bytes (the mode and size of a stored segment).
+// aTmp is a buffer of aSize bytes, which the coded payload is written to
+// (backwards) before it is copied to aDest. Returns the number of bytes
+// written.
+//-----------------------------------------------------------------------------
+static size_t _ctmRansEncodeSegment(unsigned char * aDest,
+  const unsigned char * aSrc, size_t aSize, unsigned char * aTmp)
+{
+  unsigned char table[_CTM_RANS_TABLE_SIZE];
+  size_t counts[256], n, tableSize, i;
+  CTMuint freq[256], cum[256], x[4], s, f, j, xmax;
+  unsigned char * ptr, * limit;
+
+  // Count the symbols
+  memset(counts, 0, sizeof(counts));
+  for(i = 0; i < aSize; ++ i)
+    ++ counts[aSrc[i]];
+
+  // A segment with a single symbol only needs the symbol
+  if(counts[aSrc[0]] == aSize)
+  {
+    aDest[0] = _CTM_RANS_SINGLE;
+    n = 1 + _ctmRansPutVarint(&aDest[1], aSize);
+    aDest[n ++] = aSrc[0];
+    return n;
+  }
+
+  // Build the frequency table
+  _ctmRansNormalize(counts, aSize, freq);
+  tableSize = _ctmRansPutTable(table, freq);
+  cum[0] = 0;
+  for(j = 1; j < 256; ++ j)
+    cum[j] = cum[j - 1] + freq[j - 1];
+
+  // Code the symbols in reverse order (the decoder reads the payload
+  // forwards). The payload must be smaller than the segment (minus the table
+  // and the payload size), otherwise the segment is stored.
+  ptr = &aTmp[aSize];
+  limit = aTmp + tableSize + 16;
+  if(limit > ptr)
+    limit = ptr;
+  x[0] = x[1] = x[2] = x[3] = _CTM_RANS_LOW;
+  for(i = aSize; (i > 0) && (ptr - limit >= 2); -- i)
+  {
+    s = aSrc[i - 1];
+    f = freq[s];
+    j = (CTMuint) ((i - 1) & 3);
+
+    // Renormalize (at most two bytes per symbol)
+    xmax = ((_CTM_RANS_LOW >> _CTM_RANS_BITS) << 8) * f;
+    while(x[j] >= xmax)
+    {
+      *(-- ptr) = (unsigned char) (x[j] & 0xff);
+      x[j] >>= 8;
+    }
+
+    x[j] = ((x[j] / f) << _CTM_RANS_BITS) + (x[j] % f) + cum[s];
+  }
+
+  // Flush the coder states (coder 0 first in the payload)
+  if((i == 0) && (ptr - limit >= 16))
+  {
+    for(j = 4; j > 0; -- j)
+    {
+      ptr -= 4;
+      ptr[0] = (unsigned char) (x[j - 1] & 0xff);
+      ptr[1] = (unsigned char) ((x[j - 1] >> 8) & 0xff);
+      ptr[2] = (unsigned char) ((x[j - 1] >> 16) & 0xff);
+      ptr[3] = (unsigned char) ((x[j - 1] >> 24) & 0xff);
+    }
+
+    aDest[0] = _CTM_RANS_CODED;
+    n = 1 + _ctmRansPutVarint(&aDest[1], aSize);
+    memcpy(&aDest[n], table, tableSize);
+    n += tableSize;
+    n += _ctmRansPutVarint(&aDest[n], (size_t) (&aTmp[aSize] - ptr));
+    memcpy(&aDest[n], ptr, (size_t) (&aTmp[aSize] - ptr));
+    return n + (size_t) (&aTmp[aSize] - ptr);
+  }
+
+  // The segment does not compress
+  aDest[0] = _CTM_RANS_STORED;
+  n = 1 + _ctmRansPutVarint(&aDest[1], aSize);
+  memcpy(&aDest[n], aSrc, aSize);
+  return n + aSize;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRansGetTable() - Read the frequency table of a segment, and build the
+// decoding table (one entry per slot: the symbol in bits 0-7, its frequency in
+// bits 8-19 and the offset of the slot from the start of the symbol in bits
+// 20-31). Returns CTM_FALSE if the table is invalid.
+//-----------------------------------------------------------------------------
+static int _ctmRansGetTable(const unsigned char ** aSrc,
+  const unsigned char * aEnd, CTMuint * aTable)
+{
+  const unsigned char * src = *aSrc;
+  unsigned char symbols[256];
+  CTMuint i, k, count, cum;
+  size_t freq;
+
+  // Symbols
+  if(src >= aEnd)
+    return CTM_FALSE;
+  count = (CTMuint) *src ++ + 1;
+  if(count < 2)
+    return CTM_FALSE;
+  if(count < 32)
+  {
+    if((size_t) (aEnd - src) < count)
+      return CTM_FALSE;
+    for(i = 0; i < count; ++ i)
+      symbols[i] = src[i];
+    src += count;
+  }
+  else
+  {
+    if(aEnd - src < 32)
+      return CTM_FALSE;
+    k = 0;
+    for(i = 0; i < 256; ++ i)
+    {
+      if(src[i >> 3] & (1 << (i & 7)))
+      {
+        if(k >= count)
+          return CTM_FALSE;
+        symbols[k ++] = (unsigned char) i;
+      }
+    }
+    if(k != count)
+      return CTM_FALSE;
+    src += 32;
+  }
+
+  // Frequencies
+  cum = 0;
+  for(i = 0; i < count; ++ i)
+  {
+    if(!_ctmRansGetVarint(&src, aEnd, &freq) ||
+       (freq >= (size_t) (_CTM_RANS_TOTAL - 1)) ||
+       (cum + (CTMuint) freq + 1 > _CTM_RANS_TOTAL))
+      return CTM_FALSE;
+    ++ freq;
+    for(k = 0; k < (CTMuint) freq; ++ k)
+      aTable[cum + k] = (CTMuint) symbols[i] | ((CTMuint) freq << 8) | (k << 20);
+    cum += (CTMuint) freq;
+  }
+  if(cum != _CTM_RANS_TOTAL)
+    return CTM_FALSE;
+
+  *aSrc = src;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRansDecodeSegment() - Decode the rANS payload of a segment. Returns
+// CTM_FALSE if the payload is invalid.
+//-----------------------------------------------------------------------------
+static int _ctmRansDecodeSegment(unsigned char * aDest, size_t aSize,
+  const unsigned char * aSrc, size_t aSrcSize, const CTMuint * aTable)
+{
+  const unsigned char * src, * end;
+  CTMuint x[4], e, j;
+  size_t i;
+
+  if(aSrcSize < 16)
+    return CTM_FALSE;
+  src = aSrc;
+  end = aSrc + aSrcSize;
+  for(j = 0; j < 4; ++ j)
+  {
+    x[j] = (CTMuint) src[0] | ((CTMuint) src[1] << 8) |
+           ((CTMuint) src[2] << 16) | ((CTMuint) src[3] << 24);
+    src += 4;
+  }
+
+  // Fast loop: four symbols at a time, while the payload has room for the
+  // largest possible renormalization (two bytes per symbol)
+  i = 0;
+  while((aSize - i >= 4) && (end - src >= 8))
+  {
+    for(j = 0; j < 4; ++ j)
+    {
+      e = aTable[x[j] & (_CTM_RANS_TOTAL - 1)];
+      aDest[i + j] = (unsigned char) (e & 0xff);
+      x[j] = ((e >> 8) & (_CTM_RANS_TOTAL - 1)) * (x[j] >> _CTM_RANS_BITS) + (e >> 20);
+      if(x[j] < _CTM_RANS_LOW)
+      {
+        x[j] = (x[j] << 8) | *src ++;
+        if(x[j] < _CTM_RANS_LOW)
+          x[j] = (x[j] << 8) | *src ++;
+      }
+    }
+    i += 4;
+  }
+
+  // Remaining symbols (with bounds checks)
+  for(; i < aSize; ++ i)
+  {
+    j = (CTMuint) (i & 3);
+    e = aTable[x[j] & (_CTM_RANS_TOTAL - 1)];
+    aDest[i] = (unsigned char) (e & 0xff);
+    x[j] = ((e >> 8) & (_CTM_RANS_TOTAL - 1)) * (x[j] >> _CTM_RANS_BITS) + (e >> 20);
+    while(x[j] < _CTM_RANS_LOW)
+    {
+      if(src >= end)
+        return CTM_FALSE;
+      x[j] = (x[j] << 8) | *src ++;
+    }
+  }
+
+  // The coders must end up in their initial states, with the whole payload
+  // consumed
+  return (src == end) && (x[0] == _CTM_RANS_LOW) && (x[1] == _CTM_RANS_LOW) &&
+         (x[2] == _CTM_RANS_LOW) && (x[3] == _CTM_RANS_LOW);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRansPutStream() - Code a stream as one or more segments. aCuts holds
+// (increasing) positions in the stream where a new segment may start; cuts
+// that would leave less than _CTM_RANS_MIN_CUT bytes in a segment are
+// ignored. aTmp is a buffer of (at least) aSize bytes. Returns the number of
+// bytes written.
+//-----------------------------------------------------------------------------
+static size_t _ctmRansPutStream(unsigned char * aDest,
+  const unsigned char * aSrc, size_t aSize, const size_t * aCuts,
+  CTMuint aCutCount, unsigned char * aTmp)
+{
+  size_t n, start;
+  CTMuint i;
+
+  n = 0;
+  start = 0;
+  for(i = 0; i < aCutCount; ++ i)
+  {
+    if((aCuts[i] < aSize) && (aCuts[i] - start >= _CTM_RANS_MIN_CUT))
+    {
+      n += _ctmRansEncodeSegment(&aDest[n], &aSrc[start], aCuts[i] - start, aTmp);
+      start = aCuts[i];
+    }
+  }
+  if(start < aSize)
+    n += _ctmRansEncodeSegment(&aDest[n], &aSrc[start], aSize - start, aTmp);
+
+  return n;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRansGetStream() - Decode aSize bytes of a stream (one or more segments)
+// to aDest. aTable is a buffer of _CTM_RANS_TOTAL entries. Returns CTM_FALSE if
+// the stream is invalid.
+//-----------------------------------------------------------------------------
+static int _ctmRansGetStream(const unsigned char ** aSrc,
+  const unsigned char * aEnd, unsigned char * aDest, size_t aSize,
+  CTMuint * aTable)
+{
+  const unsigned char * src = *aSrc;
+  size_t size, payloadSize;
+  int mode;
+
+  while(aSize > 0)
+  {
+    // Segment header
+    if(src >= aEnd)
+      return CTM_FALSE;
+    mode = *src ++;
+    if(!_ctmRansGetVarint(&src, aEnd, &size) || (size == 0) || (size > aSize))
+      return CTM_FALSE;
+
+    // Segment data
+    switch(mode)
+    {
+      case _CTM_RANS_STORED:
+        if((size_t) (aEnd - src) < size)
+          return CTM_FALSE;
+        memcpy(aDest, src, size);
+        src += size;
+        break;
+
+      case _CTM_RANS_SINGLE:
+        if(src >= aEnd)
+          return CTM_FALSE;
+        memset(aDest, *src ++, size);
+        break;
+
+      case _CTM_RANS_CODED:
+        if(!_ctmRansGetTable(&src, aEnd, aTable) ||
+           !_ctmRansGetVarint(&src, aEnd, &payloadSize) ||
+           ((size_t) (aEnd - src) < payloadSize) ||
+           !_ctmRansDecodeSegment(aDest, size, src, payloadSize, aTable))
+          return CTM_FALSE;
+        src += payloadSize;
+        break;
+
+      default:
+        return CTM_FALSE;
+    }
+    aDest += size;
+    aSize -= size;
+  }
+
+  *aSrc = src;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// LZ77 parser state (for a single block).
+//-----------------------------------------------------------------------------
+typedef struct {
+  const unsigned char * mSrc;  // Block data
+  size_t mSize;                // Block size
+  CTMint * mHead;              // Hash table (last position for each hash)
+  CTMint * mChain;             // Previous position with the same hash
+  size_t mInserted;            // Number of positions in the hash chains
+  CTMuint mDepth;              // Maximum number of match candidates to try
+  size_t mRep;                 // Previous match offset
+
+  unsigned char * mLit;        // Streams
+  unsigned char * mTok;
+  unsigned char * mLen;
+  unsigned char * mOff;        // Three planes of mOffCapacity bytes
+  size_t mLitCount, mTokCount, mLenCount, mOffCount, mOffCapacity;
+
+  size_t mCuts[_CTM_LZ_MAX_CUTS]; // Literal segment cuts
+  CTMuint mCutCount;
+  size_t mBoundary;            // Next segment boundary (block position)
+  size_t mStride;              // Distance between segment boundaries
+} _CTMlzparser;
+
+//-----------------------------------------------------------------------------
+// _ctmLzHash() - Hash of the _CTM_LZ_MIN_MATCH bytes at aSrc.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmLzHash(const unsigned char * aSrc)
+{
+  CTMuint x;
+
+  x = (CTMuint) aSrc[0] | ((CTMuint) aSrc[1] << 8) |
+      ((CTMuint) aSrc[2] << 16) | ((CTMuint) aSrc[3] << 24);
+  return (CTMuint) ((x * 2654435761U) >> (32 - _CTM_LZ_HASH_BITS));
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLzInsert() - Add all positions before aPos to the hash chains.
+//-----------------------------------------------------------------------------
+static void _ctmLzInsert(_CTMlzparser * aParser, size_t aPos)
+{
+  CTMuint h;
+
+  if(aPos + _CTM_LZ_MIN_MATCH > aParser->mSize)
+    aPos = aParser->mSize + 1 - _CTM_LZ_MIN_MATCH;
+  for(; aParser->mInserted < aPos; ++ aParser->mInserted)
+  {
+    h = _ctmLzHash(&aParser->mSrc[aParser->mInserted]);
+    aParser->mChain[aParser->mInserted] = aParser->mHead[h];
+    aParser->mHead[h] = (CTMint) aParser->mInserted;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLzMatchLength() - Length of the common prefix of aA and aB (at most
+// aMax bytes).
+//-----------------------------------------------------------------------------
+static size_t _ctmLzMatchLength(const unsigned char * aA,
+  const unsigned char * aB, size_t aMax)
+{
+  size_t n = 0;
+
+  while((n < aMax) && (aA[n] == aB[n]))
+    ++ n;
+  return n;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLzFindMatch() - Find the best match at aPos. Matches with the previous
+// offset are preferred, unless another match is at least two bytes longer.
+// Returns the match length (zero if there is no match), and the offset in
+// aOffset.
+//-----------------------------------------------------------------------------
+static size_t _ctmLzFindMatch(_CTMlzparser * aParser, size_t aPos,
+  size_t * aOffset)
+{
+  const unsigned char * src = &aParser->mSrc[aPos];
+  size_t maxLen, len, bestLen, repLen;
+  CTMint cand;
+  CTMuint depth;
+
+  maxLen = aParser->mSize - aPos;
+  if(maxLen < _CTM_LZ_MIN_MATCH)
+    return 0;
+  _ctmLzInsert(aParser, aPos);
+
+  // Match with the previous offset
+  repLen = 0;
+  if(aParser->mRep <= aPos)
+    repLen = _ctmLzMatchLength(src, src - aParser->mRep, maxLen);
+  *aOffset = aParser->mRep;
+  bestLen = repLen;
+  if(bestLen == maxLen)
+    return bestLen;
+
+  // Search the hash chain
+  cand = aParser->mHead[_ctmLzHash(src)];
+  for(depth = aParser->mDepth; (cand >= 0) && (depth > 0); -- depth)
+  {
+    if(src[bestLen] == aParser->mSrc[cand + bestLen])
+    {
+      len = _ctmLzMatchLength(src, &aParser->mSrc[cand], maxLen);
+      if((len > bestLen) && (len >= repLen + 2))
+      {
+        bestLen = len;
+        *aOffset = aPos - (size_t) cand;
+        if(len == maxLen)
+          break;
+      }
+    }
+    cand = aParser->mChain[cand];
+  }
+
+  return (bestLen >= _CTM_LZ_MIN_MATCH) ? bestLen : 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLzPutLength() - Write the extension of a token nibble to the length
+// stream.
+//-----------------------------------------------------------------------------
+static void _ctmLzPutLength(_CTMlzparser * aParser, size_t aValue)
+{
+  while(aValue >= 255)
+  {
+    aParser->mLen[aParser->mLenCount ++] = 255;
+    aValue -= 255;
+  }
+  aParser->mLen[aParser->mLenCount ++] = (unsigned char) aValue;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLzEmit() - Emit a token: the literals from aStart to aEnd, followed by
+// a match (unless aMatchLen is zero).
+//-----------------------------------------------------------------------------
+static void _ctmLzEmit(_CTMlzparser * aParser, size_t aStart, size_t aEnd,
+  size_t aMatchLen, size_t aOffset)
+{
+  size_t litLen = aEnd - aStart, off;
+  unsigned char token;
+
+  // Literal segment cuts at the boundaries that are passed
+  while((aParser->mBoundary < aEnd) && (aParser->mCutCount < _CTM_LZ_MAX_CUTS))
+  {
+    aParser->mCuts[aParser->mCutCount ++] = aParser->mLitCount +
+      (aParser->mBoundary > aStart ? aParser->mBoundary - aStart : 0);
+    aParser->mBoundary += aParser->mStride;
+  }
+
+  // Literals
+  memcpy(&aParser->mLit[aParser->mLitCount], &aParser->mSrc[aStart], litLen);
+  aParser->mLitCount += litLen;
+
+  // Token
+  token = (unsigned char) ((litLen < 15 ? litLen : 15) << 4);
+  if(aMatchLen > 0)
+    token |= (unsigned char) (aMatchLen - _CTM_LZ_MIN_MATCH < 15 ?
+                              aMatchLen - _CTM_LZ_MIN_MATCH : 15);
+  aParser->mTok[aParser->mTokCount ++] = token;
+  if(litLen >= 15)
+    _ctmLzPutLength(aParser, litLen - 15);
+  if(aMatchLen == 0)
+    return;
+
+  // Match
+  off = (aOffset == aParser->mRep) ? 0 : aOffset;
+  aParser->mRep = aOffset;
+  aParser->mOff[aParser->mOffCount] = (unsigned char) (off & 0xff);
+  aParser->mOff[aParser->mOffCapacity + aParser->mOffCount] =
+    (unsigned char) ((off >> 8) & 0xff);
+  aParser->mOff[2 * aParser->mOffCapacity + aParser->mOffCount] =
+    (unsigned char) ((off >> 16) & 0xff);
+  ++ aParser->mOffCount;
+  if(aMatchLen - _CTM_LZ_MIN_MATCH >= 15)
+    _ctmLzPutLength(aParser, aMatchLen - _CTM_LZ_MIN_MATCH - 15);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLzParse() - Parse a block into tokens (greedy, with one step of lazy
+// evaluation).
+//-----------------------------------------------------------------------------
+static void _ctmLzParse(_CTMlzparser * aParser)
+{
+  size_t pos, anchor, len, off, len2, off2;
+
+  pos = anchor = 0;
+  while(pos + _CTM_LZ_MIN_MATCH <= aParser->mSize)
+  {
+    len = _ctmLzFindMatch(aParser, pos, &off);
+    if(len == 0)
+    {
+      ++ pos;
+      continue;
+    }
+
+    // Is there a better match at the next position?
+    len2 = _ctmLzFindMatch(aParser, pos + 1, &off2);
+    if(len2 > len + 1)
+    {
+      ++ pos;
+      len = len2;
+      off = off2;
+    }
+
+    _ctmLzEmit(aParser, anchor, pos, len, off);
+    pos += len;
+    anchor = pos;
+  }
+
+  // Trailing literals
+  if(anchor < aParser->mSize)
+    _ctmLzEmit(aParser, anchor, aParser->mSize, 0, 0);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRansEncode() - Code a frame of packed data (see the layout above).
+// aOffset is the position of the frame in the interleaved array, and
+// aPlaneSize is the size of a byte plane of the array, which are used for
+// placing the literal segments. aLevel (0-9) controls the match search depth.
+// On input, aDestSize is the size of aDest (at least _CTM_PACKED_SIZE(aSize)),
+// and on output it is the size of the coded frame. Returns CTM_FALSE if there
+// is not enough memory.
+//-----------------------------------------------------------------------------
+int _ctmRansEncode(_CTMcontext * self, unsigned char * aDest,
+  size_t * aDestSize, const unsigned char * aSrc, size_t aSize,
+  size_t aOffset, size_t aPlaneSize, CTMuint aLevel)
+{
+  _CTMlzparser * parser;
+  unsigned char * work, * out, * tmp;
+  size_t blockSize, workSize, size, n, pos, dest, global;
+  CTMuint i;
+
+  blockSize = aSize < _CTM_LZ_BLOCK_SIZE ? aSize : _CTM_LZ_BLOCK_SIZE;
+
+  // Allocate the parser and its buffers: hash table, hash chains, literals,
+  // tokens, lengths, offsets (three planes), coded block and a segment buffer
+  parser = (_CTMlzparser *) _ctmMalloc(self, sizeof(_CTMlzparser));
+  workSize = ((size_t) 1 << _CTM_LZ_HASH_BITS) * sizeof(CTMint) +
+             blockSize * sizeof(CTMint) + blockSize * 3 +
+             (blockSize / _CTM_LZ_MIN_MATCH + 1) * 3 +
+             blockSize * 2 + _CTM_LZ_MAX_CUTS * 16 + 64 + blockSize;
+  work = (unsigned char *) _ctmMalloc(self, workSize);
+  if(!parser || !work)
+  {
+    _ctmFree(self, parser);
+    _ctmFree(self, work);
+    return CTM_FALSE;
+  }
+  parser->mHead = (CTMint *) work;
+  parser->mChain = &parser->mHead[(size_t) 1 << _CTM_LZ_HASH_BITS];
+  parser->mLit = (unsigned char *) &parser->mChain[blockSize];
+  parser->mTok = &parser->mLit[blockSize];
+  parser->mLen = &parser->mTok[blockSize];
+  parser->mOffCapacity = blockSize / _CTM_LZ_MIN_MATCH + 1;
+  parser->mOff = &parser->mLen[blockSize];
+  out = &parser->mOff[parser->mOffCapacity * 3];
+  tmp = &out[blockSize * 2 + _CTM_LZ_MAX_CUTS * 16 + 64];
+  parser->mDepth = 4U << (aLevel / 2);
+
+  dest = 0;
+  for(pos = 0; pos < aSize; pos += n)
+  {
+    n = aSize - pos < _CTM_LZ_BLOCK_SIZE ? aSize - pos : _CTM_LZ_BLOCK_SIZE;
+
+    // Parse the block
+    parser->mSrc = &aSrc[pos];
+    parser->mSize = n;
+    parser->mInserted = 0;
+    parser->mRep = 1;
+    parser->mLitCount = parser->mTokCount = parser->mLenCount = 0;
+    parser->mOffCount = 0;
+    parser->mCutCount = 0;
+    global = aOffset + pos;
+    parser->mStride = n;
+    if(aPlaneSize > 0)
+      parser->mStride = ((_CTM_RANS_MIN_SEGMENT + aPlaneSize - 1) / aPlaneSize) *
+                        aPlaneSize;
+    parser->mBoundary = parser->mStride - global % parser->mStride;
+    for(i = 0; i < ((CTMuint) 1 << _CTM_LZ_HASH_BITS); ++ i)
+      parser->mHead[i] = -1;
+    _ctmLzParse(parser);
+
+    // Code the streams
+    out[0] = _CTM_LZ_CODED;
+    size = 1;
+    size += _ctmRansPutVarint(&out[size], parser->mLitCount);
+    size += _ctmRansPutVarint(&out[size], parser->mTokCount);
+    size += _ctmRansPutVarint(&out[size], parser->mLenCount);
+    size += _ctmRansPutVarint(&out[size], parser->mOffCount);
+    size += _ctmRansPutStream(&out[size], parser->mLit,
+      parser->mLitCount, parser->mCuts, parser->mCutCount, tmp);
+    size += _ctmRansPutStream(&out[size], parser->mTok,
+      parser->mTokCount, parser->mCuts, 0, tmp);
+    size += _ctmRansPutStream(&out[size], parser->mLen,
+      parser->mLenCount, parser->mCuts, 0, tmp);
+    for(i = 0; i < 3; ++ i)
+      size += _ctmRansPutStream(&out[size],
+        &parser->mOff[i * parser->mOffCapacity], parser->mOffCount,
+        parser->mCuts, 0, tmp);
+
+    // Store the block if it did not compress
+    if(size > n)
+    {
+      aDest[dest ++] = _CTM_LZ_STORED;
+      memcpy(&aDest[dest], &aSrc[pos], n);
+      dest += n;
+    }
+    else
+    {
+      memcpy(&aDest[dest], out, size);
+      dest += size;
+    }
+  }
+
+  _ctmFree(self, work);
+  _ctmFree(self, parser);
+  *aDestSize = dest;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLzGetLength() - Read the extension of a token nibble from the length
+// stream. Returns CTM_FALSE if the length stream is exhausted.
+//-----------------------------------------------------------------------------
+static int _ctmLzGetLength(const unsigned char ** aSrc,
+  const unsigned char * aEnd, size_t * aValue)
+{
+  const unsigned char * src = *aSrc;
+  CTMuint b;
+
+  do
+  {
+    if(src >= aEnd)
+      return CTM_FALSE;
+    b = *src ++;
+    *aValue += b;
+  } while(b == 255);
+
+  *aSrc = src;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLzDecodeBlock() - Rebuild a block from its decoded streams. Returns
+// CTM_FALSE if the streams are invalid.
+//-----------------------------------------------------------------------------
+static int _ctmLzDecodeBlock(unsigned char * aDest, size_t aSize,
+  const unsigned char * aLit, size_t aLitCount,
+  const unsigned char * aTok, size_t aTokCount,
+  const unsigned char * aLen, size_t aLenCount,
+  const unsigned char * aOff, size_t aOffCount)
+{
+  const unsigned char * litEnd, * tokEnd, * lenEnd;
+  size_t pos, litLen, matchLen, off, rep, k;
+  unsigned char * dst;
+  CTMuint token;
+
+  litEnd = aLit + aLitCount;
+  tokEnd = aTok + aTokCount;
+  lenEnd = aLen + aLenCount;
+  pos = 0;
+  k = 0;
+  rep = 1;
+  while(pos < aSize)
+  {
+    // Literals
+    if(aTok >= tokEnd)
+      return CTM_FALSE;
+    token = *aTok ++;
+    litLen = token >> 4;
+    if((litLen == 15) && !_ctmLzGetLength(&aLen, lenEnd, &litLen))
+      return CTM_FALSE;
+    if((litLen > aSize - pos) || (litLen > (size_t) (litEnd - aLit)))
+      return CTM_FALSE;
+    memcpy(&aDest[pos], aLit, litLen);
+    aLit += litLen;
+    pos += litLen;
+    if(pos == aSize)
+      break;
+
+    // Match
+    if(k >= aOffCount)
+      return CTM_FALSE;
+    off = (size_t) aOff[k] | ((size_t) aOff[aOffCount + k] << 8) |
+          ((size_t) aOff[2 * aOffCount + k] << 16);
+    ++ k;
+    if(off == 0)
+      off = rep;
+    rep = off;
+    matchLen = (token & 15) + _CTM_LZ_MIN_MATCH;
+    if(((token & 15) == 15) && !_ctmLzGetLength(&aLen, lenEnd, &matchLen))
+      return CTM_FALSE;
+    if((off > pos) || (matchLen > aSize - pos))
+      return CTM_FALSE;
+    dst = &aDest[pos];
+    if(off >= matchLen)
+      memcpy(dst, dst - off, matchLen);
+    else if(off == 1)
+      memset(dst, dst[-1], matchLen);
+    else
+    {
+      for(litLen = 0; litLen < matchLen; ++ litLen)
+        dst[litLen] = dst[litLen - off];
+    }
+    pos += matchLen;
+  }
+
+  // All streams must be fully consumed
+  return (aLit == litEnd) && (aTok == tokEnd) && (aLen == lenEnd) &&
+         (k == aOffCount);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRansDecode() - Decode a frame of packed data (see the layout above) to
+// aDest, which holds aSize bytes. Returns an OpenCTM error code.
+//-----------------------------------------------------------------------------
+CTMenum _ctmRansDecode(_CTMcontext * self, unsigned char * aDest,
+  size_t aSize, const unsigned char * aSrc, size_t aSrcSize)
+{
+  const unsigned char * src, * end;
+  unsigned char * work, * lit, * tok, * len, * off;
+  size_t n, pos, counts[4], workSize;
+  CTMuint * table;
+  int mode, ok;
+  CTMuint i;
+
+  src = aSrc;
+  end = aSrc + aSrcSize;
+  for(pos = 0; pos < aSize; pos += n)
+  {
+    n = aSize - pos < _CTM_LZ_BLOCK_SIZE ? aSize - pos : _CTM_LZ_BLOCK_SIZE;
+    if(src >= end)
+      return CTM_BAD_FORMAT;
+    mode = *src ++;
+
+    // Stored block?
+    if(mode == _CTM_LZ_STORED)
+    {
+      if((size_t) (end - src) < n)
+        return CTM_BAD_FORMAT;
+      memcpy(&aDest[pos], src, n);
+      src += n;
+      continue;
+    }
+    if(mode != _CTM_LZ_CODED)
+      return CTM_BAD_FORMAT;
+
+    // Stream sizes
+    for(i = 0; i < 4; ++ i)
+    {
+      if(!_ctmRansGetVarint(&src, end, &counts[i]) || (counts[i] > n))
+        return CTM_BAD_FORMAT;
+    }
+
+    // Decode the streams
+    workSize = _CTM_RANS_TOTAL * sizeof(CTMuint) + counts[0] + counts[1] +
+               counts[2] + counts[3] * 3;
+    work = (unsigned char *) _ctmMalloc(self, workSize);
+    if(!work)
+      return CTM_OUT_OF_MEMORY;
+    table = (CTMuint *) work;
+    lit = &work[_CTM_RANS_TOTAL * sizeof(CTMuint)];
+    tok = &lit[counts[0]];
+    len = &tok[counts[1]];
+    off = &len[counts[2]];
+    ok = _ctmRansGetStream(&src, end, lit, counts[0], table) &&
+         _ctmRansGetStream(&src, end, tok, counts[1], table) &&
+         _ctmRansGetStream(&src, end, len, counts[2], table) &&
+         _ctmRansGetStream(&src, end, off, counts[3] * 3, table) &&
+         _ctmLzDecodeBlock(&aDest[pos], n, lit, counts[0], tok, counts[1],
+                           len, counts[2], off, counts[3]);
+    _ctmFree(self, work);
+    if(!ok)
+      return CTM_BAD_FORMAT;
+  }
+
+  // The whole frame must be consumed
+  return (src == end) ? CTM_NONE : CTM_BAD_FORMAT;
+}
@@ -0,0 +1,496 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        reduce.c
+// Description: Reductions over the mesh arrays (bounding box, mesh
+//              validation and edge lengths), with SSE2 kernels and parallel
+//              loops for large meshes.
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include <math.h>
+#include "openctm.h"
+#include "internal.h"
+
+#ifdef _CTM_USE_SSE2
+  #include <emmintrin.h>
+#endif
+
+// Bits of the exponent of a float (all bits set for infinity and NaN)
+#define _CTM_FLOAT_EXP_MASK 0x7f800000
+
+// Number of triangles per block when summing edge lengths. The block sums are
+// added in order, so the result does not depend on the number of threads.
+#define _CTM_EDGE_BLOCK_SIZE 0x00004000
+
+
+//-----------------------------------------------------------------------------
+// _ctmFloatBits() - Get the bit pattern of a float.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmFloatBits(CTMfloat aValue)
+{
+  union {
+    CTMfloat f;
+    CTMuint i;
+  } u;
+
+  u.f = aValue;
+  return u.i;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPartRange() - Get the range of one part of aCount elements that are
+// split into aParts parts (same split as _ctmParallelFor()).
+//-----------------------------------------------------------------------------
+static void _ctmPartRange(CTMuint aCount, CTMuint aParts, CTMuint aPart,
+  CTMuint * aBegin, CTMuint * aEnd)
+{
+  CTMuint partSize, rest;
+
+  partSize = aCount / aParts;
+  rest = aCount % aParts;
+  *aBegin = aPart * partSize + (aPart < rest ? aPart : rest);
+  *aEnd = *aBegin + partSize + (aPart < rest ? 1 : 0);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAllFinite() - Check that all values of a float array are finite (not
+// NaN or infinity).
+//-----------------------------------------------------------------------------
+static int _ctmAllFinite(const CTMfloat * aValues, size_t aCount)
+{
+  size_t i = 0;
+#ifdef _CTM_USE_SSE2
+  const __m128i mask = _mm_set1_epi32(_CTM_FLOAT_EXP_MASK);
+  __m128i bad = _mm_setzero_si128(), v0, v1, v2, v3;
+
+  for(; i + 16 <= aCount; i += 16)
+  {
+    v0 = _mm_and_si128(_mm_loadu_si128((const __m128i *) &aValues[i]), mask);
+    v1 = _mm_and_si128(_mm_loadu_si128((const __m128i *) &aValues[i + 4]), mask);
+    v2 = _mm_and_si128(_mm_loadu_si128((const __m128i *) &aValues[i + 8]), mask);
+    v3 = _mm_and_si128(_mm_loadu_si128((const __m128i *) &aValues[i + 12]), mask);
+    bad = _mm_or_si128(bad, _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi32(v0, mask), _mm_cmpeq_epi32(v1, mask)),
+      _mm_or_si128(_mm_cmpeq_epi32(v2, mask), _mm_cmpeq_epi32(v3, mask))));
+  }
+  if(_mm_movemask_epi8(bad))
+    return CTM_FALSE;
+#endif
+
+  for(; i < aCount; ++ i)
+  {
+    if((_ctmFloatBits(aValues[i]) & _CTM_FLOAT_EXP_MASK) == _CTM_FLOAT_EXP_MASK)
+      return CTM_FALSE;
+  }
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAllBelow() - Check that all values of an integer array are less than
+// aLimit.
+//-----------------------------------------------------------------------------
+static int _ctmAllBelow(const CTMuint * aValues, size_t aCount, CTMuint aLimit)
+{
+  size_t i = 0;
+#ifdef _CTM_USE_SSE2
+  // SSE2 only has signed compares, so flip the sign bits first
+  const __m128i bias = _mm_set1_epi32((int) 0x80000000);
+  const __m128i limit = _mm_set1_epi32((int) (aLimit ^ 0x80000000));
+  __m128i ok = _mm_set1_epi32(-1), v0, v1, v2, v3;
+
+  for(; i + 16 <= aCount; i += 16)
+  {
+    v0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &aValues[i]), bias);
+    v1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &aValues[i + 4]), bias);
+    v2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &aValues[i + 8]), bias);
+    v3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &aValues[i + 12]), bias);
+    ok = _mm_and_si128(ok, _mm_and_si128(
+      _mm_and_si128(_mm_cmplt_epi32(v0, limit), _mm_cmplt_epi32(v1, limit)),
+      _mm_and_si128(_mm_cmplt_epi32(v2, limit), _mm_cmplt_epi32(v3, limit))));
+  }
+  if(_mm_movemask_epi8(ok) != 0xffff)
+    return CTM_FALSE;
+#endif
+
+  for(; i < aCount; ++ i)
+  {
+    if(aValues[i] >= aLimit)
+      return CTM_FALSE;
+  }
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _CTMcheckstate - State of the parallel mesh validation.
+//-----------------------------------------------------------------------------
+typedef struct {
+  _CTMcontext * mContext;
+  CTMuint mParts;
+  int mValid[_CTM_MAX_THREADS];
+} _CTMcheckstate;
+
+//-----------------------------------------------------------------------------
+// _ctmCheckMeshPart() - Check one part of the triangles and of the vertex data
+// arrays (range function, called with one element per part).
+//-----------------------------------------------------------------------------
+static void _ctmCheckMeshPart(void * aData, CTMuint aPart, CTMuint aBegin,
+  CTMuint aEnd)
+{
+  _CTMcheckstate * state = (_CTMcheckstate *) aData;
+  _CTMcontext * self = state->mContext;
+  _CTMfloatmap * map;
+  CTMuint begin, end;
+  int valid;
+  (void) aBegin;
+  (void) aEnd;
+
+  // Check that all indices are within range
+  _ctmPartRange(self->mTriangleCount, state->mParts, aPart, &begin, &end);
+  valid = _ctmAllBelow(&self->mIndices[(size_t) begin * 3],
+    (size_t) (end - begin) * 3, self->mVertexCount);
+
+  // Check that all vertices, normals, UV coordinates and attributes are
+  // finite (non-NaN, non-inf), skipping arrays that were not loaded
+  _ctmPartRange(self->mVertexCount, state->mParts, aPart, &begin, &end);
+  valid = valid && _ctmAllFinite(&self->mVertices[(size_t) begin * 3],
+    (size_t) (end - begin) * 3);
+  if(self->mNormals)
+    valid = valid && _ctmAllFinite(&self->mNormals[(size_t) begin * 3],
+      (size_t) (end - begin) * 3);
+  for(map = self->mUVMaps; map && valid; map = map->mNext)
+    if(map->mValues)
+      valid = _ctmAllFinite(&map->mValues[(size_t) begin * 2],
+        (size_t) (end - begin) * 2);
+  for(map = self->mAttribMaps; map && valid; map = map->mNext)
+    if(map->mValues)
+      valid = _ctmAllFinite(&map->mValues[(size_t) begin * 4],
+        (size_t) (end - begin) * 4);
+
+  state->mValid[aPart] = valid;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCheckMeshData() - Check that all triangle indices are within range, and
+// that all vertex data is finite. Each part of a parallel loop checks one
+// slice of the triangles and one slice of all vertex data arrays, so every
+// array is read once.
+//-----------------------------------------------------------------------------
+int _ctmCheckMeshData(_CTMcontext * self)
+{
+  _CTMcheckstate state;
+  CTMuint i, count;
+
+  count = self->mVertexCount > self->mTriangleCount ? self->mVertexCount :
+    self->mTriangleCount;
+  state.mContext = self;
+  state.mParts = _ctmParallelParts(self, count, _CTM_PARALLEL_MIN_PART);
+  _ctmParallelFor(self, state.mParts, state.mParts, _ctmCheckMeshPart, &state);
+  for(i = 0; i < state.mParts; ++ i)
+  {
+    if(!state.mValid[i])
+      return CTM_FALSE;
+  }
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmBoundsRange() - Update a bounding box with the vertices aBegin to
+// aEnd - 1 (aMin and aMax must be initialized).
+//-----------------------------------------------------------------------------
+static void _ctmBoundsRange(const CTMfloat * aVertices, CTMuint aBegin,
+  CTMuint aEnd, CTMfloat * aMin, CTMfloat * aMax)
+{
+  const CTMfloat * p;
+  CTMuint i = aBegin, k;
+#ifdef _CTM_USE_SSE2
+  __m128 minA, minB, minC, maxA, maxB, maxC, a, b, c;
+  CTMfloat mn[12], mx[12];
+
+  // Four vertices (twelve floats) at a time. The three vectors hold the
+  // components x y z x, y z x y and z x y z. Note: _mm_min_ps() and
+  // _mm_max_ps() return the second operand if either operand is NaN, which
+  // makes NaN values ignored, just like in the scalar code.
+  if(aEnd - aBegin >= 4)
+  {
+    minA = _mm_setr_ps(aMin[0], aMin[1], aMin[2], aMin[0]);
+    minB = _mm_setr_ps(aMin[1], aMin[2], aMin[0], aMin[1]);
+    minC = _mm_setr_ps(aMin[2], aMin[0], aMin[1], aMin[2]);
+    maxA = _mm_setr_ps(aMax[0], aMax[1], aMax[2], aMax[0]);
+    maxB = _mm_setr_ps(aMax[1], aMax[2], aMax[0], aMax[1]);
+    maxC = _mm_setr_ps(aMax[2], aMax[0], aMax[1], aMax[2]);
+    for(; i + 4 <= aEnd; i += 4)
+    {
+      p = &aVertices[(size_t) i * 3];
+      a = _mm_loadu_ps(p);
+      b = _mm_loadu_ps(p + 4);
+      c = _mm_loadu_ps(p + 8);
+      minA = _mm_min_ps(a, minA);
+      minB = _mm_min_ps(b, minB);
+      minC = _mm_min_ps(c, minC);
+      maxA = _mm_max_ps(a, maxA);
+      maxB = _mm_max_ps(b, maxB);
+      maxC = _mm_max_ps(c, maxC);
+    }
+    _mm_storeu_ps(&mn[0], minA);
+    _mm_storeu_ps(&mn[4], minB);
+    _mm_storeu_ps(&mn[8], minC);
+    _mm_storeu_ps(&mx[0], maxA);
+    _mm_storeu_ps(&mx[4], maxB);
+    _mm_storeu_ps(&mx[8], maxC);
+    for(k = 0; k < 12; ++ k)
+    {
+      if(mn[k] < aMin[k % 3])
+        aMin[k % 3] = mn[k];
+      if(mx[k] > aMax[k % 3])
+        aMax[k % 3] = mx[k];
+    }
+  }
+#endif
+
+  for(; i < aEnd; ++ i)
+  {
+    p = &aVertices[(size_t) i * 3];
+    for(k = 0; k < 3; ++ k)
+    {
+      if(p[k] < aMin[k])
+        aMin[k] = p[k];
+      else if(p[k] > aMax[k])
+        aMax[k] = p[k];
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _CTMboundsstate - State of the parallel bounding box calculation.
+//-----------------------------------------------------------------------------
+typedef struct {
+  const CTMfloat * mVertices;
+  CTMfloat mMin[_CTM_MAX_THREADS][3];
+  CTMfloat mMax[_CTM_MAX_THREADS][3];
+} _CTMboundsstate;
+
+//-----------------------------------------------------------------------------
+// _ctmBoundsPart() - Calculate the bounding box of a part of the vertices
+// (range function).
+//-----------------------------------------------------------------------------
+static void _ctmBoundsPart(void * aData, CTMuint aPart, CTMuint aBegin,
+  CTMuint aEnd)
+{
+  _CTMboundsstate * state = (_CTMboundsstate *) aData;
+  CTMuint k;
+
+  // All parts start from the first vertex (like the serial loop)
+  for(k = 0; k < 3; ++ k)
+    state->mMin[aPart][k] = state->mMax[aPart][k] = state->mVertices[k];
+  _ctmBoundsRange(state->mVertices, aBegin, aEnd, state->mMin[aPart],
+    state->mMax[aPart]);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmBoundingBox() - Calculate the axis aligned bounding box of the mesh
+// vertices. The result is identical to a scalar loop that starts with the
+// first vertex and updates the box for every vertex that is outside of it.
+//-----------------------------------------------------------------------------
+void _ctmBoundingBox(_CTMcontext * self, CTMfloat * aMin, CTMfloat * aMax)
+{
+  _CTMboundsstate state;
+  const CTMfloat * v = self->mVertices;
+  CTMuint parts, i, k;
+
+  state.mVertices = v;
+  parts = _ctmParallelParts(self, self->mVertexCount, _CTM_PARALLEL_MIN_PART);
+  _ctmParallelFor(self, self->mVertexCount, parts, _ctmBoundsPart, &state);
+
+  // Combine the parts
+  for(k = 0; k < 3; ++ k)
+  {
+    aMin[k] = state.mMin[0][k];
+    aMax[k] = state.mMax[0][k];
+    for(i = 1; i < parts; ++ i)
+    {
+      if(state.mMin[i][k] < aMin[k])
+        aMin[k] = state.mMin[i][k];
+      if(state.mMax[i][k] > aMax[k])
+        aMax[k] = state.mMax[i][k];
+    }
+
+    // A zero limit may be either +0 or -0, depending on the order in which
+    // the values were compared. The scalar loop keeps the first zero.
+    if(aMin[k] == 0.0f)
+    {
+      for(i = 0; (i < self->mVertexCount) && (v[(size_t) i * 3 + k] != 0.0f); ++ i);
+      aMin[k] = v[(size_t) i * 3 + k];
+    }
+    if(aMax[k] == 0.0f)
+    {
+      for(i = 0; (i < self->mVertexCount) && (v[(size_t) i * 3 + k] != 0.0f); ++ i);
+      aMax[k] = v[(size_t) i * 3 + k];
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmEdgeLengthBlock() - Sum up the lengths of the (half) edges of the
+// triangles aBegin to aEnd - 1. The edges of each triangle are visited in the
+// order c-a, a-b, b-c, and each length is added to a double precision sum.
+//-----------------------------------------------------------------------------
+static double _ctmEdgeLengthBlock(const CTMfloat * aVertices,
+  const CTMuint * aIndices, CTMuint aBegin, CTMuint aEnd)
+{
+  const CTMfloat * p1, * p2;
+  const CTMuint * tri;
+  CTMuint i, j;
+  double sum = 0.0;
+#ifdef _CTM_USE_SSE2
+  __m128 x[3], y[3], z[3], dx, dy, dz;
+  CTMfloat len[3][4];
+  const CTMfloat * c[3][4];
+  CTMuint t;
+
+  // Four triangles at a time: the corners are gathered into vectors with one
+  // triangle per lane, and the three edge lengths are calculated with SIMD
+  // instructions (same operations, and hence same results, as the scalar
+  // code)
+  for(i = aBegin; i + 4 <= aEnd; i += 4)
+  {
+    for(t = 0; t < 4; ++ t)
+    {
+      tri = &aIndices[(size_t) (i + t) * 3];
+      for(j = 0; j < 3; ++ j)
+        c[j][t] = &aVertices[(size_t) tri[j] * 3];
+    }
+    for(j = 0; j < 3; ++ j)
+    {
+      x[j] = _mm_setr_ps(c[j][0][0], c[j][1][0], c[j][2][0], c[j][3][0]);
+      y[j] = _mm_setr_ps(c[j][0][1], c[j][1][1], c[j][2][1], c[j][3][1]);
+      z[j] = _mm_setr_ps(c[j][0][2], c[j][1][2], c[j][2][2], c[j][3][2]);
+    }
+    for(j = 0; j < 3; ++ j)
+    {
+      dx = _mm_sub_ps(x[j], x[(j + 2) % 3]);
+      dy = _mm_sub_ps(y[j], y[(j + 2) % 3]);
+      dz = _mm_sub_ps(z[j], z[(j + 2) % 3]);
+      _mm_storeu_ps(len[j], _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+        _mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz))));
+    }
+    for(t = 0; t < 4; ++ t)
+    {
+      sum += (double) len[0][t];
+      sum += (double) len[1][t];
+      sum += (double) len[2][t];
+    }
+  }
+  aBegin = i;
+#endif
+
+  for(i = aBegin; i < aEnd; ++ i)
+  {
+    tri = &aIndices[(size_t) i * 3];
+    p1 = &aVertices[(size_t) tri[2] * 3];
+    for(j = 0; j < 3; ++ j)
+    {
+      p2 = &aVertices[(size_t) tri[j] * 3];
+      sum += (double) sqrtf((p2[0] - p1[0]) * (p2[0] - p1[0]) +
+                            (p2[1] - p1[1]) * (p2[1] - p1[1]) +
+                            (p2[2] - p1[2]) * (p2[2] - p1[2]));
+      p1 = p2;
+    }
+  }
+
+  return sum;
+}
+
+//-----------------------------------------------------------------------------
+// _CTMedgestate - State of the parallel edge length summation.
+//-----------------------------------------------------------------------------
+typedef struct {
+  _CTMcontext * mContext;
+  double * mBlockSums;
+} _CTMedgestate;
+
+//-----------------------------------------------------------------------------
+// _ctmEdgeLengthPart() - Sum up the edge lengths of a range of triangle blocks
+// (range function).
+//-----------------------------------------------------------------------------
+static void _ctmEdgeLengthPart(void * aData, CTMuint aPart, CTMuint aBegin,
+  CTMuint aEnd)
+{
+  _CTMedgestate * state = (_CTMedgestate *) aData;
+  _CTMcontext * self = state->mContext;
+  CTMuint i, first, last;
+  (void) aPart;
+
+  for(i = aBegin; i < aEnd; ++ i)
+  {
+    first = i * _CTM_EDGE_BLOCK_SIZE;
+    last = self->mTriangleCount - first < _CTM_EDGE_BLOCK_SIZE ?
+      self->mTriangleCount : first + _CTM_EDGE_BLOCK_SIZE;
+    state->mBlockSums[i] = _ctmEdgeLengthBlock(self->mVertices,
+      self->mIndices, first, last);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSumEdgeLengths() - Sum up the lengths of all the half-edges of the mesh
+// (three per triangle). The triangles are summed in fixed size blocks, so the
+// result is the same for any number of threads.
+//-----------------------------------------------------------------------------
+double _ctmSumEdgeLengths(_CTMcontext * self)
+{
+  _CTMedgestate state;
+  CTMuint blockCount, parts, i;
+  double sum;
+
+  blockCount = (self->mTriangleCount + _CTM_EDGE_BLOCK_SIZE - 1) /
+    _CTM_EDGE_BLOCK_SIZE;
+  parts = _ctmParallelParts(self, self->mTriangleCount, _CTM_PARALLEL_MIN_PART);
+  if(parts > blockCount)
+    parts = blockCount;
+
+  // Sum up the blocks in parallel (if the block sums can not be allocated,
+  // the blocks are summed by this thread instead)
+  state.mContext = self;
+  state.mBlockSums = (double *) 0;
+  if(parts > 1)
+    state.mBlockSums = (double *) _ctmMalloc(self, sizeof(double) * blockCount);
+  sum = 0.0;
+  if(state.mBlockSums)
+  {
+    _ctmParallelFor(self, blockCount, parts, _ctmEdgeLengthPart, &state);
+    for(i = 0; i < blockCount; ++ i)
+      sum += state.mBlockSums[i];
+    _ctmFree(self, state.mBlockSums);
+  }
+  else
+  {
+    for(i = 0; i < blockCount; ++ i)
+    {
+      sum += _ctmEdgeLengthBlock(self->mVertices, self->mIndices,
+        i * _CTM_EDGE_BLOCK_SIZE,
+        self->mTriangleCount - i * _CTM_EDGE_BLOCK_SIZE < _CTM_EDGE_BLOCK_SIZE ?
+        self->mTriangleCount : (i + 1) * _CTM_EDGE_BLOCK_SIZE);
+    }
+  }
+
+  return sum;
+}
@@ -0,0 +1,278 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        sort.c
+// Description: Radix sorting of fixed size integer records, and triangle
+//              re-arrangement (used for ordering vertices and triangles
+//              before compression).
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+#include "openctm.h"
+#include "internal.h"
+
+
+//-----------------------------------------------------------------------------
+// _CTMsortstate - State of a radix sort that is shared by the parts of the
+// parallel sort loops.
+//-----------------------------------------------------------------------------
+typedef struct {
+  // Source and destination arrays of the current pass
+  CTMuint * mSrc;
+  CTMuint * mDst;
+
+  // Key word indices
+  CTMuint mMajor;
+  CTMuint mMinor;
+
+  // Digit histograms (or output positions), 8 x 256 counters per part
+  CTMuint * mHist;
+
+  // Current pass (0-7)
+  CTMuint mPass;
+} _CTMsortstate;
+
+//-----------------------------------------------------------------------------
+// _ctmSortDigit() - Get the digit of a record for the given pass.
+//-----------------------------------------------------------------------------
+#define _ctmSortDigit(state, rec, pass) \
+  (((rec)[(pass) < 4 ? (state)->mMinor : (state)->mMajor] >> (((pass) & 3) * 8)) & 255)
+
+//-----------------------------------------------------------------------------
+// _ctmSortCountAll() - Gather the digit histograms of all passes for a part
+// of the records (range function).
+//-----------------------------------------------------------------------------
+static void _ctmSortCountAll(void * aData, CTMuint aPart, CTMuint aBegin,
+  CTMuint aEnd)
+{
+  _CTMsortstate * state = (_CTMsortstate *) aData;
+  CTMuint * hist, * rec, i, n;
+
+  hist = &state->mHist[aPart * 8 * 256];
+  memset(hist, 0, sizeof(CTMuint) * 8 * 256);
+  for(i = aBegin; i < aEnd; ++ i)
+  {
+    rec = &state->mSrc[i * 3];
+    n = rec[state->mMinor];
+    ++ hist[n & 255];
+    ++ hist[256 + ((n >> 8) & 255)];
+    ++ hist[512 + ((n >> 16) & 255)];
+    ++ hist[768 + (n >> 24)];
+    n = rec[state->mMajor];
+    ++ hist[1024 + (n & 255)];
+    ++ hist[1280 + ((n >> 8) & 255)];
+    ++ hist[1536 + ((n >> 16) & 255)];
+    ++ hist[1792 + (n >> 24)];
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSortCount() - Gather the digit histogram of the current pass for a part
+// of the records (range function).
+//-----------------------------------------------------------------------------
+static void _ctmSortCount(void * aData, CTMuint aPart, CTMuint aBegin,
+  CTMuint aEnd)
+{
+  _CTMsortstate * state = (_CTMsortstate *) aData;
+  CTMuint * hist, i, pass;
+
+  pass = state->mPass;
+  hist = &state->mHist[(aPart * 8 + pass) * 256];
+  memset(hist, 0, sizeof(CTMuint) * 256);
+  for(i = aBegin; i < aEnd; ++ i)
+    ++ hist[_ctmSortDigit(state, &state->mSrc[i * 3], pass)];
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSortScatter() - Move a part of the records to their output positions
+// for the current pass (range function).
+//-----------------------------------------------------------------------------
+static void _ctmSortScatter(void * aData, CTMuint aPart, CTMuint aBegin,
+  CTMuint aEnd)
+{
+  _CTMsortstate * state = (_CTMsortstate *) aData;
+  CTMuint * pos, * rec, * out, i, pass;
+
+  pass = state->mPass;
+  pos = &state->mHist[(aPart * 8 + pass) * 256];
+  for(i = aBegin; i < aEnd; ++ i)
+  {
+    rec = &state->mSrc[i * 3];
+    out = &state->mDst[(pos[_ctmSortDigit(state, rec, pass)] ++) * 3];
+    out[0] = rec[0];
+    out[1] = rec[1];
+    out[2] = rec[2];
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSortRecords() - Sort an array of records of three CTMuint words each.
+// The records are ordered by the word with index aMajor, and secondly by the
+// word with index aMinor (both compared as unsigned integers). The sort is
+// stable, i.e. records with equal keys keep their relative order.
+//
+// This is an LSD radix sort with 8-bit digits (eight passes over the 64-bit
+// key). The digit histograms for all passes are gathered in a single sweep,
+// and passes where all records have the same digit (e.g. the upper bytes of
+// small indices) are skipped. The _CTM_SCRATCH_WORK scratch buffer is used as
+// the second buffer. Returns CTM_FALSE if it could not be allocated.
+//
+// With several threads, the records are split into consecutive parts that
+// are counted and scattered concurrently. Each part writes to its own output
+// positions (the positions of a digit are assigned to the parts in order), so
+// the result is identical to the serial sort.
+//-----------------------------------------------------------------------------
+int _ctmSortRecords(_CTMcontext * self, CTMuint * aRecords, CTMuint aCount,
+  CTMuint aMajor, CTMuint aMinor)
+{
+  _CTMsortstate state;
+  CTMuint localHist[8 * 256], * h, * tmp, parts, part, pass, digit, sum, n;
+  int histValid;
+
+  if(aCount < 2)
+    return CTM_TRUE;
+
+  // Get the second buffer, and the histograms (one set per part)
+  tmp = (CTMuint *) _ctmScratch(self, _CTM_SCRATCH_WORK,
+    sizeof(CTMuint) * 3 * (size_t) aCount);
+  if(!tmp)
+    return CTM_FALSE;
+  parts = _ctmParallelParts(self, aCount, _CTM_PARALLEL_MIN_PART);
+  if(parts > 1)
+  {
+    state.mHist = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * 8 * 256 * parts);
+    if(!state.mHist)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+  }
+  else
+    state.mHist = localHist;
+  state.mSrc = aRecords;
+  state.mDst = tmp;
+  state.mMajor = aMajor;
+  state.mMinor = aMinor;
+
+  // Gather the digit histograms for all passes
+  _ctmParallelFor(self, aCount, parts, _ctmSortCountAll, &state);
+  histValid = CTM_TRUE;
+
+  // Sort by one digit at a time, least significant digit first
+  for(pass = 0; pass < 8; ++ pass)
+  {
+    state.mPass = pass;
+
+    // Skip this pass if all records have the same digit (the total counts do
+    // not depend on the order of the records)
+    digit = _ctmSortDigit(&state, state.mSrc, pass);
+    sum = 0;
+    for(part = 0; part < parts; ++ part)
+      sum += state.mHist[(part * 8 + pass) * 256 + digit];
+    if(sum == aCount)
+      continue;
+
+    // The per part histograms are only valid for the order of the records
+    // that they were gathered for
+    if(!histValid)
+      _ctmParallelFor(self, aCount, parts, _ctmSortCount, &state);
+
+    // Convert the histograms to output positions
+    sum = 0;
+    for(digit = 0; digit < 256; ++ digit)
+    {
+      for(part = 0; part < parts; ++ part)
+      {
+        h = &state.mHist[(part * 8 + pass) * 256];
+        n = h[digit];
+        h[digit] = sum;
+        sum += n;
+      }
+    }
+
+    // Scatter the records
+    _ctmParallelFor(self, aCount, parts, _ctmSortScatter, &state);
+
+    h = state.mSrc;
+    state.mSrc = state.mDst;
+    state.mDst = h;
+    histValid = (parts == 1);
+  }
+
+  // Make sure that the result ends up in the original array
+  if(state.mSrc != aRecords)
+    memcpy(aRecords, state.mSrc, sizeof(CTMuint) * 3 * (size_t) aCount);
+
+  if(parts > 1)
+    _ctmFree(self, state.mHist);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRotateTriangles() - Rotate the nodes of a part of the triangles so that
+// the first index of each triangle is the smallest one (range function).
+//-----------------------------------------------------------------------------
+static void _ctmRotateTriangles(void * aData, CTMuint aPart, CTMuint aBegin,
+  CTMuint aEnd)
+{
+  CTMuint * tri, tmp, i;
+  (void) aPart;
+
+  for(i = aBegin; i < aEnd; ++ i)
+  {
+    tri = &((CTMuint *) aData)[i * 3];
+    if((tri[1] < tri[0]) && (tri[1] < tri[2]))
+    {
+      tmp = tri[0];
+      tri[0] = tri[1];
+      tri[1] = tri[2];
+      tri[2] = tmp;
+    }
+    else if((tri[2] < tri[0]) && (tri[2] < tri[1]))
+    {
+      tmp = tri[0];
+      tri[0] = tri[2];
+      tri[2] = tri[1];
+      tri[1] = tmp;
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReArrangeTriangles() - Re-arrange all triangles for optimal
+// compression (used by the MG1 and MG2 methods). Returns CTM_FALSE if the sort
+// buffer could not be allocated.
+//-----------------------------------------------------------------------------
+int _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
+{
+  // Step 1: Make sure that the first index of each triangle is the smallest
+  // one (rotate triangle nodes if necessary)
+  _ctmParallelFor(self, self->mTriangleCount,
+    _ctmParallelParts(self, self->mTriangleCount, _CTM_PARALLEL_MIN_PART),
+    _ctmRotateTriangles, (void *) aIndices);
+
+  // Step 2: Sort the triangles based on the first triangle index, and
+  // secondly the second triangle index
+  return _ctmSortRecords(self, aIndices, self->mTriangleCount, 0, 1);
+}
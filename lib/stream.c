@@ -27,7 +27,8 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <LzmaLib.h>
+#include <LzmaEnc.h>
+#include <LzmaDec.h>
 #include "openctm.h"
 #include "internal.h"
 
@@ -35,26 +36,381 @@
 #include <stdio.h>
 #endif
 
+
+//-----------------------------------------------------------------------------
+// _CTMlzmaparams - LZMA literal and position coding settings for a packed
+// data block (lc = literal context bits, lp = literal position bits, pb =
+// position bits). The settings are stored in the LZMA props of each block,
+// so any reader can uncompress the block.
+//-----------------------------------------------------------------------------
+typedef struct {
+  unsigned char mLC;
+  unsigned char mLP;
+  unsigned char mPB;
+} _CTMlzmaparams;
+
+// LZMA default settings (used for all blocks, unless the search mode finds
+// better settings for a block)
+static const _CTMlzmaparams _ctmLzmaDefault = { 3, 0, 2 };
+
+// Settings that are tried for each block in search mode (see ctmLZMASearch())
+static const _CTMlzmaparams _ctmLzmaSearch[] = {
+  { 0, 0, 0 }, { 0, 0, 2 }, { 1, 0, 0 }, { 3, 0, 2 }, { 4, 0, 0 }
+};
+#define _CTM_LZMA_SEARCH_COUNT (sizeof(_ctmLzmaSearch) / sizeof(_CTMlzmaparams))
+
+//-----------------------------------------------------------------------------
+// _ctmLzmaParamsEqual() - Check if two LZMA settings are the same.
+//-----------------------------------------------------------------------------
+static int _ctmLzmaParamsEqual(const _CTMlzmaparams * a,
+  const _CTMlzmaparams * b)
+{
+  return (a->mLC == b->mLC) && (a->mLP == b->mLP) && (a->mPB == b->mPB);
+}
+
+//-----------------------------------------------------------------------------
+// _CTMlzmaalloc - LZMA allocator interface that allocates memory with the
+// allocation functions of an OpenCTM context.
+//-----------------------------------------------------------------------------
+typedef struct {
+  // LZMA allocator interface (must be the first member)
+  ISzAlloc mAlloc;
+
+  // The context that owns the allocation functions
+  _CTMcontext * mContext;
+} _CTMlzmaalloc;
+
+//-----------------------------------------------------------------------------
+// Memory allocation functions for the LZMA encoder and decoder.
+//-----------------------------------------------------------------------------
+static void * _ctmLzmaAlloc(void * p, size_t size)
+{
+  if(size == 0)
+    return (void *) 0;
+  return _ctmMalloc(((_CTMlzmaalloc *) p)->mContext, size);
+}
+
+static void _ctmLzmaFree(void * p, void * address)
+{
+  _ctmFree(((_CTMlzmaalloc *) p)->mContext, address);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLzmaAllocInit() - Initialize an LZMA allocator for a context.
+//-----------------------------------------------------------------------------
+static void _ctmLzmaAllocInit(_CTMlzmaalloc * aAlloc, _CTMcontext * aContext)
+{
+  aAlloc->mAlloc.Alloc = _ctmLzmaAlloc;
+  aAlloc->mAlloc.Free = _ctmLzmaFree;
+  aAlloc->mContext = aContext;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReset() - Empty the stream buffer (called before a new stream is
+// loaded or saved).
+//-----------------------------------------------------------------------------
+void _ctmStreamReset(_CTMcontext * self)
+{
+  self->mStreamBufferPos = 0;
+  self->mStreamBufferFill = 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamBuffer() - Get the stream buffer, or NULL if the stream is
+// unbuffered. The buffer is allocated on first use, and is kept until the
+// buffer size is changed or the context is freed. If it can not be allocated,
+// the stream is simply left unbuffered.
 //-----------------------------------------------------------------------------
-// _ctmStreamRead() - Read data from a stream.
+static unsigned char * _ctmStreamBuffer(_CTMcontext * self)
+{
+  if(!self->mStreamBuffered)
+    return (unsigned char *) 0;
+  if(!self->mStreamBuffer && (self->mStreamBufferSize > 0))
+    self->mStreamBuffer = (unsigned char *) _ctmMalloc(self, self->mStreamBufferSize);
+  return self->mStreamBuffer;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamRead() - Read data from a stream. Small reads are served from the
+// read-ahead buffer, which is refilled with one call to the read function per
+// buffer size. Reads that are at least as large as the buffer go straight to
+// the read function.
 //-----------------------------------------------------------------------------
 CTMuint _ctmStreamRead(_CTMcontext * self, void * aBuf, CTMuint aCount)
 {
+  unsigned char * buf, * dst;
+  CTMuint done, n;
+
   if(!self->mUserData || !self->mReadFn)
     return 0;
 
-  return self->mReadFn(aBuf, aCount, self->mUserData);
+  // Unbuffered stream?
+  buf = _ctmStreamBuffer(self);
+  if(!buf)
+    return self->mReadFn(aBuf, aCount, self->mUserData);
+
+  dst = (unsigned char *) aBuf;
+  done = 0;
+  while(done < aCount)
+  {
+    // Copy what we have in the buffer
+    n = self->mStreamBufferFill - self->mStreamBufferPos;
+    if(n > 0)
+    {
+      if(n > aCount - done)
+        n = aCount - done;
+      memcpy(&dst[done], &buf[self->mStreamBufferPos], n);
+      self->mStreamBufferPos += n;
+      done += n;
+      continue;
+    }
+
+    // The buffer is empty: read large requests directly, and refill the
+    // buffer for small ones
+    if(aCount - done >= self->mStreamBufferSize)
+      n = self->mReadFn(&dst[done], aCount - done, self->mUserData);
+    else
+    {
+      n = self->mReadFn(buf, self->mStreamBufferSize, self->mUserData);
+      self->mStreamBufferPos = 0;
+      self->mStreamBufferFill = n;
+      if(n > 0)
+        continue;
+    }
+
+    // End of stream (or read error)?
+    if(n == 0)
+      break;
+    done += n;
+  }
+
+  return done;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamWrite() - Write data to a stream.
+// _CTMcodec - A codec for the frames of packed data arrays. In a v7 file each
+// frame header holds the tag of the codec that the frame is coded with, while
+// older files use the default codec of the compression method for all frames
+// (see _ctmDefaultCodec()).
 //-----------------------------------------------------------------------------
-CTMuint _ctmStreamWrite(_CTMcontext * self, void * aBuf, CTMuint aCount)
+typedef struct {
+  // Codec (CTM_CODEC_LZMA, CTM_CODEC_RANS or CTM_CODEC_STORE), and its tag in
+  // the frame headers of a v7 file
+  CTMenum mCodec;
+  unsigned char mTag;
+
+  // Size of the codec props, which follow the packed size in the frame header
+  // (at most _CTM_CODEC_PROPS_SIZE bytes)
+  size_t mPropsSize;
+
+  // Get the largest possible packed size of aSize bytes of data
+  size_t (* mBound)(size_t aSize);
+
+  // Compress the data of a packed block to aDest, and store the codec props
+  // in aProps. On input, aDestSize holds the size of aDest (at least mBound()
+  // of the data size), and on output the packed size. Returns an LZMA SDK
+  // result code (SZ_OK, SZ_ERROR_MEM or SZ_ERROR_PROGRESS if cancelled).
+  SRes (* mCompress)(_CTMpackjob * aJob, unsigned char * aDest,
+    size_t * aDestSize, unsigned char * aProps);
+
+  // Uncompress a frame of aSrcSize packed bytes to aDest, which holds exactly
+  // aDestSize bytes. Returns an OpenCTM error code.
+  CTMenum (* mUncompress)(_CTMcontext * self, unsigned char * aDest,
+    size_t aDestSize, const unsigned char * aSrc, size_t aSrcSize,
+    const unsigned char * aProps);
+
+  // Uncompress a frame while it is being read from the stream (NULL if the
+  // codec needs all of the packed data at once). Returns an OpenCTM error
+  // code.
+  CTMenum (* mReadFrame)(_CTMcontext * self, unsigned char * aDest,
+    size_t aDestSize, size_t aPackedSize, const unsigned char * aProps);
+} _CTMcodec;
+
+// Largest size of the codec props in a frame header
+#define _CTM_CODEC_PROPS_SIZE LZMA_PROPS_SIZE
+
+//-----------------------------------------------------------------------------
+// _CTMpackjob - A packed data block that is being compressed by the thread
+// pool. Any data that is written to the stream after the block (while the
+// block is still pending) is stored in the trailer buffer of the block.
+//-----------------------------------------------------------------------------
+struct _CTMpackjob_struct {
+  // Thread pool job (must be the first member)
+  _CTMjob mJob;
+
+  // The context that the block belongs to (for memory allocation)
+  _CTMcontext * mContext;
+
+  // Uncompressed (interleaved) data, and the buffer that holds it (the buffer
+  // is owned by the job, and is NULL for all but the last frame of a framed
+  // block)
+  unsigned char * mData;
+  size_t mDataSize;
+  unsigned char * mBuffer;
+
+  // The codec that the block is compressed with
+  const _CTMcodec * mCodec;
+
+  // LZMA compression settings, and the number of encoder passes (more than
+  // one if other settings are tried in search mode)
+  CTMuint mLevel;
+  CTMuint mLZMAThreads;
+  const _CTMlzmaparams * mParams;
+  CTMuint mPasses;
+  CTMuint mPass;
+
+  // The offset of the frame in the array and the byte plane size of the array
+  // (which determine where the rANS segments start)
+  size_t mOffset;
+  size_t mPlaneSize;
+
+  // Non-zero if the block is compressed by the thread that runs the save (so
+  // that the progress callback of the context may be called)
+  int mReport;
+
+  // Block tag (FOURCC) and codec time in seconds (for the statistics)
+  CTMuint mTag;
+  CTMfloat mTime;
+
+  // Compression result
+  unsigned char * mPacked;
+  size_t mPackedSize;
+  unsigned char mProps[_CTM_CODEC_PROPS_SIZE];
+  int mResult;
+
+  // Non-zero if mBuffer and mPacked are scratch buffers of the context (which
+  // are not owned by the job)
+  int mScratch;
+
+  // Data that follows the packed block in the stream
+  unsigned char * mTrailer;
+  size_t mTrailerSize;
+  size_t mTrailerCapacity;
+
+  // Next pending block
+  _CTMpackjob * mNext;
+};
+
+//-----------------------------------------------------------------------------
+// _CTMlzmaprogress - LZMA progress interface that checks for cancellation,
+// and reports the progress of a packed block.
+//-----------------------------------------------------------------------------
+typedef struct {
+  // LZMA progress interface (must be the first member)
+  ICompressProgress mProgress;
+
+  // The packed block that is being compressed
+  _CTMpackjob * mJob;
+} _CTMlzmaprogress;
+
+//-----------------------------------------------------------------------------
+// _ctmLzmaProgress() - LZMA encoder progress function. Returns an error (which
+// stops the encoder) if the operation has been cancelled.
+//-----------------------------------------------------------------------------
+static SRes _ctmLzmaProgress(void * p, UInt64 inSize, UInt64 outSize)
+{
+  _CTMpackjob * job = ((_CTMlzmaprogress *) p)->mJob;
+  (void) outSize;
+
+  if(*job->mContext->mCancelFlag)
+    return SZ_ERROR_PROGRESS;
+  if(job->mReport && (inSize != (UInt64) (Int64) -1) && (job->mDataSize > 0))
+  {
+    if(!_ctmProgress(job->mContext, CTM_STAGE_PACK,
+                     ((CTMfloat) job->mPass + (CTMfloat) inSize /
+                      (CTMfloat) job->mDataSize) / (CTMfloat) job->mPasses))
+      return SZ_ERROR_PROGRESS;
+  }
+  return SZ_OK;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWriteBuffer() - Pass the contents of the write-behind buffer to
+// the write function.
+//-----------------------------------------------------------------------------
+static int _ctmStreamWriteBuffer(_CTMcontext * self)
+{
+  CTMuint n;
+
+  n = self->mStreamBufferFill;
+  self->mStreamBufferFill = 0;
+  if(n == 0)
+    return CTM_TRUE;
+  return self->mWriteFn(self->mStreamBuffer, n, self->mUserData) == n;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWriteDirect() - Write data to a stream, bypassing the queue of
+// pending packed blocks. Small writes are collected in the write-behind
+// buffer, which is passed to the write function when it is full (or when the
+// stream is flushed).
+//-----------------------------------------------------------------------------
+static CTMuint _ctmStreamWriteDirect(_CTMcontext * self, const void * aBuf,
+  CTMuint aCount)
 {
+  unsigned char * buf;
+
   if(!self->mUserData || !self->mWriteFn)
     return 0;
 
-  return self->mWriteFn(aBuf, aCount, self->mUserData);
+  // Unbuffered stream?
+  buf = _ctmStreamBuffer(self);
+  if(!buf)
+    return self->mWriteFn(aBuf, aCount, self->mUserData);
+
+  // Make room in the write-behind buffer
+  if(self->mStreamBufferFill + aCount > self->mStreamBufferSize)
+  {
+    if(!_ctmStreamWriteBuffer(self))
+      return 0;
+
+    // Large writes go straight to the write function
+    if(aCount >= self->mStreamBufferSize)
+      return self->mWriteFn(aBuf, aCount, self->mUserData);
+  }
+
+  // Append the data to the buffer
+  memcpy(&buf[self->mStreamBufferFill], aBuf, aCount);
+  self->mStreamBufferFill += aCount;
+  return aCount;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWrite() - Write data to a stream.
+//-----------------------------------------------------------------------------
+CTMuint _ctmStreamWrite(_CTMcontext * self, void * aBuf, CTMuint aCount)
+{
+  _CTMpackjob * job;
+  unsigned char * newTrailer;
+  size_t newCapacity;
+
+  // If there are no pending packed blocks, write directly to the stream
+  job = self->mPackTail;
+  if(!job)
+    return _ctmStreamWriteDirect(self, aBuf, aCount);
+
+  // ...otherwise the data has to wait until the last pending block has been
+  // written, so append it to the trailer of that block
+  if(job->mTrailerSize + aCount > job->mTrailerCapacity)
+  {
+    newCapacity = job->mTrailerCapacity ? job->mTrailerCapacity * 2 : 64;
+    while(newCapacity < job->mTrailerSize + aCount)
+      newCapacity *= 2;
+    newTrailer = (unsigned char *) _ctmMalloc(self, newCapacity);
+    if(!newTrailer)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return 0;
+    }
+    if(job->mTrailerSize > 0)
+      memcpy(newTrailer, job->mTrailer, job->mTrailerSize);
+    _ctmFree(self, job->mTrailer);
+    job->mTrailer = newTrailer;
+    job->mTrailerCapacity = newCapacity;
+  }
+  memcpy(&job->mTrailer[job->mTrailerSize], aBuf, aCount);
+  job->mTrailerSize += aCount;
+  return aCount;
 }
 
 //-----------------------------------------------------------------------------
@@ -71,6 +427,36 @@ CTMuint _ctmStreamReadUINT(_CTMcontext * self)
          (((CTMuint) buf[3]) << 24);
 }
 
+//-----------------------------------------------------------------------------
+// _ctmStreamReadTag() - Read a block tag (FOURCC) from a stream. The tag is
+// kept as the type of the following packed data (see ctmGetStats()).
+//-----------------------------------------------------------------------------
+CTMuint _ctmStreamReadTag(_CTMcontext * self)
+{
+  self->mBlockTag = _ctmStreamReadUINT(self);
+  return self->mBlockTag;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWriteTag() - Write a block tag (four characters) to a stream. The
+// tag is kept as the type of the following packed data (which selects the
+// codec and the LZMA settings, and is used for ctmGetStats()). The codec of
+// UV and attribute map blocks is set by the caller (see mBlockCodec).
+//-----------------------------------------------------------------------------
+void _ctmStreamWriteTag(_CTMcontext * self, const char * aTag)
+{
+  self->mBlockTag = FOURCC(aTag);
+  if((self->mBlockTag == FOURCC("VERT")) || (self->mBlockTag == FOURCC("GIDX")))
+    self->mBlockCodec = self->mVertexCodec;
+  else if(self->mBlockTag == FOURCC("INDX"))
+    self->mBlockCodec = self->mIndexCodec;
+  else if(self->mBlockTag == FOURCC("NORM"))
+    self->mBlockCodec = self->mNormalCodec;
+  else
+    self->mBlockCodec = CTM_CODEC_DEFAULT;
+  _ctmStreamWrite(self, (void *) aTag, 4);
+}
+
 //-----------------------------------------------------------------------------
 // _ctmStreamWriteUINT() - Write an unsigned integer to a stream in a machine
 // endian independent manner (for portability).
@@ -113,6 +499,110 @@ void _ctmStreamWriteFLOAT(_CTMcontext * self, CTMfloat aValue)
   _ctmStreamWriteUINT(self, u.i);
 }
 
+//-----------------------------------------------------------------------------
+// _ctmStreamReadUINTArray() - Read an array of unsigned integers from a
+// stream. On little endian hosts the array is read with bulk reads (of at most
+// _CTM_STREAM_ARRAY_CHUNK elements each), otherwise it is read in small chunks
+// that are converted to the host byte order. The array is counted as an
+// uncompressed block in the statistics.
+//-----------------------------------------------------------------------------
+void _ctmStreamReadUINTArray(_CTMcontext * self, CTMuint * aArray,
+  size_t aCount)
+{
+#ifdef _CTM_LITTLE_ENDIAN
+  size_t n, size = aCount * 4;
+  while(aCount > 0)
+  {
+    n = aCount < _CTM_STREAM_ARRAY_CHUNK ? aCount : _CTM_STREAM_ARRAY_CHUNK;
+    _ctmStreamRead(self, (void *) aArray, (CTMuint) (n * 4));
+    aArray += n;
+    aCount -= n;
+  }
+#else
+  unsigned char buf[1024];
+  CTMuint i, n;
+  size_t size = aCount * 4;
+  while(aCount > 0)
+  {
+    n = aCount < 256 ? (CTMuint) aCount : 256;
+    _ctmStreamRead(self, (void *) buf, n * 4);
+    for(i = 0; i < n; ++ i)
+    {
+      aArray[i] = ((CTMuint) buf[i * 4]) |
+                  (((CTMuint) buf[i * 4 + 1]) << 8) |
+                  (((CTMuint) buf[i * 4 + 2]) << 16) |
+                  (((CTMuint) buf[i * 4 + 3]) << 24);
+    }
+    aArray += n;
+    aCount -= n;
+  }
+#endif
+
+  _ctmStatsBlock(self, self->mBlockTag, size, size, 0, 0.0f);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWriteUINTArray() - Write an array of unsigned integers to a
+// stream. On little endian hosts the array is written with bulk writes (of at
+// most _CTM_STREAM_ARRAY_CHUNK elements each), otherwise it is converted to
+// little endian in small chunks. The array is counted as an uncompressed block
+// in the statistics.
+//-----------------------------------------------------------------------------
+void _ctmStreamWriteUINTArray(_CTMcontext * self, const CTMuint * aArray,
+  size_t aCount)
+{
+#ifdef _CTM_LITTLE_ENDIAN
+  size_t n, size = aCount * 4;
+  while(aCount > 0)
+  {
+    n = aCount < _CTM_STREAM_ARRAY_CHUNK ? aCount : _CTM_STREAM_ARRAY_CHUNK;
+    _ctmStreamWrite(self, (void *) aArray, (CTMuint) (n * 4));
+    aArray += n;
+    aCount -= n;
+  }
+#else
+  unsigned char buf[1024];
+  CTMuint i, n;
+  size_t size = aCount * 4;
+  while(aCount > 0)
+  {
+    n = aCount < 256 ? (CTMuint) aCount : 256;
+    for(i = 0; i < n; ++ i)
+    {
+      buf[i * 4] = aArray[i] & 0x000000ff;
+      buf[i * 4 + 1] = (aArray[i] >> 8) & 0x000000ff;
+      buf[i * 4 + 2] = (aArray[i] >> 16) & 0x000000ff;
+      buf[i * 4 + 3] = (aArray[i] >> 24) & 0x000000ff;
+    }
+    _ctmStreamWrite(self, (void *) buf, n * 4);
+    aArray += n;
+    aCount -= n;
+  }
+#endif
+
+  _ctmStatsBlock(self, self->mBlockTag, size, size, 0, 0.0f);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadFLOATArray() - Read an array of floating point values from a
+// stream (see _ctmStreamReadUINTArray()).
+//-----------------------------------------------------------------------------
+void _ctmStreamReadFLOATArray(_CTMcontext * self, CTMfloat * aArray,
+  size_t aCount)
+{
+  _ctmStreamReadUINTArray(self, (CTMuint *) aArray, aCount);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWriteFLOATArray() - Write an array of floating point values to a
+// stream (see _ctmStreamWriteUINTArray()).
+//-----------------------------------------------------------------------------
+void _ctmStreamWriteFLOATArray(_CTMcontext * self, const CTMfloat * aArray,
+  size_t aCount)
+{
+  _ctmStreamWriteUINTArray(self, (const CTMuint *) aArray, aCount);
+}
+
 //-----------------------------------------------------------------------------
 // _ctmStreamReadSTRING() - Read a string value from a stream. The format of
 // the string in the stream is: an unsigned integer (string length) followed by
@@ -125,7 +615,7 @@ void _ctmStreamReadSTRING(_CTMcontext * self, char ** aValue)
   // Clear the old string
   if(*aValue)
   {
-    free(*aValue);
+    _ctmFree(self, *aValue);
     *aValue = (char *) 0;
   }
 
@@ -135,7 +625,7 @@ void _ctmStreamReadSTRING(_CTMcontext * self, char ** aValue)
   // Read string
   if(len > 0)
   {
-    *aValue = (char *) malloc(len + 1);
+    *aValue = (char *) _ctmMalloc(self, len + 1);
     if(*aValue)
     {
       _ctmStreamRead(self, (void *) *aValue, len);
@@ -168,345 +658,1275 @@ void _ctmStreamWriteSTRING(_CTMcontext * self, const char * aValue)
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamReadPackedInts() - Read an compressed binary integer data array
-// from a stream, and uncompress it.
+// _ctmLzmaEncode() - LZMA compress the data of a packed block with the given
+// settings. aDestSize holds the size of aDest, and receives the packed size.
 //-----------------------------------------------------------------------------
-int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData,
-  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+static SRes _ctmLzmaEncode(_CTMpackjob * aJob,
+  const _CTMlzmaparams * aParams, unsigned char * aDest, size_t * aDestSize,
+  unsigned char * aProps)
 {
-  size_t packedSize, unpackedSize;
-  CTMuint i, k, x;
-  CTMint value;
-  unsigned char * packed, * tmp;
-  unsigned char props[5];
-  int lzmaRes;
-
-  // Read packed data size from the stream
-  packedSize = (size_t) _ctmStreamReadUINT(self);
-
-  // Read LZMA compression props from the stream
-  _ctmStreamRead(self, (void *) props, 5);
-
-  // Allocate memory and read the packed data from the stream
-  packed = (unsigned char *) malloc(packedSize);
-  if(!packed)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
-  }
-  _ctmStreamRead(self, (void *) packed, packedSize);
-
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
-  {
-    free(packed);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
-  }
-
-  // Uncompress
-  unpackedSize = aCount * aSize * 4;
-  lzmaRes = LzmaUncompress(tmp, &unpackedSize, packed,
-                           &packedSize, props, 5);
-
-  // Free the packed array
-  free(packed);
+  _CTMlzmaalloc alloc;
+  _CTMlzmaprogress progress;
+  CLzmaEncProps props;
+  size_t outPropsSize;
+
+  LzmaEncProps_Init(&props);
+  props.level = (int) aJob->mLevel;               // Level (0-9)
+  props.numThreads = (int) aJob->mLZMAThreads;    // Match finder threads (1 or 2)
+  props.algo = (aJob->mLevel < 1 ? 0 : 1);        // Algorithm (0 = fast, 1 = normal)
+  props.lc = aParams->mLC;                        // Literal context bits
+  props.lp = aParams->mLP;                        // Literal position bits
+  props.pb = aParams->mPB;                        // Position bits
+
+  // The dictionary does not need to be larger than the block (the match
+  // finder memory grows with the dictionary size, so this saves a lot of
+  // memory at the higher compression levels)
+  props.dictSize = LzmaEncProps_GetDictSize(&props);
+  while((props.dictSize > (1 << 12)) && ((props.dictSize >> 1) >= aJob->mDataSize))
+    props.dictSize >>= 1;
+
+  _ctmLzmaAllocInit(&alloc, aJob->mContext);
+  progress.mProgress.Progress = _ctmLzmaProgress;
+  progress.mJob = aJob;
+  outPropsSize = LZMA_PROPS_SIZE;
+  return LzmaEncode(aDest, aDestSize, (const unsigned char *) aJob->mData,
+                    aJob->mDataSize, &props, aProps, &outPropsSize, 0,
+                    &progress.mProgress, &alloc.mAlloc, &alloc.mAlloc);
+}
 
-  // Error?
-  if((lzmaRes != SZ_OK) || (unpackedSize != aCount * aSize * 4))
-  {
-    self->mError = CTM_LZMA_ERROR;
-    free(tmp);
-    return CTM_FALSE;
-  }
+//-----------------------------------------------------------------------------
+// _ctmLzmaBound() - LZMA codec: largest packed size.
+//-----------------------------------------------------------------------------
+static size_t _ctmLzmaBound(size_t aSize)
+{
+  return _CTM_PACKED_SIZE(aSize);
+}
 
-  // Convert interleaved array to integers
-  for(i = 0; i < aCount; ++ i)
+//-----------------------------------------------------------------------------
+// _ctmLzmaCompress() - LZMA codec: compress a packed block. In search mode,
+// the block is also compressed with each of the alternative settings, and the
+// smallest result is kept.
+//-----------------------------------------------------------------------------
+static SRes _ctmLzmaCompress(_CTMpackjob * aJob, unsigned char * aDest,
+  size_t * aDestSize, unsigned char * aProps)
+{
+  unsigned char * tmp, props[LZMA_PROPS_SIZE];
+  size_t capacity, size;
+  SRes res, result;
+  CTMuint i;
+
+  capacity = *aDestSize;
+  aJob->mPass = 0;
+  result = _ctmLzmaEncode(aJob, aJob->mParams, aDest, aDestSize, aProps);
+
+  // Search mode: try the other settings (this is best effort, so the block
+  // keeps the first result if there is not enough memory)
+  tmp = (unsigned char *) 0;
+  if((aJob->mPasses > 1) && (result == SZ_OK))
+    tmp = (unsigned char *) _ctmMalloc(aJob->mContext, capacity);
+  for(i = 0; tmp && (i < _CTM_LZMA_SEARCH_COUNT); ++ i)
   {
-    for(k = 0; k < aSize; ++ k)
+    if(_ctmLzmaParamsEqual(&_ctmLzmaSearch[i], aJob->mParams))
+      continue;
+    ++ aJob->mPass;
+    size = capacity;
+    res = _ctmLzmaEncode(aJob, &_ctmLzmaSearch[i], tmp, &size, props);
+    if(res == SZ_ERROR_PROGRESS)
     {
-      value = (CTMint) tmp[i + k * aCount + 3 * aCount * aSize] |
-              (((CTMint) tmp[i + k * aCount + 2 * aCount * aSize]) << 8) |
-              (((CTMint) tmp[i + k * aCount + aCount * aSize]) << 16) |
-              (((CTMint) tmp[i + k * aCount]) << 24);
-      // Convert signed magnitude to two's complement?
-      if(aSignedInts)
-      {
-        x = (CTMuint) value;
-        value = (x & 1) ? -(CTMint)((x + 1) >> 1) : (CTMint)(x >> 1);
-      }
-      aData[i * aSize + k] = value;
+      result = res;
+      break;
+    }
+    if((res == SZ_OK) && (size < *aDestSize))
+    {
+      memcpy(aDest, tmp, size);
+      memcpy(aProps, props, LZMA_PROPS_SIZE);
+      *aDestSize = size;
     }
   }
+  _ctmFree(aJob->mContext, tmp);
 
-  // Free the interleaved array
-  free(tmp);
-
-  return CTM_TRUE;
+  return result;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamWritePackedInts() - Compress a binary integer data array, and
-// write it to a stream.
+// _ctmLzmaUncompress() - LZMA codec: uncompress a frame.
 //-----------------------------------------------------------------------------
-int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData,
-  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+static CTMenum _ctmLzmaUncompress(_CTMcontext * self, unsigned char * aDest,
+  size_t aDestSize, const unsigned char * aSrc, size_t aSrcSize,
+  const unsigned char * aProps)
 {
-  int lzmaRes, lzmaAlgo;
-  CTMuint i, k;
-  CTMint value;
-  size_t bufSize, outPropsSize;
-  unsigned char * packed, outProps[5], *tmp;
-#ifdef __DEBUG_
-  CTMuint negCount = 0;  
-#endif
+  _CTMlzmaalloc alloc;
+  ELzmaStatus status;
+  size_t unpackedSize;
+  int lzmaRes;
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
-  }
+  _ctmLzmaAllocInit(&alloc, self);
+  unpackedSize = aDestSize;
+  lzmaRes = LzmaDecode(aDest, &unpackedSize, aSrc, &aSrcSize, aProps,
+                       LZMA_PROPS_SIZE, LZMA_FINISH_ANY, &status,
+                       &alloc.mAlloc);
+  if((lzmaRes != SZ_OK) || (unpackedSize != aDestSize))
+    return CTM_LZMA_ERROR;
+  return CTM_NONE;
+}
 
-  // Convert integers to an interleaved array
-  for(i = 0; i < aCount; ++ i)
+//-----------------------------------------------------------------------------
+// _ctmLzmaReadFrame() - LZMA codec: uncompress a frame while it is being read
+// from the stream. The packed data is read in small chunks, and the
+// destination array is used as the LZMA dictionary, so no full size copy of
+// the packed data is needed.
+//-----------------------------------------------------------------------------
+static CTMenum _ctmLzmaReadFrame(_CTMcontext * self, unsigned char * aDest,
+  size_t aDestSize, size_t aPackedSize, const unsigned char * aProps)
+{
+  unsigned char buf[_CTM_LZMA_READ_SIZE];
+  size_t bufPos, bufSize, srcLen;
+  _CTMlzmaalloc alloc;
+  CLzmaDec dec;
+  ELzmaStatus status;
+  CTMenum result;
+  SRes lzmaRes;
+
+  // Initialize the decoder
+  _ctmLzmaAllocInit(&alloc, self);
+  LzmaDec_Construct(&dec);
+  lzmaRes = LzmaDec_AllocateProbs(&dec, aProps, LZMA_PROPS_SIZE,
+                                  &alloc.mAlloc);
+  if(lzmaRes != SZ_OK)
+    return (lzmaRes == SZ_ERROR_MEM) ? CTM_OUT_OF_MEMORY : CTM_LZMA_ERROR;
+  dec.dic = aDest;
+  dec.dicBufSize = aDestSize;
+  LzmaDec_Init(&dec);
+
+  // Uncompress chunks of packed data until the destination array is full
+  result = CTM_NONE;
+  bufPos = bufSize = 0;
+  while(dec.dicPos < aDestSize)
   {
-    for(k = 0; k < aSize; ++ k)
+    // Stop if the load has been cancelled
+    if(*self->mCancelFlag)
     {
-      value = aData[i * aSize + k];
-      // Convert two's complement to signed magnitude?
-      if(aSignedInts)
-        value = value < 0 ? -1 - (value << 1) : value << 1;
-#ifdef __DEBUG_
-      else if(value < 0)
-        ++ negCount;
-#endif
-      tmp[i + k * aCount + 3 * aCount * aSize] = value & 0x000000ff;
-      tmp[i + k * aCount + 2 * aCount * aSize] = (value >> 8) & 0x000000ff;
-      tmp[i + k * aCount + aCount * aSize] = (value >> 16) & 0x000000ff;
-      tmp[i + k * aCount] = (value >> 24) & 0x000000ff;
+      result = CTM_CANCELLED;
+      break;
     }
-  }
 
-  // Allocate memory for the packed data
-  bufSize = 1000 + aCount * aSize * 4;
-  packed = (unsigned char *) malloc(bufSize);
-  if(!packed)
-  {
-    free(tmp);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    // Read more packed data?
+    if(bufPos == bufSize)
+    {
+      bufSize = aPackedSize < sizeof(buf) ? aPackedSize : sizeof(buf);
+      if((bufSize == 0) ||
+         (_ctmStreamRead(self, (void *) buf, (CTMuint) bufSize) != bufSize))
+      {
+        result = CTM_LZMA_ERROR;
+        break;
+      }
+      aPackedSize -= bufSize;
+      bufPos = 0;
+    }
+
+    // Uncompress
+    srcLen = bufSize - bufPos;
+    lzmaRes = LzmaDec_DecodeToDic(&dec, aDestSize, &buf[bufPos], &srcLen,
+                                  LZMA_FINISH_ANY, &status);
+    bufPos += srcLen;
+    if((lzmaRes != SZ_OK) ||
+       ((status == LZMA_STATUS_FINISHED_WITH_MARK) && (dec.dicPos < aDestSize)))
+    {
+      result = CTM_LZMA_ERROR;
+      break;
+    }
   }
 
-  // Call LZMA to compress
-  outPropsSize = 5;
-  lzmaAlgo = (self->mCompressionLevel < 1 ? 0 : 1);
-  lzmaRes = LzmaCompress(packed,
-                         &bufSize,
-                         (const unsigned char *) tmp,
-                         aCount * aSize * 4,
-                         outProps,
-                         &outPropsSize,
-                         self->mCompressionLevel, // Level (0-9)
-                         0, -1, -1, -1, -1, -1,   // Default values (set by level)
-                         lzmaAlgo                 // Algorithm (0 = fast, 1 = normal)
-                        );
-
-  // Free temporary array
-  free(tmp);
-
-  // Error?
-  if(lzmaRes != SZ_OK)
+  LzmaDec_FreeProbs(&dec, &alloc.mAlloc);
+
+  // Skip any remaining packed data, to stay in sync with the stream
+  while((result == CTM_NONE) && (aPackedSize > 0))
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(packed);
-    return CTM_FALSE;
+    bufSize = aPackedSize < sizeof(buf) ? aPackedSize : sizeof(buf);
+    if(_ctmStreamRead(self, (void *) buf, (CTMuint) bufSize) != bufSize)
+      result = CTM_LZMA_ERROR;
+    aPackedSize -= bufSize;
   }
 
-#ifdef __DEBUG_
-  printf("%d->%d bytes (%d negative words)\n", aCount * aSize * 4, (int) bufSize, negCount);
-#endif
+  return result;
+}
 
-  // Write packed data size to the stream
-  _ctmStreamWriteUINT(self, (CTMuint) bufSize);
+//-----------------------------------------------------------------------------
+// _ctmRansBound() - rANS codec: largest packed size.
+//-----------------------------------------------------------------------------
+static size_t _ctmRansBound(size_t aSize)
+{
+  return _CTM_PACKED_SIZE(aSize);
+}
 
-  // Write LZMA compression props to the stream
-  _ctmStreamWrite(self, (void *) outProps, 5);
+//-----------------------------------------------------------------------------
+// _ctmRansCompress() - rANS codec: code a packed block (see rans.c).
+//-----------------------------------------------------------------------------
+static SRes _ctmRansCompress(_CTMpackjob * aJob, unsigned char * aDest,
+  size_t * aDestSize, unsigned char * aProps)
+{
+  (void) aProps;
+  if(!_ctmRansEncode(aJob->mContext, aDest, aDestSize, aJob->mData,
+                     aJob->mDataSize, aJob->mOffset, aJob->mPlaneSize,
+                     aJob->mLevel))
+    return SZ_ERROR_MEM;
+  return SZ_OK;
+}
 
-  // Write the packed data to the stream
-  _ctmStreamWrite(self, (void *) packed, (CTMuint) bufSize);
+//-----------------------------------------------------------------------------
+// _ctmRansUncompress() - rANS codec: decode a frame (see rans.c).
+//-----------------------------------------------------------------------------
+static CTMenum _ctmRansUncompress(_CTMcontext * self, unsigned char * aDest,
+  size_t aDestSize, const unsigned char * aSrc, size_t aSrcSize,
+  const unsigned char * aProps)
+{
+  (void) aProps;
+  return _ctmRansDecode(self, aDest, aDestSize, aSrc, aSrcSize);
+}
 
-  // Free the packed data
-  free(packed);
+//-----------------------------------------------------------------------------
+// _ctmStoreBound() - Store codec: largest packed size.
+//-----------------------------------------------------------------------------
+static size_t _ctmStoreBound(size_t aSize)
+{
+  return aSize;
+}
 
-  return CTM_TRUE;
+//-----------------------------------------------------------------------------
+// _ctmStoreCompress() - Store codec: copy a packed block as is.
+//-----------------------------------------------------------------------------
+static SRes _ctmStoreCompress(_CTMpackjob * aJob, unsigned char * aDest,
+  size_t * aDestSize, unsigned char * aProps)
+{
+  (void) aProps;
+  memcpy(aDest, aJob->mData, aJob->mDataSize);
+  *aDestSize = aJob->mDataSize;
+  return SZ_OK;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamReadPackedFloats() - Read an compressed binary float data array
-// from a stream, and uncompress it.
+// _ctmStoreUncompress() - Store codec: copy a frame as is.
 //-----------------------------------------------------------------------------
-int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData,
-  CTMuint aCount, CTMuint aSize)
+static CTMenum _ctmStoreUncompress(_CTMcontext * self, unsigned char * aDest,
+  size_t aDestSize, const unsigned char * aSrc, size_t aSrcSize,
+  const unsigned char * aProps)
 {
-  CTMuint i, k;
-  size_t packedSize, unpackedSize;
-  union {
-    CTMfloat f;
-    CTMint i;
-  } value;
-  unsigned char * packed, * tmp;
-  unsigned char props[5];
-  int lzmaRes;
+  (void) self;
+  (void) aProps;
+  if(aSrcSize != aDestSize)
+    return CTM_BAD_FORMAT;
+  memcpy(aDest, aSrc, aDestSize);
+  return CTM_NONE;
+}
+
+// All supported codecs
+static const _CTMcodec _ctmCodecs[] = {
+  { CTM_CODEC_LZMA, 0, LZMA_PROPS_SIZE, _ctmLzmaBound, _ctmLzmaCompress,
+    _ctmLzmaUncompress, _ctmLzmaReadFrame },
+  { CTM_CODEC_RANS, 1, 0, _ctmRansBound, _ctmRansCompress,
+    _ctmRansUncompress, 0 },
+  { CTM_CODEC_STORE, 2, 0, _ctmStoreBound, _ctmStoreCompress,
+    _ctmStoreUncompress, 0 }
+};
+#define _CTM_CODEC_COUNT (sizeof(_ctmCodecs) / sizeof(_CTMcodec))
 
-  // Read packed data size from the stream
-  packedSize = (size_t) _ctmStreamReadUINT(self);
+//-----------------------------------------------------------------------------
+// _ctmDefaultCodec() - Get the default codec of the compression method: rANS
+// for MG3, and LZMA for all other methods. All frames of a v5 or v6 file use
+// the default codec.
+//-----------------------------------------------------------------------------
+static const _CTMcodec * _ctmDefaultCodec(_CTMcontext * self)
+{
+  return &_ctmCodecs[self->mMethod == CTM_METHOD_MG3 ? 1 : 0];
+}
 
-  // Read LZMA compression props from the stream
-  _ctmStreamRead(self, (void *) props, 5);
+//-----------------------------------------------------------------------------
+// _ctmStreamCodec() - Get the codec for the next packed data block that is
+// written to the stream (see ctmCompressionCodec()).
+//-----------------------------------------------------------------------------
+static const _CTMcodec * _ctmStreamCodec(_CTMcontext * self)
+{
+  CTMuint i;
 
-  // Allocate memory and read the packed data from the stream
-  packed = (unsigned char *) malloc(packedSize);
-  if(!packed)
+  if(self->mFileFormat >= _CTM_FORMAT_VERSION_CODECS)
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    for(i = 0; i < _CTM_CODEC_COUNT; ++ i)
+    {
+      if(_ctmCodecs[i].mCodec == self->mBlockCodec)
+        return &_ctmCodecs[i];
+    }
   }
-  _ctmStreamRead(self, (void *) packed, packedSize);
+  return _ctmDefaultCodec(self);
+}
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
+//-----------------------------------------------------------------------------
+// _ctmStreamReadCodec() - Read the codec tag of a frame header (v7 files), and
+// get the codec. Older files use the default codec. Returns NULL if the tag
+// is unknown.
+//-----------------------------------------------------------------------------
+static const _CTMcodec * _ctmStreamReadCodec(_CTMcontext * self)
+{
+  unsigned char tag;
+  CTMuint i;
+
+  if(self->mFileFormat < _CTM_FORMAT_VERSION_CODECS)
+    return _ctmDefaultCodec(self);
+  if(_ctmStreamRead(self, (void *) &tag, 1) != 1)
+    return (const _CTMcodec *) 0;
+  for(i = 0; i < _CTM_CODEC_COUNT; ++ i)
+  {
+    if(_ctmCodecs[i].mTag == tag)
+      return &_ctmCodecs[i];
+  }
+  return (const _CTMcodec *) 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFrameHeaderSize() - Get the size of a frame header (packed size, codec
+// tag in v7 files, and the codec props), for the statistics.
+//-----------------------------------------------------------------------------
+static size_t _ctmFrameHeaderSize(_CTMcontext * self, const _CTMcodec * aCodec)
+{
+  return 4 + (self->mFileFormat >= _CTM_FORMAT_VERSION_CODECS ? 1 : 0) +
+         aCodec->mPropsSize;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPackJobRun() - Compress the data of a packed block with the codec of
+// the block (thread pool job function).
+//-----------------------------------------------------------------------------
+static void _ctmPackJobRun(_CTMjob * aJob)
+{
+  _CTMpackjob * job = (_CTMpackjob *) aJob;
+  size_t capacity;
+  double start;
+
+  // Allocate memory for the packed data, unless a scratch buffer is used
+  capacity = job->mCodec->mBound(job->mDataSize);
+  job->mPackedSize = capacity;
+  if(!job->mPacked)
+  {
+    job->mPacked = (unsigned char *) _ctmMalloc(job->mContext, capacity ? capacity : 1);
+    if(!job->mPacked)
+    {
+      job->mResult = SZ_ERROR_MEM;
+      return;
+    }
+  }
+
+  // Compress, unless the save has been cancelled while the block was queued
+  if(*job->mContext->mCancelFlag)
+  {
+    job->mResult = SZ_ERROR_PROGRESS;
+    return;
+  }
+  start = _ctmTime();
+  job->mResult = job->mCodec->mCompress(job, job->mPacked, &job->mPackedSize,
+                                        job->mProps);
+  _ctmStatsTime(&job->mTime, start);
+
+  // Free the uncompressed data as soon as possible (unless other frames of
+  // the block still use the buffer)
+  if((job->mBuffer == job->mData) && !job->mScratch)
+  {
+    _ctmFree(job->mContext, job->mBuffer);
+    job->mBuffer = (unsigned char *) 0;
+  }
+  job->mData = (unsigned char *) 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFreePackJob() - Free a packed block (and all its buffers).
+//-----------------------------------------------------------------------------
+static void _ctmFreePackJob(_CTMpackjob * aJob)
+{
+  _CTMcontext * self = aJob->mContext;
+
+  if(!aJob->mScratch)
   {
-    free(packed);
+    _ctmFree(self, aJob->mBuffer);
+    _ctmFree(self, aJob->mPacked);
+  }
+  _ctmFree(self, aJob->mTrailer);
+  _ctmFree(self, aJob);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamFlushHead() - Wait for the first pending packed block to finish,
+// and write it (and its trailer) to the stream.
+//-----------------------------------------------------------------------------
+static int _ctmStreamFlushHead(_CTMcontext * self)
+{
+  _CTMpackjob * job;
+  unsigned char buf[4];
+  int result = CTM_TRUE;
+
+  // Remove the block from the queue
+  job = self->mPackHead;
+  self->mPackHead = job->mNext;
+  if(!self->mPackHead)
+    self->mPackTail = (_CTMpackjob *) 0;
+  -- self->mPackCount;
+
+  // Wait for the compression to finish
+  _ctmThreadPoolWait(self->mThreadPool, &job->mJob);
+
+  // The packed size of a block must fit in its 32-bit size field (this can
+  // only fail for a v5 array, which is stored as a single block)
+  if((job->mResult == SZ_OK) &&
+     ((size_t) (CTMuint) job->mPackedSize != job->mPackedSize))
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    result = CTM_FALSE;
+  }
+  else if(job->mResult == SZ_OK)
+  {
+#ifdef __DEBUG_
+    printf("%d->%d bytes\n", (int) job->mDataSize, (int) job->mPackedSize);
+#endif
+
+    // Write packed data size to the stream
+    buf[0] = job->mPackedSize & 0x000000ff;
+    buf[1] = (job->mPackedSize >> 8) & 0x000000ff;
+    buf[2] = (job->mPackedSize >> 16) & 0x000000ff;
+    buf[3] = (job->mPackedSize >> 24) & 0x000000ff;
+    _ctmStreamWriteDirect(self, (void *) buf, 4);
+
+    // Write the codec tag (v7 files) and the codec props to the stream
+    if(self->mFileFormat >= _CTM_FORMAT_VERSION_CODECS)
+      _ctmStreamWriteDirect(self, (void *) &job->mCodec->mTag, 1);
+    if(job->mCodec->mPropsSize > 0)
+      _ctmStreamWriteDirect(self, (void *) job->mProps, (CTMuint) job->mCodec->mPropsSize);
+
+    // Write the packed data to the stream
+    _ctmStreamWriteDirect(self, (void *) job->mPacked, (CTMuint) job->mPackedSize);
+
+    // Write any data that followed the packed block
+    if(job->mTrailerSize > 0)
+      _ctmStreamWriteDirect(self, (void *) job->mTrailer, (CTMuint) job->mTrailerSize);
+
+    // Report the finished block
+    _ctmStatsBlock(self, job->mTag, job->mDataSize, job->mPackedSize +
+                   _ctmFrameHeaderSize(self, job->mCodec), 1, job->mTime);
+    result = _ctmProgress(self, CTM_STAGE_PACK, 1.0f);
+  }
+  else if(job->mResult == SZ_ERROR_PROGRESS)
+  {
+    self->mError = CTM_CANCELLED;
+    result = CTM_FALSE;
+  }
+  else
+  {
+    self->mError = (job->mResult == SZ_ERROR_MEM) ? CTM_OUT_OF_MEMORY : CTM_LZMA_ERROR;
+    result = CTM_FALSE;
+  }
+
+  _ctmFreePackJob(job);
+
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamDiscard() - Discard all pending packed blocks (used after an
+// error has occured).
+//-----------------------------------------------------------------------------
+static void _ctmStreamDiscard(_CTMcontext * self)
+{
+  _CTMpackjob * job;
+
+  while(self->mPackHead)
+  {
+    job = self->mPackHead;
+    self->mPackHead = job->mNext;
+    _ctmThreadPoolWait(self->mThreadPool, &job->mJob);
+    _ctmFreePackJob(job);
+  }
+  self->mPackTail = (_CTMpackjob *) 0;
+  self->mPackCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamFlush() - Write all pending packed blocks and buffered data to
+// the stream (in order). If a block could not be compressed, the remaining
+// blocks are discarded and CTM_FALSE is returned.
+//-----------------------------------------------------------------------------
+int _ctmStreamFlush(_CTMcontext * self)
+{
+  while(self->mPackHead)
+  {
+    if(!_ctmStreamFlushHead(self))
+    {
+      _ctmStreamDiscard(self);
+      _ctmStreamWriteBuffer(self);
+      return CTM_FALSE;
+    }
+  }
+
+  // Empty the write-behind buffer
+  return _ctmStreamWriteBuffer(self);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamPackBuffer() - Get a buffer for an interleaved byte array that is
+// to be passed to _ctmStreamWritePacked(). Without a thread pool, each array
+// is compressed and written before the next one is created, so a scratch
+// buffer of the context is used. Otherwise a new buffer is allocated (which
+// is freed when the array has been compressed).
+//-----------------------------------------------------------------------------
+static unsigned char * _ctmStreamPackBuffer(_CTMcontext * self, size_t aSize)
+{
+  unsigned char * buf;
+
+  if(!_ctmGetThreadPool(self))
+    return (unsigned char *) _ctmScratch(self, _CTM_SCRATCH_INTERLEAVED, aSize);
+
+  buf = (unsigned char *) _ctmMalloc(self, aSize ? aSize : 1);
+  if(!buf)
     self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+  return buf;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWritePacked() - Compress an interleaved byte array and write it to
+// the stream. The function takes ownership of aData (a buffer from
+// _ctmStreamPackBuffer(), unless it is a scratch buffer). If the context has a
+// thread pool, the compression is done asynchronously, and the data is
+// written to the stream (in order) as soon as it and all preceding blocks are
+// finished.
+//
+// In a v5 file the array is stored as a single block (packed size, codec
+// props and packed data). In a v6 file the array is split into frames of
+// _CTM_FRAME_SIZE bytes: the frame size is written first, followed by one
+// block per frame. The blocks of v5 and v6 files are coded with the default
+// codec of the method (LZMA props and LZMA data, or rANS data without props
+// for MG3). v7 files use the v6 layout, but the packed size of each block is
+// followed by the tag of the codec that the block is coded with. aPlaneSize
+// is the size of a byte plane of the interleaved array (the number of array
+// elements).
+//-----------------------------------------------------------------------------
+static int _ctmStreamWritePacked(_CTMcontext * self, unsigned char * aData,
+  size_t aSize, size_t aPlaneSize)
+{
+  _CTMthreadpool * pool;
+  _CTMpackjob * job;
+  size_t frameSize, offset;
+  CTMuint i;
+  int scratch;
+
+  // Is the array in a scratch buffer (which must not be freed)?
+  scratch = (aData == (unsigned char *) self->mScratch[_CTM_SCRATCH_INTERLEAVED]);
+
+  // Determine the frame size (v5 files use a single frame)
+  if(self->mFileFormat >= _CTM_FORMAT_VERSION_FRAMED)
+  {
+    frameSize = _CTM_FRAME_SIZE;
+    _ctmStreamWriteUINT(self, (CTMuint) frameSize);
+    if(aSize == 0)
+    {
+      if(!scratch)
+        _ctmFree(self, aData);
+      return CTM_TRUE;
+    }
+  }
+  else
+    frameSize = aSize;
+
+  pool = _ctmGetThreadPool(self);
+  offset = 0;
+  do
+  {
+    // Create a new packed block for the next frame
+    job = (_CTMpackjob *) _ctmMalloc(self, sizeof(_CTMpackjob));
+    if(!job)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      _ctmStreamDiscard(self);
+      if(!scratch)
+        _ctmFree(self, aData);
+      return CTM_FALSE;
+    }
+    memset(job, 0, sizeof(_CTMpackjob));
+    job->mJob.mFn = _ctmPackJobRun;
+    job->mContext = self;
+    job->mData = &aData[offset];
+    job->mDataSize = (aSize - offset) < frameSize ? (aSize - offset) : frameSize;
+    job->mCodec = _ctmStreamCodec(self);
+    job->mLevel = self->mCompressionLevel;
+    job->mLZMAThreads = self->mLZMAThreads;
+    job->mParams = &_ctmLzmaDefault;
+    job->mPasses = 1;
+    job->mOffset = offset;
+    job->mPlaneSize = aPlaneSize;
+    if(self->mLZMASearch && (job->mCodec->mCodec == CTM_CODEC_LZMA))
+    {
+      for(i = 0; i < _CTM_LZMA_SEARCH_COUNT; ++ i)
+      {
+        if(!_ctmLzmaParamsEqual(&_ctmLzmaSearch[i], job->mParams))
+          ++ job->mPasses;
+      }
+    }
+    job->mReport = !pool;
+    job->mTag = self->mBlockTag;
+    offset += job->mDataSize;
+
+    // A scratch array is compressed right away (there is no thread pool), so
+    // the packed data can go to a scratch buffer too
+    if(scratch)
+    {
+      job->mScratch = CTM_TRUE;
+      job->mPacked = (unsigned char *) _ctmScratch(self, _CTM_SCRATCH_PACKED,
+        job->mCodec->mBound(job->mDataSize));
+      if(!job->mPacked)
+      {
+        _ctmFree(self, job);
+        _ctmStreamDiscard(self);
+        return CTM_FALSE;
+      }
+    }
+
+    // The last frame owns the buffer (frames are written, and freed, in
+    // order, so all other frames are finished by the time it is freed)
+    if(offset >= aSize)
+      job->mBuffer = aData;
+
+    // Append the block to the queue of pending blocks
+    if(self->mPackTail)
+      self->mPackTail->mNext = job;
+    else
+      self->mPackHead = job;
+    self->mPackTail = job;
+    ++ self->mPackCount;
+
+    // Start compressing (without a thread pool, this finishes immediately)
+    _ctmThreadPoolSubmit(pool, &job->mJob);
+
+    // Write all finished blocks at the head of the queue, and limit the
+    // number of blocks in flight (and hence the amount of memory in use)
+    while(self->mPackHead &&
+          ((self->mPackCount > _ctmThreadCount(self)) ||
+           _ctmThreadPoolIsDone(pool, &self->mPackHead->mJob)))
+    {
+      if(!_ctmStreamFlushHead(self))
+      {
+        _ctmStreamDiscard(self);
+        if((offset < aSize) && !scratch)
+          _ctmFree(self, aData);
+        return CTM_FALSE;
+      }
+    }
+  } while(offset < aSize);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _CTMunframejob - A single block (frame) of a packed data array that is
+// being uncompressed by the thread pool.
+//-----------------------------------------------------------------------------
+typedef struct {
+  // Thread pool job (must be the first member)
+  _CTMjob mJob;
+
+  // The context that the frame belongs to (for memory allocation)
+  _CTMcontext * mContext;
+
+  // Packed data (as read from the stream), and the codec that it is coded
+  // with
+  unsigned char * mPacked;
+  size_t mPackedSize;
+  unsigned char mProps[_CTM_CODEC_PROPS_SIZE];
+  const _CTMcodec * mCodec;
+
+  // Destination (part of the interleaved array)
+  unsigned char * mDest;
+  size_t mDestSize;
+
+  // Codec time in seconds (for the statistics)
+  CTMfloat mTime;
+
+  // Result (an OpenCTM error code)
+  CTMenum mResult;
+} _CTMunframejob;
+
+//-----------------------------------------------------------------------------
+// _CTMunpackjob - A packed data array that is being uncompressed by the
+// thread pool. The first frame of the array is uncompressed by the job itself,
+// while any additional frames (v6 files) are submitted as separate jobs.
+//-----------------------------------------------------------------------------
+struct _CTMunpackjob_struct {
+  // Thread pool job (must be the first member)
+  _CTMjob mJob;
+
+  // The context that the array belongs to (for memory allocation)
+  _CTMcontext * mContext;
+
+  // The thread pool that the frame jobs were submitted to
+  _CTMthreadpool * mPool;
+
+  // Frames of packed data
+  _CTMunframejob * mFrames;
+  CTMuint mFrameCount;
+
+  // Interleaved (uncompressed) array
+  unsigned char * mInterleaved;
+
+  // Destination array
+  void * mData;
+  CTMuint mCount;
+  CTMuint mSize;
+  CTMint mSignedInts;
+  CTMint mFloats;
+
+  // Block tag (FOURCC, for the statistics)
+  CTMuint mTag;
+
+  // Result (an OpenCTM error code)
+  CTMenum mResult;
+
+  // Next pending block
+  _CTMunpackjob * mNext;
+};
+
+//-----------------------------------------------------------------------------
+// _ctmUnframeJobRun() - Uncompress a single frame of a packed data array
+// (thread pool job function).
+//-----------------------------------------------------------------------------
+static void _ctmUnframeJobRun(_CTMjob * aJob)
+{
+  _CTMunframejob * job = (_CTMunframejob *) aJob;
+  double start;
+
+  // Skip the frame if the load has been cancelled
+  if(*job->mContext->mCancelFlag)
+  {
+    _ctmFree(job->mContext, job->mPacked);
+    job->mPacked = (unsigned char *) 0;
+    job->mResult = CTM_CANCELLED;
+    return;
   }
 
   // Uncompress
-  unpackedSize = aCount * aSize * 4;
-  lzmaRes = LzmaUncompress(tmp, &unpackedSize, packed,
-                           &packedSize, props, 5);
+  start = _ctmTime();
+  job->mResult = job->mCodec->mUncompress(job->mContext, job->mDest,
+    job->mDestSize, job->mPacked, job->mPackedSize, job->mProps);
+  _ctmStatsTime(&job->mTime, start);
 
   // Free the packed array
-  free(packed);
+  _ctmFree(job->mContext, job->mPacked);
+  job->mPacked = (unsigned char *) 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadFrame() - Read a single frame of packed data from the stream,
+// and uncompress it. If the codec can uncompress the frame while it is being
+// read (LZMA), no full size copy of the packed data is needed. Otherwise the
+// frame is read into a scratch buffer of the context first. Returns an
+// OpenCTM error code.
+//-----------------------------------------------------------------------------
+static CTMenum _ctmStreamReadFrame(_CTMcontext * self,
+  const _CTMcodec * aCodec, unsigned char * aDest, size_t aDestSize,
+  size_t aPackedSize, const unsigned char * aProps)
+{
+  unsigned char * packed;
+
+  if(aCodec->mReadFrame)
+    return aCodec->mReadFrame(self, aDest, aDestSize, aPackedSize, aProps);
 
-  // Error?
-  if((lzmaRes != SZ_OK) || (unpackedSize != aCount * aSize * 4))
+  if((size_t) (CTMuint) aPackedSize != aPackedSize)
+    return CTM_BAD_FORMAT;
+  packed = (unsigned char *) _ctmScratch(self, _CTM_SCRATCH_PACKED,
+                                         aPackedSize ? aPackedSize : 1);
+  if(!packed)
+    return CTM_OUT_OF_MEMORY;
+  if(_ctmStreamRead(self, (void *) packed, (CTMuint) aPackedSize) != aPackedSize)
+    return CTM_BAD_FORMAT;
+  return aCodec->mUncompress(self, aDest, aDestSize, packed, aPackedSize,
+                             aProps);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmUnpackJobRun() - Uncompress the frames of a packed data array, and
+// convert the interleaved array to integers or floats (thread pool job
+// function).
+//-----------------------------------------------------------------------------
+static void _ctmUnpackJobRun(_CTMjob * aJob)
+{
+  _CTMunpackjob * job = (_CTMunpackjob *) aJob;
+  CTMuint i, aCount, aSize;
+  unsigned char * tmp;
+
+  aCount = job->mCount;
+  aSize = job->mSize;
+  tmp = job->mInterleaved;
+
+  // Uncompress the first frame (the other frames are separate jobs, that were
+  // queued before this job, so they have all been started by now). Frames
+  // that were uncompressed while reading them have no packed data.
+  job->mResult = CTM_NONE;
+  if((job->mFrameCount > 0) && job->mFrames[0].mPacked)
+    _ctmUnframeJobRun(&job->mFrames[0].mJob);
+  for(i = 0; i < job->mFrameCount; ++ i)
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(tmp);
-    return CTM_FALSE;
+    if(i > 0)
+      _ctmThreadPoolWait(job->mPool, &job->mFrames[i].mJob);
+    if(job->mFrames[i].mResult != CTM_NONE)
+      job->mResult = job->mFrames[i].mResult;
+  }
+  if(job->mResult != CTM_NONE)
+    return;
+
+  // Convert the interleaved array to integers or floats
+  _ctmDeinterleaveWords((CTMint *) job->mData, tmp, aCount, aSize,
+                        job->mFloats ? CTM_FALSE : job->mSignedInts);
+
+  // Free the interleaved array
+  _ctmFree(job->mContext, tmp);
+  job->mInterleaved = (unsigned char *) 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFreeUnpackJob() - Free a packed data array job (and all its buffers).
+//-----------------------------------------------------------------------------
+static void _ctmFreeUnpackJob(_CTMunpackjob * aJob)
+{
+  _CTMcontext * self = aJob->mContext;
+  CTMuint i;
+
+  if(aJob->mFrames)
+  {
+    for(i = 0; i < aJob->mFrameCount; ++ i)
+      _ctmFree(self, aJob->mFrames[i].mPacked);
+    _ctmFree(self, aJob->mFrames);
   }
+  _ctmFree(self, aJob->mInterleaved);
+  _ctmFree(self, aJob);
+}
 
-  // Convert interleaved array to floats
-  for(i = 0; i < aCount; ++ i)
+//-----------------------------------------------------------------------------
+// _ctmStreamReadReap() - Wait for the first pending unpack job to finish, and
+// remove it from the queue. Returns the job result (an OpenCTM error code).
+//-----------------------------------------------------------------------------
+static CTMenum _ctmStreamReadReap(_CTMcontext * self)
+{
+  _CTMunpackjob * job;
+  CTMenum result;
+  size_t packedSize;
+  CTMfloat time;
+  CTMuint i;
+
+  job = self->mUnpackHead;
+  self->mUnpackHead = job->mNext;
+  if(!self->mUnpackHead)
+    self->mUnpackTail = (_CTMunpackjob *) 0;
+
+  _ctmThreadPoolWait(self->mThreadPool, &job->mJob);
+  result = job->mResult;
+
+  // Add the array to the statistics
+  if(result == CTM_NONE)
   {
-    for(k = 0; k < aSize; ++ k)
+    packedSize = 0;
+    time = 0.0f;
+    for(i = 0; i < job->mFrameCount; ++ i)
     {
-      value.i = (CTMint) tmp[i + k * aCount + 3 * aCount * aSize] |
-                (((CTMint) tmp[i + k * aCount + 2 * aCount * aSize]) << 8) |
-                (((CTMint) tmp[i + k * aCount + aCount * aSize]) << 16) |
-                (((CTMint) tmp[i + k * aCount]) << 24);
-      aData[i * aSize + k] = value.f;
+      packedSize += job->mFrames[i].mPackedSize +
+                    _ctmFrameHeaderSize(self, job->mFrames[i].mCodec);
+      time += job->mFrames[i].mTime;
     }
+    _ctmStatsBlock(self, job->mTag, (size_t) job->mCount * job->mSize * 4,
+                   packedSize, job->mFrameCount, time);
   }
 
-  // Free the interleaved array
-  free(tmp);
+  _ctmFreeUnpackJob(job);
+
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadWait() - Wait until the packed block that is being read into
+// aData (and all blocks that were read before it) has been uncompressed.
+//-----------------------------------------------------------------------------
+int _ctmStreamReadWait(_CTMcontext * self, const void * aData)
+{
+  _CTMunpackjob * job;
+  const void * data;
+  CTMenum result;
+
+  // Is there a pending job for this array?
+  job = self->mUnpackHead;
+  while(job && (job->mData != aData))
+    job = job->mNext;
+  if(!job)
+    return CTM_TRUE;
+
+  // Wait for all jobs up to (and including) the one for this array
+  do
+  {
+    data = self->mUnpackHead->mData;
+    result = _ctmStreamReadReap(self);
+    if(result != CTM_NONE)
+    {
+      self->mError = result;
+      _ctmStreamReadDiscard(self);
+      return CTM_FALSE;
+    }
+  } while(data != aData);
 
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamWritePackedFloats() - Compress a binary float data array, and
-// write it to a stream.
+// _ctmStreamReadSync() - Wait until all pending packed blocks have been
+// uncompressed.
 //-----------------------------------------------------------------------------
-int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData,
-  CTMuint aCount, CTMuint aSize)
+int _ctmStreamReadSync(_CTMcontext * self)
 {
-  int lzmaRes, lzmaAlgo;
-  CTMuint i, k;
-  union {
-    CTMfloat f;
-    CTMint i;
-  } value;
-  size_t bufSize, outPropsSize;
-  unsigned char * packed, outProps[5], *tmp;
+  CTMenum result;
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
+  while(self->mUnpackHead)
+  {
+    result = _ctmStreamReadReap(self);
+    if(result != CTM_NONE)
+    {
+      self->mError = result;
+      _ctmStreamReadDiscard(self);
+      return CTM_FALSE;
+    }
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadDiscard() - Wait for all pending packed blocks, and ignore
+// the results (used when bailing out after an error, before the destination
+// arrays are freed).
+//-----------------------------------------------------------------------------
+void _ctmStreamReadDiscard(_CTMcontext * self)
+{
+  while(self->mUnpackHead)
+    _ctmStreamReadReap(self);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadPacked() - Read a packed data array from the stream, and
+// uncompress it into aData (as aCount * aSize integers or floats). If the
+// context has a thread pool, the array is uncompressed asynchronously, and
+// the caller must use _ctmStreamReadWait() or _ctmStreamReadSync() before
+// accessing the data. See _ctmStreamWritePacked() for the stream layout.
+//-----------------------------------------------------------------------------
+static int _ctmStreamReadPacked(_CTMcontext * self, void * aData,
+  CTMuint aCount, CTMuint aSize, CTMint aSignedInts, CTMint aFloats)
+{
+  _CTMthreadpool * pool;
+  _CTMunpackjob * job;
+  _CTMunframejob * frame;
+  size_t dataSize, frameSize, frameCount, offset;
+  CTMuint i;
+  double start;
+
+  // Create a new unpack job
+  job = (_CTMunpackjob *) _ctmMalloc(self, sizeof(_CTMunpackjob));
+  if(!job)
   {
     self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
-
-  // Convert floats to an interleaved array
-  for(i = 0; i < aCount; ++ i)
+  memset(job, 0, sizeof(_CTMunpackjob));
+  job->mJob.mFn = _ctmUnpackJobRun;
+  job->mContext = self;
+  job->mData = aData;
+  job->mCount = aCount;
+  job->mSize = aSize;
+  job->mSignedInts = aSignedInts;
+  job->mFloats = aFloats;
+  job->mTag = self->mBlockTag;
+
+  pool = _ctmGetThreadPool(self);
+
+  // Determine the frame layout (v5 files use a single frame)
+  dataSize = (size_t) aCount * aSize * 4;
+  if(self->mFileFormat >= _CTM_FORMAT_VERSION_FRAMED)
   {
-    for(k = 0; k < aSize; ++ k)
+    frameSize = (size_t) _ctmStreamReadUINT(self);
+    if(frameSize == 0)
+    {
+      _ctmFree(self, job);
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    frameCount = (dataSize + frameSize - 1) / frameSize;
+    if((size_t) (CTMuint) frameCount != frameCount)
     {
-      value.f = aData[i * aSize + k];
-      tmp[i + k * aCount + 3 * aCount * aSize] = value.i & 0x000000ff;
-      tmp[i + k * aCount + 2 * aCount * aSize] = (value.i >> 8) & 0x000000ff;
-      tmp[i + k * aCount + aCount * aSize] = (value.i >> 16) & 0x000000ff;
-      tmp[i + k * aCount] = (value.i >> 24) & 0x000000ff;
+      _ctmFree(self, job);
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
     }
+    job->mFrameCount = (CTMuint) frameCount;
+  }
+  else
+  {
+    frameSize = dataSize;
+    job->mFrameCount = 1;
   }
 
-  // Allocate memory for the packed data
-  bufSize = 1000 + aCount * aSize * 4;
-  packed = (unsigned char *) malloc(bufSize);
-  if(!packed)
+  // Allocate memory for the frames and the interleaved array
+  job->mFrames = (_CTMunframejob *) _ctmMalloc(self,
+    (job->mFrameCount ? job->mFrameCount : 1) * sizeof(_CTMunframejob));
+  job->mInterleaved = (unsigned char *) _ctmMalloc(self, dataSize ? dataSize : 1);
+  if(!job->mFrames || !job->mInterleaved)
   {
-    free(tmp);
+    job->mFrameCount = 0;
+    _ctmFreeUnpackJob(job);
     self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
+  memset(job->mFrames, 0, job->mFrameCount * sizeof(_CTMunframejob));
 
-  // Call LZMA to compress
-  outPropsSize = 5;
-  lzmaAlgo = (self->mCompressionLevel < 1 ? 0 : 1);
-  lzmaRes = LzmaCompress(packed,
-                         &bufSize,
-                         (const unsigned char *) tmp,
-                         aCount * aSize * 4,
-                         outProps,
-                         &outPropsSize,
-                         self->mCompressionLevel, // Level (0-9)
-                         0, -1, -1, -1, -1, -1,   // Default values (set by level)
-                         lzmaAlgo                 // Algorithm (0 = fast, 1 = normal)
-                        );
-
-  // Free temporary array
-  free(tmp);
-
-  // Error?
-  if(lzmaRes != SZ_OK)
+  // Read all frames from the stream
+  offset = 0;
+  for(i = 0; i < job->mFrameCount; ++ i)
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(packed);
+    frame = &job->mFrames[i];
+    frame->mJob.mFn = _ctmUnframeJobRun;
+    frame->mContext = self;
+    frame->mDest = &job->mInterleaved[offset];
+    frame->mDestSize = (dataSize - offset) < frameSize ? (dataSize - offset) : frameSize;
+    offset += frame->mDestSize;
+
+    // Read packed data size, codec tag (v7 files) and codec props from the
+    // stream
+    frame->mPackedSize = (size_t) _ctmStreamReadUINT(self);
+    frame->mCodec = _ctmStreamReadCodec(self);
+    if(!frame->mCodec)
+    {
+      _ctmFreeUnpackJob(job);
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(frame->mCodec->mPropsSize > 0)
+      _ctmStreamRead(self, (void *) frame->mProps, (CTMuint) frame->mCodec->mPropsSize);
+
+    // Without a thread pool the frames are uncompressed one at a time anyway,
+    // so uncompress the frame while reading it (this way the packed data is
+    // never held in memory)
+    if(!pool)
+    {
+      start = _ctmTime();
+      frame->mResult = _ctmStreamReadFrame(self, frame->mCodec, frame->mDest,
+        frame->mDestSize, frame->mPackedSize, frame->mProps);
+      _ctmStatsTime(&frame->mTime, start);
+      if(frame->mResult != CTM_NONE)
+      {
+        self->mError = frame->mResult;
+        _ctmFreeUnpackJob(job);
+        return CTM_FALSE;
+      }
+      if(!_ctmProgress(self, CTM_STAGE_UNPACK, (CTMfloat) (i + 1) / (CTMfloat) job->mFrameCount))
+      {
+        _ctmFreeUnpackJob(job);
+        return CTM_FALSE;
+      }
+      continue;
+    }
+
+    // Allocate memory and read the packed data from the stream
+    frame->mPacked = (unsigned char *) _ctmMalloc(self, frame->mPackedSize ? frame->mPackedSize : 1);
+    if(!frame->mPacked)
+    {
+      _ctmFreeUnpackJob(job);
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+    if(((size_t) (CTMuint) frame->mPackedSize != frame->mPackedSize) ||
+       (_ctmStreamRead(self, (void *) frame->mPacked, (CTMuint) frame->mPackedSize) != frame->mPackedSize))
+    {
+      _ctmFreeUnpackJob(job);
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(!_ctmProgress(self, CTM_STAGE_UNPACK, (CTMfloat) (i + 1) / (CTMfloat) job->mFrameCount))
+    {
+      _ctmFreeUnpackJob(job);
+      return CTM_FALSE;
+    }
+  }
+
+  // Append the job to the queue of pending jobs
+  if(self->mUnpackTail)
+    self->mUnpackTail->mNext = job;
+  else
+    self->mUnpackHead = job;
+  self->mUnpackTail = job;
+
+  // Start uncompressing (the additional frames are queued before the array
+  // job, since the array job waits for them)
+  job->mPool = pool;
+  if(pool)
+  {
+    for(i = 1; i < job->mFrameCount; ++ i)
+      _ctmThreadPoolSubmit(pool, &job->mFrames[i].mJob);
+  }
+  _ctmThreadPoolSubmit(pool, &job->mJob);
+
+  // Without a thread pool the job has already finished, so report the result
+  // right away
+  if(!pool)
+    return _ctmStreamReadSync(self);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadPackedInts() - Read an compressed binary integer data array
+// from a stream, and uncompress it.
+//-----------------------------------------------------------------------------
+int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData,
+  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+{
+  return _ctmStreamReadPacked(self, (void *) aData, aCount, aSize,
+                              aSignedInts, CTM_FALSE);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWritePackedInts() - Compress a binary integer data array, and
+// write it to a stream.
+//-----------------------------------------------------------------------------
+int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData,
+  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+{
+  unsigned char * tmp;
+#ifdef __DEBUG_
+  CTMuint i, negCount = 0;
+#endif
+
+  // Get a buffer for the interleaved array
+  tmp = _ctmStreamPackBuffer(self, (size_t) aCount * aSize * 4);
+  if(!tmp)
     return CTM_FALSE;
+
+  // Convert integers to an interleaved array
+  _ctmInterleaveWords(tmp, aData, aCount, aSize, aSignedInts);
+
+#ifdef __DEBUG_
+  if(!aSignedInts)
+  {
+    for(i = 0; i < aCount * aSize; ++ i)
+    {
+      if(aData[i] < 0)
+        ++ negCount;
+    }
   }
+#endif
 
 #ifdef __DEBUG_
-  printf("%d->%d bytes\n", aCount * aSize * 4, (int) bufSize);
+  printf("(%d negative words) ", negCount);
 #endif
 
-  // Write packed data size to the stream
-  _ctmStreamWriteUINT(self, (CTMuint) bufSize);
+  // Compress the interleaved array and write it to the stream
+  return _ctmStreamWritePacked(self, tmp, (size_t) aCount * aSize * 4, aCount);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamReadPackedFloats() - Read an compressed binary float data array
+// from a stream, and uncompress it.
+//-----------------------------------------------------------------------------
+int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData,
+  CTMuint aCount, CTMuint aSize)
+{
+  return _ctmStreamReadPacked(self, (void *) aData, aCount, aSize,
+                              CTM_FALSE, CTM_TRUE);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWritePackedFloats() - Compress a binary float data array, and
+// write it to a stream.
+//-----------------------------------------------------------------------------
+int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData,
+  CTMuint aCount, CTMuint aSize)
+{
+  unsigned char * tmp;
+
+  // Get a buffer for the interleaved array
+  tmp = _ctmStreamPackBuffer(self, (size_t) aCount * aSize * 4);
+  if(!tmp)
+    return CTM_FALSE;
+
+  // Convert floats to an interleaved array
+  _ctmInterleaveWords(tmp, (CTMint *) aData, aCount, aSize, CTM_FALSE);
+
+  // Compress the interleaved array and write it to the stream
+  return _ctmStreamWritePacked(self, tmp, (size_t) aCount * aSize * 4, aCount);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamSkip() - Skip aCount bytes of a stream. The stream is seeked if
+// possible, otherwise the data is read and discarded. Returns CTM_FALSE if the
+// end of the stream was reached first (only detected when reading).
+//-----------------------------------------------------------------------------
+int _ctmStreamSkip(_CTMcontext * self, size_t aCount)
+{
+  unsigned char buf[_CTM_LZMA_READ_SIZE];
+  CTMuint size;
 
-  // Write LZMA compression props to the stream
-  _ctmStreamWrite(self, (void *) outProps, 5);
+  // Skip what is left in the read-ahead buffer
+  size = self->mStreamBufferFill - self->mStreamBufferPos;
+  if(size > aCount)
+    size = (CTMuint) aCount;
+  self->mStreamBufferPos += size;
+  aCount -= size;
 
-  // Write the packed data to the stream
-  _ctmStreamWrite(self, (void *) packed, (CTMuint) bufSize);
+  // Seek past the rest, if the stream supports it
+  if(self->mSeekFn && (aCount > 0))
+    return self->mSeekFn(aCount, self->mUserData);
 
-  // Free the packed data
-  free(packed);
+  while(aCount > 0)
+  {
+    size = aCount < sizeof(buf) ? (CTMuint) aCount : (CTMuint) sizeof(buf);
+    if(_ctmStreamRead(self, (void *) buf, size) != size)
+      return CTM_FALSE;
+    aCount -= size;
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamSkipPacked() - Skip a packed data array of aCount * aSize
+// integers or floats in the stream, without uncompressing it. Only the frame
+// headers are read (see _ctmStreamWritePacked() for the stream layout).
+//-----------------------------------------------------------------------------
+int _ctmStreamSkipPacked(_CTMcontext * self, CTMuint aCount, CTMuint aSize)
+{
+  size_t dataSize, frameSize, frameCount, packedSize, i;
+  const _CTMcodec * codec;
+
+  // Determine the number of frames (v5 files use a single frame)
+  dataSize = (size_t) aCount * aSize * 4;
+  frameCount = 1;
+  if(self->mFileFormat >= _CTM_FORMAT_VERSION_FRAMED)
+  {
+    frameSize = (size_t) _ctmStreamReadUINT(self);
+    if(frameSize == 0)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    frameCount = (dataSize + frameSize - 1) / frameSize;
+  }
+
+  // Skip the packed data size, the codec tag and props, and the packed data
+  // of each frame
+  for(i = 0; i < frameCount; ++ i)
+  {
+    packedSize = (size_t) _ctmStreamReadUINT(self);
+    codec = _ctmStreamReadCodec(self);
+    if(!codec || !_ctmStreamSkip(self, packedSize + codec->mPropsSize))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+  }
 
   return CTM_TRUE;
 }
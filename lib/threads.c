@@ -0,0 +1,568 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        threads.c
+// Description: Portable worker thread pool (used for running independent
+//              compression/decompression jobs concurrently), background
+//              tasks (used for asynchronous loading and saving), and a wall
+//              clock timer (used for the statistics).
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+// We need POSIX (and, on Mac OS X, Darwin) extensions for sysconf() and
+// clock_gettime()
+#if !defined(_WIN32)
+  #ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200112L
+  #endif
+  #if defined(__APPLE__) && !defined(_DARWIN_C_SOURCE)
+    #define _DARWIN_C_SOURCE
+  #endif
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "openctm.h"
+#include "internal.h"
+
+#if defined(OPENCTM_NO_THREADS)
+  // No threading support: all jobs are executed by the calling thread
+#elif defined(_WIN32)
+  #ifndef _WIN32_WINNT
+    #define _WIN32_WINNT 0x0600
+  #endif
+  #include <windows.h>
+  #define _CTM_WIN32_THREADS
+#else
+  #include <pthread.h>
+  #include <unistd.h>
+  #define _CTM_POSIX_THREADS
+#endif
+
+
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+
+//-----------------------------------------------------------------------------
+// Thin platform abstraction (mutex, condition variable and thread handle).
+//-----------------------------------------------------------------------------
+#ifdef _CTM_WIN32_THREADS
+typedef CRITICAL_SECTION _CTMmutex;
+typedef CONDITION_VARIABLE _CTMcond;
+typedef HANDLE _CTMthread;
+#define _ctmMutexInit(m)     InitializeCriticalSection(m)
+#define _ctmMutexDestroy(m)  DeleteCriticalSection(m)
+#define _ctmMutexLock(m)     EnterCriticalSection(m)
+#define _ctmMutexUnlock(m)   LeaveCriticalSection(m)
+#define _ctmCondInit(c)      InitializeConditionVariable(c)
+#define _ctmCondDestroy(c)
+#define _ctmCondWait(c, m)   SleepConditionVariableCS(c, m, INFINITE)
+#define _ctmCondSignal(c)    WakeConditionVariable(c)
+#define _ctmCondBroadcast(c) WakeAllConditionVariable(c)
+#else
+typedef pthread_mutex_t _CTMmutex;
+typedef pthread_cond_t _CTMcond;
+typedef pthread_t _CTMthread;
+#define _ctmMutexInit(m)     pthread_mutex_init(m, NULL)
+#define _ctmMutexDestroy(m)  pthread_mutex_destroy(m)
+#define _ctmMutexLock(m)     pthread_mutex_lock(m)
+#define _ctmMutexUnlock(m)   pthread_mutex_unlock(m)
+#define _ctmCondInit(c)      pthread_cond_init(c, NULL)
+#define _ctmCondDestroy(c)   pthread_cond_destroy(c)
+#define _ctmCondWait(c, m)   pthread_cond_wait(c, m)
+#define _ctmCondSignal(c)    pthread_cond_signal(c)
+#define _ctmCondBroadcast(c) pthread_cond_broadcast(c)
+#endif
+
+//-----------------------------------------------------------------------------
+// _CTMthreadpool - A fixed size set of worker threads and a FIFO job queue.
+//-----------------------------------------------------------------------------
+struct _CTMthreadpool_struct {
+  // Lock that protects the job queue and the job states
+  _CTMmutex mLock;
+
+  // Signaled when a new job has been queued (or when the pool is shut down)
+  _CTMcond mWorkCond;
+
+  // Signaled when a job has been finished
+  _CTMcond mDoneCond;
+
+  // Job queue (singly linked list, FIFO)
+  _CTMjob * mHead;
+  _CTMjob * mTail;
+
+  // Set to non-zero when the worker threads should terminate
+  int mQuit;
+
+  // Worker threads
+  CTMuint mThreadCount;
+  _CTMthread mThreads[_CTM_MAX_THREADS];
+};
+
+//-----------------------------------------------------------------------------
+// _ctmWorkerMain() - Worker thread main loop.
+//-----------------------------------------------------------------------------
+#ifdef _CTM_WIN32_THREADS
+static DWORD WINAPI _ctmWorkerMain(LPVOID aArg)
+#else
+static void * _ctmWorkerMain(void * aArg)
+#endif
+{
+  _CTMthreadpool * pool = (_CTMthreadpool *) aArg;
+  _CTMjob * job;
+
+  _ctmMutexLock(&pool->mLock);
+  while(1)
+  {
+    // Wait for work
+    while(!pool->mHead && !pool->mQuit)
+      _ctmCondWait(&pool->mWorkCond, &pool->mLock);
+    if(!pool->mHead)
+      break;
+
+    // Dequeue the next job
+    job = pool->mHead;
+    pool->mHead = job->mNext;
+    if(!pool->mHead)
+      pool->mTail = (_CTMjob *) 0;
+
+    // Run the job (without holding the lock)
+    _ctmMutexUnlock(&pool->mLock);
+    job->mFn(job);
+    _ctmMutexLock(&pool->mLock);
+
+    // Mark the job as done, and wake up anyone who is waiting for it
+    job->mDone = 1;
+    _ctmCondBroadcast(&pool->mDoneCond);
+  }
+  _ctmMutexUnlock(&pool->mLock);
+
+  return 0;
+}
+
+#endif // _CTM_WIN32_THREADS || _CTM_POSIX_THREADS
+
+
+//-----------------------------------------------------------------------------
+// _ctmCPUCount() - Get the number of logical processors in the system.
+//-----------------------------------------------------------------------------
+CTMuint _ctmCPUCount(void)
+{
+#if defined(_CTM_WIN32_THREADS)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? (CTMuint) info.dwNumberOfProcessors : 1;
+#elif defined(_CTM_POSIX_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (CTMuint) count : 1;
+#else
+  return 1;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmThreadPoolCreate() - Create a new thread pool with the given number of
+// worker threads. If threads are not supported (or if less than two threads
+// are requested), NULL is returned, which means that all jobs submitted to
+// the pool will be executed immediately by the calling thread.
+//-----------------------------------------------------------------------------
+_CTMthreadpool * _ctmThreadPoolCreate(CTMuint aThreadCount)
+{
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  _CTMthreadpool * pool;
+  CTMuint i;
+
+  if(aThreadCount < 2)
+    return (_CTMthreadpool *) 0;
+  if(aThreadCount > _CTM_MAX_THREADS)
+    aThreadCount = _CTM_MAX_THREADS;
+
+  // Allocate & initialize the pool
+  pool = (_CTMthreadpool *) malloc(sizeof(_CTMthreadpool));
+  if(!pool)
+    return (_CTMthreadpool *) 0;
+  memset(pool, 0, sizeof(_CTMthreadpool));
+  _ctmMutexInit(&pool->mLock);
+  _ctmCondInit(&pool->mWorkCond);
+  _ctmCondInit(&pool->mDoneCond);
+
+  // Start the worker threads
+  for(i = 0; i < aThreadCount; ++ i)
+  {
+#ifdef _CTM_WIN32_THREADS
+    pool->mThreads[i] = CreateThread(NULL, 0, _ctmWorkerMain, (LPVOID) pool, 0, NULL);
+    if(!pool->mThreads[i])
+      break;
+#else
+    if(pthread_create(&pool->mThreads[i], NULL, _ctmWorkerMain, (void *) pool) != 0)
+      break;
+#endif
+    ++ pool->mThreadCount;
+  }
+
+  // If we could not start any threads at all, fall back to serial execution
+  if(pool->mThreadCount == 0)
+  {
+    _ctmThreadPoolDestroy(pool);
+    return (_CTMthreadpool *) 0;
+  }
+
+  return pool;
+#else
+  (void) aThreadCount;
+  return (_CTMthreadpool *) 0;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmThreadPoolDestroy() - Terminate all worker threads and free the pool.
+// Any jobs that are still in the queue are executed before the threads exit.
+//-----------------------------------------------------------------------------
+void _ctmThreadPoolDestroy(_CTMthreadpool * aPool)
+{
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  CTMuint i;
+
+  if(!aPool)
+    return;
+
+  // Tell all worker threads to quit
+  _ctmMutexLock(&aPool->mLock);
+  aPool->mQuit = 1;
+  _ctmCondBroadcast(&aPool->mWorkCond);
+  _ctmMutexUnlock(&aPool->mLock);
+
+  // Wait for the worker threads to finish
+  for(i = 0; i < aPool->mThreadCount; ++ i)
+  {
+#ifdef _CTM_WIN32_THREADS
+    WaitForSingleObject(aPool->mThreads[i], INFINITE);
+    CloseHandle(aPool->mThreads[i]);
+#else
+    pthread_join(aPool->mThreads[i], NULL);
+#endif
+  }
+
+  // Free resources
+  _ctmCondDestroy(&aPool->mDoneCond);
+  _ctmCondDestroy(&aPool->mWorkCond);
+  _ctmMutexDestroy(&aPool->mLock);
+  free(aPool);
+#else
+  (void) aPool;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmThreadPoolSubmit() - Queue a job for execution. The job structure must
+// stay valid until _ctmThreadPoolWait() has returned for the job. If aPool is
+// NULL, the job is executed immediately by the calling thread.
+//-----------------------------------------------------------------------------
+void _ctmThreadPoolSubmit(_CTMthreadpool * aPool, _CTMjob * aJob)
+{
+  aJob->mNext = (_CTMjob *) 0;
+  aJob->mDone = 0;
+
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  if(aPool)
+  {
+    _ctmMutexLock(&aPool->mLock);
+    if(aPool->mTail)
+      aPool->mTail->mNext = aJob;
+    else
+      aPool->mHead = aJob;
+    aPool->mTail = aJob;
+    _ctmCondSignal(&aPool->mWorkCond);
+    _ctmMutexUnlock(&aPool->mLock);
+    return;
+  }
+#else
+  (void) aPool;
+#endif
+
+  aJob->mFn(aJob);
+  aJob->mDone = 1;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmThreadPoolWait() - Wait for a previously submitted job to finish.
+//-----------------------------------------------------------------------------
+void _ctmThreadPoolWait(_CTMthreadpool * aPool, _CTMjob * aJob)
+{
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  if(aPool)
+  {
+    _ctmMutexLock(&aPool->mLock);
+    while(!aJob->mDone)
+      _ctmCondWait(&aPool->mDoneCond, &aPool->mLock);
+    _ctmMutexUnlock(&aPool->mLock);
+  }
+#else
+  (void) aPool;
+  (void) aJob;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmThreadPoolIsDone() - Check (without blocking) if a previously submitted
+// job has finished.
+//-----------------------------------------------------------------------------
+int _ctmThreadPoolIsDone(_CTMthreadpool * aPool, _CTMjob * aJob)
+{
+  int done;
+
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  if(aPool)
+  {
+    _ctmMutexLock(&aPool->mLock);
+    done = aJob->mDone;
+    _ctmMutexUnlock(&aPool->mLock);
+    return done;
+  }
+#else
+  (void) aPool;
+#endif
+
+  done = aJob->mDone;
+  return done;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmThreadCount() - Get the effective number of threads to use for the
+// given context.
+//-----------------------------------------------------------------------------
+CTMuint _ctmThreadCount(_CTMcontext * self)
+{
+  CTMuint count;
+
+  count = self->mThreadCount ? self->mThreadCount : _ctmCPUCount();
+  if(count > _CTM_MAX_THREADS)
+    count = _CTM_MAX_THREADS;
+  return count;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmGetThreadPool() - Get the thread pool for the given context (the pool
+// is created on first use). Returns NULL if the context is configured for
+// serial operation.
+//-----------------------------------------------------------------------------
+_CTMthreadpool * _ctmGetThreadPool(_CTMcontext * self)
+{
+  if(!self->mThreadPool && (_ctmThreadCount(self) > 1))
+    self->mThreadPool = _ctmThreadPoolCreate(_ctmThreadCount(self));
+  return self->mThreadPool;
+}
+
+//-----------------------------------------------------------------------------
+// _CTMrangejob - One part of a range that is processed by _ctmParallelFor().
+//-----------------------------------------------------------------------------
+typedef struct {
+  // Thread pool job (must be the first member)
+  _CTMjob mJob;
+
+  // Range function and its data
+  _CTMrangefn mFn;
+  void * mData;
+
+  // Part index and element range of this part
+  CTMuint mPart;
+  CTMuint mBegin;
+  CTMuint mEnd;
+} _CTMrangejob;
+
+//-----------------------------------------------------------------------------
+// _ctmRangeJobRun() - Process one part of a range (thread pool job function).
+//-----------------------------------------------------------------------------
+static void _ctmRangeJobRun(_CTMjob * aJob)
+{
+  _CTMrangejob * job = (_CTMrangejob *) aJob;
+  job->mFn(job->mData, job->mPart, job->mBegin, job->mEnd);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmParallelParts() - Get the number of parts that a range of aCount
+// elements should be split into by _ctmParallelFor(), so that each part has
+// at least aMinPartSize elements. Returns 1 if the context is configured for
+// serial operation.
+//-----------------------------------------------------------------------------
+CTMuint _ctmParallelParts(_CTMcontext * self, CTMuint aCount,
+  CTMuint aMinPartSize)
+{
+  CTMuint parts;
+
+  if((_ctmThreadCount(self) < 2) || !_ctmGetThreadPool(self))
+    return 1;
+  parts = _ctmThreadCount(self);
+  if(parts > aCount / aMinPartSize)
+    parts = aCount / aMinPartSize;
+  return parts > 0 ? parts : 1;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmParallelFor() - Split the range [0, aCount) into aParts consecutive
+// parts of (almost) equal size, and call aFn for each part. The parts are
+// processed concurrently by the thread pool of the context, and the calling
+// thread processes the first part itself. The function returns when all parts
+// are done.
+//-----------------------------------------------------------------------------
+void _ctmParallelFor(_CTMcontext * self, CTMuint aCount, CTMuint aParts,
+  _CTMrangefn aFn, void * aData)
+{
+  _CTMrangejob jobs[_CTM_MAX_THREADS];
+  _CTMthreadpool * pool;
+  CTMuint i, partSize, rest;
+
+  if(aParts > _CTM_MAX_THREADS)
+    aParts = _CTM_MAX_THREADS;
+  pool = aParts > 1 ? _ctmGetThreadPool(self) : (_CTMthreadpool *) 0;
+  if(!pool)
+  {
+    aFn(aData, 0, 0, aCount);
+    return;
+  }
+
+  // Queue all parts but the first one (the first aCount % aParts parts get
+  // one extra element)
+  partSize = aCount / aParts;
+  rest = aCount % aParts;
+  for(i = 0; i < aParts; ++ i)
+  {
+    jobs[i].mJob.mFn = _ctmRangeJobRun;
+    jobs[i].mFn = aFn;
+    jobs[i].mData = aData;
+    jobs[i].mPart = i;
+    jobs[i].mBegin = i * partSize + (i < rest ? i : rest);
+    jobs[i].mEnd = jobs[i].mBegin + partSize + (i < rest ? 1 : 0);
+    if(i > 0)
+      _ctmThreadPoolSubmit(pool, &jobs[i].mJob);
+  }
+
+  // Process the first part in this thread, and wait for the others
+  _ctmRangeJobRun(&jobs[0].mJob);
+  for(i = 1; i < aParts; ++ i)
+    _ctmThreadPoolWait(pool, &jobs[i].mJob);
+}
+
+//-----------------------------------------------------------------------------
+// _CTMtask - A function that is run by a separate (background) thread.
+//-----------------------------------------------------------------------------
+struct _CTMtask_struct {
+  // Task function and its argument
+  _CTMtaskfn mFn;
+  void * mArg;
+
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  // The thread that runs the task
+  _CTMthread mThread;
+#endif
+};
+
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+
+//-----------------------------------------------------------------------------
+// _ctmTaskMain() - Background task thread main function.
+//-----------------------------------------------------------------------------
+#ifdef _CTM_WIN32_THREADS
+static DWORD WINAPI _ctmTaskMain(LPVOID aArg)
+#else
+static void * _ctmTaskMain(void * aArg)
+#endif
+{
+  _CTMtask * task = (_CTMtask *) aArg;
+  task->mFn(task->mArg);
+  return 0;
+}
+
+#endif // _CTM_WIN32_THREADS || _CTM_POSIX_THREADS
+
+//-----------------------------------------------------------------------------
+// _ctmTaskStart() - Run aFn(aArg) on a new thread. If threads are not
+// supported (or if the thread could not be started), NULL is returned, and
+// the caller should run the function itself.
+//-----------------------------------------------------------------------------
+_CTMtask * _ctmTaskStart(_CTMtaskfn aFn, void * aArg)
+{
+#if defined(_CTM_WIN32_THREADS) || defined(_CTM_POSIX_THREADS)
+  _CTMtask * task;
+
+  task = (_CTMtask *) malloc(sizeof(_CTMtask));
+  if(!task)
+    return (_CTMtask *) 0;
+  task->mFn = aFn;
+  task->mArg = aArg;
+
+#ifdef _CTM_WIN32_THREADS
+  task->mThread = CreateThread(NULL, 0, _ctmTaskMain, (LPVOID) task, 0, NULL);
+  if(!task->mThread)
+#else
+  if(pthread_create(&task->mThread, NULL, _ctmTaskMain, (void *) task) != 0)
+#endif
+  {
+    free(task);
+    return (_CTMtask *) 0;
+  }
+
+  return task;
+#else
+  (void) aFn;
+  (void) aArg;
+  return (_CTMtask *) 0;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTaskWait() - Wait for a task to finish, and free it.
+//-----------------------------------------------------------------------------
+void _ctmTaskWait(_CTMtask * aTask)
+{
+  if(!aTask)
+    return;
+
+#if defined(_CTM_WIN32_THREADS)
+  WaitForSingleObject(aTask->mThread, INFINITE);
+  CloseHandle(aTask->mThread);
+#elif defined(_CTM_POSIX_THREADS)
+  pthread_join(aTask->mThread, NULL);
+#endif
+  free(aTask);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTime() - Get the current time of a monotonic wall clock, in seconds
+// (from an arbitrary starting point). If no such clock is available, the
+// processor time of the process is used instead.
+//-----------------------------------------------------------------------------
+double _ctmTime(void)
+{
+#if defined(_CTM_WIN32_THREADS)
+  LARGE_INTEGER count, freq;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&freq);
+  return (double) count.QuadPart / (double) freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double) t.tv_sec + 1e-9 * (double) t.tv_nsec;
+#else
+  return (double) clock() / (double) CLOCKS_PER_SEC;
+#endif
+}
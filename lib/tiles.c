@@ -0,0 +1,1019 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        tiles.c
+// Description: Spatially tiled MG2 files. The bounding box of the mesh is
+//              divided into tiles, and the triangles of each tile are stored
+//              as an independent MG2 mesh, so that a reader can load only the
+//              tiles that intersect a region of interest.
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+#include "openctm.h"
+#include "internal.h"
+
+// Stream layout of a tiled MG2 file (method "MG2T"), following the header:
+//
+//   "MG2T"
+//   vertex precision, normal precision (FLOAT)
+//   bounding box: min x, y, z, max x, y, z (FLOAT)
+//   tile division: x, y, z (UINT)
+//   tile count, shared vertex count (UINT)
+//   tile directory, one entry per (non-empty) tile:
+//     bounding box of the tile vertices (6 x FLOAT)
+//     vertex count, triangle count, size of the tile data in bytes (UINT)
+//   UV maps: name, file name (STRING), precision (FLOAT)
+//   attribute maps: name (STRING), precision (FLOAT)
+//   tile data, one block per tile:
+//     a complete MG2 file with the triangles of the tile
+//     "TMAP", vertex map (packed UINTs, one per tile vertex in file order)
+//
+// Each triangle belongs to the tile that contains its centroid. Vertices that
+// are used by several tiles are stored once in each of those tiles, and have
+// a shared vertex index (the vertex map holds the shared index + 1, or zero
+// for vertices that belong to a single tile), which is used for merging them
+// again when loading.
+
+#define _CTM_NO_INDEX 0xffffffff
+
+
+//-----------------------------------------------------------------------------
+// _CTMtile - Tile directory entry.
+//-----------------------------------------------------------------------------
+typedef struct {
+  // Bounding box of the tile vertices
+  CTMfloat mMin[3];
+  CTMfloat mMax[3];
+
+  // Size of the tile mesh
+  CTMuint mVertexCount;
+  CTMuint mTriangleCount;
+
+  // Size of the tile data (bytes), and the data itself (only when saving)
+  CTMuint mDataSize;
+  unsigned char * mData;
+} _CTMtile;
+
+//-----------------------------------------------------------------------------
+// _CTMtilebuf - Growable memory buffer that a tile is written to.
+//-----------------------------------------------------------------------------
+typedef struct {
+  _CTMcontext * mContext;
+  unsigned char * mData;
+  size_t mSize;
+  size_t mCapacity;
+  CTMuint mFailed;
+} _CTMtilebuf;
+
+//-----------------------------------------------------------------------------
+// _CTMtiling - Assignment of the triangles and vertices of a mesh to tiles.
+//-----------------------------------------------------------------------------
+typedef struct {
+  // Tile division and scale (tiles per unit length) of the bounding box
+  CTMuint mDivision[3];
+  CTMfloat mMin[3];
+  CTMfloat mMax[3];
+  CTMfloat mScale[3];
+  CTMuint mCellCount;
+
+  // Triangles sorted by tile, and the first triangle of each tile
+  CTMuint * mTriangleOrder;
+  CTMuint * mTriangleStart;
+
+  // Vertices that are not used by any triangle, sorted by tile, and the first
+  // such vertex of each tile
+  CTMuint * mIsolatedOrder;
+  CTMuint * mIsolatedStart;
+
+  // Shared vertex index + 1 of each vertex (0 = used by a single tile)
+  CTMuint * mShared;
+  CTMuint mSharedCount;
+
+  // Tile local index of each vertex (_CTM_NO_INDEX = not in the current tile)
+  CTMuint * mLocal;
+} _CTMtiling;
+
+
+//-----------------------------------------------------------------------------
+// _ctmTileWrite() - Write function for saving a tile to a memory buffer.
+//-----------------------------------------------------------------------------
+static CTMuint CTMCALL _ctmTileWrite(const void * aBuf, CTMuint aCount,
+  void * aUserData)
+{
+  _CTMtilebuf * buf = (_CTMtilebuf *) aUserData;
+  unsigned char * newData;
+  size_t newCapacity;
+
+  if(buf->mSize + aCount > buf->mCapacity)
+  {
+    newCapacity = buf->mCapacity ? buf->mCapacity * 2 : 4096;
+    while(newCapacity < buf->mSize + aCount)
+      newCapacity *= 2;
+    newData = (unsigned char *) _ctmMalloc(buf->mContext, newCapacity);
+    if(!newData)
+    {
+      buf->mFailed = CTM_TRUE;
+      return 0;
+    }
+    if(buf->mSize > 0)
+      memcpy(newData, buf->mData, buf->mSize);
+    if(buf->mData)
+      _ctmFree(buf->mContext, buf->mData);
+    buf->mData = newData;
+    buf->mCapacity = newCapacity;
+  }
+  memcpy(&buf->mData[buf->mSize], aBuf, aCount);
+  buf->mSize += aCount;
+  return aCount;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTileRead() - Read function for loading a tile from the stream of the
+// context that is given as the user data.
+//-----------------------------------------------------------------------------
+static CTMuint CTMCALL _ctmTileRead(void * aBuf, CTMuint aCount,
+  void * aUserData)
+{
+  return _ctmStreamRead((_CTMcontext *) aUserData, aBuf, aCount);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmNewTileContext() - Create a context for saving or loading a single tile,
+// with the same settings as the given context. The tile context uses the
+// thread pool, the progress callback and the cancellation flag of the given
+// context.
+//-----------------------------------------------------------------------------
+static _CTMcontext * _ctmNewTileContext(_CTMcontext * self, CTMenum aMode)
+{
+  _CTMcontext * tile;
+
+  tile = (_CTMcontext *) ctmNewContext(aMode);
+  if(!tile)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return (_CTMcontext *) 0;
+  }
+  tile->mAllocFn = self->mAllocFn;
+  tile->mFreeFn = self->mFreeFn;
+  tile->mAllocUserData = self->mAllocUserData;
+  tile->mMethod = self->mMethod;
+  tile->mCompressionLevel = self->mCompressionLevel;
+  tile->mFileFormat = self->mFileFormat;
+  tile->mVertexPrecision = self->mVertexPrecision;
+  tile->mNormalPrecision = self->mNormalPrecision;
+  tile->mSkipNormals = self->mSkipNormals;
+  tile->mSkipUVMaps = self->mSkipUVMaps;
+  tile->mSkipAttribMaps = self->mSkipAttribMaps;
+  tile->mThreadCount = self->mThreadCount;
+  tile->mLZMAThreads = self->mLZMAThreads;
+  tile->mLZMASearch = self->mLZMASearch;
+  tile->mVertexSortOrder = self->mVertexSortOrder;
+  tile->mVertexCodec = self->mVertexCodec;
+  tile->mIndexCodec = self->mIndexCodec;
+  tile->mNormalCodec = self->mNormalCodec;
+  tile->mThreadPool = _ctmGetThreadPool(self);
+  tile->mProgressFn = self->mProgressFn;
+  tile->mProgressUserData = self->mProgressUserData;
+  tile->mCancelFlag = self->mCancelFlag;
+
+  // Tiles are read through the (buffered) stream of the given context
+  if(aMode == CTM_IMPORT)
+    tile->mStreamBufferSize = 0;
+
+  return tile;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFreeTileContext() - Free a tile context (but not the thread pool, which
+// belongs to the context that created the tile context). The statistics of
+// the tile are added to those of the context that created it.
+//-----------------------------------------------------------------------------
+static void _ctmFreeTileContext(_CTMcontext * self, _CTMcontext * aTile)
+{
+  _ctmStatsMerge(self, aTile);
+  aTile->mThreadPool = (_CTMthreadpool *) 0;
+  ctmFreeContext((CTMcontext) aTile);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTileCell() - Get the index of the tile that contains the given point.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmTileCell(_CTMtiling * aTiling, const CTMfloat * aPoint)
+{
+  CTMuint i, idx[3];
+  CTMfloat t;
+
+  for(i = 0; i < 3; ++ i)
+  {
+    t = (aPoint[i] - aTiling->mMin[i]) * aTiling->mScale[i];
+    if(!(t > 0.0f))
+      idx[i] = 0;
+    else if(t >= (CTMfloat) aTiling->mDivision[i])
+      idx[i] = aTiling->mDivision[i] - 1;
+    else
+      idx[i] = (CTMuint) t;
+  }
+  return idx[0] + aTiling->mDivision[0] * (idx[1] + aTiling->mDivision[1] * idx[2]);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFreeTiling() - Free the arrays of a tile assignment.
+//-----------------------------------------------------------------------------
+static void _ctmFreeTiling(_CTMcontext * self, _CTMtiling * aTiling)
+{
+  if(aTiling->mTriangleOrder) _ctmFree(self, aTiling->mTriangleOrder);
+  if(aTiling->mTriangleStart) _ctmFree(self, aTiling->mTriangleStart);
+  if(aTiling->mIsolatedOrder) _ctmFree(self, aTiling->mIsolatedOrder);
+  if(aTiling->mIsolatedStart) _ctmFree(self, aTiling->mIsolatedStart);
+  if(aTiling->mShared) _ctmFree(self, aTiling->mShared);
+  if(aTiling->mLocal) _ctmFree(self, aTiling->mLocal);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTileSort() - Sort items by tile (counting sort, which keeps the original
+// order within each tile). On input, aStart[c + 1] holds the number of items
+// in tile c, and on output aStart[c] is the index of the first item of tile c
+// in aOrder. Items with the tile index _CTM_NO_INDEX are left out.
+//-----------------------------------------------------------------------------
+static void _ctmTileSort(CTMuint * aStart, CTMuint aCellCount,
+  const CTMuint * aCell, CTMuint aCount, CTMuint * aOrder)
+{
+  CTMuint i;
+
+  aStart[0] = 0;
+  for(i = 0; i < aCellCount; ++ i)
+    aStart[i + 1] += aStart[i];
+  for(i = 0; i < aCount; ++ i)
+  {
+    if(aCell[i] != _CTM_NO_INDEX)
+      aOrder[aStart[aCell[i]] ++] = i;
+  }
+
+  // aStart[c] is now the end of tile c, i.e. the start of tile c + 1
+  for(i = aCellCount; i > 0; -- i)
+    aStart[i] = aStart[i - 1];
+  aStart[0] = 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSetupTiling() - Assign each triangle and each vertex of the mesh to a
+// tile, and find the vertices that are shared by several tiles.
+//-----------------------------------------------------------------------------
+static int _ctmSetupTiling(_CTMcontext * self, _CTMtiling * aTiling)
+{
+  CTMuint i, j, v, cell, count, * triCell, * vtxCell;
+  CTMfloat centroid[3];
+  const CTMfloat * p;
+
+  // Tile grid
+  _ctmBoundingBox(self, aTiling->mMin, aTiling->mMax);
+  aTiling->mCellCount = 1;
+  for(i = 0; i < 3; ++ i)
+  {
+    aTiling->mDivision[i] = self->mTileDivision[i];
+    aTiling->mCellCount *= aTiling->mDivision[i];
+    if(aTiling->mMax[i] > aTiling->mMin[i])
+      aTiling->mScale[i] = (CTMfloat) aTiling->mDivision[i] /
+                           (aTiling->mMax[i] - aTiling->mMin[i]);
+    else
+      aTiling->mScale[i] = 0.0f;
+  }
+
+  // Allocate memory for the tile assignment
+  aTiling->mTriangleOrder = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * self->mTriangleCount);
+  aTiling->mTriangleStart = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * (aTiling->mCellCount + 1));
+  aTiling->mIsolatedStart = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * (aTiling->mCellCount + 1));
+  aTiling->mShared = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * self->mVertexCount);
+  aTiling->mLocal = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * self->mVertexCount);
+  triCell = (CTMuint *) _ctmScratch(self, _CTM_SCRATCH_SORT, sizeof(CTMuint) * self->mTriangleCount);
+  vtxCell = (CTMuint *) _ctmScratch(self, _CTM_SCRATCH_WORK, sizeof(CTMuint) * self->mVertexCount);
+  if(!aTiling->mTriangleOrder || !aTiling->mTriangleStart ||
+     !aTiling->mIsolatedStart || !aTiling->mShared || !aTiling->mLocal ||
+     !triCell || !vtxCell)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+
+  // Assign each triangle to the tile that contains its centroid, and sort the
+  // triangles by tile (counting sort, which keeps the original order within
+  // each tile)
+  memset(aTiling->mTriangleStart, 0, sizeof(CTMuint) * (aTiling->mCellCount + 1));
+  for(i = 0; i < self->mTriangleCount; ++ i)
+  {
+    for(j = 0; j < 3; ++ j)
+    {
+      centroid[j] = (self->mVertices[self->mIndices[i * 3] * 3 + j] +
+                     self->mVertices[self->mIndices[i * 3 + 1] * 3 + j] +
+                     self->mVertices[self->mIndices[i * 3 + 2] * 3 + j]) *
+                    (1.0f / 3.0f);
+    }
+    triCell[i] = _ctmTileCell(aTiling, centroid);
+    ++ aTiling->mTriangleStart[triCell[i] + 1];
+  }
+  _ctmTileSort(aTiling->mTriangleStart, aTiling->mCellCount, triCell,
+              self->mTriangleCount, aTiling->mTriangleOrder);
+
+  // Find the vertices that are used by more than one tile
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    vtxCell[i] = _CTM_NO_INDEX;
+    aTiling->mShared[i] = 0;
+  }
+  for(i = 0; i < self->mTriangleCount * 3; ++ i)
+  {
+    v = self->mIndices[i];
+    cell = triCell[i / 3];
+    if(vtxCell[v] == _CTM_NO_INDEX)
+      vtxCell[v] = cell;
+    else if(vtxCell[v] != cell)
+      aTiling->mShared[v] = 1;
+  }
+  aTiling->mSharedCount = 0;
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    if(aTiling->mShared[i])
+      aTiling->mShared[i] = ++ aTiling->mSharedCount;
+  }
+
+  // Vertices that are not used by any triangle are stored in the tile that
+  // contains them (or in the first non-empty tile, if that tile is empty)
+  memset(aTiling->mIsolatedStart, 0, sizeof(CTMuint) * (aTiling->mCellCount + 1));
+  count = 0;
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    if(vtxCell[i] == _CTM_NO_INDEX)
+    {
+      p = &self->mVertices[i * 3];
+      cell = _ctmTileCell(aTiling, p);
+      if(aTiling->mTriangleStart[cell] == aTiling->mTriangleStart[cell + 1])
+        cell = triCell[aTiling->mTriangleOrder[0]];
+      vtxCell[i] = cell | 0x80000000;
+      ++ aTiling->mIsolatedStart[cell + 1];
+      ++ count;
+    }
+  }
+  aTiling->mIsolatedOrder = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * (count > 0 ? count : 1));
+  if(!aTiling->mIsolatedOrder)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  for(i = 0; i < self->mVertexCount; ++ i)
+    vtxCell[i] = (vtxCell[i] & 0x80000000) ? (vtxCell[i] & 0x7fffffff) : _CTM_NO_INDEX;
+  _ctmTileSort(aTiling->mIsolatedStart, aTiling->mCellCount, vtxCell,
+              self->mVertexCount, aTiling->mIsolatedOrder);
+
+  // No vertex is in a tile yet
+  for(i = 0; i < self->mVertexCount; ++ i)
+    aTiling->mLocal[i] = _CTM_NO_INDEX;
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCompressTile() - Compress the triangles (and isolated vertices) of one
+// tile to a memory buffer: an MG2 file followed by the vertex map.
+//-----------------------------------------------------------------------------
+static int _ctmCompressTile(_CTMcontext * self, _CTMtiling * aTiling,
+  CTMuint aCell, _CTMtile * aTile)
+{
+  _CTMcontext * tile;
+  _CTMfloatmap * map, * tileMap;
+  _CTMtilebuf buf;
+  CTMuint i, j, k, v, vertexCount, triangleCount, mapCount, * vertices,
+          * indices, * order, * vertexMap;
+  CTMfloat * floats, * tileVertices, * tileNormals, * p;
+  size_t floatCount;
+  int result;
+
+  triangleCount = aTiling->mTriangleStart[aCell + 1] - aTiling->mTriangleStart[aCell];
+  floatCount = (size_t) triangleCount * 3 + aTiling->mIsolatedStart[aCell + 1] -
+               aTiling->mIsolatedStart[aCell];
+  vertexCount = floatCount < self->mVertexCount ? (CTMuint) floatCount : self->mVertexCount;
+
+  // Allocate memory for the tile mesh (all float arrays in one block)
+  mapCount = self->mUVMapCount * 2 + self->mAttribMapCount * 4;
+  floatCount = (size_t) vertexCount * (3 + (self->mNormals ? 3 : 0) + mapCount);
+  vertices = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * vertexCount * 3);
+  indices = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * triangleCount * 3);
+  floats = (CTMfloat *) _ctmMalloc(self, sizeof(CTMfloat) * floatCount);
+  if(!vertices || !indices || !floats)
+  {
+    if(vertices) _ctmFree(self, vertices);
+    if(indices) _ctmFree(self, indices);
+    if(floats) _ctmFree(self, floats);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  order = &vertices[vertexCount];
+  vertexMap = &vertices[(size_t) vertexCount * 2];
+
+  // Gather the vertices of the tile (in order of first use), and convert the
+  // triangle indices to tile local indices
+  vertexCount = 0;
+  for(i = 0; i < triangleCount; ++ i)
+  {
+    k = aTiling->mTriangleOrder[aTiling->mTriangleStart[aCell] + i];
+    for(j = 0; j < 3; ++ j)
+    {
+      v = self->mIndices[k * 3 + j];
+      if(aTiling->mLocal[v] == _CTM_NO_INDEX)
+      {
+        aTiling->mLocal[v] = vertexCount;
+        vertices[vertexCount ++] = v;
+      }
+      indices[i * 3 + j] = aTiling->mLocal[v];
+    }
+  }
+  for(i = aTiling->mIsolatedStart[aCell]; i < aTiling->mIsolatedStart[aCell + 1]; ++ i)
+    vertices[vertexCount ++] = aTiling->mIsolatedOrder[i];
+  for(i = 0; i < vertexCount; ++ i)
+    aTiling->mLocal[vertices[i]] = _CTM_NO_INDEX;
+
+  // Copy the vertex data of the tile, and calculate the tile bounding box
+  tileVertices = floats;
+  for(i = 0; i < vertexCount; ++ i)
+  {
+    for(j = 0; j < 3; ++ j)
+      tileVertices[i * 3 + j] = self->mVertices[vertices[i] * 3 + j];
+  }
+  for(j = 0; j < 3; ++ j)
+  {
+    aTile->mMin[j] = aTile->mMax[j] = tileVertices[j];
+    for(i = 1; i < vertexCount; ++ i)
+    {
+      if(tileVertices[i * 3 + j] < aTile->mMin[j])
+        aTile->mMin[j] = tileVertices[i * 3 + j];
+      else if(tileVertices[i * 3 + j] > aTile->mMax[j])
+        aTile->mMax[j] = tileVertices[i * 3 + j];
+    }
+  }
+  p = &floats[(size_t) vertexCount * 3];
+  tileNormals = (CTMfloat *) 0;
+  if(self->mNormals)
+  {
+    tileNormals = p;
+    for(i = 0; i < vertexCount; ++ i)
+    {
+      for(j = 0; j < 3; ++ j)
+        tileNormals[i * 3 + j] = self->mNormals[vertices[i] * 3 + j];
+    }
+    p += (size_t) vertexCount * 3;
+  }
+  aTile->mVertexCount = vertexCount;
+  aTile->mTriangleCount = triangleCount;
+
+  // Define the tile mesh
+  result = CTM_FALSE;
+  tile = _ctmNewTileContext(self, CTM_EXPORT);
+  if(tile)
+  {
+    ctmDefineMesh((CTMcontext) tile, tileVertices, vertexCount, indices,
+                  triangleCount, tileNormals);
+    for(map = self->mUVMaps; map; map = map->mNext)
+    {
+      for(i = 0; i < vertexCount; ++ i)
+      {
+        p[i * 2] = map->mValues[vertices[i] * 2];
+        p[i * 2 + 1] = map->mValues[vertices[i] * 2 + 1];
+      }
+      ctmAddUVMap((CTMcontext) tile, p, map->mName, map->mFileName);
+      p += (size_t) vertexCount * 2;
+    }
+    for(map = self->mAttribMaps; map; map = map->mNext)
+    {
+      for(i = 0; i < vertexCount; ++ i)
+      {
+        for(j = 0; j < 4; ++ j)
+          p[i * 4 + j] = map->mValues[vertices[i] * 4 + j];
+      }
+      ctmAddAttribMap((CTMcontext) tile, p, map->mName);
+      p += (size_t) vertexCount * 4;
+    }
+    map = self->mUVMaps;
+    for(tileMap = tile->mUVMaps; map && tileMap; tileMap = tileMap->mNext)
+    {
+      tileMap->mPrecision = map->mPrecision;
+      tileMap->mCodec = map->mCodec;
+      map = map->mNext;
+    }
+    map = self->mAttribMaps;
+    for(tileMap = tile->mAttribMaps; map && tileMap; tileMap = tileMap->mNext)
+    {
+      tileMap->mPrecision = map->mPrecision;
+      tileMap->mCodec = map->mCodec;
+      map = map->mNext;
+    }
+
+    // Save the tile mesh, followed by the vertex map (in the order that the
+    // MG2 encoder stored the vertices)
+    memset(&buf, 0, sizeof(buf));
+    buf.mContext = self;
+    if(tile->mError == CTM_NONE)
+    {
+      tile->mVertexOrder = order;
+      ctmSaveCustom((CTMcontext) tile, _ctmTileWrite, &buf);
+    }
+    if(tile->mError == CTM_NONE)
+    {
+      for(i = 0; i < vertexCount; ++ i)
+        vertexMap[i] = aTiling->mShared[vertices[order[i]]];
+      _ctmStreamWriteTag(tile, "TMAP");
+      _ctmStreamWritePackedInts(tile, (CTMint *) vertexMap, vertexCount, 1, CTM_FALSE);
+      _ctmStreamFlush(tile);
+    }
+    if(buf.mFailed)
+      self->mError = CTM_OUT_OF_MEMORY;
+    else if(tile->mError != CTM_NONE)
+      self->mError = tile->mError;
+    else if(buf.mSize > 0xffffffff)
+      self->mError = CTM_INVALID_OPERATION;
+    else
+    {
+      aTile->mData = buf.mData;
+      aTile->mDataSize = (CTMuint) buf.mSize;
+      buf.mData = (unsigned char *) 0;
+      result = CTM_TRUE;
+    }
+    if(buf.mData)
+      _ctmFree(self, buf.mData);
+    _ctmFreeTileContext(self, tile);
+  }
+
+  _ctmFree(self, vertices);
+  _ctmFree(self, indices);
+  _ctmFree(self, floats);
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCompressMesh_Tiles() - Compress the mesh that is stored in the CTM
+// context as a tiled MG2 mesh, and write it to the output stream.
+//-----------------------------------------------------------------------------
+int _ctmCompressMesh_Tiles(_CTMcontext * self)
+{
+  _CTMtiling tiling;
+  _CTMtile * tiles;
+  _CTMfloatmap * map;
+  CTMuint i, j, tileCount;
+  int result;
+  double start;
+
+  // Assign triangles and vertices to tiles
+  memset(&tiling, 0, sizeof(tiling));
+  start = _ctmTime();
+  result = _ctmSetupTiling(self, &tiling);
+  _ctmStatsTime(&self->mStats.mGridTime, start);
+  if(!result)
+  {
+    _ctmFreeTiling(self, &tiling);
+    return CTM_FALSE;
+  }
+
+  // Compress all the non-empty tiles
+  tiles = (_CTMtile *) _ctmMalloc(self, sizeof(_CTMtile) * tiling.mCellCount);
+  if(!tiles)
+  {
+    _ctmFreeTiling(self, &tiling);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  memset(tiles, 0, sizeof(_CTMtile) * tiling.mCellCount);
+  tileCount = 0;
+  result = CTM_TRUE;
+  for(i = 0; (i < tiling.mCellCount) && result; ++ i)
+  {
+    if(tiling.mTriangleStart[i + 1] > tiling.mTriangleStart[i])
+    {
+      result = _ctmCompressTile(self, &tiling, i, &tiles[tileCount]);
+      ++ tileCount;
+    }
+  }
+
+  // Write the header and the tile directory
+  if(result)
+  {
+    _ctmStreamWriteTag(self, self->mMethod == CTM_METHOD_MG3 ? "MG3T" : "MG2T");
+    _ctmStreamWriteFLOAT(self, self->mVertexPrecision);
+    _ctmStreamWriteFLOAT(self, self->mNormalPrecision);
+    for(j = 0; j < 3; ++ j)
+      _ctmStreamWriteFLOAT(self, tiling.mMin[j]);
+    for(j = 0; j < 3; ++ j)
+      _ctmStreamWriteFLOAT(self, tiling.mMax[j]);
+    for(j = 0; j < 3; ++ j)
+      _ctmStreamWriteUINT(self, tiling.mDivision[j]);
+    _ctmStreamWriteUINT(self, tileCount);
+    _ctmStreamWriteUINT(self, tiling.mSharedCount);
+    for(i = 0; i < tileCount; ++ i)
+    {
+      _ctmStreamWriteFLOATArray(self, tiles[i].mMin, 3);
+      _ctmStreamWriteFLOATArray(self, tiles[i].mMax, 3);
+      _ctmStreamWriteUINT(self, tiles[i].mVertexCount);
+      _ctmStreamWriteUINT(self, tiles[i].mTriangleCount);
+      _ctmStreamWriteUINT(self, tiles[i].mDataSize);
+    }
+
+    // Write UV map and attribute map information
+    for(map = self->mUVMaps; map; map = map->mNext)
+    {
+      _ctmStreamWriteSTRING(self, map->mName);
+      _ctmStreamWriteSTRING(self, map->mFileName);
+      _ctmStreamWriteFLOAT(self, map->mPrecision);
+    }
+    for(map = self->mAttribMaps; map; map = map->mNext)
+    {
+      _ctmStreamWriteSTRING(self, map->mName);
+      _ctmStreamWriteFLOAT(self, map->mPrecision);
+    }
+
+    // Write the tile data
+    for(i = 0; i < tileCount; ++ i)
+      _ctmStreamWrite(self, tiles[i].mData, tiles[i].mDataSize);
+  }
+
+  // Free the tiles
+  for(i = 0; i < tileCount; ++ i)
+  {
+    if(tiles[i].mData)
+      _ctmFree(self, tiles[i].mData);
+  }
+  _ctmFree(self, tiles);
+  _ctmFreeTiling(self, &tiling);
+
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadTileHeader() - Read the tiled MG2 header and the tile directory from
+// the input stream. Returns the tile directory (NULL on failure), and the
+// number of shared vertices.
+//-----------------------------------------------------------------------------
+static _CTMtile * _ctmReadTileHeader(_CTMcontext * self, CTMuint * aSharedCount)
+{
+  _CTMtile * tiles;
+  CTMuint i, division[3], tileCount;
+
+  // Read the header
+  if(_ctmStreamReadTag(self) != (self->mMethod == CTM_METHOD_MG3 ?
+                                 FOURCC("MG3T") : FOURCC("MG2T")))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return (_CTMtile *) 0;
+  }
+  self->mVertexPrecision = _ctmStreamReadFLOAT(self);
+  self->mNormalPrecision = _ctmStreamReadFLOAT(self);
+  if((self->mVertexPrecision <= 0.0f) || (self->mNormalPrecision <= 0.0f))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return (_CTMtile *) 0;
+  }
+  _ctmStreamReadFLOATArray(self, self->mBoundingBox, 6);
+  for(i = 0; i < 3; ++ i)
+  {
+    if(self->mBoundingBox[i + 3] < self->mBoundingBox[i])
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return (_CTMtile *) 0;
+    }
+  }
+  self->mHasBoundingBox = CTM_TRUE;
+  for(i = 0; i < 3; ++ i)
+    division[i] = _ctmStreamReadUINT(self);
+  tileCount = _ctmStreamReadUINT(self);
+  *aSharedCount = _ctmStreamReadUINT(self);
+  if((division[0] < 1) || (division[1] < 1) || (division[2] < 1) ||
+     (tileCount < 1) || (tileCount > _CTM_MAX_TILE_COUNT) ||
+     (tileCount > self->mTriangleCount) ||
+     (*aSharedCount > self->mVertexCount))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return (_CTMtile *) 0;
+  }
+
+  // Read the tile directory
+  tiles = (_CTMtile *) _ctmMalloc(self, sizeof(_CTMtile) * tileCount);
+  if(!tiles)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return (_CTMtile *) 0;
+  }
+  for(i = 0; i < tileCount; ++ i)
+  {
+    _ctmStreamReadFLOATArray(self, tiles[i].mMin, 3);
+    _ctmStreamReadFLOATArray(self, tiles[i].mMax, 3);
+    tiles[i].mVertexCount = _ctmStreamReadUINT(self);
+    tiles[i].mTriangleCount = _ctmStreamReadUINT(self);
+    tiles[i].mDataSize = _ctmStreamReadUINT(self);
+    tiles[i].mData = (unsigned char *) 0;
+    if((tiles[i].mVertexCount < 1) || (tiles[i].mTriangleCount < 1) ||
+       (tiles[i].mVertexCount > self->mVertexCount) ||
+       (tiles[i].mTriangleCount > self->mTriangleCount))
+    {
+      _ctmFree(self, tiles);
+      self->mError = CTM_BAD_FORMAT;
+      return (_CTMtile *) 0;
+    }
+  }
+  self->mTileCount = tileCount;
+
+  return tiles;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadTileMaps() - Read the UV map and attribute map information of a
+// tiled MG2 mesh from the input stream.
+//-----------------------------------------------------------------------------
+static int _ctmReadTileMaps(_CTMcontext * self)
+{
+  _CTMfloatmap * map;
+
+  for(map = self->mUVMaps; map; map = map->mNext)
+  {
+    _ctmStreamReadSTRING(self, &map->mName);
+    _ctmStreamReadSTRING(self, &map->mFileName);
+    map->mPrecision = _ctmStreamReadFLOAT(self);
+    if(map->mPrecision <= 0.0f)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+  }
+  for(map = self->mAttribMaps; map; map = map->mNext)
+  {
+    _ctmStreamReadSTRING(self, &map->mName);
+    map->mPrecision = _ctmStreamReadFLOAT(self);
+    if(map->mPrecision <= 0.0f)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTileSelected() - Check if a tile intersects the region of interest (all
+// tiles are selected if no region has been set).
+//-----------------------------------------------------------------------------
+static int _ctmTileSelected(_CTMcontext * self, const _CTMtile * aTile)
+{
+  CTMuint i;
+
+  if(!self->mHasRegion)
+    return CTM_TRUE;
+  for(i = 0; i < 3; ++ i)
+  {
+    if((aTile->mMin[i] > self->mRegion[i + 3]) ||
+       (aTile->mMax[i] < self->mRegion[i]))
+      return CTM_FALSE;
+  }
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCopyMapValues() - Copy the values of one vertex between two lists of
+// float maps.
+//-----------------------------------------------------------------------------
+static void _ctmCopyMapValues(_CTMfloatmap * aDst, CTMuint aDstIdx,
+  _CTMfloatmap * aSrc, CTMuint aSrcIdx, CTMuint aSize)
+{
+  while(aDst && aSrc)
+  {
+    if(aDst->mValues && aSrc->mValues)
+      memcpy(&aDst->mValues[(size_t) aDstIdx * aSize],
+             &aSrc->mValues[(size_t) aSrcIdx * aSize],
+             sizeof(CTMfloat) * aSize);
+    aDst = aDst->mNext;
+    aSrc = aSrc->mNext;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLoadTile() - Load one tile from the input stream, and append it to the
+// mesh (vertices that have already been loaded by another tile are merged).
+//-----------------------------------------------------------------------------
+static int _ctmLoadTile(_CTMcontext * self, const _CTMtile * aTile,
+  CTMuint * aSharedMap, CTMuint aSharedCount, CTMuint * aVertexCount,
+  CTMuint * aTriangleCount)
+{
+  _CTMcontext * tile;
+  CTMuint i, id, idx, * vertexMap;
+  int result;
+
+  // Load the tile mesh
+  tile = _ctmNewTileContext(self, CTM_IMPORT);
+  if(!tile)
+    return CTM_FALSE;
+  ctmLoadCustom((CTMcontext) tile, _ctmTileRead, (void *) self);
+  if(tile->mError != CTM_NONE)
+  {
+    self->mError = (self->mError != CTM_NONE) ? self->mError : tile->mError;
+    _ctmFreeTileContext(self, tile);
+    return CTM_FALSE;
+  }
+  if((tile->mVertexCount != aTile->mVertexCount) ||
+     (tile->mTriangleCount != aTile->mTriangleCount) ||
+     (tile->mUVMapCount != self->mUVMapCount) ||
+     (tile->mAttribMapCount != self->mAttribMapCount) ||
+     (self->mNormals && !tile->mNormals))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    _ctmFreeTileContext(self, tile);
+    return CTM_FALSE;
+  }
+
+  // Read the vertex map
+  vertexMap = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * tile->mVertexCount);
+  if(!vertexMap)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    _ctmFreeTileContext(self, tile);
+    return CTM_FALSE;
+  }
+  result = CTM_FALSE;
+  if(_ctmStreamReadTag(self) != FOURCC("TMAP"))
+    self->mError = CTM_BAD_FORMAT;
+  else if(_ctmStreamReadPackedInts(self, (CTMint *) vertexMap,
+            tile->mVertexCount, 1, CTM_FALSE) && _ctmStreamReadSync(self))
+    result = CTM_TRUE;
+
+  // Append the tile vertices (unless they are shared, and have already been
+  // loaded), and convert the vertex map to mesh indices
+  for(i = 0; (i < tile->mVertexCount) && result; ++ i)
+  {
+    id = vertexMap[i];
+    if(id > aSharedCount)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      result = CTM_FALSE;
+      break;
+    }
+    if(id && (aSharedMap[id - 1] != _CTM_NO_INDEX))
+    {
+      vertexMap[i] = aSharedMap[id - 1];
+      continue;
+    }
+    idx = (*aVertexCount) ++;
+    if(id)
+      aSharedMap[id - 1] = idx;
+    vertexMap[i] = idx;
+    memcpy(&self->mVertices[(size_t) idx * 3], &tile->mVertices[(size_t) i * 3],
+           sizeof(CTMfloat) * 3);
+    if(self->mNormals)
+      memcpy(&self->mNormals[(size_t) idx * 3], &tile->mNormals[(size_t) i * 3],
+             sizeof(CTMfloat) * 3);
+    _ctmCopyMapValues(self->mUVMaps, idx, tile->mUVMaps, i, 2);
+    _ctmCopyMapValues(self->mAttribMaps, idx, tile->mAttribMaps, i, 4);
+  }
+
+  // Append the tile triangles
+  if(result)
+  {
+    idx = (*aTriangleCount) * 3;
+    for(i = 0; i < tile->mTriangleCount * 3; ++ i)
+      self->mIndices[(size_t) idx + i] = vertexMap[tile->mIndices[i]];
+    (*aTriangleCount) += tile->mTriangleCount;
+  }
+
+  _ctmFree(self, vertexMap);
+  _ctmFreeTileContext(self, tile);
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmUncompressMesh_Tiles() - Read a tiled MG2 mesh from the input stream,
+// and load the tiles that intersect the region of interest (or all tiles).
+//-----------------------------------------------------------------------------
+int _ctmUncompressMesh_Tiles(_CTMcontext * self)
+{
+  _CTMtile * tiles;
+  CTMuint i, sharedCount, fileVertexCount, fileTriangleCount, vertexCount,
+          triangleCount, * sharedMap;
+  size_t vertexCapacity, triangleCapacity;
+  int result;
+
+  // Read the header and the tile directory
+  tiles = _ctmReadTileHeader(self, &sharedCount);
+  if(!tiles)
+    return CTM_FALSE;
+
+  // Size of the selected tiles (the vertex count is an upper limit, since
+  // vertices that are shared between the selected tiles are merged)
+  vertexCapacity = 0;
+  triangleCapacity = 0;
+  for(i = 0; i < self->mTileCount; ++ i)
+  {
+    if(_ctmTileSelected(self, &tiles[i]))
+    {
+      vertexCapacity += tiles[i].mVertexCount;
+      triangleCapacity += tiles[i].mTriangleCount;
+    }
+  }
+  if(triangleCapacity == 0)
+  {
+    _ctmFree(self, tiles);
+    self->mError = CTM_INVALID_MESH;
+    return CTM_FALSE;
+  }
+  if((vertexCapacity > _CTM_MAX_VERTEX_COUNT) ||
+     (triangleCapacity > _CTM_MAX_TRIANGLE_COUNT))
+  {
+    _ctmFree(self, tiles);
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+
+  // Allocate memory for the mesh arrays
+  fileVertexCount = self->mVertexCount;
+  fileTriangleCount = self->mTriangleCount;
+  self->mVertexCount = (CTMuint) vertexCapacity;
+  self->mTriangleCount = (CTMuint) triangleCapacity;
+  if(!_ctmAllocateMesh(self))
+  {
+    _ctmFree(self, tiles);
+    return CTM_FALSE;
+  }
+  sharedMap = (CTMuint *) _ctmMalloc(self, sizeof(CTMuint) * (sharedCount > 0 ? sharedCount : 1));
+  if(!sharedMap)
+  {
+    _ctmFree(self, tiles);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  for(i = 0; i < sharedCount; ++ i)
+    sharedMap[i] = _CTM_NO_INDEX;
+
+  // Read UV map and attribute map information
+  result = _ctmReadTileMaps(self);
+
+  // Load the selected tiles, and skip the others
+  vertexCount = 0;
+  triangleCount = 0;
+  for(i = 0; (i < self->mTileCount) && result; ++ i)
+  {
+    if(_ctmTileSelected(self, &tiles[i]))
+      result = _ctmLoadTile(self, &tiles[i], sharedMap, sharedCount,
+                            &vertexCount, &triangleCount);
+    else if(!_ctmStreamSkip(self, tiles[i].mDataSize))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      result = CTM_FALSE;
+    }
+  }
+  _ctmFree(self, sharedMap);
+  _ctmFree(self, tiles);
+  if(!result)
+    return CTM_FALSE;
+
+  // The whole mesh must match the file header
+  if(!self->mHasRegion &&
+     ((vertexCount != fileVertexCount) || (triangleCount != fileTriangleCount)))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  self->mVertexCount = vertexCount;
+  self->mTriangleCount = triangleCount;
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadHeader_Tiles() - Read the tiled MG2 header and the UV and attribute
+// map information from the input stream, without loading any tiles (used
+// when only the header of a file is loaded).
+//-----------------------------------------------------------------------------
+int _ctmReadHeader_Tiles(_CTMcontext * self)
+{
+  _CTMtile * tiles;
+  CTMuint sharedCount;
+
+  tiles = _ctmReadTileHeader(self, &sharedCount);
+  if(!tiles)
+    return CTM_FALSE;
+  _ctmFree(self, tiles);
+
+  return _ctmReadTileMaps(self);
+}
@@ -47,6 +47,8 @@ Options::Options()
 
   mMethod = CTM_METHOD_MG2;
   mLevel = 1;
+  mFileFormat = 5;
+  mVertexOrder = CTM_ORDER_GRID;
   mVertexPrecision = 0.0f;
   mVertexPrecisionRel = 0.01f;
   mNormalPrecision = 1.0f / 256.0f;
@@ -138,8 +140,10 @@ void Options::GetFromArgs(int argc, char **argv, int aStartIdx)
         mMethod = CTM_METHOD_MG1;
       else if(method == string("MG2"))
         mMethod = CTM_METHOD_MG2;
+      else if(method == string("MG3"))
+        mMethod = CTM_METHOD_MG3;
       else
-        throw runtime_error("Invalid method (use RAW, MG1 or MG2).");
+        throw runtime_error("Invalid method (use RAW, MG1, MG2 or MG3).");
     }
     else if((cmd == string("--level")) && (i < (argc - 1)))
     {
@@ -149,6 +153,27 @@ void Options::GetFromArgs(int argc, char **argv, int aStartIdx)
       mLevel = CTMuint(val);
       ++ i;
     }
+    else if((cmd == string("--format")) && (i < (argc - 1)))
+    {
+      CTMint val = GetIntArg(argv[i + 1]);
+      if( (val < 5) || (val > 6) )
+        throw runtime_error("Invalid file format version (use 5 or 6).");
+      mFileFormat = CTMuint(val);
+      ++ i;
+    }
+    else if((cmd == string("--order")) && (i < (argc - 1)))
+    {
+      string order(argv[i + 1]);
+      ++ i;
+      if(order == string("grid"))
+        mVertexOrder = CTM_ORDER_GRID;
+      else if(order == string("morton"))
+        mVertexOrder = CTM_ORDER_MORTON;
+      else if(order == string("hilbert"))
+        mVertexOrder = CTM_ORDER_HILBERT;
+      else
+        throw runtime_error("Invalid vertex order (use grid, morton or hilbert).");
+    }
     else if((cmd == string("--vprec")) && (i < (argc - 1)))
     {
       mVertexPrecision = GetFloatArg(argv[i + 1]);
@@ -54,7 +54,9 @@ class Options {
 
     CTMenum mMethod;
     CTMuint mLevel;
+    CTMuint mFileFormat;
 
+    CTMenum mVertexOrder;
     CTMfloat mVertexPrecision;
     CTMfloat mVertexPrecisionRel;
     CTMfloat mNormalPrecision;
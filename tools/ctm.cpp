@@ -152,6 +152,9 @@ void Export_CTM(const char * aFileName, Mesh * aMesh, Options &aOptions)
   ctm.CompressionMethod(aOptions.mMethod);
   ctm.CompressionLevel(aOptions.mLevel);
 
+  // Set file format version
+  ctm.FileFormat(aOptions.mFileFormat);
+
   // Set vertex precision
   if(aOptions.mVertexPrecision > 0.0f)
     ctm.VertexPrecision(aOptions.mVertexPrecision);
@@ -161,6 +164,9 @@ void Export_CTM(const char * aFileName, Mesh * aMesh, Options &aOptions)
   // Set normal precision
   ctm.NormalPrecision(aOptions.mNormalPrecision);
 
+  // Set vertex order
+  ctm.VertexOrder(aOptions.mVertexOrder);
+
   // Export file
   ctm.Save(aFileName);
 }
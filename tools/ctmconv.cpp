@@ -165,14 +165,16 @@ int main(int argc, char ** argv)
     cout << "  --no-texcoords  Do not export texture coordinates." << endl;
     cout << "  --no-colors     Do not export vertex colors." << endl;
     cout << endl << " OpenCTM output" << endl;
-    cout << "  --method arg    Select compression method (RAW, MG1, MG2)" << endl;
+    cout << "  --method arg    Select compression method (RAW, MG1, MG2, MG3)" << endl;
     cout << "  --level arg     Set the compression level (0 - 9)" << endl;
-    cout << endl << " OpenCTM MG2 method" << endl;
+    cout << "  --format arg    Set the file format version (5 or 6)" << endl;
+    cout << endl << " OpenCTM MG2/MG3 methods" << endl;
     cout << "  --vprec arg     Set vertex precision" << endl;
     cout << "  --vprecrel arg  Set vertex precision, relative method" << endl;
     cout << "  --nprec arg     Set normal precision" << endl;
     cout << "  --tprec arg     Set texture map precision" << endl;
     cout << "  --cprec arg     Set color precision" << endl;
+    cout << "  --order arg     Set the vertex order (grid, morton, hilbert)" << endl;
     cout << endl << " Miscellaneous" << endl;
     cout << "  --comment arg   Set the file comment (default is to use the comment" << endl;
     cout << "                  from the input file, if any)." << endl;